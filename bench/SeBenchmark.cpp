@@ -0,0 +1,337 @@
+﻿#include "SeBenchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+#include "Config.h"
+#include "SeCamera.h"
+#include "SeCameraPath.h"
+#include "SeDevice.h"
+#include "SeComponents.h"
+#include "SeRenderer.h"
+#include "ShamanEngine.h"
+#include "vulkancontext.h"
+
+namespace SE {
+
+namespace {
+// Frame time differences below this are noise, whatever the percentage says
+constexpr double MIN_REGRESSION_DELTA_MS = 0.05;
+constexpr uint32_t SCENE_SEED = 1337;
+
+// mt19937 output is specified by the standard, the distributions are not. Convert by hand
+// so every platform builds the same scene
+float random01(std::mt19937& rng)
+{
+    return static_cast<float>(rng() >> 8) * (1.f / 16777216.f);
+}
+
+// Value of "key":number on a report line, negative when missing
+double readNumber(const std::string& line, const std::string& key)
+{
+    size_t pos = line.find("\"" + key + "\":");
+    if (pos == std::string::npos) return -1.0;
+    return std::atof(line.c_str() + pos + key.size() + 3);
+}
+
+std::string readString(const std::string& line, const std::string& key)
+{
+    std::string pattern = "\"" + key + "\":\"";
+    size_t pos = line.find(pattern);
+    if (pos == std::string::npos) return "";
+    size_t begin = pos + pattern.size();
+    size_t end = line.find('"', begin);
+    return end == std::string::npos ? "" : line.substr(begin, end - begin);
+}
+}
+
+SeBenchmark::SeBenchmark(ShamanEngine& inengine, Settings insettings)
+    : engine(inengine)
+    , settings(std::move(insettings))
+{
+}
+
+std::vector<SeBenchmark::Scene> SeBenchmark::defaultScenes()
+{
+    // Unique meshes allocate two buffers each, keep them well below maxMemoryAllocationCount
+    return {
+        {"cubes_1k", SceneKind::CUBES, 1000},
+        {"cubes_10k", SceneKind::CUBES, 10000},
+        {"vases_1k", SceneKind::VASES, 1000},
+        {"mixed_2k", SceneKind::MIXED, 2000},
+        {"unique_1k", SceneKind::UNIQUE_MESHES, 1000},
+        {"instanced_1k", SceneKind::INSTANCED_MESHES, 1000},
+    };
+}
+
+uint32_t SeBenchmark::buildScene(const Scene& scene, uint32_t& uniqueModels, uint64_t& vertices, float& extent)
+{
+    auto ctx = engine.ctx;
+    const std::string modelDir = Config::get().asset_path() + Config::get().model_path();
+    const uint32_t count = std::max<uint32_t>(1, static_cast<uint32_t>(scene.objectCount * settings.scale));
+    std::mt19937 rng(SCENE_SEED);
+
+    std::vector<std::shared_ptr<SeModel>> models;
+    std::vector<SeModel::Vertex> cubeVertices;
+    switch (scene.kind)
+    {
+    case SceneKind::CUBES:
+    case SceneKind::INSTANCED_MESHES:
+        models.push_back(SeModel::createModelFromFile(ctx, modelDir + "colored_cube.obj"));
+        break;
+    case SceneKind::VASES:
+        models.push_back(SeModel::createModelFromFile(ctx, modelDir + "smooth_vase.obj"));
+        break;
+    case SceneKind::MIXED:
+        models.push_back(SeModel::createModelFromFile(ctx, modelDir + "colored_cube.obj"));
+        models.push_back(SeModel::createModelFromFile(ctx, modelDir + "smooth_vase.obj"));
+        models.push_back(SeModel::createModelFromFile(ctx, modelDir + "flat_vase.obj"));
+        break;
+    case SceneKind::UNIQUE_MESHES:
+        cubeVertices = SeModel::loadVertices(modelDir + "colored_cube.obj");
+        break;
+    }
+
+    // Square grid on the XZ plane centered on the origin
+    const float spacing = 2.f;
+    const uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(count))));
+    extent = side * spacing;
+
+    vertices = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        std::shared_ptr<SeModel> model;
+        if (scene.kind == SceneKind::UNIQUE_MESHES)
+        {
+            // Same vertex count as the instanced scene, only the buffers differ
+            std::vector<SeModel::Vertex> meshVertices = cubeVertices;
+            glm::vec3 stretch{0.8f + 0.4f * random01(rng), 0.8f + 0.4f * random01(rng), 0.8f + 0.4f * random01(rng)};
+            for (auto& vertex : meshVertices)
+            {
+                vertex.position *= stretch;
+            }
+            model = std::make_shared<SeModel>(ctx, meshVertices);
+            models.push_back(model);
+        } else
+        {
+            model = models[i % models.size()];
+        }
+
+        float x = (i % side) * spacing - extent * 0.5f;
+        float z = (i / side) * spacing - extent * 0.5f;
+        TransformComponent transform;
+        transform.translation = {x, 0.f, z};
+        transform.rotation = {0.f, glm::two_pi<float>() * random01(rng), 0.f};
+        transform.scale = glm::vec3{0.5f};
+        glm::vec3 color{random01(rng), random01(rng), random01(rng)};
+        vertices += model->getVertexCount();
+        ctx->Se_renderer->createObject(model, color, transform);
+    }
+    uniqueModels = static_cast<uint32_t>(models.size());
+    return count;
+}
+
+SeBenchmark::Result SeBenchmark::runScene(const Scene& scene)
+{
+    auto ctx = engine.ctx;
+    Result result;
+    result.name = scene.name;
+
+    // Between scenes only, nothing is measured here
+    vkDeviceWaitIdle(ctx->Se_device->device);
+    ctx->Se_renderer->clearObjects();
+
+    float extent = 0.f;
+    result.objects = buildScene(scene, result.uniqueModels, result.vertices, extent);
+
+    SeCameraPath path = SeCameraPath::orbit(glm::vec3{0.f}, extent * 0.75f, extent * 0.25f + 2.f);
+    auto renderAt = [&](uint32_t frame, uint32_t frameCount) {
+        SeCameraPath::Pose pose = path.pose(static_cast<float>(frame) / frameCount);
+        ctx->Se_camera->setViewYXZ(pose.position, pose.rotation);
+        return engine.renderFrame();
+    };
+
+    std::cout << "Scene " << scene.name << ": " << result.objects << " objects, " << result.uniqueModels << " meshes" << std::endl;
+    for (uint32_t i = 0; i < settings.warmupFrames; i++)
+    {
+        renderAt(i, settings.warmupFrames);
+    }
+    ctx->Se_renderer->resetFrameStats();
+
+    // Headless frames are never skipped, the attempt limit only guards against a broken swap chain
+    uint32_t rendered = 0;
+    for (uint32_t attempt = 0; rendered < settings.frames && attempt < settings.frames * 2; attempt++)
+    {
+        if (renderAt(rendered, settings.frames)) rendered++;
+    }
+    vkDeviceWaitIdle(ctx->Se_device->device);
+
+    SeFrameStats::Summary summary = ctx->Se_renderer->getFrameStats().getTotalSummary();
+    result.frames = summary.frames;
+    result.avgFrameTime = summary.avgFrameTime;
+    result.p50 = summary.p50;
+    result.p95 = summary.p95;
+    result.p99 = summary.p99;
+    result.max = summary.max;
+    result.onePercentLowFps = summary.onePercentLowFps;
+    result.hitches = summary.hitches;
+    result.avgCpuTime = summary.avgCpuTime;
+    result.avgGpuTime = summary.avgGpuTime;
+    result.p95GpuTime = summary.p95GpuTime;
+    result.drawsPerFrame = ctx->Se_renderer->getDrawCount();
+    result.deviceMemoryMB = ctx->Se_device->getDeviceMemoryUsage() / (1024.0 * 1024.0);
+    result.processMemoryMB = peakProcessMemoryMB();
+    SeFrameStats::printSummary(summary);
+    return result;
+}
+
+bool SeBenchmark::run()
+{
+    if (!engine.ctx->Se_swapchain->isHeadless())
+    {
+        std::cout << "Benchmark results are only comparable headless, set headless=true in config/bench.ini" << std::endl;
+    }
+
+    for (const Scene& scene : defaultScenes())
+    {
+        const auto& filter = settings.sceneFilter;
+        if (!filter.empty() && std::find(filter.begin(), filter.end(), scene.name) == filter.end()) continue;
+        results.push_back(runScene(scene));
+    }
+    if (results.empty())
+    {
+        std::cout << "No scene matched the filter" << std::endl;
+        return false;
+    }
+
+    writeReport(settings.reportPath);
+    if (settings.baselinePath.empty()) return true;
+    if (settings.bUpdateBaseline)
+    {
+        writeReport(settings.baselinePath);
+        return true;
+    }
+    return compareToBaseline(settings.baselinePath);
+}
+
+void SeBenchmark::writeReport(const std::string& path) const
+{
+    std::ofstream file(path);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("failed to open benchmark report: " + path);
+    }
+
+    // One scene per line, compareToBaseline reads it back line by line
+    file << std::fixed << std::setprecision(4);
+    file << "{\"device\":\"" << engine.ctx->Se_device->properties.deviceName << "\",\"warmup_frames\":" << settings.warmupFrames
+         << ",\"frames\":" << settings.frames << ",\"scale\":" << settings.scale << ",\"depth_prepass\":"
+         << (Config::get().depth_prepass() ? "true" : "false") << ",\n\"scenes\":[\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        file << "{\"name\":\"" << r.name << "\",\"objects\":" << r.objects << ",\"unique_models\":" << r.uniqueModels
+             << ",\"vertices\":" << r.vertices << ",\"draws_per_frame\":" << r.drawsPerFrame << ",\"frames\":" << r.frames
+             << ",\"avg_ms\":" << r.avgFrameTime << ",\"p50_ms\":" << r.p50 << ",\"p95_ms\":" << r.p95 << ",\"p99_ms\":" << r.p99
+             << ",\"max_ms\":" << r.max << ",\"low1_fps\":" << r.onePercentLowFps << ",\"hitches\":" << r.hitches
+             << ",\"cpu_avg_ms\":" << r.avgCpuTime << ",\"gpu_avg_ms\":" << r.avgGpuTime << ",\"gpu_p95_ms\":" << r.p95GpuTime
+             << ",\"device_memory_mb\":" << r.deviceMemoryMB << ",\"process_memory_mb\":" << r.processMemoryMB << "}"
+             << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "]}\n";
+    std::cout << "Wrote benchmark report to " << path << std::endl;
+}
+
+bool SeBenchmark::compareToBaseline(const std::string& path) const
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cout << "Baseline " << path << " not found, run with --update-baseline to create it" << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        lines.push_back(line);
+    }
+    if (!lines.empty() && readString(lines[0], "device") != engine.ctx->Se_device->properties.deviceName)
+    {
+        std::cout << "Baseline was recorded on " << readString(lines[0], "device") << ", numbers may not be comparable" << std::endl;
+    }
+
+    static const char* metrics[] = {"p50_ms", "p95_ms", "p99_ms", "cpu_avg_ms", "gpu_avg_ms"};
+    bool bPassed = true;
+    std::cout << std::fixed << std::setprecision(3);
+    for (const Result& result : results)
+    {
+        auto baseline = std::find_if(lines.begin(), lines.end(), [&](const std::string& l) { return readString(l, "name") == result.name; });
+        if (baseline == lines.end())
+        {
+            std::cout << "\t" << result.name << ": not in baseline" << std::endl;
+            continue;
+        }
+
+        // Re-read the current values from the same text so both sides went through identical rounding
+        std::ostringstream current;
+        current << std::fixed << std::setprecision(4) << "\"p50_ms\":" << result.p50 << ",\"p95_ms\":" << result.p95
+                << ",\"p99_ms\":" << result.p99 << ",\"cpu_avg_ms\":" << result.avgCpuTime << ",\"gpu_avg_ms\":" << result.avgGpuTime;
+        for (const char* metric : metrics)
+        {
+            double before = readNumber(*baseline, metric);
+            double after = readNumber(current.str(), metric);
+            if (before <= 0.0 || after < 0.0) continue;
+
+            double change = (after - before) / before * 100.0;
+            bool bRegressed = change > settings.threshold && after - before > MIN_REGRESSION_DELTA_MS;
+            bPassed &= !bRegressed;
+            std::cout << "\t" << std::left << std::setw(14) << result.name << std::setw(12) << metric << std::right
+                      << before << " -> " << after << " ms (" << std::showpos << change << std::noshowpos << "%)"
+                      << (bRegressed ? "  REGRESSION" : "") << std::endl;
+        }
+    }
+    std::cout << std::defaultfloat;
+    if (bPassed) std::cout << "No regressions against " << path << std::endl;
+    else std::cout << "Regressions above " << settings.threshold << "% against " << path << std::endl;
+    return bPassed;
+}
+
+double SeBenchmark::peakProcessMemoryMB()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters = {};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+    }
+    return 0.0;
+#elif defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.rfind("VmHWM:", 0) == 0) return std::atof(line.c_str() + 6) / 1024.0;
+    }
+    return 0.0;
+#else
+    return 0.0;
+#endif
+}
+
+}
@@ -0,0 +1,90 @@
+﻿#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace SE {
+class ShamanEngine;
+
+// Repeatable stress scenes rendered headless along a fixed camera path.
+//
+// Each scene runs warm up frames, then a fixed number of measured frames, and ends up as
+// one entry of a JSON report. A report can be checked against a stored baseline, any
+// frame time metric that got slower by more than the threshold counts as a regression.
+class SeBenchmark
+{
+public:
+    enum class SceneKind
+    {
+        CUBES,            // one cube mesh, many objects
+        VASES,            // smooth vase from assets/models, many objects
+        MIXED,            // cubes and both vases interleaved
+        UNIQUE_MESHES,    // every object has its own vertex buffer
+        INSTANCED_MESHES  // same object count as UNIQUE_MESHES sharing a single mesh
+    };
+
+    struct Scene
+    {
+        std::string name;
+        SceneKind kind;
+        uint32_t objectCount;
+    };
+
+    struct Settings
+    {
+        uint32_t warmupFrames = 60;
+        uint32_t frames = 600;
+        float scale = 1.f;              // multiplies every scene's object count
+        std::vector<std::string> sceneFilter;   // empty = all scenes
+        std::string reportPath = "bench_report.json";
+        std::string baselinePath;       // empty = no comparison
+        float threshold = 5.f;          // percent
+        bool bUpdateBaseline = false;
+    };
+
+    struct Result
+    {
+        std::string name;
+        uint32_t objects = 0;
+        uint32_t uniqueModels = 0;
+        uint64_t vertices = 0;
+        uint32_t drawsPerFrame = 0;
+        uint64_t frames = 0;
+        double avgFrameTime = 0.0;
+        double p50 = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+        double onePercentLowFps = 0.0;
+        uint64_t hitches = 0;
+        double avgCpuTime = 0.0;
+        double avgGpuTime = -1.0;
+        double p95GpuTime = -1.0;
+        double deviceMemoryMB = 0.0;   // 0 without VK_EXT_memory_budget
+        double processMemoryMB = 0.0;  // peak resident set
+    };
+
+    SeBenchmark(ShamanEngine& inengine, Settings insettings);
+
+    static std::vector<Scene> defaultScenes();
+
+    // Runs every selected scene, writes the report and compares it against the baseline.
+    // Returns false when a regression was found
+    bool run();
+
+private:
+    // Creates the scene's objects in the renderer, returns how many
+    uint32_t buildScene(const Scene& scene, uint32_t& uniqueModels, uint64_t& vertices, float& extent);
+    Result runScene(const Scene& scene);
+    void writeReport(const std::string& path) const;
+    bool compareToBaseline(const std::string& path) const;
+
+    static double peakProcessMemoryMB();
+
+    ShamanEngine& engine;
+    Settings settings;
+    std::vector<Result> results;
+};
+
+}
@@ -0,0 +1,62 @@
+﻿#include "SeCameraPath.h"
+
+#include <cassert>
+#include <cmath>
+#include <GLM/gtc/constants.hpp>
+
+namespace SE {
+
+SeCameraPath::SeCameraPath(std::vector<glm::vec3> inpoints)
+{
+    points = std::move(inpoints);
+    assert(points.size() >= 4 && "A closed Catmull-Rom spline needs at least four points");
+}
+
+SeCameraPath SeCameraPath::orbit(const glm::vec3& center, float radius, float height)
+{
+    // Eight points around the center, alternating radius and height so the view sweeps
+    // across near and far objects. Negative y is up
+    std::vector<glm::vec3> orbitPoints;
+    for (int i = 0; i < 8; i++)
+    {
+        float angle = glm::two_pi<float>() * i / 8.f;
+        float r = radius * (i % 2 == 0 ? 1.f : 0.6f);
+        float y = -height * (i % 2 == 0 ? 1.f : 0.4f);
+        orbitPoints.push_back(center + glm::vec3{r * std::cos(angle), y, r * std::sin(angle)});
+    }
+    SeCameraPath path(std::move(orbitPoints));
+    path.setTarget(center);
+    return path;
+}
+
+glm::vec3 SeCameraPath::position(float t) const
+{
+    const size_t count = points.size();
+    float scaled = (t - std::floor(t)) * count;
+    size_t segment = static_cast<size_t>(scaled) % count;
+    float u = scaled - std::floor(scaled);
+
+    const glm::vec3& p0 = points[(segment + count - 1) % count];
+    const glm::vec3& p1 = points[segment];
+    const glm::vec3& p2 = points[(segment + 1) % count];
+    const glm::vec3& p3 = points[(segment + 2) % count];
+
+    float u2 = u * u;
+    float u3 = u2 * u;
+    return 0.5f * ((2.f * p1) + (-p0 + p2) * u + (2.f * p0 - 5.f * p1 + 4.f * p2 - p3) * u2 + (-p0 + 3.f * p1 - 3.f * p2 + p3) * u3);
+}
+
+SeCameraPath::Pose SeCameraPath::pose(float t) const
+{
+    Pose result;
+    result.position = position(t);
+    glm::vec3 direction = (bHasTarget ? target : position(t + 0.001f)) - result.position;
+    float length = glm::length(direction);
+    direction = length > 0.f ? direction / length : glm::vec3{0.f, 0.f, 1.f};
+
+    // Inverse of the forward vector in setViewYXZ: (sin(yaw) cos(pitch), -sin(pitch), cos(yaw) cos(pitch))
+    result.rotation = {std::asin(glm::clamp(-direction.y, -1.f, 1.f)), std::atan2(direction.x, direction.z), 0.f};
+    return result;
+}
+
+}
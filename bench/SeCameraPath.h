@@ -0,0 +1,40 @@
+﻿#pragma once
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <GLM/glm.hpp>
+
+namespace SE {
+
+// Closed Catmull-Rom spline the benchmark camera flies along.
+//
+// Sampled by a normalized parameter rather than by time, so frame N always looks at
+// exactly the same view no matter how long the previous frames took.
+class SeCameraPath
+{
+public:
+    struct Pose
+    {
+        glm::vec3 position;
+        glm::vec3 rotation;   // for SeCamera::setViewYXZ
+    };
+
+    explicit SeCameraPath(std::vector<glm::vec3> inpoints);
+
+    // Orbit around and look at the scene center, swinging in and out and up and down
+    static SeCameraPath orbit(const glm::vec3& center, float radius, float height);
+
+    void setTarget(const glm::vec3& intarget) { target = intarget; bHasTarget = true; }
+
+    glm::vec3 position(float t) const;
+    // t in [0, 1) and wraps around. Looks at the target, or along the direction of travel without one
+    Pose pose(float t) const;
+
+private:
+    std::vector<glm::vec3> points;
+    glm::vec3 target{0.f};
+    bool bHasTarget = false;
+};
+
+}
@@ -0,0 +1,66 @@
+﻿#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "Config.h"
+#include "SeBenchmark.h"
+#include "ShamanEngine.h"
+
+namespace {
+void printUsage()
+{
+    std::cout << "ShamanBench [options]\n"
+              << "  --frames N          measured frames per scene (600)\n"
+              << "  --warmup N          frames rendered before measuring (60)\n"
+              << "  --scene NAME        only run this scene, repeatable\n"
+              << "  --scale F           multiply every scene's object count (1.0)\n"
+              << "  --report PATH       where to write the JSON report (bench_report.json)\n"
+              << "  --baseline PATH     compare against this report, exit code 1 on regression\n"
+              << "  --threshold PCT     allowed slowdown in percent (5)\n"
+              << "  --update-baseline   overwrite the baseline with this run instead of comparing\n"
+              << "  --list              print the scene names\n";
+}
+}
+
+int main(int argc, char** argv)
+{
+    // Headless and uncapped on top of the regular config
+    SE::Config::get().load_from_file("config/bench.ini");
+
+    SE::SeBenchmark::Settings settings;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool bHasValue = i + 1 < argc;
+        if (arg == "--frames" && bHasValue) settings.frames = static_cast<uint32_t>(std::atoi(argv[++i]));
+        else if (arg == "--warmup" && bHasValue) settings.warmupFrames = static_cast<uint32_t>(std::atoi(argv[++i]));
+        else if (arg == "--scene" && bHasValue) settings.sceneFilter.push_back(argv[++i]);
+        else if (arg == "--scale" && bHasValue) settings.scale = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--report" && bHasValue) settings.reportPath = argv[++i];
+        else if (arg == "--baseline" && bHasValue) settings.baselinePath = argv[++i];
+        else if (arg == "--threshold" && bHasValue) settings.threshold = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--update-baseline") settings.bUpdateBaseline = true;
+        else if (arg == "--list")
+        {
+            for (const auto& scene : SE::SeBenchmark::defaultScenes()) std::cout << scene.name << "\n";
+            return EXIT_SUCCESS;
+        } else
+        {
+            printUsage();
+            return arg == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    try
+    {
+        SE::ShamanEngine shamanEngine{};
+        SE::SeBenchmark benchmark(shamanEngine, settings);
+        return benchmark.run() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,183 @@
+﻿#include "SeShaderCooker.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <spirv-tools/libspirv.hpp>
+#include <spirv-tools/optimizer.hpp>
+
+#include "Config.h"
+#include "SeShaderArchive.h"
+#include "SeShaderReflection.h"
+
+namespace SE {
+
+namespace {
+// Matches SeShaderCompiler's target environment
+constexpr spv_target_env TARGET_ENV = SPV_ENV_VULKAN_1_2;
+
+std::string describe(const SeShaderCooker::Variant& variant)
+{
+    std::string name = variant.file;
+    for (const auto& [define, value] : variant.defines)
+    {
+        name += " " + define + (value.empty() ? "" : "=" + value);
+    }
+    return name;
+}
+
+std::vector<char> readBinary(const std::string& path)
+{
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) throw std::runtime_error("failed to open file: " + path);
+    std::vector<char> code(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(code.data(), code.size());
+    return code;
+}
+}
+
+SeShaderCooker::SeShaderCooker(const Settings& insettings)
+{
+    settings = insettings;
+    if (settings.outputPath.empty()) settings.outputPath = Config::get().shader_archive_path();
+}
+
+std::vector<SeShaderCooker::Variant> SeShaderCooker::collectVariants() const
+{
+    std::vector<Variant> variants;
+    const std::filesystem::path root(Config::get().shader_path());
+    std::error_code error;
+    for (auto it = std::filesystem::recursive_directory_iterator(root, error); !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+    {
+        if (!it->is_regular_file(error) || !SeShaderCompiler::isSource(it->path().string())) continue;
+        variants.push_back({it->path().lexically_relative(root).generic_string(), {}});
+    }
+    // Directory order differs between platforms, the archive should not
+    std::sort(variants.begin(), variants.end(), [](const Variant& a, const Variant& b) { return a.file < b.file; });
+
+    std::ifstream manifest(settings.manifestPath);
+    std::string line;
+    for (uint32_t lineNumber = 1; std::getline(manifest, line); lineNumber++)
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        Variant variant;
+        if (!(words >> variant.file)) continue;
+        std::string define;
+        while (words >> define)
+        {
+            const size_t equals = define.find('=');
+            if (equals == 0) throw std::runtime_error(settings.manifestPath + ":" + std::to_string(lineNumber) + ": define without a name");
+            if (equals == std::string::npos) variant.defines.emplace_back(define, "");
+            else variant.defines.emplace_back(define.substr(0, equals), define.substr(equals + 1));
+        }
+        // Sources without defines are already in the list
+        const uint64_t key = SeShaderArchive::variantKey(variant.file, variant.defines);
+        bool bKnown = std::any_of(variants.begin(), variants.end(), [&](const Variant& other) {
+            return SeShaderArchive::variantKey(other.file, other.defines) == key;
+        });
+        if (!bKnown) variants.push_back(std::move(variant));
+    }
+    return variants;
+}
+
+std::vector<uint32_t> SeShaderCooker::optimize(const std::vector<uint32_t>& words, const std::string& name) const
+{
+    std::string log;
+    auto consumer = [&log](spv_message_level_t level, const char*, const spv_position_t& position, const char* message) {
+        if (level > SPV_MSG_WARNING) return;
+        log += "\n  word " + std::to_string(position.index) + ": " + message;
+    };
+
+    std::vector<uint32_t> optimized = words;
+    if (settings.bOptimize || settings.bStripDebugInfo)
+    {
+        spvtools::Optimizer optimizer(TARGET_ENV);
+        optimizer.SetMessageConsumer(consumer);
+        // Unused inputs and resources stay, pipeline layouts and vertex input state are built for the full interface
+        if (settings.bOptimize) optimizer.RegisterPerformancePasses(true);
+        if (settings.bStripDebugInfo)
+        {
+            optimizer.RegisterPass(spvtools::CreateStripDebugInfoPass());
+            optimizer.RegisterPass(spvtools::CreateStripNonSemanticInfoPass());
+        }
+        optimized.clear();
+        if (!optimizer.Run(words.data(), words.size(), &optimized)) throw std::runtime_error(name + ": optimizer failed" + log);
+    }
+
+    spvtools::SpirvTools tools(TARGET_ENV);
+    tools.SetMessageConsumer(consumer);
+    if (!tools.Validate(optimized)) throw std::runtime_error(name + ": validation failed" + log);
+    return optimized;
+}
+
+std::vector<char> SeShaderCooker::cook(const Variant& variant)
+{
+    const std::string name = describe(variant);
+    std::vector<char> code;
+    if (SeShaderCompiler::isSource(variant.file)) code = compiler.compile(variant.file, variant.defines).code;
+    else if (variant.defines.empty()) code = readBinary(Config::get().shader_path() + variant.file);
+    else throw std::runtime_error(name + ": defines on a SPIR-V file");
+    if (code.size() % sizeof(uint32_t) != 0) throw std::runtime_error(name + ": not a SPIR-V module");
+
+    std::vector<uint32_t> words(code.size() / sizeof(uint32_t));
+    std::memcpy(words.data(), code.data(), code.size());
+    const std::vector<uint32_t> optimized = optimize(words, name);
+
+    std::vector<char> result(optimized.size() * sizeof(uint32_t));
+    std::memcpy(result.data(), optimized.data(), result.size());
+    // Throws on anything SeShaderCache would refuse at load time
+    SeShaderReflection::reflect(result);
+    return result;
+}
+
+bool SeShaderCooker::run()
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    const std::vector<Variant> variants = collectVariants();
+    std::vector<SeShaderArchive::Entry> entries;
+    size_t failed = 0;
+    size_t bytes = 0;
+    for (const Variant& variant : variants)
+    {
+        try
+        {
+            SeShaderArchive::Entry entry;
+            entry.key = SeShaderArchive::variantKey(variant.file, variant.defines);
+            entry.name = describe(variant);
+            entry.code = cook(variant);
+            bytes += entry.code.size();
+            std::cout << "  " << entry.name << " (" << entry.code.size() << " bytes)" << std::endl;
+            entries.push_back(std::move(entry));
+        } catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            failed++;
+        }
+    }
+    if (failed > 0)
+    {
+        std::cerr << failed << " of " << variants.size() << " shaders failed, " << settings.outputPath << " was not written" << std::endl;
+        return false;
+    }
+
+    std::filesystem::path output(settings.outputPath);
+    std::error_code error;
+    if (output.has_parent_path()) std::filesystem::create_directories(output.parent_path(), error);
+    SeShaderArchive::write(settings.outputPath, entries);
+
+    double duration = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << std::fixed << std::setprecision(1) << "Cooked " << entries.size() << " shaders (" << bytes << " bytes) into "
+              << settings.outputPath << " in " << duration << " ms" << std::defaultfloat << std::endl;
+    return true;
+}
+
+}
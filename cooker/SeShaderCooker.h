@@ -0,0 +1,50 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SeShaderCompiler.h"
+
+namespace SE {
+
+// Offline shader build for shipping: every variant the engine uses, compiled, optimized,
+// validated and packed into one SeShaderArchive.
+//
+// Variants are every source in Config::shader_path() without defines plus one per manifest line,
+// "file [NAME[=VALUE] ...]", '#' starts a comment. Each goes through SeShaderCompiler (the same
+// options and disk cache as the engine), the spirv-tools performance passes with the interface
+// kept intact, optionally strip debug info, the validator and SeShaderReflection, so anything the
+// engine would reject at load time fails the cook instead.
+class SeShaderCooker
+{
+public:
+    struct Settings
+    {
+        std::string manifestPath = "shaders/shaders.manifest";     // optional
+        std::string outputPath;         // empty = Config::shader_archive_path()
+        bool bOptimize = true;
+        bool bStripDebugInfo = true;
+    };
+
+    struct Variant
+    {
+        std::string file;               // relative to shader_path
+        SeShaderDefines defines;
+    };
+
+    SeShaderCooker(const Settings& insettings);
+
+    // False when a variant failed, the archive is only written when all succeed
+    bool run();
+
+    std::vector<Variant> collectVariants() const;
+
+private:
+    std::vector<char> cook(const Variant& variant);
+    std::vector<uint32_t> optimize(const std::vector<uint32_t>& words, const std::string& name) const;
+
+    Settings settings;
+    SeShaderCompiler compiler;
+};
+
+}
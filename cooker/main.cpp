@@ -0,0 +1,59 @@
+﻿#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "SeShaderCooker.h"
+
+namespace {
+void printUsage()
+{
+    std::cout << "ShaderCooker [options]\n"
+              << "  --manifest PATH     shader variants to cook besides every source (shaders/shaders.manifest)\n"
+              << "  --output PATH       archive to write (shader_archive_path of config/config.ini)\n"
+              << "  --no-optimize       skip the spirv-tools performance passes\n"
+              << "  --keep-debug-info   do not strip debug names and lines, e.g. for RenderDoc\n"
+              << "  --list              print the variants without cooking\n";
+}
+}
+
+int main(int argc, char** argv)
+{
+    SE::SeShaderCooker::Settings settings;
+    bool bList = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool bHasValue = i + 1 < argc;
+        if (arg == "--manifest" && bHasValue) settings.manifestPath = argv[++i];
+        else if (arg == "--output" && bHasValue) settings.outputPath = argv[++i];
+        else if (arg == "--no-optimize") settings.bOptimize = false;
+        else if (arg == "--keep-debug-info") settings.bStripDebugInfo = false;
+        else if (arg == "--list") bList = true;
+        else
+        {
+            printUsage();
+            return arg == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    try
+    {
+        SE::SeShaderCooker cooker(settings);
+        if (bList)
+        {
+            for (const auto& variant : cooker.collectVariants())
+            {
+                std::cout << variant.file;
+                for (const auto& [name, value] : variant.defines) std::cout << " " << name << (value.empty() ? "" : "=" + value);
+                std::cout << "\n";
+            }
+            return EXIT_SUCCESS;
+        }
+        return cooker.run() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+}
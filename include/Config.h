@@ -37,8 +37,34 @@ public:
     const std::string& model_path() const { return model_path_; }
     const std::string& texture_path() const { return texture_path_; }
     const std::string& shader_path() const { return shader_path_; }
+    const std::string& shader_cache_path() const { return shader_cache_path_; }
+    const std::string& shader_archive_path() const { return shader_archive_path_; }
+    const bool& depth_prepass() const { return depth_prepass_; }
+    const std::string& present_profile() const { return present_profile_; }
+    const int frame_cap() const { return frame_cap_; }
+    const bool& skip_pending_pipelines() const { return skip_pending_pipelines_; }
+    const std::string& material_features() const { return material_features_; }
+    const bool& headless() const { return headless_; }
+    const int frame_limit() const { return frame_limit_; }
+    const float time_limit() const { return time_limit_; }
+    const std::string& readback_path() const { return readback_path_; }
+    const int job_threads() const { return job_threads_; }
+    const bool& pin_job_threads() const { return pin_job_threads_; }
+    const bool& render_thread() const { return render_thread_; }
+    const bool& pipeline_library() const { return pipeline_library_; }
+    const bool& pipeline_library_optimize() const { return pipeline_library_optimize_; }
+    const bool& shader_hot_reload() const { return shader_hot_reload_; }
+    const std::string& pipeline_cache_path() const { return pipeline_cache_path_; }
+    const float pipeline_cache_save_interval() const { return pipeline_cache_save_interval_; }
+    const bool& pipeline_statistics() const { return pipeline_statistics_; }
+    const bool& print_gpu_profile() const { return print_gpu_profile_; }
+    const std::string& cpu_trace_path() const { return cpu_trace_path_; }
+    const float hitch_threshold() const { return hitch_threshold_; }
+    const float frame_stats_interval() const { return frame_stats_interval_; }
+    const std::string& frame_stats_path() const { return frame_stats_path_; }
     const bool& print_extensions_to_console() const { return print_extensions_to_console_; }
     const bool& print_device_info() const { return print_device_info_; }
+    const bool& print_pipeline_cache_stats() const { return print_pipeline_cache_stats_; }
     
     // Load config from file
     void load_from_file(const std::string& filename) {
@@ -73,8 +99,34 @@ public:
             else if (key == "model_path") model_path_ = value;
             else if (key == "texture_path") texture_path_ = value;
             else if (key == "shader_path") shader_path_ = value;
+            else if (key == "shader_cache_path") shader_cache_path_ = value;
+            else if (key == "shader_archive_path") shader_archive_path_ = value;
+            else if (key == "depth_prepass") depth_prepass_ = stringToBool(value);
+            else if (key == "present_profile") present_profile_ = value;
+            else if (key == "frame_cap") frame_cap_ = std::stoi(value);
+            else if (key == "skip_pending_pipelines") skip_pending_pipelines_ = stringToBool(value);
+            else if (key == "material_features") material_features_ = value;
+            else if (key == "headless") headless_ = stringToBool(value);
+            else if (key == "frame_limit") frame_limit_ = std::stoi(value);
+            else if (key == "time_limit") time_limit_ = std::stof(value);
+            else if (key == "readback_path") readback_path_ = value;
+            else if (key == "job_threads") job_threads_ = std::stoi(value);
+            else if (key == "pin_job_threads") pin_job_threads_ = stringToBool(value);
+            else if (key == "render_thread") render_thread_ = stringToBool(value);
+            else if (key == "pipeline_library") pipeline_library_ = stringToBool(value);
+            else if (key == "pipeline_library_optimize") pipeline_library_optimize_ = stringToBool(value);
+            else if (key == "shader_hot_reload") shader_hot_reload_ = stringToBool(value);
+            else if (key == "pipeline_cache_path") pipeline_cache_path_ = value;
+            else if (key == "pipeline_cache_save_interval") pipeline_cache_save_interval_ = std::stof(value);
+            else if (key == "pipeline_statistics") pipeline_statistics_ = stringToBool(value);
+            else if (key == "print_gpu_profile") print_gpu_profile_ = stringToBool(value);
+            else if (key == "cpu_trace_path") cpu_trace_path_ = value;
+            else if (key == "hitch_threshold") hitch_threshold_ = std::stof(value);
+            else if (key == "frame_stats_interval") frame_stats_interval_ = std::stof(value);
+            else if (key == "frame_stats_path") frame_stats_path_ = value;
             else if (key == "print_extensions_to_console") print_extensions_to_console_ = stringToBool(value);
             else if (key == "print_device_info") print_device_info_ = stringToBool(value);
+            else if (key == "print_pipeline_cache_stats") print_pipeline_cache_stats_ = stringToBool(value);
             
         }
         
@@ -99,8 +151,34 @@ private:
         , model_path_("models/")
         , texture_path_("textures/")
         , shader_path_("shaders/")
+        , shader_cache_path_("cache/shaders/")
+        , shader_archive_path_("shaders/shaders.pak")
+        , depth_prepass_(false)
+        , present_profile_("custom")
+        , frame_cap_(0)
+        , skip_pending_pipelines_(false)
+        , material_features_("")
+        , headless_(false)
+        , frame_limit_(0)
+        , time_limit_(0.f)
+        , readback_path_("")
+        , job_threads_(-1)
+        , pin_job_threads_(false)
+        , render_thread_(true)
+        , pipeline_library_(true)
+        , pipeline_library_optimize_(true)
+        , shader_hot_reload_(false)
+        , pipeline_cache_path_("cache/")
+        , pipeline_cache_save_interval_(60.f)
+        , pipeline_statistics_(false)
+        , print_gpu_profile_(false)
+        , cpu_trace_path_("")
+        , hitch_threshold_(0.f)
+        , frame_stats_interval_(1.f)
+        , frame_stats_path_("")
         , print_extensions_to_console_(false)
         , print_device_info_(false)
+        , print_pipeline_cache_stats_(false)
     {
         // Load config at construction (could move to main if preferred)
         load_from_file("config/config.ini");
@@ -114,7 +192,33 @@ private:
     std::string model_path_;
     std::string texture_path_;
     std::string shader_path_;
+    std::string shader_cache_path_;
+    std::string shader_archive_path_;
+    bool depth_prepass_;
+    std::string present_profile_;
+    int frame_cap_;
+    bool skip_pending_pipelines_;
+    std::string material_features_;
+    bool headless_;
+    int frame_limit_;
+    float time_limit_;
+    std::string readback_path_;
+    int job_threads_;
+    bool pin_job_threads_;
+    bool render_thread_;
+    bool pipeline_library_;
+    bool pipeline_library_optimize_;
+    bool shader_hot_reload_;
+    std::string pipeline_cache_path_;
+    float pipeline_cache_save_interval_;
+    bool pipeline_statistics_;
+    bool print_gpu_profile_;
+    std::string cpu_trace_path_;
+    float hitch_threshold_;
+    float frame_stats_interval_;
+    std::string frame_stats_path_;
     bool print_extensions_to_console_;
     bool print_device_info_;
+    bool print_pipeline_cache_stats_;
 };
 }
@@ -0,0 +1,188 @@
+﻿#include "SeMicroBench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace SE {
+
+namespace {
+double elapsedNs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+}
+
+SeMicroBench::SeMicroBench(Settings insettings)
+{
+    settings = std::move(insettings);
+}
+
+void SeMicroBench::add(const std::string& name, uint64_t itemsPerIteration, BenchFn fn)
+{
+    cases.push_back({name, std::max<uint64_t>(itemsPerIteration, 1), std::move(fn)});
+}
+
+bool SeMicroBench::pinCurrentThread(int cpu)
+{
+#if defined(_WIN32)
+    HANDLE thread = GetCurrentThread();
+    SetThreadPriority(thread, THREAD_PRIORITY_HIGHEST);
+    return SetThreadAffinityMask(thread, DWORD_PTR(1) << cpu) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+std::string SeMicroBench::requestPerformanceMode(int cpu)
+{
+#if defined(_WIN32)
+    (void)cpu;
+    // Opt out of EcoQoS, Windows would otherwise park a background looking process on slow clocks
+    PROCESS_POWER_THROTTLING_STATE throttling = {};
+    throttling.Version = PROCESS_POWER_THROTTLING_CURRENT_VERSION;
+    throttling.ControlMask = PROCESS_POWER_THROTTLING_EXECUTION_SPEED;
+    throttling.StateMask = 0;
+    bool bThrottlingOff = SetProcessInformation(GetCurrentProcess(), ProcessPowerThrottling, &throttling, sizeof(throttling)) != 0;
+    SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+    return bThrottlingOff ? "power throttling off" : "power throttling unchanged";
+#elif defined(__linux__)
+    // Changing the governor needs root, only report it so noisy numbers can be explained
+    std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(std::max(cpu, 0)) + "/cpufreq/scaling_governor");
+    std::string governor;
+    if (!(file >> governor)) return "unknown";
+    if (governor != "performance")
+    {
+        std::cout << "CPU governor is " << governor << ", results are more stable with the performance governor" << std::endl;
+    }
+    return governor;
+#else
+    (void)cpu;
+    return "unknown";
+#endif
+}
+
+SeMicroBench::Result SeMicroBench::runCase(const Case& benchCase)
+{
+    Result result;
+    result.name = benchCase.name;
+    result.itemsPerIteration = benchCase.itemsPerIteration;
+
+    // Grow the batch until a repetition is long enough for the clock to be irrelevant
+    uint64_t iterations = 1;
+    for (;;)
+    {
+        auto start = std::chrono::steady_clock::now();
+        benchCase.fn(iterations);
+        if (elapsedNs(start) >= settings.minRepetitionMs * 1e6 || iterations >= (1ull << 40)) break;
+        iterations *= 2;
+    }
+    result.iterations = iterations;
+
+    auto warmupStart = std::chrono::steady_clock::now();
+    while (elapsedNs(warmupStart) < settings.warmupMs * 1e6)
+    {
+        benchCase.fn(iterations);
+    }
+
+    std::vector<double> samples(settings.repetitions);
+    const double items = static_cast<double>(iterations * benchCase.itemsPerIteration);
+    for (auto& sample : samples)
+    {
+        auto start = std::chrono::steady_clock::now();
+        benchCase.fn(iterations);
+        sample = elapsedNs(start) / items;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    result.min = samples.front();
+    result.max = samples.back();
+    size_t middle = samples.size() / 2;
+    result.median = samples.size() % 2 ? samples[middle] : 0.5 * (samples[middle - 1] + samples[middle]);
+    double sum = 0.0;
+    for (double sample : samples) sum += sample;
+    result.mean = sum / samples.size();
+    double variance = 0.0;
+    for (double sample : samples) variance += (sample - result.mean) * (sample - result.mean);
+    result.stddev = samples.size() > 1 ? std::sqrt(variance / (samples.size() - 1)) : 0.0;
+    return result;
+}
+
+bool SeMicroBench::run()
+{
+    if (settings.cpu >= 0)
+    {
+        bPinned = pinCurrentThread(settings.cpu);
+        if (!bPinned) std::cout << "Could not pin to CPU " << settings.cpu << ", running unpinned" << std::endl;
+    }
+    powerState = requestPerformanceMode(settings.cpu);
+    settings.repetitions = std::max<uint32_t>(settings.repetitions, 1);
+
+    std::vector<Result> results;
+    std::cout << std::left << std::setw(44) << "case" << std::right << std::setw(12) << "median ns" << std::setw(12) << "min ns"
+              << std::setw(10) << "cv %" << std::setw(14) << "items/s" << std::endl;
+    for (const Case& benchCase : cases)
+    {
+        if (!settings.filter.empty() && benchCase.name.find(settings.filter) == std::string::npos) continue;
+
+        Result result = runCase(benchCase);
+        double cv = result.mean > 0.0 ? result.stddev / result.mean * 100.0 : 0.0;
+        std::cout << std::left << std::setw(44) << result.name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << result.median << std::setw(12) << result.min << std::setw(10) << cv
+                  << std::setw(14) << std::setprecision(0) << (result.median > 0.0 ? 1e9 / result.median : 0.0)
+                  << std::defaultfloat << std::endl;
+        results.push_back(result);
+    }
+
+    if (results.empty())
+    {
+        std::cout << "No benchmark matched the filter" << std::endl;
+        return false;
+    }
+    return writeJson(results);
+}
+
+bool SeMicroBench::writeJson(const std::vector<Result>& results) const
+{
+    if (settings.jsonPath.empty()) return true;
+    std::ofstream file(settings.jsonPath);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open " << settings.jsonPath << std::endl;
+        return false;
+    }
+
+    file << std::fixed << std::setprecision(3);
+    file << "{\"cpu\":" << (bPinned ? settings.cpu : -1) << ",\"power\":\"" << powerState << "\",\"repetitions\":" << settings.repetitions
+         << ",\n\"results\":[\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        file << "{\"name\":\"" << r.name << "\",\"items_per_iteration\":" << r.itemsPerIteration << ",\"iterations\":" << r.iterations
+             << ",\"ns_min\":" << r.min << ",\"ns_median\":" << r.median << ",\"ns_mean\":" << r.mean << ",\"ns_stddev\":" << r.stddev
+             << ",\"ns_max\":" << r.max << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "]}\n";
+    std::cout << "Wrote " << results.size() << " results to " << settings.jsonPath << std::endl;
+    return true;
+}
+
+}
@@ -0,0 +1,90 @@
+﻿#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace SE {
+
+// Keeps the compiler from optimizing away a result the benchmark never reads
+template <class T>
+inline void doNotOptimize(const T& value)
+{
+#if defined(_MSC_VER)
+    static volatile const void* sink;
+    sink = &value;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "g"(&value) : "memory");
+#endif
+}
+
+// Minimal CPU microbenchmark harness.
+//
+// Every case doubles its iteration count until one repetition takes at least minRepetitionMs,
+// is warmed up for warmupMs at that count, then runs a fixed number of repetitions. The summary is
+// computed over the per repetition times, so the spread shows how noisy the machine was.
+class SeMicroBench
+{
+public:
+    struct Settings
+    {
+        double warmupMs = 200.0;
+        double minRepetitionMs = 10.0;
+        uint32_t repetitions = 15;
+        std::string filter;                    // substring of the case name, empty = all
+        std::string jsonPath = "microbench.json";
+        int cpu = 0;                           // core to pin to, -1 = don't pin
+    };
+
+    struct Result
+    {
+        std::string name;
+        uint64_t itemsPerIteration = 1;
+        uint64_t iterations = 0;               // per repetition
+        // Nanoseconds per item over all repetitions
+        double min = 0.0;
+        double median = 0.0;
+        double mean = 0.0;
+        double stddev = 0.0;
+        double max = 0.0;
+    };
+
+    // Runs the measured code iterations times
+    using BenchFn = std::function<void(uint64_t iterations)>;
+
+    explicit SeMicroBench(Settings insettings);
+
+    // itemsPerIteration: objects, matrices, ... one call of the measured code handles
+    void add(const std::string& name, uint64_t itemsPerIteration, BenchFn fn);
+    // Returns false when nothing ran or the report could not be written
+    bool run();
+
+    // Pins the calling thread to one CPU, returns false if the OS refused. Windows also raises the
+    // thread priority, Linux only sets the affinity (a higher priority needs privileges there)
+    static bool pinCurrentThread(int cpu);
+    // Asks the OS not to clock the process down, returns the CPU governor / power state it found
+    static std::string requestPerformanceMode(int cpu);
+
+private:
+    struct Case
+    {
+        std::string name;
+        uint64_t itemsPerIteration;
+        BenchFn fn;
+    };
+
+    Result runCase(const Case& benchCase);
+    bool writeJson(const std::vector<Result>& results) const;
+
+    Settings settings;
+    std::vector<Case> cases;
+    std::string powerState;
+    bool bPinned = false;
+};
+
+}
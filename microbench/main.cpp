@@ -0,0 +1,475 @@
+﻿#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Config.h"
+#include "SeCamera.h"
+#include "SeFrameStats.h"
+#include "SeJobSystem.h"
+#include "SeMicroBench.h"
+#include "SeComponents.h"
+#include "SeOcclusionCuller.h"
+#include "SeProfiler.h"
+#include "SeRenderSnapshot.h"
+#include "SeRenderer.h"
+#include "SeSceneGraph.h"
+#include "SeTransformBatch.h"
+#include "SeWorld.h"
+#include "ShamanEngine.h"
+#include "vulkancontext.h"
+
+using namespace SE;
+
+namespace {
+
+// Largest difference a SIMD kernel of SeTransformBatch may have against the scalar reference.
+// Only the FMA and summation order differ, that stays a few ulp of the largest entries (~100).
+// A broken kernel is off by whole units
+constexpr float TRANSFORM_BATCH_TOLERANCE = 1e-4f;
+
+float random01(std::mt19937& rng)
+{
+    return static_cast<float>(rng() >> 8) * (1.f / 16777216.f);
+}
+
+// Deterministic transforms, the same for every run
+std::vector<TransformComponent> makeTransforms(size_t count)
+{
+    std::mt19937 rng(1337);
+    std::vector<TransformComponent> transforms(count);
+    for (auto& transform : transforms)
+    {
+        transform.translation = {random01(rng) * 100.f, random01(rng) * 10.f, random01(rng) * 100.f};
+        transform.rotation = {random01(rng) * 6.28f, random01(rng) * 6.28f, random01(rng) * 6.28f};
+        transform.scale = glm::vec3{0.5f + random01(rng)};
+    }
+    return transforms;
+}
+
+// Drawn entities laid out like SeRenderer::createObject does, world matrices already resolved.
+// Without a model it is enough for everything that only reads transforms
+struct Scene
+{
+    SeWorld world;
+    SeSceneGraph sceneGraph;
+};
+
+std::shared_ptr<Scene> makeScene(size_t count, std::shared_ptr<SeModel> model = nullptr)
+{
+    auto scene = std::make_shared<Scene>();
+    std::mt19937 rng(7);
+    for (const auto& transform : makeTransforms(count))
+    {
+        SeSceneGraph::NodeId node = scene->sceneGraph.createNode(transform);
+        scene->world.createEntity(RenderComponent{model, {random01(rng), random01(rng), random01(rng)}}, SceneNodeComponent{node});
+    }
+    scene->sceneGraph.update();
+    return scene;
+}
+
+struct Velocity
+{
+    glm::vec3 linear{};
+};
+
+struct Tag
+{
+};
+
+void addMathCases(SeMicroBench& bench)
+{
+    auto transforms = std::make_shared<std::vector<TransformComponent>>(makeTransforms(1024));
+    bench.add("TransformComponent::mat4", transforms->size(), [transforms](uint64_t iterations) {
+        for (uint64_t it = 0; it < iterations; it++)
+        {
+            for (const auto& transform : *transforms)
+            {
+                glm::mat4 m = transform.mat4();
+                doNotOptimize(m);
+            }
+        }
+    });
+
+    auto camera = std::make_shared<SeCamera>(nullptr);
+    bench.add("SeCamera::setViewYXZ", 1, [camera](uint64_t iterations) {
+        glm::vec3 position{1.f, 2.f, 3.f};
+        glm::vec3 rotation{0.1f, 0.2f, 0.f};
+        for (uint64_t it = 0; it < iterations; it++)
+        {
+            rotation.y += 0.001f;
+            camera->setViewYXZ(position, rotation);
+            doNotOptimize(camera->getViewMatrix());
+        }
+    });
+    bench.add("SeCamera::setPerspectiveProjection", 1, [camera](uint64_t iterations) {
+        float aspect = 1.7f;
+        for (uint64_t it = 0; it < iterations; it++)
+        {
+            aspect += 1e-6f;
+            camera->setPerspectiveProjection(0.87f, aspect, 0.1f, 1000.f);
+            doNotOptimize(camera->getProjectionMatrix());
+        }
+    });
+
+    for (size_t count : {size_t(1000), size_t(10000)})
+    {
+        auto scene = makeScene(count);
+        auto pushData = std::make_shared<std::vector<SimplePushConstantData>>();
+        glm::mat4 projectionView{1.f};
+        bench.add("SeRenderer::writePushConstants/" + std::to_string(count), count, [=](uint64_t iterations) {
+            for (uint64_t it = 0; it < iterations; it++)
+            {
+                SeRenderer::writePushConstants(projectionView, scene->world, scene->sceneGraph, *pushData);
+                doNotOptimize(pushData->data());
+            }
+        });
+    }
+
+    // Matrix math alone on data that already is SoA, per kernel. 100k matrices do not fit in L2
+    auto batch = std::make_shared<SeTransformBatch>();
+    batch->gather(makeTransforms(100000));
+    auto matrices = std::make_shared<std::vector<glm::mat4>>(batch->size());
+    const glm::mat4 projectionView = glm::perspective(0.87f, 1.7f, 0.1f, 1000.f);
+    const float maxError = batch->validate(projectionView);
+    std::cout << "SeTransformBatch kernel " << SeTransformBatch::kernelName(batch->getKernel()) << ", max error vs scalar "
+              << maxError << " (tolerance " << TRANSFORM_BATCH_TOLERANCE << ")" << std::endl;
+    // Timing a kernel that computes wrong matrices is pointless, the run fails instead
+    if (!(maxError <= TRANSFORM_BATCH_TOLERANCE))
+    {
+        throw std::runtime_error(std::string("SeTransformBatch kernel ") + SeTransformBatch::kernelName(batch->getKernel()) +
+                                 " exceeds the tolerance against the scalar reference");
+    }
+    std::vector<SeTransformBatch::Kernel> kernels{SeTransformBatch::Kernel::SCALAR};
+    if (SeTransformBatch::detectKernel() != SeTransformBatch::Kernel::SCALAR) kernels.push_back(SeTransformBatch::detectKernel());
+    for (auto kernel : kernels)
+    {
+        bench.add(std::string("SeTransformBatch::computeMatrices/100000 ") + SeTransformBatch::kernelName(kernel), batch->size(), [=](uint64_t iterations) {
+            batch->setKernel(kernel);
+            for (uint64_t it = 0; it < iterations; it++)
+            {
+                batch->computeMatrices(projectionView, matrices->data(), sizeof(glm::mat4));
+                doNotOptimize(matrices->data());
+            }
+        });
+    }
+
+    // 100k nodes, a tenth of them parents of ten children each. Only the moving share is recomputed
+    auto sceneTransforms = std::make_shared<std::vector<TransformComponent>>(makeTransforms(100000));
+    auto sceneGraph = std::make_shared<SeSceneGraph>();
+    for (size_t i = 0; i < sceneTransforms->size(); i++)
+    {
+        SeSceneGraph::NodeId parent = i % 11 ? static_cast<SeSceneGraph::NodeId>(i - i % 11) : SeSceneGraph::INVALID_NODE;
+        sceneGraph->createNode((*sceneTransforms)[i], parent);
+    }
+    sceneGraph->update();
+    for (size_t moving : {size_t(0), size_t(10000), size_t(100000)})
+    {
+        bench.add("SeSceneGraph::update/100000 moving " + std::to_string(moving), sceneTransforms->size(), [=](uint64_t iterations) {
+            for (uint64_t it = 0; it < iterations; it++)
+            {
+                for (size_t i = 0; i < moving; i++)
+                {
+                    // Node ids are creation order, so the same index as the transform
+                    size_t node = i * sceneTransforms->size() / std::max<size_t>(moving, 1);
+                    sceneGraph->setLocal(static_cast<SeSceneGraph::NodeId>(node), (*sceneTransforms)[node]);
+                }
+                sceneGraph->update();
+                doNotOptimize(sceneGraph->getWorld(0));
+            }
+        });
+    }
+}
+
+void addAllocationCases(SeMicroBench& bench)
+{
+    // Per frame paths that allocate when used carelessly
+    auto scene = makeScene(1000);
+    bench.add("SeRenderer::writePushConstants/1000 cold", 1000, [scene](uint64_t iterations) {
+        for (uint64_t it = 0; it < iterations; it++)
+        {
+            // Fresh vector every time, measures the resize on top of the math
+            std::vector<SimplePushConstantData> pushData;
+            SeRenderer::writePushConstants(glm::mat4{1.f}, scene->world, scene->sceneGraph, pushData);
+            doNotOptimize(pushData.data());
+        }
+    });
+
+    auto stats = std::make_shared<SeFrameStats>();
+    bench.add("SeFrameStats::addFrame", 1, [stats](uint64_t iterations) {
+        for (uint64_t it = 0; it < iterations; it++)
+        {
+            stats->addFrame(it, 16.6 + (it % 7) * 0.1, 0.5);
+        }
+    });
+
+#ifdef SE_ENABLE_PROFILER
+    bench.add("SeProfileZone", 1, [](uint64_t iterations) {
+        for (uint64_t it = 0; it < iterations; it++)
+        {
+            SE_PROFILE_ZONE("microbench");
+        }
+    });
+#endif
+}
+
+void addWorldCases(SeMicroBench& bench)
+{
+    // Iteration: integrate 100k velocities, the plain loop an ECS system boils down to
+    auto world = std::make_shared<SeWorld>();
+    for (const auto& transform : makeTransforms(100000))
+    {
+        world->createEntity(transform, Velocity{transform.translation * 0.01f});
+    }
+    bench.add("SeWorld::eachChunk/100000", world->count<TransformComponent, Velocity>(), [world](uint64_t iterations) {
+        for (uint64_t it = 0; it < iterations; it++)
+        {
+            world->eachChunk<TransformComponent, const Velocity>([](uint32_t count, const Entity*, TransformComponent* transforms, const Velocity* velocities) {
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    transforms[i].translation += velocities[i].linear;
+                }
+            });
+        }
+    });
+    auto jobs = std::make_shared<SeJobSystem>();
+    bench.add("SeWorld::parallelEachChunk/100000", world->count<TransformComponent, Velocity>(), [world, jobs](uint64_t iterations) {
+        for (uint64_t it = 0; it < iterations; it++)
+        {
+            world->parallelEachChunk<TransformComponent, const Velocity>(*jobs, [](uint32_t, uint32_t count, const Entity*, TransformComponent* transforms, const Velocity* velocities) {
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    transforms[i].translation += velocities[i].linear;
+                }
+            });
+        }
+    });
+
+    // Structural changes: create and destroy, then an archetype move there and back
+    auto churn = std::make_shared<SeWorld>();
+    auto entities = std::make_shared<std::vector<Entity>>(10000);
+    bench.add("SeWorld::createEntity+destroyEntity/10000", entities->size(), [churn, entities](uint64_t iterations) {
+        for (uint64_t it = 0; it < iterations; it++)
+        {
+            for (auto& entity : *entities)
+            {
+                entity = churn->createEntity(TransformComponent{}, Velocity{});
+            }
+            for (auto entity : *entities)
+            {
+                churn->destroyEntity(entity);
+            }
+        }
+    });
+    auto moving = std::make_shared<SeWorld>();
+    auto movingEntities = std::make_shared<std::vector<Entity>>();
+    for (int i = 0; i < 10000; i++)
+    {
+        movingEntities->push_back(moving->createEntity(TransformComponent{}, Velocity{}));
+    }
+    bench.add("SeWorld::add+remove/10000", movingEntities->size(), [moving, movingEntities](uint64_t iterations) {
+        for (uint64_t it = 0; it < iterations; it++)
+        {
+            for (auto entity : *movingEntities)
+            {
+                moving->add(entity, Tag{});
+            }
+            for (auto entity : *movingEntities)
+            {
+                moving->remove<Tag>(entity);
+            }
+        }
+    });
+}
+
+void addAssetCases(SeMicroBench& bench)
+{
+    const std::string path = Config::get().asset_path() + Config::get().model_path() + "smooth_vase.obj";
+    bench.add("SeModel::loadVertices/smooth_vase", 1, [path](uint64_t iterations) {
+        for (uint64_t it = 0; it < iterations; it++)
+        {
+            auto vertices = SeModel::loadVertices(path);
+            doNotOptimize(vertices.data());
+        }
+    });
+}
+
+// Submits dependents while the job they depend on finishes on a worker. A dependent that is lost
+// in that race never runs, its counter is given a deadline instead of waiting forever
+void checkJobDependencies()
+{
+    SeJobSystem jobs(std::max(2u, std::thread::hardware_concurrency()) - 1);
+    constexpr uint32_t ROUNDS = 100000;
+    constexpr uint32_t DEPENDENTS = 8;
+    for (uint32_t round = 0; round < ROUNDS; round++)
+    {
+        SeJobCounter dependency;
+        SeJobCounter done;
+        // A short spin puts the finish right where the dependent registers, varied per round
+        const uint32_t spins = round % 64;
+        jobs.run([spins]() {
+            for (volatile uint32_t i = 0; i < spins; i++) {}
+        }, &dependency);
+        // Every submit is another chance to land in the window
+        for (uint32_t i = 0; i < DEPENDENTS; i++)
+        {
+            jobs.run([]() {}, &done, &dependency);
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!done.isDone())
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                throw std::runtime_error("SeJobSystem lost a dependent job in round " + std::to_string(round));
+            }
+            std::this_thread::yield();
+        }
+        // Both counters live on this stack, wait() returns once no finishing job still holds them
+        jobs.wait(done);
+        jobs.wait(dependency);
+    }
+    std::cout << "SeJobSystem dependency check passed (" << ROUNDS << " rounds)" << std::endl;
+}
+
+void addJobCases(SeMicroBench& bench)
+{
+    checkJobDependencies();
+    // Scaling of the engine's per frame transform work and the cost of a job itself, 1 thread = main thread only
+    auto scene = makeScene(100000);
+    auto pushData = std::make_shared<std::vector<SimplePushConstantData>>();
+    for (uint32_t threads : {1u, 2u, 4u, 8u, 16u})
+    {
+        auto jobs = std::make_shared<SeJobSystem>(threads - 1);
+        const std::string suffix = " " + std::to_string(threads) + (threads == 1 ? " thread" : " threads");
+        bench.add("SeRenderer::writePushConstants/100000" + suffix, scene->world.count<RenderComponent, SceneNodeComponent>(), [=](uint64_t iterations) {
+            for (uint64_t it = 0; it < iterations; it++)
+            {
+                SeRenderer::writePushConstants(glm::mat4{1.f}, scene->world, scene->sceneGraph, *pushData, jobs.get());
+                doNotOptimize(pushData->data());
+            }
+        });
+        bench.add("SeJobSystem::run+wait/1000 empty" + suffix, 1000, [jobs](uint64_t iterations) {
+            for (uint64_t it = 0; it < iterations; it++)
+            {
+                SeJobCounter counter;
+                for (uint32_t i = 0; i < 1000; i++)
+                {
+                    jobs->run([]() {}, &counter);
+                }
+                jobs->wait(counter);
+            }
+        });
+    }
+
+    // Simulation to render thread handoff with an empty render side, the floor under the frame overlap
+    bench.add("SeRenderSnapshots::beginWrite+publish", 1, [](uint64_t iterations) {
+        SeRenderSnapshots snapshots;
+        std::thread consumer([&snapshots]() {
+            while (snapshots.acquire())
+            {
+                snapshots.release();
+            }
+        });
+        for (uint64_t it = 0; it < iterations; it++)
+        {
+            SeRenderSnapshot* snapshot = snapshots.beginWrite();
+            snapshot->simulationFrame = it;
+            snapshots.publish();
+        }
+        snapshots.stop();
+        consumer.join();
+    });
+}
+
+// Needs SeModels, which need a device. Skipped when no Vulkan implementation is available
+void addDeviceCases(SeMicroBench& bench, std::shared_ptr<ShamanEngine> engine)
+{
+    const std::string path = Config::get().asset_path() + Config::get().model_path() + "smooth_vase.obj";
+    auto model = SeModel::createModelFromFile(engine->ctx, path);
+    for (size_t count : {size_t(1000), size_t(10000)})
+    {
+        auto scene = makeScene(count, model);
+        auto bounds = std::make_shared<std::vector<char>>(SeOcclusionCuller::boundsSize(static_cast<uint32_t>(count)));
+        // The captured engine keeps the model's device alive for as long as the case exists
+        bench.add("SeOcclusionCuller::writeObjectBounds/" + std::to_string(count), count, [engine, scene, bounds](uint64_t iterations) {
+            for (uint64_t it = 0; it < iterations; it++)
+            {
+                SeOcclusionCuller::writeObjectBounds(scene->world, scene->sceneGraph, bounds->data());
+                doNotOptimize(bounds->data());
+            }
+        });
+    }
+}
+
+void printUsage()
+{
+    std::cout << "ShamanMicroBench [options]\n"
+              << "  --filter TEXT   only run cases whose name contains TEXT\n"
+              << "  --reps N        measured repetitions per case (15)\n"
+              << "  --warmup MS     warm up time per case (200)\n"
+              << "  --min-time MS   minimum time of one repetition (10)\n"
+              << "  --cpu N         core to pin to, -1 = no pinning (0)\n"
+              << "  --json PATH     machine readable results (microbench.json)\n"
+              << "  --no-device     skip the cases that need a Vulkan device\n";
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    // Headless, no window is needed for the device backed cases
+    Config::get().load_from_file("config/bench.ini");
+
+    SeMicroBench::Settings settings;
+    bool bUseDevice = true;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool bHasValue = i + 1 < argc;
+        if (arg == "--filter" && bHasValue) settings.filter = argv[++i];
+        else if (arg == "--reps" && bHasValue) settings.repetitions = static_cast<uint32_t>(std::atoi(argv[++i]));
+        else if (arg == "--warmup" && bHasValue) settings.warmupMs = std::atof(argv[++i]);
+        else if (arg == "--min-time" && bHasValue) settings.minRepetitionMs = std::atof(argv[++i]);
+        else if (arg == "--cpu" && bHasValue) settings.cpu = std::atoi(argv[++i]);
+        else if (arg == "--json" && bHasValue) settings.jsonPath = argv[++i];
+        else if (arg == "--no-device") bUseDevice = false;
+        else
+        {
+            printUsage();
+            return arg == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    try
+    {
+        SeMicroBench bench(settings);
+        addMathCases(bench);
+        addAllocationCases(bench);
+        addWorldCases(bench);
+        addJobCases(bench);
+        addAssetCases(bench);
+        if (bUseDevice)
+        {
+            try
+            {
+                addDeviceCases(bench, std::make_shared<ShamanEngine>());
+            } catch (const std::exception& e)
+            {
+                std::cout << "Skipping device cases: " << e.what() << std::endl;
+            }
+        }
+        return bench.run() ? EXIT_SUCCESS : EXIT_FAILURE;
+    } catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+}
@@ -1,3 +1,15 @@
+newoption
+{
+    trigger = "profile",
+    description = "Compile in the CPU profiler zones (SE_ENABLE_PROFILER)"
+}
+
+newoption
+{
+    trigger = "shaderc",
+    description = "Compile GLSL at runtime with shaderc_combined from the Vulkan SDK (SE_ENABLE_SHADERC)"
+}
+
 workspace "ShamanEngine"
 	architecture "x64"
 	
@@ -52,6 +64,14 @@ filter { "configurations:Debug" }
     symbols "On"
     
 
+filter { "options:profile" }
+    defines { "SE_ENABLE_PROFILER" }
+
+filter { "options:shaderc" }
+    defines { "SE_ENABLE_SHADERC" }
+    libdirs { "$(VULKAN_SDK)/Lib" }
+    links { "shaderc_combined" }
+
 filter { "configurations:Release" }
     buildoptions "/MT"
     defines { "NDEBUG" }
@@ -60,3 +80,176 @@ filter { "configurations:Release" }
     
 
 
+
+-- Headless scene benchmark, links the engine sources without src/main.cpp
+project "ShamanBench"
+kind "ConsoleApp"
+language "C++"
+
+targetdir ("build/bin/" .. outputdir .. "/%{prj.name}")
+objdir ("build/bin-obj/" .. outputdir .. "/%{prj.name}")
+
+files
+{
+    "src/**.h",
+    "src/**.cpp",
+    "bench/**.h",
+    "bench/**.cpp",
+    "config/**.ini"
+}
+removefiles { "src/main.cpp" }
+
+includedirs
+{
+    "include/",
+    "src/",
+    "vendor/",
+    "vendor/vulkan/"
+}
+
+libdirs
+{
+    "vendor/GLFW/lib-vc2022",
+    "vendor/vulkan"
+}
+links { "glfw3_mt", "vulkan-1" }
+
+
+filter "system:windows"
+cppdialect "C++17"
+staticruntime "On"
+systemversion "latest"
+
+filter { "configurations:Debug" }
+    buildoptions "/MTd"
+    defines { "DEBUG" }
+    runtime "Debug"
+    symbols "On"
+
+filter { "options:profile" }
+    defines { "SE_ENABLE_PROFILER" }
+
+filter { "options:shaderc" }
+    defines { "SE_ENABLE_SHADERC" }
+    libdirs { "$(VULKAN_SDK)/Lib" }
+    links { "shaderc_combined" }
+
+filter { "configurations:Release" }
+    buildoptions "/MT"
+    defines { "NDEBUG" }
+    runtime "Release"
+    optimize "On"
+
+
+-- CPU microbenchmarks of per object and per frame engine code
+project "ShamanMicroBench"
+kind "ConsoleApp"
+language "C++"
+
+targetdir ("build/bin/" .. outputdir .. "/%{prj.name}")
+objdir ("build/bin-obj/" .. outputdir .. "/%{prj.name}")
+
+files
+{
+    "src/**.h",
+    "src/**.cpp",
+    "microbench/**.h",
+    "microbench/**.cpp",
+    "config/**.ini"
+}
+removefiles { "src/main.cpp" }
+
+includedirs
+{
+    "include/",
+    "src/",
+    "vendor/",
+    "vendor/vulkan/"
+}
+
+libdirs
+{
+    "vendor/GLFW/lib-vc2022",
+    "vendor/vulkan"
+}
+links { "glfw3_mt", "vulkan-1" }
+
+
+filter "system:windows"
+cppdialect "C++17"
+staticruntime "On"
+systemversion "latest"
+
+filter { "configurations:Debug" }
+    buildoptions "/MTd"
+    defines { "DEBUG" }
+    runtime "Debug"
+    symbols "On"
+
+filter { "options:profile" }
+    defines { "SE_ENABLE_PROFILER" }
+
+filter { "options:shaderc" }
+    defines { "SE_ENABLE_SHADERC" }
+    libdirs { "$(VULKAN_SDK)/Lib" }
+    links { "shaderc_combined" }
+
+filter { "configurations:Release" }
+    buildoptions "/MT"
+    defines { "NDEBUG" }
+    runtime "Release"
+    optimize "On"
+
+
+-- Offline shader build, compiles, optimizes and validates every variant into shaders/shaders.pak
+project "ShaderCooker"
+kind "ConsoleApp"
+language "C++"
+
+targetdir ("build/bin/" .. outputdir .. "/%{prj.name}")
+objdir ("build/bin-obj/" .. outputdir .. "/%{prj.name}")
+
+files
+{
+    "src/SeShaderArchive.*",
+    "src/SeShaderCompiler.*",
+    "src/SeShaderReflection.*",
+    "src/SeProfiler.*",
+    "cooker/**.h",
+    "cooker/**.cpp",
+    "shaders/shaders.manifest"
+}
+
+includedirs
+{
+    "include/",
+    "src/",
+    "vendor/",
+    "vendor/vulkan/"
+}
+
+-- shaderc and spirv-tools are only shipped as libraries with the Vulkan SDK
+defines { "SE_ENABLE_SHADERC" }
+libdirs { "$(VULKAN_SDK)/Lib" }
+links { "shaderc_combined", "SPIRV-Tools-opt", "SPIRV-Tools" }
+
+
+filter "system:windows"
+cppdialect "C++17"
+staticruntime "On"
+systemversion "latest"
+
+filter { "configurations:Debug" }
+    buildoptions "/MTd"
+    defines { "DEBUG" }
+    runtime "Debug"
+    symbols "On"
+
+filter { "options:profile" }
+    defines { "SE_ENABLE_PROFILER" }
+
+filter { "configurations:Release" }
+    buildoptions "/MT"
+    defines { "NDEBUG" }
+    runtime "Release"
+    optimize "On"
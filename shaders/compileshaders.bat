@@ -1,6 +1,13 @@
-P:\Development\Tools\VulkanSDK\1_4\Bin\glslc.exe %~dp0simple_shader.vert -o %~dp0simple_shader_vert.spv
-P:\Development\Tools\VulkanSDK\1_4\Bin\glslc.exe %~dp0simple_shader.frag -o %~dp0simple_shader_frag.spv
-echo "P:\Development\Tools\VulkanSDK\1_4\Bin\glslc.exe %~dp0simple_shader.vert -o %~dp0simple_shader_vert.spv"
-echo "P:\Development\Tools\VulkanSDK\1_4\Bin\glslc.exe %~dp0simple_shader.frag -o %~dp0simple_shader_frag.spv"
+@echo off
+rem Prebuilt SPIR-V for builds without shaderc (premake5 --shaderc), glslc comes with the Vulkan SDK
+if "%VULKAN_SDK%"=="" (
+    echo VULKAN_SDK is not set, install the Vulkan SDK or set it to the SDK directory
+    exit /b 1
+)
+set GLSLC="%VULKAN_SDK%\Bin\glslc.exe"
 
-exit
+%GLSLC% %~dp0simple_shader.vert -o %~dp0simple_shader_vert.spv || exit /b 1
+%GLSLC% %~dp0simple_shader.frag -o %~dp0simple_shader_frag.spv || exit /b 1
+%GLSLC% %~dp0depth_prepass.vert -o %~dp0depth_prepass_vert.spv || exit /b 1
+%GLSLC% %~dp0hiz_downsample.comp -o %~dp0hiz_downsample_comp.spv || exit /b 1
+%GLSLC% %~dp0occlusion_cull.comp -o %~dp0occlusion_cull_comp.spv || exit /b 1
@@ -1,9 +1,16 @@
 #version 450
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in float viewDepth;
 
 layout(location = 0) out vec4 outColor;
 
+// SeShaderFeatures, set per material pipeline
+layout(constant_id = 1) const bool FOG = false;
+
+// distant surfaces fade into the clear color
+const vec3 FOG_COLOR = vec3(0.1);
+const float FOG_DENSITY = 0.08;
 
 layout(push_constant) uniform Push{
     mat4 transform;
@@ -11,6 +18,10 @@ layout(push_constant) uniform Push{
 } push;
 
 void main() {
-
-    outColor = vec4(fragColor, 1.0);
+    vec3 color = fragColor;
+    if (FOG) {
+        float visibility = clamp(exp(-FOG_DENSITY * viewDepth), 0.0, 1.0);
+        color = mix(FOG_COLOR, color, visibility);
+    }
+    outColor = vec4(color, 1.0);
 }
\ No newline at end of file
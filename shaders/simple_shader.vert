@@ -4,6 +4,13 @@ layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 color;
 
 layout(location = 0) out vec3 fragColor;
+layout(location = 1) out float viewDepth;
+
+// the depth prepass writes the same positions, required for the EQUAL depth test
+invariant gl_Position;
+
+// SeShaderFeatures, set per material pipeline
+layout(constant_id = 0) const bool VERTEX_COLOR = true;
 
 layout(push_constant) uniform Push{
     mat4 transform;
@@ -12,5 +19,7 @@ layout(push_constant) uniform Push{
 
 void main() {
     gl_Position = push.transform * vec4(position, 1.0);
-    fragColor = color;
+    fragColor = VERTEX_COLOR ? color : push.color;
+    // w of a perspective projection is the distance along the view axis
+    viewDepth = gl_Position.w;
 }
\ No newline at end of file
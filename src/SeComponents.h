@@ -1,17 +1,20 @@
 ﻿#pragma once
+#include <cstdint>
 #include <memory>
 
 #include <GLM/gtc/matrix_transform.hpp>
 #include "SeModel.h"
+#include "SeShaderFeatures.h"
 
 namespace SE {
+class SePipelineEntry;
 
 struct TransformComponent
 {
     glm::vec3 translation{};
     glm::vec3 scale{1.f, 1.f, 1.f};
     glm::vec3 rotation{};
-    glm::mat4 mat4() {
+    glm::mat4 mat4() const {
         const float c3 = glm::cos(rotation.z);
         const float s3 = glm::sin(rotation.z);
         const float c2 = glm::cos(rotation.x);
@@ -41,36 +44,23 @@ struct TransformComponent
     }
 };
 
-class SeObject
+// What the renderer needs to draw an entity
+struct RenderComponent
 {
-public:
-    using id_t = unsigned int;
-
-    static SeObject createObject()
-    {
-        static id_t currentId = 0;
-        return SeObject{currentId++};
-    }
-
-    SeObject(const SeObject &) = delete;
-    SeObject &operator=(const SeObject &) = delete;
-    SeObject(SeObject &&) = default;
-    SeObject &operator=(SeObject &&) = default;
-
-    id_t getId() const { return id; }
-
     std::shared_ptr<SeModel> model{};
     glm::vec3 color{};
-    TransformComponent transform{};
-
-private:
-    SeObject(id_t objId) : id{objId} {}
-
-    id_t id;
+    // From SePipelineRegistry::registerGraphicsPipeline, nullptr draws with the renderer's main pipeline
+    // specialized for features. Compiled in the background on first use, see Config::skip_pending_pipelines()
+    SePipelineEntry* pipeline = nullptr;
+    // Material of the main pipeline, one pipeline per feature set. Rebuilt with the render passes
+    SeShaderFeatures features{};
+};
 
-    
-    
+// Node in the renderer's SeSceneGraph that owns the entity's transform.
+// Move the entity with SeSceneGraph::setLocal() on this node
+struct SceneNodeComponent
+{
+    uint32_t node = ~0u;
 };
 
 }
-
@@ -2,7 +2,8 @@
 
 #include <iostream>
 #include <GLM/vec3.hpp>
-#include "SeObject.h"
+#include "SeComponents.h"
+#include "SeRenderer.h"
 #include "vulkancontext.h"
 
 namespace SE {
@@ -45,7 +46,7 @@ SeController::SeController(std::shared_ptr<VulkanContext> inctx)
 
 
 
-void SeController::moveInPlaneXZ(GLFWwindow* window, float deltaTime, SeObject& object)
+void SeController::moveInPlaneXZ(GLFWwindow* window, float deltaTime, TransformComponent& transform)
 {
      
      glm::vec3 rotate{0};
@@ -63,7 +64,7 @@ void SeController::moveInPlaneXZ(GLFWwindow* window, float deltaTime, SeObject&
           rotate.y += dy;
           if (glm::dot(rotate, rotate) > std::numeric_limits<float>::epsilon())
           {
-               object.transform.rotation += lookSpeed * deltaTime * rotate;
+               transform.rotation += lookSpeed * deltaTime * rotate;
           }
 
           //if (dx > 0 || dy > 0) std::cout << dx << ", " << dy << std::endl;
@@ -76,13 +77,13 @@ void SeController::moveInPlaneXZ(GLFWwindow* window, float deltaTime, SeObject&
      if (glfwGetKey(window, keys.lookDown) == GLFW_PRESS) rotate.x -= 1.f;
      if (glm::dot(rotate, rotate) > std::numeric_limits<float>::epsilon())
      {
-          object.transform.rotation += lookSpeed * deltaTime * glm::normalize(rotate);
+          transform.rotation += lookSpeed * deltaTime * glm::normalize(rotate);
      }
 
-     object.transform.rotation.x = glm::clamp(object.transform.rotation.x, -34.5f, 34.5f);
-     object.transform.rotation.y = glm::mod(object.transform.rotation.y, glm::two_pi<float>());
+     transform.rotation.x = glm::clamp(transform.rotation.x, -34.5f, 34.5f);
+     transform.rotation.y = glm::mod(transform.rotation.y, glm::two_pi<float>());
 
-     float yaw = object.transform.rotation.y;
+     float yaw = transform.rotation.y;
      const glm::vec3 forwardDir{sin(yaw), 0, cos(yaw)};
      const glm::vec3 upDir{0.f, -1.f, 0.f};
      const glm::vec3 rightDir = glm::normalize(glm::cross(forwardDir, upDir)); // Correct right vector
@@ -97,8 +98,24 @@ void SeController::moveInPlaneXZ(GLFWwindow* window, float deltaTime, SeObject&
      
      if (glm::dot(moveDir, moveDir) > std::numeric_limits<float>::epsilon())
      {
-          object.transform.translation += moveSpeed * deltaTime * glm::normalize(moveDir);
+          transform.translation += moveSpeed * deltaTime * glm::normalize(moveDir);
      }
 }
 
+void SeController::switchPresentProfile(GLFWwindow* window)
+{
+     int pressed = GLFW_KEY_UNKNOWN;
+     PresentProfile profile = PresentProfile::Custom;
+     if (glfwGetKey(window, keys.lowLatencyProfile) == GLFW_PRESS) { pressed = keys.lowLatencyProfile; profile = PresentProfile::LowLatency; }
+     else if (glfwGetKey(window, keys.throughputProfile) == GLFW_PRESS) { pressed = keys.throughputProfile; profile = PresentProfile::Throughput; }
+     else if (glfwGetKey(window, keys.powerSavingProfile) == GLFW_PRESS) { pressed = keys.powerSavingProfile; profile = PresentProfile::PowerSaving; }
+
+     // Only on the press, holding the key must not recreate the swap chain every frame
+     if (pressed != GLFW_KEY_UNKNOWN && pressed != lastProfileKey)
+     {
+          ctx->Se_renderer->setPresentProfile(profile);
+     }
+     lastProfileKey = pressed;
+}
+
 }
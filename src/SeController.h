@@ -7,7 +7,7 @@
 namespace SE {
 struct VulkanContext;
 
-class SeObject;
+struct TransformComponent;
 
 class SeController
 {
@@ -25,6 +25,9 @@ public:
         int lookUp = GLFW_KEY_UP;
         int lookDown = GLFW_KEY_DOWN;
         int mouseMove = GLFW_MOUSE_BUTTON_2;
+        int lowLatencyProfile = GLFW_KEY_F1;
+        int throughputProfile = GLFW_KEY_F2;
+        int powerSavingProfile = GLFW_KEY_F3;
     };
 
     static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
@@ -32,7 +35,9 @@ public:
 
     SeController(std::shared_ptr<VulkanContext> inctx);
 
-    void moveInPlaneXZ(GLFWwindow* window, float deltaTime, SeObject& object);
+    void moveInPlaneXZ(GLFWwindow* window, float deltaTime, TransformComponent& transform);
+    // Switches the present profile on key press, takes effect next frame
+    void switchPresentProfile(GLFWwindow* window);
 
     KeyMappings keys{};
     float moveSpeed{3.f};
@@ -44,6 +49,7 @@ public:
     float cY = 0.0f;
     float lX = 0.0f;
     float lY = 0.0f;
+    int lastProfileKey = GLFW_KEY_UNKNOWN;
 };
 
 }
\ No newline at end of file
@@ -25,7 +25,7 @@ SeDevice::~SeDevice() {
 
   
 
-  vkDestroySurfaceKHR(ctx->Se_engine->instance, ctx->Se_window->surface, nullptr);
+  if (ctx->Se_window) vkDestroySurfaceKHR(ctx->Se_engine->instance, ctx->Se_window->surface, nullptr);
   vkDestroyInstance(ctx->Se_engine->instance, nullptr);
 }
   
@@ -52,6 +52,7 @@ void SeDevice::pickPhysicalDevice() {
   }
 
   vkGetPhysicalDeviceProperties(physical_device, &properties);
+  vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
   
   if (Config::get().print_device_info())
   {
@@ -79,6 +80,13 @@ void SeDevice::createLogicalDevice() {
 
   VkPhysicalDeviceFeatures deviceFeatures = {};
   deviceFeatures.samplerAnisotropy = VK_TRUE;
+  // rg32f storage images for the Hi-Z pyramid
+  if (Config::get().depth_prepass() && !supported_features.shaderStorageImageExtendedFormats) {
+    throw std::runtime_error("depth prepass requires shaderStorageImageExtendedFormats!");
+  }
+  deviceFeatures.shaderStorageImageExtendedFormats = supported_features.shaderStorageImageExtendedFormats;
+  // optional, SeGpuProfiler falls back to timestamps only
+  deviceFeatures.pipelineStatisticsQuery = Config::get().pipeline_statistics() ? supported_features.pipelineStatisticsQuery : VK_FALSE;
 
   VkDeviceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -87,8 +95,38 @@ void SeDevice::createLogicalDevice() {
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
   createInfo.pEnabledFeatures = &deviceFeatures;
-  createInfo.enabledExtensionCount = static_cast<uint32_t>(ctx->Se_engine->deviceExtensions.size());
-  createInfo.ppEnabledExtensionNames = ctx->Se_engine->deviceExtensions.data();
+
+  VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+  timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+  timelineFeatures.timelineSemaphore = VK_TRUE;
+  createInfo.pNext = &timelineFeatures;
+
+  // Optional, SePipeline links pipelines from separately compiled parts when available
+  VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT libraryFeatures = {};
+  libraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+  bGraphicsPipelineLibrarySupported = Config::get().pipeline_library() &&
+                                      hasDeviceExtension(physical_device, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+                                      hasDeviceExtension(physical_device, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+  if (bGraphicsPipelineLibrarySupported) {
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &libraryFeatures;
+    vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+    bGraphicsPipelineLibrarySupported = libraryFeatures.graphicsPipelineLibrary == VK_TRUE;
+  }
+  if (bGraphicsPipelineLibrarySupported) timelineFeatures.pNext = &libraryFeatures;
+  // Optional extensions on top of the required ones
+  std::vector<const char *> enabledExtensions = ctx->Se_engine->deviceExtensions;
+  bMemoryBudgetSupported = hasDeviceExtension(physical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  if (bMemoryBudgetSupported) enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  bPipelineFeedbackSupported = hasDeviceExtension(physical_device, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+  if (bPipelineFeedbackSupported) enabledExtensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+  if (bGraphicsPipelineLibrarySupported) {
+    enabledExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+    enabledExtensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+  }
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+  createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
   // might not really be necessary anymore because device specific validation layers
   // have been deprecated
@@ -126,8 +164,9 @@ bool SeDevice::isDeviceSuitable(VkPhysicalDevice device) {
 
   bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-  bool swapChainAdequate = false;
-  if (extensionsSupported) {
+  // Headless rendering never presents, any device with a graphics queue will do
+  bool swapChainAdequate = Config::get().headless();
+  if (extensionsSupported && !Config::get().headless()) {
     SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
     swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
   }
@@ -135,8 +174,22 @@ bool SeDevice::isDeviceSuitable(VkPhysicalDevice device) {
   VkPhysicalDeviceFeatures supportedFeatures;
   vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
+  // Frame pacing runs on a timeline semaphore, core since Vulkan 1.2
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(device, &deviceProperties);
+  VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+  timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+  VkPhysicalDeviceFeatures2 features2 = {};
+  features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features2.pNext = &timelineFeatures;
+  bool timelineSupported = deviceProperties.apiVersion >= VK_API_VERSION_1_2;
+  if (timelineSupported) {
+    vkGetPhysicalDeviceFeatures2(device, &features2);
+    timelineSupported = timelineFeatures.timelineSemaphore == VK_TRUE;
+  }
+
   return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-         supportedFeatures.samplerAnisotropy;
+         supportedFeatures.samplerAnisotropy && timelineSupported;
 }
 
 
@@ -149,6 +202,37 @@ bool SeDevice::isDeviceSuitable(VkPhysicalDevice device) {
 
 
 
+bool SeDevice::hasDeviceExtension(VkPhysicalDevice device, const char *extensionName) {
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+  for (const auto &extension : availableExtensions) {
+    if (strcmp(extension.extensionName, extensionName) == 0) return true;
+  }
+  return false;
+}
+
+VkDeviceSize SeDevice::getDeviceMemoryUsage() {
+  if (!bMemoryBudgetSupported) return 0;
+
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+  budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+  VkPhysicalDeviceMemoryProperties2 memoryProperties = {};
+  memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+  memoryProperties.pNext = &budget;
+  vkGetPhysicalDeviceMemoryProperties2(physical_device, &memoryProperties);
+
+  VkDeviceSize usage = 0;
+  for (uint32_t i = 0; i < memoryProperties.memoryProperties.memoryHeapCount; i++) {
+    if (memoryProperties.memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      usage += budget.heapUsage[i];
+    }
+  }
+  return usage;
+}
+
 bool SeDevice::checkDeviceExtensionSupport(VkPhysicalDevice device) {
   uint32_t extensionCount;
   vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
@@ -185,7 +269,12 @@ QueueFamilyIndices SeDevice::findQueueFamilies(VkPhysicalDevice device) {
       indices.graphicsFamilyHasValue = true;
     }
     VkBool32 presentSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, ctx->Se_window->surface, &presentSupport);
+    if (ctx->Se_window) {
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, ctx->Se_window->surface, &presentSupport);
+    } else {
+      // No surface, "present" is the copy out of the offscreen image on the graphics queue
+      presentSupport = indices.graphicsFamilyHasValue && indices.graphicsFamily == static_cast<uint32_t>(i);
+    }
     if (queueFamily.queueCount > 0 && presentSupport) {
       indices.presentFamily = i;
       indices.presentFamilyHasValue = true;
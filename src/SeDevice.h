@@ -67,6 +67,9 @@ public:
       VkImage &image,
       VkDeviceMemory &imageMemory);
 
+    // Bytes in use on device local heaps as reported by VK_EXT_memory_budget, 0 when unsupported
+    VkDeviceSize getDeviceMemoryUsage();
+
 public:
   
     VkPhysicalDevice physical_device;
@@ -75,7 +78,12 @@ public:
     VkQueue present_queue;
     VkCommandPool command_pool;
     VkPhysicalDeviceProperties properties;
+    VkPhysicalDeviceFeatures supported_features{};
     VkInstance instance;
+    bool bMemoryBudgetSupported = false;
+    bool bPipelineFeedbackSupported = false;
+    // VK_EXT_graphics_pipeline_library, also false when disabled in the config
+    bool bGraphicsPipelineLibrarySupported = false;
 
   
 
@@ -93,6 +101,7 @@ private:
     
     
     bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+    bool hasDeviceExtension(VkPhysicalDevice device, const char *extensionName);
     SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
   
     std::shared_ptr<VulkanContext> ctx;
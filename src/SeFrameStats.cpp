@@ -0,0 +1,287 @@
+﻿#include "SeFrameStats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "Config.h"
+
+namespace SE {
+
+namespace {
+constexpr double HISTOGRAM_MIN = 0.01;   // ms
+constexpr double HISTOGRAM_GROWTH = 1.01;
+constexpr size_t MAX_HITCH_FRAMES = 256;
+// The automatic threshold needs a median worth trusting
+constexpr uint64_t MIN_FRAMES_FOR_AUTO_HITCH = 30;
+}
+
+uint32_t SeFrameStats::Histogram::bucketFor(double ms)
+{
+    if (ms <= HISTOGRAM_MIN) return 0;
+    double bucket = std::log(ms / HISTOGRAM_MIN) / std::log(HISTOGRAM_GROWTH) + 1.0;
+    return static_cast<uint32_t>(std::min(bucket, static_cast<double>(BUCKET_COUNT)));
+}
+
+double SeFrameStats::Histogram::bucketValue(uint32_t bucket) const
+{
+    // The overflow bucket has no upper edge, the maximum is the best guess
+    if (bucket >= BUCKET_COUNT) return max;
+    if (bucket == 0) return HISTOGRAM_MIN;
+    // Geometric middle of [min * g^(b-1), min * g^b)
+    return std::min(HISTOGRAM_MIN * std::pow(HISTOGRAM_GROWTH, bucket - 0.5), max);
+}
+
+void SeFrameStats::Histogram::add(double ms)
+{
+    buckets[bucketFor(ms)]++;
+    total++;
+    sum += ms;
+    max = std::max(max, ms);
+}
+
+void SeFrameStats::Histogram::reset()
+{
+    buckets.fill(0);
+    total = 0;
+    sum = 0.0;
+    max = 0.0;
+}
+
+double SeFrameStats::Histogram::percentile(double p) const
+{
+    if (total == 0) return 0.0;
+    uint64_t rank = static_cast<uint64_t>(std::ceil(std::clamp(p, 0.0, 1.0) * total));
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i <= BUCKET_COUNT; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank) return bucketValue(i);
+    }
+    return max;
+}
+
+double SeFrameStats::Histogram::tailMean(double fraction) const
+{
+    if (total == 0) return 0.0;
+    uint64_t wanted = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(fraction * total)), 1);
+    uint64_t taken = 0;
+    double tailSum = 0.0;
+    for (int i = BUCKET_COUNT; i >= 0 && taken < wanted; i--)
+    {
+        uint64_t n = std::min<uint64_t>(buckets[i], wanted - taken);
+        tailSum += bucketValue(static_cast<uint32_t>(i)) * n;
+        taken += n;
+    }
+    return tailSum / taken;
+}
+
+void SeFrameStats::Histograms::reset()
+{
+    frame.reset();
+    cpu.reset();
+    wait.reset();
+    gpu.reset();
+    hitches = 0;
+}
+
+SeFrameStats::SeFrameStats()
+{
+    hitchThreshold = Config::get().hitch_threshold();
+    reportInterval = Config::get().frame_stats_interval() > 0.f ? Config::get().frame_stats_interval() : 1.0;
+    dumpPath = Config::get().frame_stats_path();
+    bDumpJson = dumpPath.size() >= 5 && dumpPath.compare(dumpPath.size() - 5, 5, ".json") == 0;
+    // CSV rows are appended per window, start from an empty file
+    if (!dumpPath.empty() && !bDumpJson) std::ofstream(dumpPath, std::ios::trunc);
+}
+
+void SeFrameStats::reset()
+{
+    sampleCount = 0;
+    window.reset();
+    total.reset();
+    windowSummary = Summary{};
+    hitchFrames.clear();
+}
+
+double SeFrameStats::getHitchThreshold() const
+{
+    if (hitchThreshold > 0.0) return hitchThreshold;
+    if (total.frame.count() < MIN_FRAMES_FOR_AUTO_HITCH) return 0.0;
+    return total.frame.percentile(0.5) * 2.0;
+}
+
+void SeFrameStats::addFrame(uint64_t frameNumber, double frameTime, double waitTime)
+{
+    Sample& sample = ring[sampleCount % RING_SIZE];
+    sample.frameNumber = frameNumber;
+    sample.frameTime = frameTime;
+    sample.waitTime = std::min(waitTime, frameTime);
+    sample.cpuTime = frameTime - sample.waitTime;
+    sample.gpuTime = -1.0;
+    double threshold = getHitchThreshold();
+    sample.bHitch = threshold > 0.0 && frameTime > threshold;
+    sampleCount++;
+
+    for (Histograms* histograms : {&window, &total})
+    {
+        histograms->frame.add(sample.frameTime);
+        histograms->cpu.add(sample.cpuTime);
+        histograms->wait.add(sample.waitTime);
+        if (sample.bHitch) histograms->hitches++;
+    }
+
+    if (sample.bHitch)
+    {
+        if (hitchFrames.size() >= MAX_HITCH_FRAMES) hitchFrames.erase(hitchFrames.begin());
+        hitchFrames.push_back(frameNumber);
+    }
+}
+
+void SeFrameStats::addGpuTime(uint64_t frameNumber, double gpuTime)
+{
+    if (gpuTime < 0.0) return;
+    window.gpu.add(gpuTime);
+    total.gpu.add(gpuTime);
+
+    // Older than the ring, only the histograms keep it
+    if (sampleCount == 0 || frameNumber + RING_SIZE < ring[(sampleCount - 1) % RING_SIZE].frameNumber) return;
+    for (uint64_t i = sampleCount; i > 0 && i + RING_SIZE > sampleCount; i--)
+    {
+        Sample& sample = ring[(i - 1) % RING_SIZE];
+        if (sample.frameNumber == frameNumber)
+        {
+            sample.gpuTime = gpuTime;
+            return;
+        }
+        if (sample.frameNumber < frameNumber) return;
+    }
+}
+
+SeFrameStats::Summary SeFrameStats::summarize(const Histograms& histograms, double duration)
+{
+    Summary summary;
+    summary.frames = histograms.frame.count();
+    summary.duration = duration;
+    if (summary.frames == 0) return summary;
+
+    summary.avgFrameTime = histograms.frame.mean();
+    summary.p50 = histograms.frame.percentile(0.50);
+    summary.p95 = histograms.frame.percentile(0.95);
+    summary.p99 = histograms.frame.percentile(0.99);
+    summary.max = histograms.frame.maximum();
+    summary.avgFps = duration > 0.0 ? summary.frames / duration : 1000.0 / summary.avgFrameTime;
+    double slowest = histograms.frame.tailMean(0.01);
+    summary.onePercentLowFps = slowest > 0.0 ? 1000.0 / slowest : 0.0;
+    summary.hitches = histograms.hitches;
+    summary.avgCpuTime = histograms.cpu.mean();
+    summary.p95CpuTime = histograms.cpu.percentile(0.95);
+    summary.avgWaitTime = histograms.wait.mean();
+    summary.avgGpuTime = histograms.gpu.count() ? histograms.gpu.mean() : -1.0;
+    summary.p95GpuTime = histograms.gpu.count() ? histograms.gpu.percentile(0.95) : -1.0;
+    return summary;
+}
+
+SeFrameStats::Summary SeFrameStats::endWindow(double duration)
+{
+    windowSummary = summarize(window, duration);
+    window.reset();
+    if (!dumpPath.empty()) dumpWindow(windowSummary);
+    return windowSummary;
+}
+
+SeFrameStats::Summary SeFrameStats::getTotalSummary() const
+{
+    // Sum of frame intervals, covers the window that is still open as well
+    return summarize(total, total.frame.mean() * total.frame.count() / 1000.0);
+}
+
+std::vector<SeFrameStats::Sample> SeFrameStats::getSamples() const
+{
+    std::vector<Sample> samples;
+    uint64_t first = sampleCount > RING_SIZE ? sampleCount - RING_SIZE : 0;
+    samples.reserve(static_cast<size_t>(sampleCount - first));
+    for (uint64_t i = first; i < sampleCount; i++)
+    {
+        samples.push_back(ring[i % RING_SIZE]);
+    }
+    return samples;
+}
+
+bool SeFrameStats::writeSamplesCsv(const std::string& path) const
+{
+    std::ofstream file(path);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open frame time file: " << path << std::endl;
+        return false;
+    }
+    file << std::fixed << std::setprecision(4);
+    file << "frame,frame_ms,cpu_ms,wait_ms,gpu_ms,hitch\n";
+    for (const auto& sample : getSamples())
+    {
+        file << sample.frameNumber << "," << sample.frameTime << "," << sample.cpuTime << "," << sample.waitTime << ","
+             << sample.gpuTime << "," << (sample.bHitch ? 1 : 0) << "\n";
+    }
+    return true;
+}
+
+void SeFrameStats::dumpWindow(const Summary& summary)
+{
+    if (!bDumpJson)
+    {
+        std::ofstream file(dumpPath, std::ios::app);
+        if (!file.is_open()) return;
+        file << std::fixed << std::setprecision(4);
+        if (dumpedWindows.empty())
+        {
+            file << "window,frames,duration_s,avg_ms,p50_ms,p95_ms,p99_ms,max_ms,avg_fps,low1_fps,hitches,"
+                    "cpu_avg_ms,cpu_p95_ms,wait_avg_ms,gpu_avg_ms,gpu_p95_ms\n";
+        }
+        file << dumpedWindows.size() << "," << summary.frames << "," << summary.duration << "," << summary.avgFrameTime << ","
+             << summary.p50 << "," << summary.p95 << "," << summary.p99 << "," << summary.max << "," << summary.avgFps << ","
+             << summary.onePercentLowFps << "," << summary.hitches << "," << summary.avgCpuTime << "," << summary.p95CpuTime << ","
+             << summary.avgWaitTime << "," << summary.avgGpuTime << "," << summary.p95GpuTime << "\n";
+        dumpedWindows.push_back(summary);
+        return;
+    }
+
+    // JSON can't be appended to, rewrite it with every window and the run so far
+    dumpedWindows.push_back(summary);
+    std::ofstream file(dumpPath, std::ios::trunc);
+    if (!file.is_open()) return;
+    file << std::fixed << std::setprecision(4);
+    auto writeSummary = [&file](const Summary& s) {
+        file << "{\"frames\":" << s.frames << ",\"duration_s\":" << s.duration << ",\"avg_ms\":" << s.avgFrameTime
+             << ",\"p50_ms\":" << s.p50 << ",\"p95_ms\":" << s.p95 << ",\"p99_ms\":" << s.p99 << ",\"max_ms\":" << s.max
+             << ",\"avg_fps\":" << s.avgFps << ",\"low1_fps\":" << s.onePercentLowFps << ",\"hitches\":" << s.hitches
+             << ",\"cpu_avg_ms\":" << s.avgCpuTime << ",\"cpu_p95_ms\":" << s.p95CpuTime << ",\"wait_avg_ms\":" << s.avgWaitTime
+             << ",\"gpu_avg_ms\":" << s.avgGpuTime << ",\"gpu_p95_ms\":" << s.p95GpuTime << "}";
+    };
+    file << "{\"total\":";
+    writeSummary(getTotalSummary());
+    file << ",\"windows\":[\n";
+    for (size_t i = 0; i < dumpedWindows.size(); i++)
+    {
+        if (i > 0) file << ",\n";
+        writeSummary(dumpedWindows[i]);
+    }
+    file << "\n]}\n";
+}
+
+void SeFrameStats::printSummary(const Summary& summary)
+{
+    if (summary.frames == 0) return;
+    std::cout << std::fixed << std::setprecision(2)
+              << "FPS: " << summary.avgFps << " (1% low " << summary.onePercentLowFps << ")"
+              << " | frame ms p50 " << summary.p50 << " p95 " << summary.p95 << " p99 " << summary.p99 << " max " << summary.max
+              << " | CPU " << summary.avgCpuTime << " ms, wait " << summary.avgWaitTime << " ms";
+    if (summary.avgGpuTime >= 0.0) std::cout << ", GPU " << summary.avgGpuTime << " ms";
+    if (summary.hitches > 0) std::cout << " | " << summary.hitches << " hitches";
+    std::cout << std::defaultfloat << std::endl;
+}
+
+}
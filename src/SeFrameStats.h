@@ -0,0 +1,127 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace SE {
+
+// Rolling frame time statistics, all times in milliseconds.
+//
+// Every frame lands in a fixed size ring and in two histograms, one covering the current
+// report window and one the whole run. Percentiles come from the histograms, so they cost
+// the same no matter how many frames were recorded.
+class SeFrameStats
+{
+public:
+    struct Sample
+    {
+        uint64_t frameNumber = 0;
+        double frameTime = 0.0;   // beginFrame to beginFrame
+        double cpuTime = 0.0;     // frameTime minus the time spent waiting for the GPU and the display
+        double waitTime = 0.0;
+        double gpuTime = -1.0;    // arrives framesInFlight frames later, -1 until then
+        bool bHitch = false;
+    };
+
+    struct Summary
+    {
+        uint64_t frames = 0;
+        double duration = 0.0;    // seconds
+        double avgFrameTime = 0.0;
+        double p50 = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+        double avgFps = 0.0;
+        double onePercentLowFps = 0.0;   // average FPS over the slowest 1% of frames
+        uint64_t hitches = 0;
+        double avgCpuTime = 0.0;
+        double p95CpuTime = 0.0;
+        double avgWaitTime = 0.0;
+        double avgGpuTime = 0.0;         // -1 without GPU timings
+        double p95GpuTime = 0.0;
+    };
+
+    // Log scale buckets, 1% apart from 0.01 ms to ~100 ms, plus one for everything slower
+    class Histogram
+    {
+    public:
+        void add(double ms);
+        void reset();
+        uint64_t count() const { return total; }
+        double mean() const { return total ? sum / total : 0.0; }
+        double maximum() const { return max; }
+        // p in [0, 1], returns the bucket's representative value
+        double percentile(double p) const;
+        // Mean of the slowest fraction of samples
+        double tailMean(double fraction) const;
+
+    private:
+        static constexpr uint32_t BUCKET_COUNT = 928;
+        static uint32_t bucketFor(double ms);
+        double bucketValue(uint32_t bucket) const;
+
+        std::array<uint32_t, BUCKET_COUNT + 1> buckets{};
+        uint64_t total = 0;
+        double sum = 0.0;
+        double max = 0.0;
+    };
+
+    static constexpr uint32_t RING_SIZE = 4096;
+
+    SeFrameStats();
+
+    // Forgets every frame recorded so far, settings and the dump file are kept
+    void reset();
+    void addFrame(uint64_t frameNumber, double frameTime, double waitTime);
+    // GPU times are only known once the frame retired
+    void addGpuTime(uint64_t frameNumber, double gpuTime);
+
+    // Closes the current report window, returns its summary and appends it to the dump file if one is set
+    Summary endWindow(double duration);
+    bool isWindowElapsed(double elapsed) const { return elapsed >= reportInterval; }
+
+    const Summary& getWindowSummary() const { return windowSummary; }   // last closed window
+    Summary getTotalSummary() const;
+    // Up to RING_SIZE most recent frames, oldest first
+    std::vector<Sample> getSamples() const;
+    // Frame numbers of the most recent hitches, oldest first
+    const std::vector<uint64_t>& getHitches() const { return hitchFrames; }
+    double getHitchThreshold() const;
+
+    // Writes the ring as one row per frame
+    bool writeSamplesCsv(const std::string& path) const;
+    static void printSummary(const Summary& summary);
+
+private:
+    struct Histograms
+    {
+        Histogram frame;
+        Histogram cpu;
+        Histogram wait;
+        Histogram gpu;
+        uint64_t hitches = 0;
+
+        void reset();
+    };
+
+    static Summary summarize(const Histograms& histograms, double duration);
+    void dumpWindow(const Summary& summary);
+
+    std::array<Sample, RING_SIZE> ring{};
+    uint64_t sampleCount = 0;
+
+    Histograms window;
+    Histograms total;
+    Summary windowSummary{};
+    std::vector<Summary> dumpedWindows;
+
+    std::vector<uint64_t> hitchFrames;
+    double hitchThreshold = 0.0;   // 0 = twice the running median
+    double reportInterval = 1.0;
+    std::string dumpPath;
+    bool bDumpJson = false;
+};
+
+}
@@ -0,0 +1,253 @@
+﻿#include "SeGpuProfiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#include "Config.h"
+#include "SeDevice.h"
+#include "SeSwapChain.h"
+#include "vulkancontext.h"
+
+namespace SE {
+
+SeGpuProfiler::Scope::Scope(SeGpuProfiler* inprofiler, VkCommandBuffer commandBuffer, const char* name, bool bStatistics)
+{
+    profiler = inprofiler;
+    command_buffer = commandBuffer;
+    if (profiler) profiler->beginScope(command_buffer, name, bStatistics);
+}
+
+SeGpuProfiler::Scope::~Scope()
+{
+    if (profiler) profiler->endScope(command_buffer);
+}
+
+SeGpuProfiler::SeGpuProfiler(std::shared_ptr<VulkanContext> inctx)
+{
+    ctx = inctx;
+
+    QueueFamilyIndices indices = ctx->Se_device->findPhysicalQueueFamilies();
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx->Se_device->physical_device, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx->Se_device->physical_device, &queueFamilyCount, queueFamilies.data());
+
+    uint32_t validBits = queueFamilies[indices.graphicsFamily].timestampValidBits;
+    bTimestampsSupported = validBits > 0 && ctx->Se_device->properties.limits.timestampComputeAndGraphics;
+    if (!bTimestampsSupported)
+    {
+        std::cout << "GPU timestamps unsupported, GPU profiler disabled" << std::endl;
+        return;
+    }
+    timestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+    timestampPeriod = ctx->Se_device->properties.limits.timestampPeriod;
+
+    const int frameCount = SeSwapChain::MAX_FRAMES_IN_FLIGHT;
+    frames.resize(frameCount);
+    timestamp_pools.resize(frameCount);
+
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = MAX_SCOPES * 2;
+    for (int i = 0; i < frameCount; i++)
+    {
+        if (vkCreateQueryPool(ctx->Se_device->device, &queryPoolInfo, nullptr, &timestamp_pools[i]) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create timestamp query pool!");
+        }
+    }
+
+    if (Config::get().pipeline_statistics())
+    {
+        if (!ctx->Se_device->supported_features.pipelineStatisticsQuery)
+        {
+            std::cout << "Pipeline statistics queries unsupported, profiling timestamps only" << std::endl;
+            return;
+        }
+
+        // Results come back in bit order, which matches the Statistic enum
+        VkQueryPoolCreateInfo statisticsPoolInfo = {};
+        statisticsPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        statisticsPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        statisticsPoolInfo.queryCount = MAX_SCOPES;
+        statisticsPoolInfo.pipelineStatistics =
+            VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+        statistics_pools.resize(frameCount);
+        for (int i = 0; i < frameCount; i++)
+        {
+            if (vkCreateQueryPool(ctx->Se_device->device, &statisticsPoolInfo, nullptr, &statistics_pools[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create pipeline statistics query pool!");
+            }
+        }
+    }
+}
+
+SeGpuProfiler::~SeGpuProfiler()
+{
+    for (auto pool : timestamp_pools)
+    {
+        vkDestroyQueryPool(ctx->Se_device->device, pool, nullptr);
+    }
+    for (auto pool : statistics_pools)
+    {
+        vkDestroyQueryPool(ctx->Se_device->device, pool, nullptr);
+    }
+}
+
+void SeGpuProfiler::beginFrame(VkCommandBuffer commandBuffer, int frameIndex, uint64_t frameNumber)
+{
+    if (!bTimestampsSupported) return;
+
+    resolveFrame(frameIndex);
+
+    currentFrame = frameIndex;
+    FrameQueries& frame = frames[frameIndex];
+    frame.scopes.clear();
+    frame.openScopes.clear();
+    frame.timestampCount = 0;
+    frame.statisticsCount = 0;
+    frame.activeStatistics = -1;
+    frame.frameNumber = frameNumber;
+
+    vkCmdResetQueryPool(commandBuffer, timestamp_pools[frameIndex], 0, MAX_SCOPES * 2);
+    if (hasStatistics()) vkCmdResetQueryPool(commandBuffer, statistics_pools[frameIndex], 0, MAX_SCOPES);
+}
+
+void SeGpuProfiler::beginScope(VkCommandBuffer commandBuffer, const char* name, bool bStatistics)
+{
+    if (!bTimestampsSupported) return;
+
+    FrameQueries& frame = frames[currentFrame];
+    if (frame.timestampCount + 2 > MAX_SCOPES * 2)
+    {
+        // Out of queries, keep the nesting balanced but don't record anything
+        frame.openScopes.push_back(UINT32_MAX);
+        return;
+    }
+
+    ScopeRecord record{};
+    record.name = name;
+    record.depth = static_cast<uint32_t>(frame.openScopes.size());
+    record.beginQuery = frame.timestampCount++;
+    record.endQuery = frame.timestampCount++;
+    record.statisticsQuery = -1;
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_pools[currentFrame], record.beginQuery);
+    if (bStatistics && hasStatistics() && frame.activeStatistics < 0)
+    {
+        record.statisticsQuery = static_cast<int>(frame.statisticsCount++);
+        frame.activeStatistics = static_cast<int>(frame.scopes.size());
+        vkCmdBeginQuery(commandBuffer, statistics_pools[currentFrame], record.statisticsQuery, 0);
+    }
+
+    frame.openScopes.push_back(static_cast<uint32_t>(frame.scopes.size()));
+    frame.scopes.push_back(record);
+}
+
+void SeGpuProfiler::endScope(VkCommandBuffer commandBuffer)
+{
+    if (!bTimestampsSupported) return;
+
+    FrameQueries& frame = frames[currentFrame];
+    assert(!frame.openScopes.empty() && "endScope() without a matching beginScope()");
+    uint32_t scopeIndex = frame.openScopes.back();
+    frame.openScopes.pop_back();
+    if (scopeIndex == UINT32_MAX) return;
+
+    const ScopeRecord& record = frame.scopes[scopeIndex];
+    if (record.statisticsQuery >= 0)
+    {
+        vkCmdEndQuery(commandBuffer, statistics_pools[currentFrame], record.statisticsQuery);
+        frame.activeStatistics = -1;
+    }
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_pools[currentFrame], record.endQuery);
+}
+
+void SeGpuProfiler::resolveFrame(int frameIndex)
+{
+    FrameQueries& frame = frames[frameIndex];
+    if (frame.frameNumber == 0 || frame.scopes.empty()) return;
+    assert(frame.openScopes.empty() && "GPU profiler scope left open at the end of the frame");
+
+    // No WAIT flag, the slot already retired. NOT_READY only happens if a frame was abandoned
+    std::vector<uint64_t> timestamps(frame.timestampCount);
+    VkResult result = vkGetQueryPoolResults(
+        ctx->Se_device->device, timestamp_pools[frameIndex], 0, frame.timestampCount,
+        timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) return;
+
+    std::vector<uint64_t> statistics(static_cast<size_t>(frame.statisticsCount) * STATISTIC_COUNT);
+    if (frame.statisticsCount > 0)
+    {
+        result = vkGetQueryPoolResults(
+            ctx->Se_device->device, statistics_pools[frameIndex], 0, frame.statisticsCount,
+            statistics.size() * sizeof(uint64_t), statistics.data(), STATISTIC_COUNT * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (result != VK_SUCCESS) statistics.assign(statistics.size(), 0);
+    }
+
+    if (frame.frameNumber < resultFrame) return;
+    resultFrame = frame.frameNumber;
+    results.resize(frame.scopes.size());
+    uint64_t frameEnd = 0;
+    for (size_t i = 0; i < frame.scopes.size(); i++)
+    {
+        const ScopeRecord& record = frame.scopes[i];
+        uint64_t begin = timestamps[record.beginQuery] & timestampMask;
+        uint64_t end = timestamps[record.endQuery] & timestampMask;
+        frameEnd = std::max(frameEnd, end);
+
+        ScopeResult& scope = results[i];
+        scope.name = record.name;
+        scope.depth = record.depth;
+        scope.gpuTime = end > begin ? static_cast<double>(end - begin) * timestampPeriod * 1e-6 : 0.0;
+        scope.bHasStatistics = record.statisticsQuery >= 0;
+        for (uint32_t s = 0; s < STATISTIC_COUNT; s++)
+        {
+            scope.statistics[s] = scope.bHasStatistics ? statistics[record.statisticsQuery * STATISTIC_COUNT + s] : 0;
+        }
+    }
+
+    if (firstTimestamp == 0) firstTimestamp = timestamps[frame.scopes[0].beginQuery] & timestampMask;
+    frameEndTime = static_cast<double>(frameEnd - firstTimestamp) * timestampPeriod * 1e-6;
+}
+
+double SeGpuProfiler::getFrameTime() const
+{
+    for (const auto& scope : results)
+    {
+        if (scope.depth == 0) return scope.gpuTime;
+    }
+    return -1.0;
+}
+
+void SeGpuProfiler::printResults() const
+{
+    if (results.empty()) return;
+
+    std::cout << "GPU profile (frame " << resultFrame << "):" << std::endl;
+    for (const auto& scope : results)
+    {
+        std::cout << "\t" << std::string(scope.depth * 2, ' ') << std::left << std::setw(24) << scope.name
+                  << std::right << std::fixed << std::setprecision(3) << scope.gpuTime << " ms";
+        if (scope.bHasStatistics)
+        {
+            std::cout << "  vs " << scope.statistics[VERTEX_INVOCATIONS]
+                      << "  clip " << scope.statistics[CLIPPING_INVOCATIONS] << "/" << scope.statistics[CLIPPING_PRIMITIVES]
+                      << "  fs " << scope.statistics[FRAGMENT_INVOCATIONS]
+                      << "  cs " << scope.statistics[COMPUTE_INVOCATIONS];
+        }
+        std::cout << std::defaultfloat << std::endl;
+    }
+}
+
+}
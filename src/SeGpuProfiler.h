@@ -0,0 +1,120 @@
+﻿#pragma once
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace SE {
+struct VulkanContext;
+
+// GPU timings per named scope, optionally with pipeline statistics.
+//
+// Every frame in flight owns its own query pools. Results of a frame are read when its slot
+// comes around again, after the frame timeline wait in acquireNextImage, so reading never
+// stalls and the numbers lag framesInFlight frames behind.
+class SeGpuProfiler
+{
+public:
+    enum Statistic : uint32_t
+    {
+        VERTEX_INVOCATIONS = 0,
+        CLIPPING_INVOCATIONS,
+        CLIPPING_PRIMITIVES,
+        FRAGMENT_INVOCATIONS,
+        COMPUTE_INVOCATIONS,
+        STATISTIC_COUNT
+    };
+
+    struct ScopeResult
+    {
+        std::string name;
+        uint32_t depth = 0;
+        double gpuTime = 0.0;   // ms
+        bool bHasStatistics = false;
+        std::array<uint64_t, STATISTIC_COUNT> statistics{};
+    };
+
+    // Opens a scope on construction and closes it when it goes out of scope
+    class Scope
+    {
+    public:
+        Scope(SeGpuProfiler* inprofiler, VkCommandBuffer commandBuffer, const char* name, bool bStatistics = true);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        SeGpuProfiler* profiler;
+        VkCommandBuffer command_buffer;
+    };
+
+    SeGpuProfiler(std::shared_ptr<VulkanContext> inctx);
+    ~SeGpuProfiler();
+
+    SeGpuProfiler(const SeGpuProfiler&) = delete;
+    void operator=(const SeGpuProfiler&) = delete;
+
+    // Reads back the slot's previous frame and resets its pools, call right after beginning the command buffer
+    void beginFrame(VkCommandBuffer commandBuffer, int frameIndex, uint64_t frameNumber);
+
+    // Prefer Scope, these are for scopes that open and close in different functions.
+    // Pipeline statistics queries cannot nest, only the outermost scope asking for them gets them
+    void beginScope(VkCommandBuffer commandBuffer, const char* name, bool bStatistics = true);
+    void endScope(VkCommandBuffer commandBuffer);
+
+    bool isEnabled() const { return bTimestampsSupported; }
+    bool hasStatistics() const { return !statistics_pools.empty(); }
+
+    // Newest frame with complete results, scopes in the order they were opened
+    uint64_t getResultFrame() const { return resultFrame; }
+    const std::vector<ScopeResult>& getResults() const { return results; }
+    // Duration of the first top level scope (the whole frame when the renderer opened one), -1 when unknown
+    double getFrameTime() const;
+    // GPU clock at the end of the newest resolved frame, relative to the first frame ever resolved
+    double getFrameEndTime() const { return frameEndTime; }
+
+    void printResults() const;
+
+    static constexpr uint32_t MAX_SCOPES = 64;
+
+private:
+    struct ScopeRecord
+    {
+        const char* name;
+        uint32_t depth;
+        uint32_t beginQuery;
+        uint32_t endQuery;
+        int statisticsQuery;   // -1 = none
+    };
+
+    struct FrameQueries
+    {
+        std::vector<ScopeRecord> scopes;
+        std::vector<uint32_t> openScopes;
+        uint32_t timestampCount = 0;
+        uint32_t statisticsCount = 0;
+        int activeStatistics = -1;
+        uint64_t frameNumber = 0;   // 0 = nothing recorded yet
+    };
+
+    void resolveFrame(int frameIndex);
+
+    std::shared_ptr<VulkanContext> ctx;
+    bool bTimestampsSupported = false;
+    uint64_t timestampMask = ~0ull;
+    double timestampPeriod = 1.0;   // ns per tick
+
+    std::vector<VkQueryPool> timestamp_pools;
+    std::vector<VkQueryPool> statistics_pools;
+    std::vector<FrameQueries> frames;
+    int currentFrame = 0;
+
+    std::vector<ScopeResult> results;
+    uint64_t resultFrame = 0;
+    uint64_t firstTimestamp = 0;
+    double frameEndTime = 0.0;
+};
+
+}
@@ -0,0 +1,56 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace SE {
+
+constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+
+// FNV-1a, stable across runs and platforms, so hashes may be written to disk.
+// Chain calls by passing the previous result as seed
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = FNV_OFFSET_BASIS)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t hashString(const std::string& str, uint64_t seed = FNV_OFFSET_BASIS)
+{
+    return hashBytes(str.data(), str.size(), seed);
+}
+
+// Appends values bytewise to a key for exact comparison and hashing
+struct SeKeyWriter
+{
+    std::vector<char>& out;
+
+    template <class T>
+    void write(const T& value)
+    {
+        // Only padding free types, uninitialized padding bytes would make equal states differ
+        static_assert(std::is_trivially_copyable<T>::value, "key values are copied bytewise");
+        const char* bytes = reinterpret_cast<const char*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <class T>
+    void writeArray(const T* values, size_t count)
+    {
+        write(static_cast<uint64_t>(count));
+        for (size_t i = 0; i < count; i++)
+        {
+            write(values[i]);
+        }
+    }
+};
+
+}
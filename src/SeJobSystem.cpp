@@ -0,0 +1,366 @@
+﻿#include "SeJobSystem.h"
+
+#include <algorithm>
+#include <string>
+
+#include "SeProfiler.h"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace SE {
+
+namespace {
+// Set on worker threads only, the main thread is recognized by its id so it can own several systems
+thread_local const SeJobSystem* tlsSystem = nullptr;
+thread_local uint32_t tlsThreadIndex = ~0u;
+
+// Spins before a worker goes to sleep, waking a sleeping thread costs microseconds
+constexpr uint32_t IDLE_SPINS = 64;
+}
+
+SeWorkStealingDeque::SeWorkStealingDeque()
+{
+    for (auto& slot : buffer)
+    {
+        slot.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+bool SeWorkStealingDeque::push(SeJob* job)
+{
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if (b - t >= CAPACITY) return false;
+
+    buffer[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+SeJob* SeWorkStealingDeque::pop()
+{
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    if (t > b)
+    {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    SeJob* job = buffer[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+    if (t == b)
+    {
+        // Last job, race the thieves for it
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) job = nullptr;
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+SeJob* SeWorkStealingDeque::steal()
+{
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+
+    SeJob* job = buffer[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+    return job;
+}
+
+SeJobSystem::SeJobSystem(uint32_t workerCount, bool bPinThreads)
+{
+    if (workerCount == AUTO_WORKERS) workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+
+    for (uint32_t i = 0; i <= workerCount; i++)
+    {
+        threads.push_back(std::make_unique<ThreadState>());
+        threads.back()->stealSeed = i * 2654435761u + 1;
+    }
+    mainThread = std::this_thread::get_id();
+    if (bPinThreads) pinCurrentThread(0);
+    for (uint32_t i = 1; i <= workerCount; i++)
+    {
+        threads[i]->thread = std::thread(&SeJobSystem::workerMain, this, i, bPinThreads);
+    }
+}
+
+SeJobSystem::~SeJobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        bRunning.store(false);
+    }
+    sleepCondition.notify_all();
+    for (auto& state : threads)
+    {
+        if (state->thread.joinable()) state->thread.join();
+    }
+}
+
+uint32_t SeJobSystem::getThreadIndex() const
+{
+    if (tlsSystem == this) return tlsThreadIndex;
+    return std::this_thread::get_id() == mainThread ? 0 : ~0u;
+}
+
+uint32_t SeJobSystem::batchSize(uint32_t count, uint32_t minBatch) const
+{
+    // Four batches per thread leaves room to rebalance when some batches are slower
+    uint32_t batches = getThreadCount() * 4;
+    uint32_t batch = (count + batches - 1) / batches;
+    return std::max({batch, minBatch, 1u});
+}
+
+bool SeJobSystem::pinCurrentThread(uint32_t core)
+{
+    core %= std::max(1u, std::thread::hardware_concurrency());
+#if defined(_WIN32)
+    return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)core;
+    return false;
+#endif
+}
+
+SeJob* SeJobSystem::allocateJob()
+{
+    uint32_t threadIndex = getThreadIndex();
+    if (threadIndex == ~0u)
+    {
+        std::unique_lock<std::mutex> lock(sharedMutex);
+        for (;;)
+        {
+            SeJob& job = sharedJobs[nextSharedJob++ % JOBS_PER_THREAD];
+            bool bFree = false;
+            if (job.bInUse.compare_exchange_strong(bFree, true, std::memory_order_acquire)) return &job;
+            // The whole ring is in flight, give the workers a moment
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        }
+    }
+
+    ThreadState& state = *threads[threadIndex];
+    for (;;)
+    {
+        SeJob& job = state.jobs[state.nextJob++ % JOBS_PER_THREAD];
+        if (!job.bInUse.load(std::memory_order_acquire))
+        {
+            job.bInUse.store(true, std::memory_order_relaxed);
+            return &job;
+        }
+        // Slot still in flight after a full lap of the ring, help drain the queues
+        if (SeJob* other = findJob(threadIndex)) execute(other);
+    }
+}
+
+void SeJobSystem::submit(SeJob* job, SeJobCounter* dependency)
+{
+    if (dependency)
+    {
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        // finish() only decrements without the mutex while the bit is clear, so the bit has to go in
+        // atomically with the check. Once it is set the last finish() waits for this lock
+        uint32_t value = dependency->value.load(std::memory_order_acquire);
+        while ((value & ~SeJobCounter::HAS_DEPENDENTS) != 0)
+        {
+            if (dependency->value.compare_exchange_weak(value, value | SeJobCounter::HAS_DEPENDENTS, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                job->next = dependency->dependents;
+                dependency->dependents = job;
+                return;
+            }
+        }
+    }
+    schedule(job);
+}
+
+void SeJobSystem::schedule(SeJob* job)
+{
+    if (job->bMainThread)
+    {
+        std::lock_guard<std::mutex> lock(mainMutex);
+        job->next = nullptr;
+        if (mainTail) mainTail->next = job;
+        else mainHead = job;
+        mainTail = job;
+        return;
+    }
+
+    uint32_t threadIndex = getThreadIndex();
+    if (threadIndex == ~0u || !threads[threadIndex]->deque.push(job))
+    {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        job->next = nullptr;
+        if (sharedTail) sharedTail->next = job;
+        else sharedHead = job;
+        sharedTail = job;
+        sharedCount.fetch_add(1, std::memory_order_release);
+    }
+    wakeWorkers();
+}
+
+void SeJobSystem::wakeWorkers()
+{
+    workEpoch.fetch_add(1, std::memory_order_seq_cst);
+    if (sleepingWorkers.load(std::memory_order_seq_cst) > 0)
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        sleepCondition.notify_one();
+    }
+}
+
+void SeJobSystem::execute(SeJob* job)
+{
+    SeJobCounter* signal = job->signal;
+    job->invoke(*job);
+    job->bInUse.store(false, std::memory_order_release);
+    if (signal) finish(signal);
+}
+
+void SeJobSystem::finish(SeJobCounter* counter)
+{
+    // Without dependents the decrement is the last access, the waiter may free the counter right after
+    uint32_t value = counter->value.load(std::memory_order_relaxed);
+    while (!(value & SeJobCounter::HAS_DEPENDENTS))
+    {
+        if (counter->value.compare_exchange_weak(value, value - 1, std::memory_order_acq_rel, std::memory_order_relaxed)) return;
+    }
+
+    // wait() takes the same mutex before it returns, so the counter stays alive until we unlock
+    SeJob* dependents = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        value = counter->value.fetch_sub(1, std::memory_order_acq_rel) - 1;
+        if (value == SeJobCounter::HAS_DEPENDENTS)
+        {
+            dependents = counter->dependents;
+            counter->dependents = nullptr;
+            counter->value.fetch_and(~SeJobCounter::HAS_DEPENDENTS, std::memory_order_acq_rel);
+        }
+    }
+    while (dependents)
+    {
+        SeJob* job = dependents;
+        dependents = job->next;
+        schedule(job);
+    }
+}
+
+SeJob* SeJobSystem::findJob(uint32_t threadIndex)
+{
+    ThreadState& state = *threads[threadIndex];
+    if (SeJob* job = state.deque.pop()) return job;
+
+    if (sharedCount.load(std::memory_order_acquire) > 0)
+    {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        if (SeJob* job = sharedHead)
+        {
+            sharedHead = job->next;
+            if (!sharedHead) sharedTail = nullptr;
+            sharedCount.fetch_sub(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+
+    // Start at a random victim so thieves spread out instead of all hitting thread 0
+    const uint32_t count = getThreadCount();
+    state.stealSeed = state.stealSeed * 1664525u + 1013904223u;
+    uint32_t start = state.stealSeed % count;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t victim = (start + i) % count;
+        if (victim == threadIndex) continue;
+        if (SeJob* job = threads[victim]->deque.steal()) return job;
+    }
+    return nullptr;
+}
+
+void SeJobSystem::wait(SeJobCounter& counter)
+{
+    uint32_t threadIndex = getThreadIndex();
+    uint32_t idle = 0;
+    while (!counter.isDone())
+    {
+        if (threadIndex == 0) pumpMainThread();
+        SeJob* job = threadIndex == ~0u ? nullptr : findJob(threadIndex);
+        if (job)
+        {
+            execute(job);
+            idle = 0;
+        } else if (++idle > IDLE_SPINS)
+        {
+            std::this_thread::yield();
+        }
+    }
+    // A finishing job that started dependents may still hold the mutex
+    std::lock_guard<std::mutex> lock(counter.mutex);
+}
+
+void SeJobSystem::pumpMainThread()
+{
+    if (!isMainThread()) return;
+    SeJob* jobs = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mainMutex);
+        jobs = mainHead;
+        mainHead = mainTail = nullptr;
+    }
+    while (jobs)
+    {
+        SeJob* job = jobs;
+        jobs = job->next;
+        execute(job);
+    }
+    if (getThreadCount() > 1) return;
+    while (SeJob* job = findJob(0))
+    {
+        execute(job);
+    }
+}
+
+void SeJobSystem::workerMain(uint32_t threadIndex, bool bPin)
+{
+    tlsSystem = this;
+    tlsThreadIndex = threadIndex;
+    if (bPin) pinCurrentThread(threadIndex);
+    SE_PROFILE_THREAD(("Job worker " + std::to_string(threadIndex)).c_str());
+
+    uint32_t idle = 0;
+    while (bRunning.load(std::memory_order_relaxed))
+    {
+        uint64_t epoch = workEpoch.load(std::memory_order_seq_cst);
+        if (SeJob* job = findJob(threadIndex))
+        {
+            execute(job);
+            idle = 0;
+            continue;
+        }
+        if (++idle < IDLE_SPINS) continue;
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+        sleepCondition.wait(lock, [&]() { return !bRunning.load() || workEpoch.load(std::memory_order_seq_cst) != epoch; });
+        sleepingWorkers.fetch_sub(1, std::memory_order_relaxed);
+        idle = 0;
+    }
+}
+
+}
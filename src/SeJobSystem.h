@@ -0,0 +1,218 @@
+﻿#pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace SE {
+
+struct SeJob;
+
+// Outstanding jobs of a group. Every job that signals the counter adds one when it is
+// scheduled and removes it when it finishes. Jobs can also wait for a counter to reach zero
+// before they start. A counter that jobs signal must outlive SeJobSystem::wait() on it
+class SeJobCounter
+{
+public:
+    SeJobCounter() = default;
+    SeJobCounter(const SeJobCounter&) = delete;
+    SeJobCounter& operator=(const SeJobCounter&) = delete;
+
+    bool isDone() const { return value.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class SeJobSystem;
+
+    // Set while dependents are queued, finishing jobs then take the mutex to start them
+    static constexpr uint32_t HAS_DEPENDENTS = 1u << 31;
+
+    std::atomic<uint32_t> value{0};
+    std::mutex mutex;
+    SeJob* dependents = nullptr;  // started once value reaches zero
+};
+
+// Fixed size job slot. The callable is stored inline, so scheduling never allocates
+struct alignas(64) SeJob
+{
+    static constexpr size_t STORAGE_SIZE = 96;
+
+    void (*invoke)(SeJob& job) = nullptr;  // runs and destroys the stored callable
+    SeJobCounter* signal = nullptr;
+    SeJob* next = nullptr;                 // dependents and main thread list
+    std::atomic<bool> bInUse{false};
+    bool bMainThread = false;
+    alignas(16) unsigned char storage[STORAGE_SIZE];
+};
+
+// Chase-Lev work stealing deque with a fixed capacity. The owner pushes and pops at the
+// bottom, other threads steal from the top
+class SeWorkStealingDeque
+{
+public:
+    static constexpr int64_t CAPACITY = 4096;
+
+    SeWorkStealingDeque();
+
+    // Owner only, false when the deque is full
+    bool push(SeJob* job);
+    // Owner only
+    SeJob* pop();
+    // Any thread
+    SeJob* steal();
+
+private:
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    alignas(64) std::array<std::atomic<SeJob*>, CAPACITY> buffer;
+};
+
+// Work stealing job system.
+//
+// One worker thread per core besides the thread that created the system, which takes part
+// as thread 0 whenever it waits. Every thread owns a deque and a ring of job slots, jobs
+// spawned by a job land in the spawning thread's deque and idle threads steal from the others.
+// Once the rings are warm nothing is allocated per job.
+//
+// Jobs marked for the main thread (GLFW and other thread affine calls) only run inside
+// wait() or pumpMainThread() on the creating thread.
+class SeJobSystem
+{
+public:
+    static constexpr uint32_t AUTO_WORKERS = ~0u;
+
+    // One worker per core minus the main thread by default, 0 runs every job on the main thread
+    explicit SeJobSystem(uint32_t workerCount = AUTO_WORKERS, bool bPinThreads = false);
+    ~SeJobSystem();
+
+    SeJobSystem(const SeJobSystem&) = delete;
+    SeJobSystem& operator=(const SeJobSystem&) = delete;
+
+    // signal is incremented now and decremented when fn finished. With a dependency the job
+    // only starts once that counter reached zero
+    template <class Fn>
+    void run(Fn&& fn, SeJobCounter* signal = nullptr, SeJobCounter* dependency = nullptr)
+    {
+        submit(makeJob(std::forward<Fn>(fn), signal, false), dependency);
+    }
+
+    template <class Fn>
+    void runOnMainThread(Fn&& fn, SeJobCounter* signal = nullptr, SeJobCounter* dependency = nullptr)
+    {
+        submit(makeJob(std::forward<Fn>(fn), signal, true), dependency);
+    }
+
+    // fn(uint32_t begin, uint32_t end) over [0, count) in batches of at least minBatch,
+    // sized so every thread gets a few to balance. Returns when all batches are done
+    template <class Fn>
+    void parallelFor(uint32_t count, uint32_t minBatch, Fn&& fn)
+    {
+        if (count == 0) return;
+        const uint32_t batch = batchSize(count, minBatch);
+        if (batch >= count)
+        {
+            fn(0u, count);
+            return;
+        }
+        SeJobCounter counter;
+        const auto* body = &fn;
+        for (uint32_t begin = batch; begin < count; begin += batch)
+        {
+            uint32_t end = begin + batch < count ? begin + batch : count;
+            run([body, begin, end]() { (*body)(begin, end); }, &counter);
+        }
+        // The calling thread takes the first batch itself instead of going idle right away
+        fn(0u, batch);
+        wait(counter);
+    }
+
+    // Runs other jobs until the counter reaches zero
+    void wait(SeJobCounter& counter);
+    // Runs the queued main thread jobs, call once per frame from the main thread. Without workers
+    // it runs every other queued job as well, nothing else would pick up fire and forget work
+    void pumpMainThread();
+
+    // Workers plus the main thread
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(threads.size()); }
+    // 0 on the main thread, 1.. on workers, ~0u on threads that do not belong to this system
+    uint32_t getThreadIndex() const;
+    bool isMainThread() const { return getThreadIndex() == 0; }
+    uint32_t batchSize(uint32_t count, uint32_t minBatch) const;
+
+    // Pins the calling thread to one core, false if the OS refused
+    static bool pinCurrentThread(uint32_t core);
+
+private:
+    static constexpr uint32_t JOBS_PER_THREAD = 4096;
+
+    struct alignas(64) ThreadState
+    {
+        SeWorkStealingDeque deque;
+        std::array<SeJob, JOBS_PER_THREAD> jobs;
+        uint32_t nextJob = 0;
+        uint32_t stealSeed = 0;
+        std::thread thread;
+    };
+
+    template <class Fn>
+    SeJob* makeJob(Fn&& fn, SeJobCounter* signal, bool bMainThread)
+    {
+        using Callable = std::decay_t<Fn>;
+        static_assert(sizeof(Callable) <= SeJob::STORAGE_SIZE, "job captures too much, capture a pointer instead");
+        static_assert(alignof(Callable) <= 16, "job callable is over aligned");
+
+        SeJob* job = allocateJob();
+        new (job->storage) Callable(std::forward<Fn>(fn));
+        job->invoke = [](SeJob& self) {
+            Callable* callable = std::launder(reinterpret_cast<Callable*>(self.storage));
+            (*callable)();
+            callable->~Callable();
+        };
+        job->signal = signal;
+        job->next = nullptr;
+        job->bMainThread = bMainThread;
+        if (signal) signal->value.fetch_add(1, std::memory_order_relaxed);
+        return job;
+    }
+
+    SeJob* allocateJob();
+    void submit(SeJob* job, SeJobCounter* dependency);
+    void schedule(SeJob* job);
+    void execute(SeJob* job);
+    void finish(SeJobCounter* counter);
+    // One job from this thread's deque, the shared queues or another thread's deque
+    SeJob* findJob(uint32_t threadIndex);
+    void workerMain(uint32_t threadIndex, bool bPin);
+    void wakeWorkers();
+
+    std::vector<std::unique_ptr<ThreadState>> threads;
+    std::thread::id mainThread;
+    std::atomic<bool> bRunning{true};
+
+    // Jobs submitted from threads outside the system and deques that overflowed
+    std::mutex sharedMutex;
+    SeJob* sharedHead = nullptr;
+    SeJob* sharedTail = nullptr;
+    std::atomic<uint32_t> sharedCount{0};
+    std::array<SeJob, JOBS_PER_THREAD> sharedJobs;
+    uint32_t nextSharedJob = 0;
+
+    std::mutex mainMutex;
+    SeJob* mainHead = nullptr;
+    SeJob* mainTail = nullptr;
+
+    // Idle workers sleep until the epoch moves
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::atomic<uint64_t> workEpoch{0};
+    std::atomic<uint32_t> sleepingWorkers{0};
+};
+
+}
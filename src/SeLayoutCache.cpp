@@ -0,0 +1,221 @@
+﻿#include "SeLayoutCache.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+
+#include "SeDevice.h"
+#include "SeHash.h"
+#include "SeShaderCache.h"
+#include "SeShaderReflection.h"
+#include "vulkancontext.h"
+
+namespace SE {
+
+SeLayoutCache::SeLayoutCache(std::shared_ptr<VulkanContext> inctx)
+{
+    ctx = inctx;
+}
+
+SeLayoutCache::~SeLayoutCache()
+{
+    for (auto& [layout, info] : pipelineLayouts)
+    {
+        vkDestroyPipelineLayout(ctx->Se_device->device, layout, nullptr);
+    }
+    for (auto& [layout, bindings] : setLayouts)
+    {
+        vkDestroyDescriptorSetLayout(ctx->Se_device->device, layout, nullptr);
+    }
+}
+
+VkDescriptorSetLayout SeLayoutCache::getDescriptorSetLayout(std::vector<VkDescriptorSetLayoutBinding> bindings)
+{
+    std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+        return a.binding < b.binding;
+    });
+    std::vector<char> key;
+    SeKeyWriter writer{key};
+    for (const VkDescriptorSetLayoutBinding& binding : bindings)
+    {
+        // Immutable samplers are not supported, they would have to enter by handle
+        if (binding.pImmutableSamplers) throw std::runtime_error("Descriptor set layouts with immutable samplers are not cached");
+        writer.write(binding.binding);
+        writer.write(binding.descriptorType);
+        writer.write(binding.descriptorCount);
+        writer.write(binding.stageFlags);
+    }
+    const uint64_t hash = hashBytes(key.data(), key.size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& bucket = setLayoutsByKey[hash];
+    for (auto& [existingKey, layout] : bucket)
+    {
+        if (existingKey == key) return layout;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+    VkDescriptorSetLayout layout;
+    if (vkCreateDescriptorSetLayout(ctx->Se_device->device, &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create descriptor set layout!");
+    }
+    bucket.emplace_back(std::move(key), layout);
+    setLayouts.emplace(layout, std::move(bindings));
+    return layout;
+}
+
+VkPipelineLayout SeLayoutCache::getPipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayoutHandles, const std::vector<VkPushConstantRange>& pushConstantRanges)
+{
+    std::vector<char> key;
+    SeKeyWriter writer{key};
+    writer.writeArray(setLayoutHandles.data(), setLayoutHandles.size());
+    for (const VkPushConstantRange& range : pushConstantRanges)
+    {
+        writer.write(range.stageFlags);
+        writer.write(range.offset);
+        writer.write(range.size);
+    }
+    const uint64_t hash = hashBytes(key.data(), key.size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& bucket = pipelineLayoutsByKey[hash];
+    for (auto& [existingKey, layout] : bucket)
+    {
+        if (existingKey == key) return layout;
+    }
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayoutHandles.size());
+    pipelineLayoutInfo.pSetLayouts = setLayoutHandles.data();
+    pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+    pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges.data();
+    VkPipelineLayout layout;
+    if (vkCreatePipelineLayout(ctx->Se_device->device, &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+    bucket.emplace_back(std::move(key), layout);
+    pipelineLayouts.emplace(layout, PipelineLayoutInfo{setLayoutHandles, pushConstantRanges});
+    return layout;
+}
+
+VkPipelineLayout SeLayoutCache::getPipelineLayout(const std::vector<const SeShaderModule*>& stages, uint32_t pushConstantSize)
+{
+    VkShaderStageFlags allStages = 0;
+    VkShaderStageFlags pushStages = 0;
+    uint32_t reflectedPushSize = 0;
+    // set -> binding -> merged description
+    std::map<uint32_t, std::map<uint32_t, VkDescriptorSetLayoutBinding>> sets;
+    for (const SeShaderModule* stage : stages)
+    {
+        const SeShaderReflection& reflection = stage->reflection;
+        allStages |= reflection.stage;
+        if (reflection.pushConstantSize > 0)
+        {
+            pushStages |= reflection.stage;
+            reflectedPushSize = std::max(reflectedPushSize, reflection.pushConstantSize);
+        }
+        if (pushConstantSize > 0 && reflection.pushConstantSize > pushConstantSize)
+        {
+            throw std::runtime_error("Shader reads " + std::to_string(reflection.pushConstantSize) + " bytes of push constants, only " +
+                                     std::to_string(pushConstantSize) + " are pushed");
+        }
+
+        for (const SeShaderReflection::Binding& binding : reflection.bindings)
+        {
+            auto [it, bInserted] = sets[binding.set].try_emplace(binding.binding);
+            VkDescriptorSetLayoutBinding& merged = it->second;
+            if (bInserted)
+            {
+                merged.binding = binding.binding;
+                merged.descriptorType = binding.type;
+                merged.descriptorCount = binding.count;
+                merged.stageFlags = 0;
+                merged.pImmutableSamplers = nullptr;
+            } else if (merged.descriptorType != binding.type || merged.descriptorCount != binding.count)
+            {
+                throw std::runtime_error("Stages disagree about set " + std::to_string(binding.set) + " binding " + std::to_string(binding.binding));
+            }
+            merged.stageFlags |= reflection.stage;
+        }
+    }
+
+    // Sets are indexed by number, unused ones in between get an empty layout
+    std::vector<VkDescriptorSetLayout> setLayoutHandles;
+    const uint32_t setCount = sets.empty() ? 0 : sets.rbegin()->first + 1;
+    for (uint32_t set = 0; set < setCount; set++)
+    {
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+        for (auto& [number, binding] : sets[set])
+        {
+            // Runtime sized arrays need descriptor indexing, a single descriptor is what the engine binds
+            if (binding.descriptorCount == 0) binding.descriptorCount = 1;
+            bindings.push_back(binding);
+        }
+        setLayoutHandles.push_back(getDescriptorSetLayout(std::move(bindings)));
+    }
+
+    std::vector<VkPushConstantRange> pushConstantRanges;
+    if (pushConstantSize > 0) pushConstantRanges.push_back({allStages, 0, pushConstantSize});
+    else if (reflectedPushSize > 0) pushConstantRanges.push_back({pushStages, 0, reflectedPushSize});
+    return getPipelineLayout(setLayoutHandles, pushConstantRanges);
+}
+
+VkDescriptorSetLayout SeLayoutCache::getSetLayout(VkPipelineLayout layout, uint32_t set) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = pipelineLayouts.find(layout);
+    if (it == pipelineLayouts.end() || set >= it->second.setLayouts.size()) return VK_NULL_HANDLE;
+    return it->second.setLayouts[set];
+}
+
+void SeLayoutCache::validate(VkPipelineLayout layout, const SeShaderReflection& stage, const std::string& name) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = pipelineLayouts.find(layout);
+    if (it == pipelineLayouts.end()) return;
+    const PipelineLayoutInfo& info = it->second;
+
+    if (stage.pushConstantSize > 0)
+    {
+        bool bCovered = std::any_of(info.pushConstantRanges.begin(), info.pushConstantRanges.end(), [&](const VkPushConstantRange& range) {
+            return (range.stageFlags & stage.stage) && range.offset == 0 && range.size >= stage.pushConstantSize;
+        });
+        if (!bCovered)
+        {
+            throw std::runtime_error(name + " reads " + std::to_string(stage.pushConstantSize) + " bytes of push constants the pipeline layout does not provide");
+        }
+    }
+
+    for (const SeShaderReflection::Binding& binding : stage.bindings)
+    {
+        const std::string where = name + " set " + std::to_string(binding.set) + " binding " + std::to_string(binding.binding);
+        if (binding.set >= info.setLayouts.size()) throw std::runtime_error(where + " is missing from the pipeline layout");
+        const std::vector<VkDescriptorSetLayoutBinding>& bindings = setLayouts.at(info.setLayouts[binding.set]);
+        auto match = std::find_if(bindings.begin(), bindings.end(), [&](const VkDescriptorSetLayoutBinding& other) { return other.binding == binding.binding; });
+        if (match == bindings.end()) throw std::runtime_error(where + " is missing from the pipeline layout");
+        if (match->descriptorType != binding.type) throw std::runtime_error(where + " has a different descriptor type in the pipeline layout");
+        if (match->descriptorCount < binding.count) throw std::runtime_error(where + " needs " + std::to_string(binding.count) + " descriptors");
+        if (!(match->stageFlags & stage.stage)) throw std::runtime_error(where + " is not visible to its stage in the pipeline layout");
+    }
+}
+
+size_t SeLayoutCache::getDescriptorSetLayoutCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return setLayouts.size();
+}
+
+size_t SeLayoutCache::getPipelineLayoutCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pipelineLayouts.size();
+}
+
+}
@@ -0,0 +1,64 @@
+﻿#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace SE {
+struct VulkanContext;
+struct SeShaderModule;
+struct SeShaderReflection;
+
+// Descriptor set and pipeline layouts, deduplicated by content.
+//
+// Layouts built from shader reflection cover every resource the stages declare, a binding seen
+// by several stages gets all of their stage flags. Equal layouts come back as the same handle,
+// which also keeps pipeline state keys (layouts enter by handle) equal. Layouts live until the
+// cache is destroyed. Thread safe.
+class SeLayoutCache
+{
+public:
+    SeLayoutCache(std::shared_ptr<VulkanContext> inctx);
+    ~SeLayoutCache();
+
+    SeLayoutCache(const SeLayoutCache&) = delete;
+    void operator=(const SeLayoutCache&) = delete;
+
+    VkDescriptorSetLayout getDescriptorSetLayout(std::vector<VkDescriptorSetLayoutBinding> bindings);
+    VkPipelineLayout getPipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, const std::vector<VkPushConstantRange>& pushConstantRanges);
+
+    // Layout for the resources of all stages. With pushConstantSize the layout gets a single range
+    // of that size for all stages, matching what the CPU pushes, and a stage reading past it throws.
+    // Stages declaring the same binding differently throw as well
+    VkPipelineLayout getPipelineLayout(const std::vector<const SeShaderModule*>& stages, uint32_t pushConstantSize = 0);
+    // Set layout of a pipeline layout from this cache, for allocating its descriptor sets
+    VkDescriptorSetLayout getSetLayout(VkPipelineLayout layout, uint32_t set) const;
+
+    // Throws when a layout from this cache lacks a binding or push constant bytes the stage reads.
+    // Layouts created elsewhere are not checked
+    void validate(VkPipelineLayout layout, const SeShaderReflection& stage, const std::string& name) const;
+
+    size_t getDescriptorSetLayoutCount() const;
+    size_t getPipelineLayoutCount() const;
+
+private:
+    struct PipelineLayoutInfo
+    {
+        std::vector<VkDescriptorSetLayout> setLayouts;
+        std::vector<VkPushConstantRange> pushConstantRanges;
+    };
+
+    std::shared_ptr<VulkanContext> ctx;
+
+    mutable std::mutex mutex;
+    // By content hash, keys compared on equal hashes
+    std::unordered_map<uint64_t, std::vector<std::pair<std::vector<char>, VkDescriptorSetLayout>>> setLayoutsByKey;
+    std::unordered_map<uint64_t, std::vector<std::pair<std::vector<char>, VkPipelineLayout>>> pipelineLayoutsByKey;
+    std::unordered_map<VkDescriptorSetLayout, std::vector<VkDescriptorSetLayoutBinding>> setLayouts;
+    std::unordered_map<VkPipelineLayout, PipelineLayoutInfo> pipelineLayouts;
+};
+
+}
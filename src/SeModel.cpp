@@ -1,6 +1,12 @@
 ﻿#include "SeModel.h"
 
+#include <stdexcept>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <TinyObjectLoader/tiny_obj_loader.h>
+
 #include "SeDevice.h"
+#include "SeProfiler.h"
 #include "vulkancontext.h"
 
 namespace SE {
@@ -27,17 +33,78 @@ std::vector<VkVertexInputAttributeDescription> SeModel::Vertex::getAttributeDesc
     return attributeDescriptions;
 }
 
+std::vector<VkVertexInputBindingDescription> SeModel::Vertex::getPositionBindingDescriptions()
+{
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions(1);
+    bindingDescriptions[0].binding = 0;
+    bindingDescriptions[0].stride = sizeof(glm::vec3);
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    return bindingDescriptions;
+}
+
+std::vector<VkVertexInputAttributeDescription> SeModel::Vertex::getPositionAttributeDescriptions()
+{
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions(1);
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[0].offset = 0;
+    return attributeDescriptions;
+}
+
 SeModel::SeModel(std::shared_ptr<VulkanContext> inctx, std::vector<Vertex>& vertices)
 {
     ctx = inctx;
     createVertexBuffer(vertices);
-    
+    createPositionBuffer(vertices);
+    computeBounds(vertices);
+}
+
+std::vector<SeModel::Vertex> SeModel::loadVertices(const std::string& filepath)
+{
+    SE_PROFILE_FUNCTION();
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn, err;
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filepath.c_str()))
+    {
+        throw std::runtime_error("failed to load model " + filepath + ": " + warn + err);
+    }
+
+    std::vector<Vertex> vertices;
+    for (const auto& shape : shapes)
+    {
+        for (const auto& index : shape.mesh.indices)
+        {
+            Vertex vertex{};
+            vertex.position = {
+                attrib.vertices[3 * index.vertex_index + 0],
+                attrib.vertices[3 * index.vertex_index + 1],
+                attrib.vertices[3 * index.vertex_index + 2]};
+            // tinyobj fills in white when the file has no vertex colors
+            vertex.color = {
+                attrib.colors[3 * index.vertex_index + 0],
+                attrib.colors[3 * index.vertex_index + 1],
+                attrib.colors[3 * index.vertex_index + 2]};
+            vertices.push_back(vertex);
+        }
+    }
+    return vertices;
+}
+
+std::shared_ptr<SeModel> SeModel::createModelFromFile(std::shared_ptr<VulkanContext> inctx, const std::string& filepath)
+{
+    std::vector<Vertex> vertices = loadVertices(filepath);
+    return std::make_shared<SeModel>(inctx, vertices);
 }
 
 SeModel::~SeModel()
 {
     vkDestroyBuffer(ctx->Se_device->device, vertexBuffer, nullptr);
     vkFreeMemory(ctx->Se_device->device, vertexBufferMemory, nullptr);
+    vkDestroyBuffer(ctx->Se_device->device, positionBuffer, nullptr);
+    vkFreeMemory(ctx->Se_device->device, positionBufferMemory, nullptr);
 }
 
 void SeModel::bind(VkCommandBuffer commandBuffer)
@@ -47,11 +114,23 @@ void SeModel::bind(VkCommandBuffer commandBuffer)
     vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
 }
 
+void SeModel::bindPositions(VkCommandBuffer commandBuffer)
+{
+    VkBuffer buffers[] = { positionBuffer };
+    VkDeviceSize offsets[] = { 0 };
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+}
+
 void SeModel::draw(VkCommandBuffer commandBuffer)
 {
     vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
 }
 
+void SeModel::drawIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset)
+{
+    vkCmdDrawIndirect(commandBuffer, buffer, offset, 1, sizeof(VkDrawIndirectCommand));
+}
+
 void SeModel::createVertexBuffer(const std::vector<Vertex>& vertices)
 {
     vertexCount = static_cast<uint32_t>(vertices.size());
@@ -70,4 +149,44 @@ void SeModel::createVertexBuffer(const std::vector<Vertex>& vertices)
     vkUnmapMemory(ctx->Se_device->device, vertexBufferMemory);
     
 }
+
+void SeModel::createPositionBuffer(const std::vector<Vertex>& vertices)
+{
+    // Tightly packed positions so the depth prepass only fetches what it needs
+    std::vector<glm::vec3> positions(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        positions[i] = vertices[i].position;
+    }
+
+    VkDeviceSize positionBufferSize = sizeof(positions[0]) * positions.size();
+    ctx->Se_device->createBuffer(
+        positionBufferSize,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            positionBuffer,
+            positionBufferMemory
+        );
+    void *data;
+    vkMapMemory(ctx->Se_device->device, positionBufferMemory, 0, positionBufferSize, 0, &data);
+    memcpy(data, positions.data(), positionBufferSize);
+    vkUnmapMemory(ctx->Se_device->device, positionBufferMemory);
+}
+
+void SeModel::computeBounds(const std::vector<Vertex>& vertices)
+{
+    glm::vec3 minPos{vertices[0].position};
+    glm::vec3 maxPos{vertices[0].position};
+    for (auto& v : vertices)
+    {
+        minPos = glm::min(minPos, v.position);
+        maxPos = glm::max(maxPos, v.position);
+    }
+    boundsCenter = (minPos + maxPos) * 0.5f;
+    boundsRadius = 0.f;
+    for (auto& v : vertices)
+    {
+        boundsRadius = glm::max(boundsRadius, glm::length(v.position - boundsCenter));
+    }
+}
 }
@@ -6,6 +6,7 @@
 #include <GLM/glm.hpp>
 #include <GLM/gtc/constants.hpp>
 #include <memory>
+#include <string>
 #include <vector>
 
 
@@ -23,21 +24,41 @@ public:
 
         static std::vector<VkVertexInputBindingDescription> getBindingDescriptions();
         static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions();
+
+        // Position-only stream used by the depth prepass
+        static std::vector<VkVertexInputBindingDescription> getPositionBindingDescriptions();
+        static std::vector<VkVertexInputAttributeDescription> getPositionAttributeDescriptions();
     };
     
     SeModel(std::shared_ptr<VulkanContext> inctx, std::vector<Vertex>& vertices);
     ~SeModel();
+
+    // Triangulated, non indexed vertices of an .obj file, vertex colors default to white
+    static std::vector<Vertex> loadVertices(const std::string& filepath);
+    static std::shared_ptr<SeModel> createModelFromFile(std::shared_ptr<VulkanContext> inctx, const std::string& filepath);
+
     void bind(VkCommandBuffer commandBuffer);
+    void bindPositions(VkCommandBuffer commandBuffer);
     void draw(VkCommandBuffer commandBuffer);
+    void drawIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset);
 
-    
+    uint32_t getVertexCount() const { return vertexCount; }
+    // Model space bounding sphere
+    const glm::vec3& getBoundsCenter() const { return boundsCenter; }
+    float getBoundsRadius() const { return boundsRadius; }
 
     private:
     void createVertexBuffer(const std::vector<Vertex>& vertices);
+    void createPositionBuffer(const std::vector<Vertex>& vertices);
+    void computeBounds(const std::vector<Vertex>& vertices);
     std::shared_ptr<VulkanContext> ctx;
     VkBuffer vertexBuffer;
     VkDeviceMemory vertexBufferMemory;
+    VkBuffer positionBuffer;
+    VkDeviceMemory positionBufferMemory;
     uint32_t vertexCount;
+    glm::vec3 boundsCenter{0.f};
+    float boundsRadius = 0.f;
 };
 }
 
@@ -1,4 +0,0 @@
-﻿#include "SeObject.h"
-namespace SE {
-
-}
\ No newline at end of file
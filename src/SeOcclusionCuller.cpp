@@ -0,0 +1,566 @@
+﻿#include "SeOcclusionCuller.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "Config.h"
+#include "SeDevice.h"
+#include "SeComponents.h"
+#include "SeLayoutCache.h"
+#include "SePipeline.h"
+#include "SePipelineCache.h"
+#include "SeShaderCache.h"
+#include "SeSceneGraph.h"
+#include "SeWorld.h"
+#include "SeProfiler.h"
+#include "SeRenderSnapshot.h"
+#include "SeRenderer.h"
+#include "SeSwapChain.h"
+#include "vulkancontext.h"
+
+namespace SE {
+
+static uint32_t previousPowerOfTwo(uint32_t value)
+{
+    uint32_t result = 1;
+    while (result * 2 <= value) result *= 2;
+    return result;
+}
+
+SeOcclusionCuller::SeOcclusionCuller(std::shared_ptr<VulkanContext> inctx)
+{
+    ctx = inctx;
+    createDescriptorSetLayouts();
+    createComputePipelines();
+    createSampler();
+    createHiZResources();
+    createObjectBuffers(64);
+}
+
+SeOcclusionCuller::~SeOcclusionCuller()
+{
+    destroyHiZResources();
+    destroyObjectBuffers();
+    vkDestroyPipeline(ctx->Se_device->device, hiz_pipeline, nullptr);
+    vkDestroyPipeline(ctx->Se_device->device, cull_pipeline, nullptr);
+    vkDestroySampler(ctx->Se_device->device, sampler, nullptr);
+}
+
+void SeOcclusionCuller::createDescriptorSetLayouts()
+{
+    // Reflected from the shaders, the push constant ranges are sized to what dispatches push
+    const SeShaderModule& hiz = ctx->Se_shaders->getModule("hiz_downsample.comp");
+    hiz_pipeline_layout = ctx->Se_layouts->getPipelineLayout({&hiz}, sizeof(HiZPushConstants));
+    hiz_set_layout = ctx->Se_layouts->getSetLayout(hiz_pipeline_layout, 0);
+
+    const SeShaderModule& cull = ctx->Se_shaders->getModule("occlusion_cull.comp");
+    cull_pipeline_layout = ctx->Se_layouts->getPipelineLayout({&cull}, sizeof(CullPushConstants));
+    cull_set_layout = ctx->Se_layouts->getSetLayout(cull_pipeline_layout, 0);
+}
+
+VkPipeline SeOcclusionCuller::createComputePipeline(const std::string& shaderFile, VkPipelineLayout layout)
+{
+    SE_PROFILE_FUNCTION();
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    const SeShaderModule& shader = ctx->Se_shaders->getModule(shaderFile);
+    ctx->Se_layouts->validate(layout, shader.reflection, shaderFile);
+    pipelineInfo.stage.module = shader.module;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = layout;
+
+    VkPipeline computePipeline;
+    VkResult result = ctx->Se_pipeline_cache->createComputePipeline(pipelineInfo, &computePipeline, shaderFile);
+    if (result != VK_SUCCESS)
+    {
+        std::cout << "Failed to create compute pipeline: " << result << std::endl;
+        throw std::runtime_error("Failed to create compute pipeline " + shaderFile);
+    }
+    return computePipeline;
+}
+
+void SeOcclusionCuller::createComputePipelines()
+{
+    hiz_pipeline = createComputePipeline("hiz_downsample.comp", hiz_pipeline_layout);
+    cull_pipeline = createComputePipeline("occlusion_cull.comp", cull_pipeline_layout);
+}
+
+void SeOcclusionCuller::createSampler()
+{
+    // Only used with texelFetch, filtering never applies
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    if (vkCreateSampler(ctx->Se_device->device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create Hi-Z sampler!");
+    }
+}
+
+void SeOcclusionCuller::createHiZResources()
+{
+    VkExtent2D extent = ctx->Se_swapchain->getSwapChainExtent();
+    hizExtent = {previousPowerOfTwo(extent.width), previousPowerOfTwo(extent.height)};
+    hizMipCount = 1;
+    while ((std::max(hizExtent.width, hizExtent.height) >> hizMipCount) > 0) hizMipCount++;
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = hizExtent.width;
+    imageInfo.extent.height = hizExtent.height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = hizMipCount;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = VK_FORMAT_R32G32_SFLOAT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    ctx->Se_device->createImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, hiz_image, hiz_image_memory);
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = hiz_image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R32G32_SFLOAT;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = hizMipCount;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+    if (vkCreateImageView(ctx->Se_device->device, &viewInfo, nullptr, &hiz_view) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create Hi-Z image view!");
+    }
+
+    hizMipViews.resize(hizMipCount);
+    for (uint32_t i = 0; i < hizMipCount; i++)
+    {
+        viewInfo.subresourceRange.baseMipLevel = i;
+        viewInfo.subresourceRange.levelCount = 1;
+        if (vkCreateImageView(ctx->Se_device->device, &viewInfo, nullptr, &hizMipViews[i]) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create Hi-Z mip view!");
+        }
+    }
+
+    // The pyramid lives in GENERAL, the transition is recorded into the next frame instead of a blocking submit
+    bHiZLayoutPending = true;
+
+    uint32_t depthImageCount = static_cast<uint32_t>(ctx->Se_swapchain->imageCount());
+    uint32_t setCount = depthImageCount + hizMipCount;
+    std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+    poolSizes[0] = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount};
+    poolSizes[1] = {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, setCount};
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = setCount;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    if (vkCreateDescriptorPool(ctx->Se_device->device, &poolInfo, nullptr, &hiz_descriptor_pool) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create Hi-Z descriptor pool!");
+    }
+
+    std::vector<VkDescriptorSetLayout> layouts(setCount, hiz_set_layout);
+    std::vector<VkDescriptorSet> sets(setCount);
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = hiz_descriptor_pool;
+    allocInfo.descriptorSetCount = setCount;
+    allocInfo.pSetLayouts = layouts.data();
+    if (vkAllocateDescriptorSets(ctx->Se_device->device, &allocInfo, sets.data()) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to allocate Hi-Z descriptor sets!");
+    }
+    hizDepthSets.assign(sets.begin(), sets.begin() + depthImageCount);
+    hizMipSets.assign(sets.begin() + depthImageCount, sets.end());
+
+    for (uint32_t i = 0; i < setCount; i++)
+    {
+        bool fromDepth = i < depthImageCount;
+        uint32_t dstMip = fromDepth ? 0 : i - depthImageCount + 1;
+        if (dstMip >= hizMipCount) continue;
+
+        VkDescriptorImageInfo srcInfo = {};
+        srcInfo.sampler = sampler;
+        srcInfo.imageView = fromDepth ? ctx->Se_swapchain->getDepthImageView(i) : hizMipViews[dstMip - 1];
+        srcInfo.imageLayout = fromDepth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+        VkDescriptorImageInfo dstInfo = {};
+        dstInfo.imageView = hizMipViews[dstMip];
+        dstInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        std::array<VkWriteDescriptorSet, 2> writes = {};
+        writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[0].dstSet = sets[i];
+        writes[0].dstBinding = 0;
+        writes[0].descriptorCount = 1;
+        writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writes[0].pImageInfo = &srcInfo;
+        writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[1].dstSet = sets[i];
+        writes[1].dstBinding = 1;
+        writes[1].descriptorCount = 1;
+        writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        writes[1].pImageInfo = &dstInfo;
+        vkUpdateDescriptorSets(ctx->Se_device->device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    }
+
+    bHiZValid = false;
+    std::fill(cullSetsDirty.begin(), cullSetsDirty.end(), true);
+}
+
+void SeOcclusionCuller::transitionHiZLayout(VkCommandBuffer commandBuffer)
+{
+    if (!bHiZLayoutPending) return;
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = hiz_image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, hizMipCount, 0, 1};
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    bHiZLayoutPending = false;
+}
+
+void SeOcclusionCuller::destroyHiZResources()
+{
+    vkDestroyDescriptorPool(ctx->Se_device->device, hiz_descriptor_pool, nullptr);
+    hizDepthSets.clear();
+    hizMipSets.clear();
+    for (auto view : hizMipViews)
+    {
+        vkDestroyImageView(ctx->Se_device->device, view, nullptr);
+    }
+    hizMipViews.clear();
+    vkDestroyImageView(ctx->Se_device->device, hiz_view, nullptr);
+    vkDestroyImage(ctx->Se_device->device, hiz_image, nullptr);
+    vkFreeMemory(ctx->Se_device->device, hiz_image_memory, nullptr);
+}
+
+void SeOcclusionCuller::recreateHiZ()
+{
+    // Frames still in flight sample the old pyramid, hand it to the renderer to destroy once they retire
+    VkDevice device = ctx->Se_device->device;
+    VkDescriptorPool pool = hiz_descriptor_pool;
+    std::vector<VkImageView> mipViews = std::move(hizMipViews);
+    VkImageView view = hiz_view;
+    VkImage image = hiz_image;
+    VkDeviceMemory memory = hiz_image_memory;
+    ctx->Se_renderer->deferDestroy([=]()
+    {
+        vkDestroyDescriptorPool(device, pool, nullptr);
+        for (auto mipView : mipViews) vkDestroyImageView(device, mipView, nullptr);
+        vkDestroyImageView(device, view, nullptr);
+        vkDestroyImage(device, image, nullptr);
+        vkFreeMemory(device, memory, nullptr);
+    });
+    hizMipViews.clear();
+    hizDepthSets.clear();
+    hizMipSets.clear();
+
+    createHiZResources();
+}
+
+void SeOcclusionCuller::createObjectBuffers(uint32_t capacity)
+{
+    objectCapacity = capacity;
+    const int framesInFlight = SeSwapChain::MAX_FRAMES_IN_FLIGHT;
+
+    boundsBuffers.resize(framesInFlight);
+    boundsBufferMemorys.resize(framesInFlight);
+    boundsMapped.resize(framesInFlight);
+    VkDeviceSize boundsSize = sizeof(CullHeader) + sizeof(ObjectBounds) * capacity;
+    for (int i = 0; i < framesInFlight; i++)
+    {
+        ctx->Se_device->createBuffer(
+            boundsSize,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            boundsBuffers[i],
+            boundsBufferMemorys[i]);
+        vkMapMemory(ctx->Se_device->device, boundsBufferMemorys[i], 0, boundsSize, 0, &boundsMapped[i]);
+    }
+
+    ctx->Se_device->createBuffer(
+        sizeof(uint32_t) * capacity,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        visibility_buffer,
+        visibility_buffer_memory);
+
+    ctx->Se_device->createBuffer(
+        sizeof(VkDrawIndirectCommand) * capacity * 3,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        indirect_buffer,
+        indirect_buffer_memory);
+
+    std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+    poolSizes[0] = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3u * framesInFlight};
+    poolSizes[1] = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, static_cast<uint32_t>(framesInFlight)};
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = framesInFlight;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    if (vkCreateDescriptorPool(ctx->Se_device->device, &poolInfo, nullptr, &cull_descriptor_pool) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create cull descriptor pool!");
+    }
+
+    std::vector<VkDescriptorSetLayout> layouts(framesInFlight, cull_set_layout);
+    cullSets.resize(framesInFlight);
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = cull_descriptor_pool;
+    allocInfo.descriptorSetCount = framesInFlight;
+    allocInfo.pSetLayouts = layouts.data();
+    if (vkAllocateDescriptorSets(ctx->Se_device->device, &allocInfo, cullSets.data()) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to allocate cull descriptor sets!");
+    }
+    cullSetsDirty.assign(framesInFlight, true);
+}
+
+void SeOcclusionCuller::destroyObjectBuffers()
+{
+    vkDestroyDescriptorPool(ctx->Se_device->device, cull_descriptor_pool, nullptr);
+    cullSets.clear();
+    for (size_t i = 0; i < boundsBuffers.size(); i++)
+    {
+        vkUnmapMemory(ctx->Se_device->device, boundsBufferMemorys[i]);
+        vkDestroyBuffer(ctx->Se_device->device, boundsBuffers[i], nullptr);
+        vkFreeMemory(ctx->Se_device->device, boundsBufferMemorys[i], nullptr);
+    }
+    boundsBuffers.clear();
+    boundsBufferMemorys.clear();
+    boundsMapped.clear();
+    vkDestroyBuffer(ctx->Se_device->device, visibility_buffer, nullptr);
+    vkFreeMemory(ctx->Se_device->device, visibility_buffer_memory, nullptr);
+    vkDestroyBuffer(ctx->Se_device->device, indirect_buffer, nullptr);
+    vkFreeMemory(ctx->Se_device->device, indirect_buffer_memory, nullptr);
+}
+
+void SeOcclusionCuller::writeCullDescriptorSet(int frameIndex)
+{
+    // Only ever called for the frame being recorded, its previous submission has completed
+    std::array<VkDescriptorBufferInfo, 3> bufferInfos = {};
+    bufferInfos[0] = {boundsBuffers[frameIndex], 0, VK_WHOLE_SIZE};
+    bufferInfos[1] = {visibility_buffer, 0, VK_WHOLE_SIZE};
+    bufferInfos[2] = {indirect_buffer, 0, VK_WHOLE_SIZE};
+
+    VkDescriptorImageInfo hizInfo = {};
+    hizInfo.sampler = sampler;
+    hizInfo.imageView = hiz_view;
+    hizInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    std::array<VkWriteDescriptorSet, 4> writes = {};
+    for (uint32_t b = 0; b < 4; b++)
+    {
+        writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[b].dstSet = cullSets[frameIndex];
+        writes[b].dstBinding = b;
+        writes[b].descriptorCount = 1;
+        if (b < 3)
+        {
+            writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[b].pBufferInfo = &bufferInfos[b];
+        } else
+        {
+            writes[b].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            writes[b].pImageInfo = &hizInfo;
+        }
+    }
+    vkUpdateDescriptorSets(ctx->Se_device->device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    cullSetsDirty[frameIndex] = false;
+}
+
+void SeOcclusionCuller::updateObjects(int frameIndex, const SeRenderSnapshot& snapshot)
+{
+    const uint32_t count = snapshot.getObjectCount();
+    const glm::mat4 projectionView = snapshot.projection * snapshot.view;
+    if (count > objectCapacity)
+    {
+        // Older frames keep using the old buffers until they retire
+        VkDevice device = ctx->Se_device->device;
+        VkDescriptorPool pool = cull_descriptor_pool;
+        std::vector<VkBuffer> oldBounds = std::move(boundsBuffers);
+        std::vector<VkDeviceMemory> oldBoundsMemory = std::move(boundsBufferMemorys);
+        std::array<VkBuffer, 2> oldBuffers = {visibility_buffer, indirect_buffer};
+        std::array<VkDeviceMemory, 2> oldMemory = {visibility_buffer_memory, indirect_buffer_memory};
+        ctx->Se_renderer->deferDestroy([=]()
+        {
+            vkDestroyDescriptorPool(device, pool, nullptr);
+            for (size_t i = 0; i < oldBounds.size(); i++)
+            {
+                vkUnmapMemory(device, oldBoundsMemory[i]);
+                vkDestroyBuffer(device, oldBounds[i], nullptr);
+                vkFreeMemory(device, oldBoundsMemory[i], nullptr);
+            }
+            for (size_t i = 0; i < oldBuffers.size(); i++)
+            {
+                vkDestroyBuffer(device, oldBuffers[i], nullptr);
+                vkFreeMemory(device, oldMemory[i], nullptr);
+            }
+        });
+        boundsBuffers.clear();
+        boundsBufferMemorys.clear();
+        boundsMapped.clear();
+
+        uint32_t newCapacity = std::max(count, objectCapacity * 2);
+        createObjectBuffers(newCapacity);
+    }
+    if (cullSetsDirty[frameIndex]) writeCullDescriptorSet(frameIndex);
+    objectCount = count;
+
+    char* mapped = static_cast<char*>(boundsMapped[frameIndex]);
+    CullHeader header{projectionView, prevProjectionView};
+    memcpy(mapped, &header, sizeof(CullHeader));
+
+    // Written by the simulation in SeRenderer::writeSnapshot
+    memcpy(mapped + sizeof(CullHeader), snapshot.bounds.data(), boundsSize(count));
+
+    prevProjectionView = projectionView;
+}
+
+void SeOcclusionCuller::writeObjectBounds(SeWorld& world, const SeSceneGraph& sceneGraph, void* destination, SeJobSystem* jobs)
+{
+    // Same query as the renderer's draw loops, bounds[first + k] belongs to the (first + k)-th drawn entity
+    auto writeChunk = [&sceneGraph, destination](uint32_t first, uint32_t count, const Entity*, const RenderComponent* renders, const SceneNodeComponent* nodes) {
+        ObjectBounds* bounds = static_cast<ObjectBounds*>(destination) + first;
+        for (uint32_t k = 0; k < count; k++)
+        {
+            const SeModel& model = *renders[k].model;
+            const glm::mat4& world = sceneGraph.getWorld(nodes[k].node);
+            // Parents may scale too, the world matrix' axis lengths are the combined scale
+            glm::vec3 scale{glm::length(glm::vec3(world[0])), glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))};
+            float maxScale = std::max(scale.x, std::max(scale.y, scale.z));
+
+            bounds[k].sphere = glm::vec4(glm::vec3(world * glm::vec4(model.getBoundsCenter(), 1.f)), model.getBoundsRadius() * maxScale);
+            bounds[k].vertexCount = model.getVertexCount();
+            bounds[k].firstVertex = 0;
+        }
+    };
+    if (jobs)
+    {
+        world.parallelEachChunk<const RenderComponent, const SceneNodeComponent>(*jobs, writeChunk);
+        return;
+    }
+    uint32_t first = 0;
+    world.eachChunk<const RenderComponent, const SceneNodeComponent>(
+        [&](uint32_t count, const Entity* entities, const RenderComponent* renders, const SceneNodeComponent* nodes) {
+            writeChunk(first, count, entities, renders, nodes);
+            first += count;
+        });
+}
+
+void SeOcclusionCuller::cull(VkCommandBuffer commandBuffer, int frameIndex, Phase phase)
+{
+    assert(phase != MAIN && "MAIN draw commands are produced by the LATE phase");
+    transitionHiZLayout(commandBuffer);
+
+    // Earlier indirect reads and visibility/Hi-Z accesses before we overwrite the commands
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    CullPushConstants push{};
+    push.objectCount = objectCount;
+    push.phase = phase;
+    push.hizValid = bHiZValid ? 1 : 0;
+    push.mipCount = hizMipCount;
+    push.hizSize = glm::vec2(hizExtent.width, hizExtent.height);
+    push.commandStride = objectCapacity;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline_layout, 0, 1, &cullSets[frameIndex], 0, nullptr);
+    vkCmdPushConstants(commandBuffer, cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &push);
+    vkCmdDispatch(commandBuffer, (objectCount + 63) / 64, 1, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void SeOcclusionCuller::buildHiZ(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    transitionHiZLayout(commandBuffer);
+
+    // Culling may still be reading the pyramid we are about to overwrite
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiz_pipeline);
+
+    VkExtent2D depthExtent = ctx->Se_swapchain->getSwapChainExtent();
+    HiZPushConstants push{};
+    push.srcSize = glm::ivec2(depthExtent.width, depthExtent.height);
+    push.dstSize = glm::ivec2(hizExtent.width, hizExtent.height);
+    push.sourceIsDepth = 1;
+
+    for (uint32_t mip = 0; mip < hizMipCount; mip++)
+    {
+        VkDescriptorSet set = mip == 0 ? hizDepthSets[imageIndex] : hizMipSets[mip - 1];
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiz_pipeline_layout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, hiz_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(HiZPushConstants), &push);
+        vkCmdDispatch(commandBuffer, (push.dstSize.x + 7) / 8, (push.dstSize.y + 7) / 8, 1);
+
+        // Each level reads the one before it
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        push.srcSize = push.dstSize;
+        push.dstSize = glm::max(push.dstSize / 2, glm::ivec2(1));
+        push.sourceIsDepth = 0;
+    }
+
+    bHiZValid = true;
+}
+
+}
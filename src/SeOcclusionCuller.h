@@ -0,0 +1,152 @@
+﻿#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <GLM/glm.hpp>
+
+namespace SE {
+struct VulkanContext;
+class SeJobSystem;
+struct SeRenderSnapshot;
+class SeSceneGraph;
+class SeWorld;
+
+// Hierarchical-Z occlusion culling driven by the depth prepass.
+//
+// Every frame runs in two phases:
+//  - Early: objects are tested against the previous frame's Hi-Z pyramid and the
+//    survivors are drawn into the depth prepass.
+//  - Late: the pyramid is rebuilt from that depth, everything the early phase
+//    rejected is tested again and the newly visible objects are drawn as well.
+// The late phase catches objects that were disoccluded this frame, so nothing pops in.
+// Results are written to per-object VkDrawIndirectCommands, the CPU never waits on them.
+class SeOcclusionCuller
+{
+public:
+    enum Phase : uint32_t
+    {
+        EARLY = 0,  // drawn in the first prepass
+        LATE = 1,   // drawn in the second prepass
+        MAIN = 2    // everything visible, drawn in the main pass
+    };
+
+    SeOcclusionCuller(std::shared_ptr<VulkanContext> inctx);
+    ~SeOcclusionCuller();
+
+    SeOcclusionCuller(const SeOcclusionCuller&) = delete;
+    void operator=(const SeOcclusionCuller&) = delete;
+
+    // Upload world space bounds for this frame, must be called before cull()
+    void updateObjects(int frameIndex, const SeRenderSnapshot& snapshot);
+    void cull(VkCommandBuffer commandBuffer, int frameIndex, Phase phase);
+    void buildHiZ(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    // Swap chain extent or images changed, pyramid has to be rebuilt from scratch.
+    // The old pyramid is retired through the renderer's deletion queue, nothing waits for idle
+    void recreateHiZ();
+
+    // CPU half of the cull, world space bounding spheres for every object, chunks are spread over
+    // jobs when given. Exposed for the microbenchmarks
+    static size_t boundsSize(uint32_t objectCount) { return objectCount * sizeof(ObjectBounds); }
+    static void writeObjectBounds(SeWorld& world, const SeSceneGraph& sceneGraph, void* destination, SeJobSystem* jobs = nullptr);
+
+    VkBuffer getIndirectBuffer() const { return indirect_buffer; }
+    VkDeviceSize getIndirectOffset(Phase phase, uint32_t objectIndex) const
+    {
+        return (static_cast<VkDeviceSize>(phase) * objectCapacity + objectIndex) * sizeof(VkDrawIndirectCommand);
+    }
+
+private:
+    struct ObjectBounds
+    {
+        glm::vec4 sphere;   // world space center, radius
+        uint32_t vertexCount;
+        uint32_t firstVertex;
+        uint32_t pad[2];
+    };
+
+    struct CullHeader
+    {
+        glm::mat4 viewProj;
+        glm::mat4 prevViewProj;
+    };
+
+    struct CullPushConstants
+    {
+        uint32_t objectCount;
+        uint32_t phase;
+        uint32_t hizValid;
+        uint32_t mipCount;
+        glm::vec2 hizSize;
+        uint32_t commandStride;
+    };
+
+    struct HiZPushConstants
+    {
+        glm::ivec2 srcSize;
+        glm::ivec2 dstSize;
+        uint32_t sourceIsDepth;
+    };
+
+    void createDescriptorSetLayouts();
+    void createComputePipelines();
+    void createSampler();
+    void createHiZResources();
+    void destroyHiZResources();
+    void createObjectBuffers(uint32_t capacity);
+    void destroyObjectBuffers();
+    void writeCullDescriptorSet(int frameIndex);
+    void transitionHiZLayout(VkCommandBuffer commandBuffer);
+    VkPipeline createComputePipeline(const std::string& shaderFile, VkPipelineLayout layout);
+
+    std::shared_ptr<VulkanContext> ctx;
+
+    // Hi-Z pyramid, rg32f holding min and max depth, kept in VK_IMAGE_LAYOUT_GENERAL
+    VkImage hiz_image = VK_NULL_HANDLE;
+    VkDeviceMemory hiz_image_memory = VK_NULL_HANDLE;
+    VkImageView hiz_view = VK_NULL_HANDLE;
+    std::vector<VkImageView> hizMipViews;
+    VkExtent2D hizExtent{};
+    uint32_t hizMipCount = 0;
+    bool bHiZValid = false;
+    bool bHiZLayoutPending = false;
+
+    VkSampler sampler = VK_NULL_HANDLE;
+    // Owned by SeLayoutCache
+    VkDescriptorSetLayout hiz_set_layout = VK_NULL_HANDLE;
+    VkDescriptorSetLayout cull_set_layout = VK_NULL_HANDLE;
+    VkPipelineLayout hiz_pipeline_layout = VK_NULL_HANDLE;
+    VkPipelineLayout cull_pipeline_layout = VK_NULL_HANDLE;
+    VkPipeline hiz_pipeline = VK_NULL_HANDLE;
+    VkPipeline cull_pipeline = VK_NULL_HANDLE;
+
+    // One set per swap chain depth image for level 0, then one per mip level
+    VkDescriptorPool hiz_descriptor_pool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> hizDepthSets;
+    std::vector<VkDescriptorSet> hizMipSets;
+
+    // One set per frame in flight
+    VkDescriptorPool cull_descriptor_pool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> cullSets;
+    // Rewritten lazily when their frame comes around, another frame may still be reading its set
+    std::vector<bool> cullSetsDirty;
+
+    // Per frame bounds written by the CPU, header + ObjectBounds[]
+    std::vector<VkBuffer> boundsBuffers;
+    std::vector<VkDeviceMemory> boundsBufferMemorys;
+    std::vector<void*> boundsMapped;
+    // Written by the GPU only: early visibility flags and EARLY/LATE/MAIN draw commands
+    VkBuffer visibility_buffer = VK_NULL_HANDLE;
+    VkDeviceMemory visibility_buffer_memory = VK_NULL_HANDLE;
+    VkBuffer indirect_buffer = VK_NULL_HANDLE;
+    VkDeviceMemory indirect_buffer_memory = VK_NULL_HANDLE;
+    uint32_t objectCapacity = 0;
+    uint32_t objectCount = 0;
+
+    glm::mat4 prevProjectionView{1.f};
+};
+
+}
@@ -1,5 +1,6 @@
 ﻿#include "SePipeline.h"
 
+#include <algorithm>
 #include <cassert>
 #include <Config.h>
 #include <fstream>
@@ -8,7 +9,13 @@
 #include <vulkan/vk_enum_string_helper.h>
 
 #include "SeDevice.h"
+#include "SeHash.h"
+#include "SeLayoutCache.h"
 #include "SeModel.h"
+#include "SePipelineCache.h"
+#include "SePipelineLibrary.h"
+#include "SeShaderCache.h"
+#include "SeProfiler.h"
 #include "vulkancontext.h"
 
 namespace SE {
@@ -19,8 +26,6 @@ SePipeline::SePipeline(std::shared_ptr<VulkanContext> inpctx)
 
 SePipeline::~SePipeline()
 {
-    vkDestroyShaderModule(ctx->Se_device->device, vert_shader_module, nullptr);
-    vkDestroyShaderModule(ctx->Se_device->device, frag_shader_module, nullptr);
     vkDestroyPipeline(ctx->Se_device->device, pipeline, nullptr);
 }
 
@@ -29,85 +34,88 @@ void SePipeline::bind(VkCommandBuffer commandBuffer)
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 }
 
-void SePipeline::defaultPipelineConfigInfo()
+void SePipeline::defaultPipelineConfigInfo(PipelineConfigInfo& configInfo)
 {
-    //PipelineConfigInfo configInfo{};
-    pipeline_config_info.inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    pipeline_config_info.inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    pipeline_config_info.inputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
+    configInfo.inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    configInfo.inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    configInfo.inputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
  
 
     // viewport
-    pipeline_config_info.viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    pipeline_config_info.viewportInfo.viewportCount = 1;
-    pipeline_config_info.viewportInfo.pViewports = nullptr;
-    pipeline_config_info.viewportInfo.scissorCount = 1;
-    pipeline_config_info.viewportInfo.pScissors = nullptr;
+    configInfo.viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    configInfo.viewportInfo.viewportCount = 1;
+    configInfo.viewportInfo.pViewports = nullptr;
+    configInfo.viewportInfo.scissorCount = 1;
+    configInfo.viewportInfo.pScissors = nullptr;
 
     // rasterizationInfo
-    pipeline_config_info.rasterizationInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    pipeline_config_info.rasterizationInfo.depthClampEnable = VK_FALSE;
-    pipeline_config_info.rasterizationInfo.rasterizerDiscardEnable = VK_FALSE;
-    pipeline_config_info.rasterizationInfo.polygonMode = VK_POLYGON_MODE_FILL;
-    pipeline_config_info.rasterizationInfo.lineWidth = 1.0f;
-    pipeline_config_info.rasterizationInfo.cullMode = VK_CULL_MODE_NONE;
-    pipeline_config_info.rasterizationInfo.frontFace = VK_FRONT_FACE_CLOCKWISE;
-    pipeline_config_info.rasterizationInfo.depthBiasEnable = VK_FALSE;
-    pipeline_config_info.rasterizationInfo.depthBiasConstantFactor = 0.0f;  // Optional
-    pipeline_config_info.rasterizationInfo.depthBiasClamp = 0.0f;           // Optional
-    pipeline_config_info.rasterizationInfo.depthBiasSlopeFactor = 0.0f;     // Optional
+    configInfo.rasterizationInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    configInfo.rasterizationInfo.depthClampEnable = VK_FALSE;
+    configInfo.rasterizationInfo.rasterizerDiscardEnable = VK_FALSE;
+    configInfo.rasterizationInfo.polygonMode = VK_POLYGON_MODE_FILL;
+    configInfo.rasterizationInfo.lineWidth = 1.0f;
+    configInfo.rasterizationInfo.cullMode = VK_CULL_MODE_NONE;
+    configInfo.rasterizationInfo.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    configInfo.rasterizationInfo.depthBiasEnable = VK_FALSE;
+    configInfo.rasterizationInfo.depthBiasConstantFactor = 0.0f;  // Optional
+    configInfo.rasterizationInfo.depthBiasClamp = 0.0f;           // Optional
+    configInfo.rasterizationInfo.depthBiasSlopeFactor = 0.0f;     // Optional
  
-    pipeline_config_info.multisampleInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    pipeline_config_info.multisampleInfo.sampleShadingEnable = VK_FALSE;
-    pipeline_config_info.multisampleInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-    pipeline_config_info.multisampleInfo.minSampleShading = 1.0f;           // Optional
-    pipeline_config_info.multisampleInfo.pSampleMask = nullptr;             // Optional
-    pipeline_config_info.multisampleInfo.alphaToCoverageEnable = VK_FALSE;  // Optional
-    pipeline_config_info.multisampleInfo.alphaToOneEnable = VK_FALSE;       // Optional
+    configInfo.multisampleInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    configInfo.multisampleInfo.sampleShadingEnable = VK_FALSE;
+    configInfo.multisampleInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    configInfo.multisampleInfo.minSampleShading = 1.0f;           // Optional
+    configInfo.multisampleInfo.pSampleMask = nullptr;             // Optional
+    configInfo.multisampleInfo.alphaToCoverageEnable = VK_FALSE;  // Optional
+    configInfo.multisampleInfo.alphaToOneEnable = VK_FALSE;       // Optional
     
-    pipeline_config_info.colorBlendAttachment.blendEnable = VK_FALSE;
-    pipeline_config_info.colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;   // Optional
-    pipeline_config_info.colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;  // Optional
-    pipeline_config_info.colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;              // Optional
-    pipeline_config_info.colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;   // Optional
-    pipeline_config_info.colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;  // Optional
-    pipeline_config_info.colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;      
-    pipeline_config_info.colorBlendAttachment.colorWriteMask =  VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT |
+    configInfo.colorBlendAttachment.blendEnable = VK_FALSE;
+    configInfo.colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;   // Optional
+    configInfo.colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;  // Optional
+    configInfo.colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;              // Optional
+    configInfo.colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;   // Optional
+    configInfo.colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;  // Optional
+    configInfo.colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;      
+    configInfo.colorBlendAttachment.colorWriteMask =  VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT |
       VK_COLOR_COMPONENT_A_BIT;
 
-    pipeline_config_info.colorBlendInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    pipeline_config_info.colorBlendInfo.logicOpEnable = VK_FALSE;
-    pipeline_config_info.colorBlendInfo.logicOp = VK_LOGIC_OP_COPY;  // Optional
-    pipeline_config_info.colorBlendInfo.attachmentCount = 1;
-    pipeline_config_info.colorBlendInfo.pAttachments = &pipeline_config_info.colorBlendAttachment;
-    pipeline_config_info.colorBlendInfo.blendConstants[0] = 0.0f;  // Optional
-    pipeline_config_info.colorBlendInfo.blendConstants[1] = 0.0f;  // Optional
-    pipeline_config_info.colorBlendInfo.blendConstants[2] = 0.0f;  // Optional
-    pipeline_config_info.colorBlendInfo.blendConstants[3] = 0.0f;  // Optional
+    configInfo.colorBlendInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    configInfo.colorBlendInfo.logicOpEnable = VK_FALSE;
+    configInfo.colorBlendInfo.logicOp = VK_LOGIC_OP_COPY;  // Optional
+    configInfo.colorBlendInfo.attachmentCount = 1;
+    configInfo.colorBlendInfo.pAttachments = &configInfo.colorBlendAttachment;
+    configInfo.colorBlendInfo.blendConstants[0] = 0.0f;  // Optional
+    configInfo.colorBlendInfo.blendConstants[1] = 0.0f;  // Optional
+    configInfo.colorBlendInfo.blendConstants[2] = 0.0f;  // Optional
+    configInfo.colorBlendInfo.blendConstants[3] = 0.0f;  // Optional
 
  
-    pipeline_config_info.depthStencilInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    pipeline_config_info.depthStencilInfo.depthTestEnable = VK_TRUE;
-    pipeline_config_info.depthStencilInfo.depthWriteEnable = VK_TRUE;
-    pipeline_config_info.depthStencilInfo.depthCompareOp = VK_COMPARE_OP_LESS;
-    pipeline_config_info.depthStencilInfo.depthBoundsTestEnable = VK_FALSE;
-    pipeline_config_info.depthStencilInfo.minDepthBounds = 0.0f;  // Optional
-    pipeline_config_info.depthStencilInfo.maxDepthBounds = 1.0f;  // Optional
-    pipeline_config_info.depthStencilInfo.stencilTestEnable = VK_FALSE;
-    pipeline_config_info.depthStencilInfo.front = {};  // Optional
-    pipeline_config_info.depthStencilInfo.back = {};   // Optional
-
-    pipeline_config_info.dynamicStateEnables = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
-    pipeline_config_info.dynamicStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    pipeline_config_info.dynamicStateInfo.pDynamicStates = pipeline_config_info.dynamicStateEnables.data();
-    pipeline_config_info.dynamicStateInfo.dynamicStateCount = static_cast<uint32_t>(pipeline_config_info.dynamicStateEnables.size());
-    pipeline_config_info.dynamicStateInfo.flags = 0;
-    
-    
+    configInfo.depthStencilInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    configInfo.depthStencilInfo.depthTestEnable = VK_TRUE;
+    configInfo.depthStencilInfo.depthWriteEnable = VK_TRUE;
+    configInfo.depthStencilInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+    configInfo.depthStencilInfo.depthBoundsTestEnable = VK_FALSE;
+    configInfo.depthStencilInfo.minDepthBounds = 0.0f;  // Optional
+    configInfo.depthStencilInfo.maxDepthBounds = 1.0f;  // Optional
+    configInfo.depthStencilInfo.stencilTestEnable = VK_FALSE;
+    configInfo.depthStencilInfo.front = {};  // Optional
+    configInfo.depthStencilInfo.back = {};   // Optional
+
+    configInfo.dynamicStateEnables = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    configInfo.dynamicStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    configInfo.dynamicStateInfo.pDynamicStates = configInfo.dynamicStateEnables.data();
+    configInfo.dynamicStateInfo.dynamicStateCount = static_cast<uint32_t>(configInfo.dynamicStateEnables.size());
+    configInfo.dynamicStateInfo.flags = 0;
+
+    configInfo.bindingDescriptions = SeModel::Vertex::getBindingDescriptions();
+    configInfo.attributeDescriptions = SeModel::Vertex::getAttributeDescriptions();
+    configInfo.vertShaderFile = "simple_shader.vert";
+    configInfo.fragShaderFile = "simple_shader.frag";
 }
 
 std::vector<char> SePipeline::readFile(std::string filepath)
 {
+    SE_PROFILE_FUNCTION();
     std::ifstream file{filepath, std::ios::ate | std::ios::binary};
 
     if (!file.is_open()) {
@@ -125,37 +133,44 @@ std::vector<char> SePipeline::readFile(std::string filepath)
     
 }
 
-void SePipeline::createGraphicsPipeline()
+void SePipeline::prepareCreateInfo()
 {
-    
     if (pipeline_config_info.pipelineLayout == VK_NULL_HANDLE) std::cout << "Cannot create graphics pipeline: No pipelineLayout provided in configInfo \n"; 
     if (pipeline_config_info.renderPass == VK_NULL_HANDLE) std::cout << "Cannot create graphics pipeline: No renderPass provided in configInfo \n"; 
 
-    // Create Shader Modules
-    auto vertCode = readFile(Config::get().shader_path() + "simple_shader_vert.spv");
-    createShaderModule(vertCode, vert_shader_module);
-    auto fragCode = readFile(Config::get().shader_path() + "simple_shader_frag.spv");
-    createShaderModule(fragCode, frag_shader_module);
+    // Each file is read and turned into a module once per run, every pipeline using it shares the module
+    const SeShaderModule& vert = ctx->Se_shaders->getModule(pipeline_config_info.vertShaderFile, pipeline_config_info.vertShaderDefines);
+    bool hasFragmentStage = !pipeline_config_info.fragShaderFile.empty();
+    const SeShaderModule* frag = hasFragmentStage ? &ctx->Se_shaders->getModule(pipeline_config_info.fragShaderFile, pipeline_config_info.fragShaderDefines) : nullptr;
+    validateShaderInterface(vert, frag);
+    vert_shader_module = vert.module;
+    if (frag) frag_shader_module = frag->module;
+
+    specializationInfo = {};
+    specializationInfo.mapEntryCount = static_cast<uint32_t>(pipeline_config_info.specializationEntries.size());
+    specializationInfo.pMapEntries = pipeline_config_info.specializationEntries.data();
+    specializationInfo.dataSize = pipeline_config_info.specializationData.size();
+    specializationInfo.pData = pipeline_config_info.specializationData.data();
+    const VkSpecializationInfo* pSpecializationInfo = specializationInfo.mapEntryCount > 0 ? &specializationInfo : nullptr;
 
 
-    VkPipelineShaderStageCreateInfo shaderStages[2];
     shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
     shaderStages[0].module = vert_shader_module;
     shaderStages[0].pName = "main";
     shaderStages[0].flags = 0;
     shaderStages[0].pNext = nullptr;
-    shaderStages[0].pSpecializationInfo = nullptr;
+    shaderStages[0].pSpecializationInfo = pSpecializationInfo;
     shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
     shaderStages[1].module = frag_shader_module;
     shaderStages[1].pName = "main";
     shaderStages[1].flags = 0;
     shaderStages[1].pNext = nullptr;
-    shaderStages[1].pSpecializationInfo = nullptr;
+    shaderStages[1].pSpecializationInfo = pSpecializationInfo;
 
-    auto bindingDescriptions = SeModel::Vertex::getBindingDescriptions();
-    auto attributeDescriptions = SeModel::Vertex::getAttributeDescriptions();
+    auto& bindingDescriptions = pipeline_config_info.bindingDescriptions;
+    auto& attributeDescriptions = pipeline_config_info.attributeDescriptions;
     
     // VkPipelineVertexInputStateCreateInfo
     pipeline_config_info.vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -164,6 +179,11 @@ void SePipeline::createGraphicsPipeline()
     pipeline_config_info.vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
     pipeline_config_info.vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
 
+    // The config may have been copied, point the states back at this copy's members
+    pipeline_config_info.colorBlendInfo.pAttachments = &pipeline_config_info.colorBlendAttachment;
+    pipeline_config_info.dynamicStateInfo.pDynamicStates = pipeline_config_info.dynamicStateEnables.data();
+    pipeline_config_info.dynamicStateInfo.dynamicStateCount = static_cast<uint32_t>(pipeline_config_info.dynamicStateEnables.size());
+
 /*
     pipeline_config_info.viewport.width = ctx->Se_swapchain->getSwapChainExtent().width;
     pipeline_config_info.viewport.height = ctx->Se_swapchain->getSwapChainExtent().height;
@@ -180,7 +200,7 @@ void SePipeline::createGraphicsPipeline()
     pipeline_config_info.graphicsPipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     pipeline_config_info.graphicsPipelineInfo.pNext = nullptr;
     pipeline_config_info.graphicsPipelineInfo.flags = 0;
-    pipeline_config_info.graphicsPipelineInfo.stageCount = 2;
+    pipeline_config_info.graphicsPipelineInfo.stageCount = hasFragmentStage ? 2 : 1;
     pipeline_config_info.graphicsPipelineInfo.pStages = shaderStages;
     pipeline_config_info.graphicsPipelineInfo.pVertexInputState = &pipeline_config_info.vertexInputInfo;
     pipeline_config_info.graphicsPipelineInfo.pInputAssemblyState = &pipeline_config_info.inputAssemblyInfo;
@@ -192,12 +212,55 @@ void SePipeline::createGraphicsPipeline()
     pipeline_config_info.graphicsPipelineInfo.pColorBlendState = &pipeline_config_info.colorBlendInfo;
     pipeline_config_info.graphicsPipelineInfo.pDynamicState = &pipeline_config_info.dynamicStateInfo;
     pipeline_config_info.graphicsPipelineInfo.layout = pipeline_config_info.pipelineLayout;
-    pipeline_config_info.graphicsPipelineInfo.renderPass = ctx->Se_swapchain->render_pass;
+    pipeline_config_info.graphicsPipelineInfo.renderPass = pipeline_config_info.renderPass;
     pipeline_config_info.graphicsPipelineInfo.subpass = pipeline_config_info.subpass;
     pipeline_config_info.graphicsPipelineInfo.basePipelineIndex = -1;
     pipeline_config_info.graphicsPipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+}
+
+void SePipeline::validateShaderInterface(const SeShaderModule& vert, const SeShaderModule* frag) const
+{
+    const PipelineConfigInfo& config = pipeline_config_info;
+    for (const SeShaderReflection::Input& input : vert.reflection.inputs)
+    {
+        auto attribute = std::find_if(config.attributeDescriptions.begin(), config.attributeDescriptions.end(),
+                                      [&](const VkVertexInputAttributeDescription& other) { return other.location == input.location; });
+        if (attribute == config.attributeDescriptions.end())
+        {
+            throw std::runtime_error(config.vertShaderFile + " reads vertex input location " + std::to_string(input.location) + ", the pipeline has no attribute for it");
+        }
+        if (!SeShaderReflection::isInputCompatible(input.format, attribute->format))
+        {
+            throw std::runtime_error(config.vertShaderFile + " reads vertex input location " + std::to_string(input.location) + " as a different numeric type than "
+                                     + string_VkFormat(attribute->format));
+        }
+    }
 
-    VkResult result = vkCreateGraphicsPipelines(ctx->Se_device->device, VK_NULL_HANDLE, 1, &pipeline_config_info.graphicsPipelineInfo, nullptr, &pipeline);
+    // The specialization data is applied to both stages, a constant only has to exist in one of them
+    for (const VkSpecializationMapEntry& entry : config.specializationEntries)
+    {
+        const SeShaderReflection::SpecConstant* constant = vert.reflection.findSpecConstant(entry.constantID);
+        if (!constant && frag) constant = frag->reflection.findSpecConstant(entry.constantID);
+        if (!constant)
+        {
+            throw std::runtime_error(getName() + " has no specialization constant " + std::to_string(entry.constantID));
+        }
+        if (constant->size != entry.size || entry.offset + entry.size > config.specializationData.size())
+        {
+            throw std::runtime_error(getName() + " specialization constant " + std::to_string(entry.constantID) + " needs " + std::to_string(constant->size) + " bytes");
+        }
+    }
+
+    ctx->Se_layouts->validate(config.pipelineLayout, vert.reflection, config.vertShaderFile);
+    if (frag) ctx->Se_layouts->validate(config.pipelineLayout, frag->reflection, config.fragShaderFile);
+}
+
+void SePipeline::createGraphicsPipeline(VkPipelineCache cache)
+{
+    SE_PROFILE_FUNCTION();
+    prepareCreateInfo();
+
+    VkResult result = ctx->Se_pipeline_cache->createGraphicsPipeline(pipeline_config_info.graphicsPipelineInfo, &pipeline, getName(), cache);
     string_VkResult(result);
     if (result != VK_SUCCESS)
     {
@@ -209,27 +272,112 @@ void SePipeline::createGraphicsPipeline()
     
 }
 
-void SePipeline::recreateGraphicsPipeline()
+void SePipeline::linkGraphicsPipeline(bool bOptimized, VkPipelineCache cache)
 {
-    vkDestroyShaderModule(ctx->Se_device->device, frag_shader_module, nullptr);
-    vkDestroyShaderModule(ctx->Se_device->device, vert_shader_module, nullptr);
-    vkDestroyPipeline(ctx->Se_device->device, pipeline, nullptr);
-    createGraphicsPipeline();
-    
+    SE_PROFILE_FUNCTION();
+    prepareCreateInfo();
+    pipeline = ctx->Se_pipeline_library->link(pipeline_config_info, bOptimized, getName(), cache);
 }
 
-void SePipeline::createShaderModule(const std::vector<char>& code, VkShaderModule &shaderModule)
+void SePipeline::writeStateKey(VulkanContext& ctx, const PipelineConfigInfo& config, uint32_t parts, std::vector<char>& key)
 {
-    VkShaderModuleCreateInfo createInfo{};
-    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = code.size();
-    createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+    SeKeyWriter writer{key};
+    writer.write(parts);
+    // Every part carries the dynamic states, each library only takes the ones it covers
+    writer.writeArray(config.dynamicStateEnables.data(), config.dynamicStateEnables.size());
+
+    if (parts & VERTEX_INPUT)
+    {
+        writer.writeArray(config.bindingDescriptions.data(), config.bindingDescriptions.size());
+        writer.writeArray(config.attributeDescriptions.data(), config.attributeDescriptions.size());
+        writer.write(config.inputAssemblyInfo.topology);
+        writer.write(config.inputAssemblyInfo.primitiveRestartEnable);
+    }
 
-    if (vkCreateShaderModule(ctx->Se_device->device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+    // Everything but vertex input is built against the layout and a render pass. Compatible render
+    // passes share pipelines, so they enter by attachment formats (sample counts are in the multisample state)
+    if (parts & (PRE_RASTERIZATION | FRAGMENT_SHADER | FRAGMENT_OUTPUT))
+    {
+        writer.write(config.colorFormat);
+        writer.write(config.depthFormat);
+        writer.write(config.subpass);
+    }
+    if (parts & (PRE_RASTERIZATION | FRAGMENT_SHADER))
     {
-        std::cout << "Failed to create shader module" << std::endl;
-        throw std::runtime_error("Failed to create shader module");
+        writer.write(config.pipelineLayout);
+        writer.writeArray(config.specializationEntries.data(), config.specializationEntries.size());
+        writer.writeArray(config.specializationData.data(), config.specializationData.size());
+    }
+
+    if (parts & PRE_RASTERIZATION)
+    {
+        // Shaders by content, two files with the same SPIR-V give the same pipeline
+        writer.write(ctx.Se_shaders->getModule(config.vertShaderFile, config.vertShaderDefines).hash);
+        writer.write(config.viewportInfo.viewportCount);
+        writer.write(config.viewportInfo.scissorCount);
+
+        const VkPipelineRasterizationStateCreateInfo& raster = config.rasterizationInfo;
+        writer.write(raster.depthClampEnable);
+        writer.write(raster.rasterizerDiscardEnable);
+        writer.write(raster.polygonMode);
+        writer.write(raster.cullMode);
+        writer.write(raster.frontFace);
+        writer.write(raster.depthBiasEnable);
+        writer.write(raster.depthBiasConstantFactor);
+        writer.write(raster.depthBiasClamp);
+        writer.write(raster.depthBiasSlopeFactor);
+        writer.write(raster.lineWidth);
+    }
+
+    if (parts & (FRAGMENT_SHADER | FRAGMENT_OUTPUT))
+    {
+        const VkPipelineMultisampleStateCreateInfo& multisample = config.multisampleInfo;
+        writer.write(multisample.rasterizationSamples);
+        writer.write(multisample.sampleShadingEnable);
+        writer.write(multisample.minSampleShading);
+        writer.write(multisample.alphaToCoverageEnable);
+        writer.write(multisample.alphaToOneEnable);
+    }
+
+    if (parts & FRAGMENT_SHADER)
+    {
+        writer.write(config.fragShaderFile.empty() ? uint64_t(0) : ctx.Se_shaders->getModule(config.fragShaderFile, config.fragShaderDefines).hash);
+
+        const VkPipelineDepthStencilStateCreateInfo& depth = config.depthStencilInfo;
+        writer.write(depth.depthTestEnable);
+        writer.write(depth.depthWriteEnable);
+        writer.write(depth.depthCompareOp);
+        writer.write(depth.depthBoundsTestEnable);
+        writer.write(depth.stencilTestEnable);
+        writer.write(depth.front);
+        writer.write(depth.back);
+        writer.write(depth.minDepthBounds);
+        writer.write(depth.maxDepthBounds);
+    }
+
+    if (parts & FRAGMENT_OUTPUT)
+    {
+        // pAttachments always points at colorBlendAttachment once the pipeline is created
+        const VkPipelineColorBlendStateCreateInfo& blend = config.colorBlendInfo;
+        writer.write(blend.logicOpEnable);
+        writer.write(blend.logicOp);
+        writer.write(blend.attachmentCount);
+        if (blend.attachmentCount > 0) writer.write(config.colorBlendAttachment);
+        writer.writeArray(blend.blendConstants, 4);
     }
 }
+
+std::string SePipeline::getName() const
+{
+    if (pipeline_config_info.fragShaderFile.empty()) return pipeline_config_info.vertShaderFile;
+    return pipeline_config_info.vertShaderFile + " + " + pipeline_config_info.fragShaderFile;
 }
 
+void SePipeline::recreateGraphicsPipeline()
+{
+    // Caller guarantees the old pipeline is no longer in use, shader modules come from the cache
+    vkDestroyPipeline(ctx->Se_device->device, pipeline, nullptr);
+    pipeline = VK_NULL_HANDLE;
+    createGraphicsPipeline();
+}
+}
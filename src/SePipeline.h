@@ -3,9 +3,11 @@
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
+#include "SeShaderCompiler.h"
 #include "vulkancontext.h"
 
 namespace SE {
+struct SeShaderModule;
 
 class SePipeline
 {
@@ -25,11 +27,35 @@ public:
         VkPipelineDepthStencilStateCreateInfo depthStencilInfo;
         std::vector<VkDynamicState> dynamicStateEnables;
         VkPipelineDynamicStateCreateInfo dynamicStateInfo;
+        std::vector<VkVertexInputBindingDescription> bindingDescriptions{};
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions{};
+        std::string vertShaderFile;
+        std::string fragShaderFile; // Leave empty for depth only pipelines
+        // Variant defines of sources, unused for prebuilt .spv files
+        SeShaderDefines vertShaderDefines{};
+        SeShaderDefines fragShaderDefines{};
+        // Applied to every stage, empty = no specialization
+        std::vector<VkSpecializationMapEntry> specializationEntries{};
+        std::vector<char> specializationData{};
         VkPipelineLayout pipelineLayout = nullptr;
         VkRenderPass renderPass = nullptr;
+        // Attachment formats of renderPass. Pipelines are shared between compatible render passes,
+        // so these rather than the handle are part of the state hash
+        VkFormat colorFormat = VK_FORMAT_UNDEFINED;  // undefined for depth only passes
+        VkFormat depthFormat = VK_FORMAT_UNDEFINED;
         uint32_t subpass = 0;
     };
     
+    // State subsets as VK_EXT_graphics_pipeline_library splits them
+    enum StatePart : uint32_t
+    {
+        VERTEX_INPUT = 1,
+        PRE_RASTERIZATION = 2,
+        FRAGMENT_SHADER = 4,
+        FRAGMENT_OUTPUT = 8,
+        ALL_STATE = 15
+    };
+
     SePipeline(std::shared_ptr<VulkanContext> inctx);
     ~SePipeline();
 
@@ -38,25 +64,44 @@ public:
 
     void bind(VkCommandBuffer commandBuffer);
     
-    void defaultPipelineConfigInfo();
+    static void defaultPipelineConfigInfo(PipelineConfigInfo& configInfo);
 
-    void createGraphicsPipeline();
+    // cache: a thread cache from SePipelineCache::createThreadCache(), the shared one by default
+    void createGraphicsPipeline(VkPipelineCache cache = VK_NULL_HANDLE);
+    // Same pipeline linked from SePipelineLibrary parts, needs ctx->Se_pipeline_library. A fast
+    // link takes well under a millisecond once the parts exist, an optimized one runs the full
+    // compiler over the retained parts and is as fast on the GPU as createGraphicsPipeline()
+    void linkGraphicsPipeline(bool bOptimized, VkPipelineCache cache = VK_NULL_HANDLE);
     void recreateGraphicsPipeline();
+    // Shader files, for logs and statistics
+    std::string getName() const;
 
 public:
 
-    VkPipeline pipeline;
+    VkPipeline pipeline = VK_NULL_HANDLE;
     PipelineConfigInfo pipeline_config_info{};
-    VkShaderModule vert_shader_module;
-    VkShaderModule frag_shader_module;
-    
-private:
+    // Owned by SeShaderCache
+    VkShaderModule vert_shader_module = VK_NULL_HANDLE;
+    VkShaderModule frag_shader_module = VK_NULL_HANDLE;
+    // SePipelineRegistry key, 0 for pipelines created outside the registry
+    uint64_t state_hash = 0;
+
     static std::vector<char> readFile(std::string file);
+    // Appends canonical bytes of the selected parts of config to key, for exact comparison and
+    // hashing. Pointers are followed, shaders enter by content hash, render passes by attachment
+    // formats. The pipeline layout enters by handle, so keys are only comparable within one run
+    static void writeStateKey(VulkanContext& ctx, const PipelineConfigInfo& config, uint32_t parts, std::vector<char>& key);
     
-    
-    void createShaderModule(const std::vector<char>& code, VkShaderModule &shaderModule);
+private:
+    // Fills graphicsPipelineInfo, which then points into this object
+    void prepareCreateInfo();
+    // Throws when the shaders read vertex inputs, specialization constants, descriptors or push
+    // constants the config does not provide, before the driver or the validation layers see it
+    void validateShaderInterface(const SeShaderModule& vert, const SeShaderModule* frag) const;
 
     std::shared_ptr<VulkanContext> ctx;
+    VkPipelineShaderStageCreateInfo shaderStages[2]{};
+    VkSpecializationInfo specializationInfo{};
     
 };
 }
@@ -0,0 +1,355 @@
+﻿#include "SePipelineCache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "Config.h"
+#include "SeDevice.h"
+#include "SeHash.h"
+#include "SeProfiler.h"
+#include "vulkancontext.h"
+
+namespace SE {
+
+namespace {
+// Our own header in front of the driver blob. The driver validates its data loosely at best, a
+// truncated or bit flipped file must never reach vkCreatePipelineCache
+struct FileHeader
+{
+    char magic[4] = {'S', 'E', 'P', 'C'};
+    uint32_t version = 1;
+    uint64_t dataSize = 0;
+    uint64_t checksum = 0;
+};
+
+const char* lookupName(SePipelineCache::Lookup lookup)
+{
+    switch (lookup)
+    {
+    case SePipelineCache::Lookup::HIT: return "hit";
+    case SePipelineCache::Lookup::MISS: return "miss";
+    default: return "unknown";
+    }
+}
+}
+
+SePipelineCache::SePipelineCache(std::shared_ptr<VulkanContext> inctx) : ctx(inctx)
+{
+    SE_PROFILE_FUNCTION();
+
+    // One file per GPU, switching between two adapters does not throw the other one's cache away
+    const VkPhysicalDeviceProperties& properties = ctx->Se_device->properties;
+    std::ostringstream name;
+    name << "pipelines_" << std::hex << std::setfill('0') << std::setw(4) << properties.vendorID << "_" << std::setw(4) << properties.deviceID << ".bin";
+    path = (std::filesystem::path(Config::get().pipeline_cache_path()) / name.str()).string();
+
+    std::vector<char> data = loadFile();
+
+    VkPipelineCacheCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = data.size();
+    createInfo.pInitialData = data.empty() ? nullptr : data.data();
+    VkResult result = vkCreatePipelineCache(ctx->Se_device->device, &createInfo, nullptr, &pipeline_cache);
+    if (result != VK_SUCCESS && !data.empty())
+    {
+        // Header matched but the driver still refused it, compiling everything again beats failing
+        std::cout << "Pipeline cache: driver rejected " << path << " (" << result << "), starting empty" << std::endl;
+        data.clear();
+        createInfo.initialDataSize = 0;
+        createInfo.pInitialData = nullptr;
+        result = vkCreatePipelineCache(ctx->Se_device->device, &createInfo, nullptr, &pipeline_cache);
+    }
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+
+    stats.bLoaded = !data.empty();
+    stats.loadedBytes = data.size();
+    if (stats.bLoaded) std::cout << "Pipeline cache: loaded " << data.size() / 1024 << " KB from " << path << std::endl;
+    lastSave = std::chrono::steady_clock::now();
+}
+
+SePipelineCache::~SePipelineCache()
+{
+    if (ctx->Se_jobs) ctx->Se_jobs->wait(saveJob);
+    save();
+    vkDestroyPipelineCache(ctx->Se_device->device, pipeline_cache, nullptr);
+}
+
+std::vector<char> SePipelineCache::loadFile()
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) return {};
+
+    const std::streamsize fileSize = file.tellg();
+    FileHeader header;
+    if (fileSize < static_cast<std::streamsize>(sizeof(FileHeader)))
+    {
+        std::cout << "Pipeline cache: " << path << " is truncated, starting empty" << std::endl;
+        return {};
+    }
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    const FileHeader expected;
+    if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version ||
+        header.dataSize != static_cast<uint64_t>(fileSize) - sizeof(FileHeader))
+    {
+        std::cout << "Pipeline cache: " << path << " has an unknown format, starting empty" << std::endl;
+        return {};
+    }
+
+    std::vector<char> data(header.dataSize);
+    file.read(data.data(), data.size());
+    if (!file || hashBytes(data.data(), data.size()) != header.checksum)
+    {
+        std::cout << "Pipeline cache: " << path << " is corrupt, starting empty" << std::endl;
+        return {};
+    }
+    if (!isHeaderCompatible(data.data(), data.size()))
+    {
+        std::cout << "Pipeline cache: " << path << " was written by another device or driver, starting empty" << std::endl;
+        return {};
+    }
+    return data;
+}
+
+bool SePipelineCache::isHeaderCompatible(const char* data, size_t size) const
+{
+    VkPipelineCacheHeaderVersionOne header;
+    if (size < sizeof(header)) return false;
+    std::memcpy(&header, data, sizeof(header));
+
+    const VkPhysicalDeviceProperties& properties = ctx->Se_device->properties;
+    return header.headerSize >= sizeof(header) && header.headerSize <= size &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == properties.vendorID &&
+           header.deviceID == properties.deviceID &&
+           std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void SePipelineCache::save()
+{
+    SE_PROFILE_FUNCTION();
+    std::lock_guard<std::mutex> lock(saveMutex);
+
+    uint32_t created;
+    {
+        std::lock_guard<std::mutex> statsLock(statsMutex);
+        created = stats.created;
+    }
+
+    std::vector<char> data;
+    {
+        std::shared_lock<std::shared_mutex> cacheLock(cacheMutex);
+        size_t size = 0;
+        if (vkGetPipelineCacheData(ctx->Se_device->device, pipeline_cache, &size, nullptr) != VK_SUCCESS || size == 0) return;
+        data.resize(size);
+        // Pipelines created in between may grow the cache, a VK_INCOMPLETE result is still a valid prefix but not worth keeping
+        if (vkGetPipelineCacheData(ctx->Se_device->device, pipeline_cache, &size, data.data()) != VK_SUCCESS) return;
+        data.resize(size);
+    }
+
+    FileHeader header;
+    header.dataSize = data.size();
+    header.checksum = hashBytes(data.data(), data.size());
+
+    // Written next to the target and renamed over it, readers only ever see a complete file
+    std::error_code error;
+    const std::filesystem::path target(path);
+    if (target.has_parent_path()) std::filesystem::create_directories(target.parent_path(), error);
+    const std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(data.data(), data.size());
+        file.close();
+        if (!file)
+        {
+            std::cout << "Pipeline cache: failed to write " << tempPath << std::endl;
+            std::filesystem::remove(tempPath, error);
+            return;
+        }
+    }
+    std::filesystem::rename(tempPath, target, error);
+    if (error)
+    {
+        std::cout << "Pipeline cache: failed to replace " << path << ": " << error.message() << std::endl;
+        std::filesystem::remove(tempPath, error);
+        return;
+    }
+
+    std::lock_guard<std::mutex> statsLock(statsMutex);
+    savedCreations = created;
+}
+
+void SePipelineCache::saveIfDue()
+{
+    const float interval = Config::get().pipeline_cache_save_interval();
+    if (interval <= 0.f || !ctx->Se_jobs) return;
+
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<float>(now - lastSave).count() < interval || !saveJob.isDone()) return;
+    lastSave = now;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        if (stats.created == savedCreations) return;
+    }
+    // vkGetPipelineCacheData and the file write take milliseconds, keep them off the frame
+    ctx->Se_jobs->run([this]() { save(); }, &saveJob);
+}
+
+VkPipelineCache SePipelineCache::createThreadCache()
+{
+    SE_PROFILE_FUNCTION();
+    std::vector<char> data;
+    {
+        std::shared_lock<std::shared_mutex> lock(cacheMutex);
+        size_t size = 0;
+        if (vkGetPipelineCacheData(ctx->Se_device->device, pipeline_cache, &size, nullptr) == VK_SUCCESS && size > 0)
+        {
+            data.resize(size);
+            if (vkGetPipelineCacheData(ctx->Se_device->device, pipeline_cache, &size, data.data()) != VK_SUCCESS) size = 0;
+            data.resize(size);
+        }
+    }
+
+    VkPipelineCacheCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = data.size();
+    createInfo.pInitialData = data.empty() ? nullptr : data.data();
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    if (vkCreatePipelineCache(ctx->Se_device->device, &createInfo, nullptr, &cache) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create thread pipeline cache!");
+    }
+    return cache;
+}
+
+void SePipelineCache::mergeThreadCaches(const std::vector<VkPipelineCache>& caches)
+{
+    SE_PROFILE_FUNCTION();
+    if (caches.empty()) return;
+    {
+        std::unique_lock<std::shared_mutex> lock(cacheMutex);
+        if (vkMergePipelineCaches(ctx->Se_device->device, pipeline_cache, static_cast<uint32_t>(caches.size()), caches.data()) != VK_SUCCESS)
+        {
+            // Only costs the next run a recompile of what was built into them
+            std::cout << "Pipeline cache: failed to merge " << caches.size() << " thread caches" << std::endl;
+        }
+    }
+    for (VkPipelineCache cache : caches)
+    {
+        vkDestroyPipelineCache(ctx->Se_device->device, cache, nullptr);
+    }
+}
+
+VkResult SePipelineCache::createGraphicsPipeline(const VkGraphicsPipelineCreateInfo& createInfo, VkPipeline* pipeline, const std::string& name,
+                                                 VkPipelineCache cache)
+{
+    SE_PROFILE_FUNCTION();
+
+    VkGraphicsPipelineCreateInfo info = createInfo;
+    VkPipelineCreationFeedbackEXT feedback = {};
+    std::vector<VkPipelineCreationFeedbackEXT> stageFeedback(info.stageCount);
+    VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo = {};
+    if (ctx->Se_device->bPipelineFeedbackSupported)
+    {
+        feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+        feedbackInfo.pNext = info.pNext;
+        feedbackInfo.pPipelineCreationFeedback = &feedback;
+        feedbackInfo.pipelineStageCreationFeedbackCount = info.stageCount;
+        feedbackInfo.pPipelineStageCreationFeedbacks = stageFeedback.data();
+        info.pNext = &feedbackInfo;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(cacheMutex);
+    auto start = std::chrono::high_resolution_clock::now();
+    VkResult result = vkCreateGraphicsPipelines(ctx->Se_device->device, cache != VK_NULL_HANDLE ? cache : pipeline_cache, 1, &info, nullptr, pipeline);
+    double duration = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    if (result == VK_SUCCESS) recordCreation(name, feedback, duration);
+    return result;
+}
+
+VkResult SePipelineCache::createComputePipeline(const VkComputePipelineCreateInfo& createInfo, VkPipeline* pipeline, const std::string& name,
+                                                VkPipelineCache cache)
+{
+    SE_PROFILE_FUNCTION();
+
+    VkComputePipelineCreateInfo info = createInfo;
+    VkPipelineCreationFeedbackEXT feedback = {};
+    VkPipelineCreationFeedbackEXT stageFeedback = {};
+    VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo = {};
+    if (ctx->Se_device->bPipelineFeedbackSupported)
+    {
+        feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+        feedbackInfo.pNext = info.pNext;
+        feedbackInfo.pPipelineCreationFeedback = &feedback;
+        feedbackInfo.pipelineStageCreationFeedbackCount = 1;
+        feedbackInfo.pPipelineStageCreationFeedbacks = &stageFeedback;
+        info.pNext = &feedbackInfo;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(cacheMutex);
+    auto start = std::chrono::high_resolution_clock::now();
+    VkResult result = vkCreateComputePipelines(ctx->Se_device->device, cache != VK_NULL_HANDLE ? cache : pipeline_cache, 1, &info, nullptr, pipeline);
+    double duration = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    if (result == VK_SUCCESS) recordCreation(name, feedback, duration);
+    return result;
+}
+
+void SePipelineCache::recordCreation(const std::string& name, const VkPipelineCreationFeedbackEXT& feedback, double cpuDuration)
+{
+    Creation creation;
+    creation.name = name;
+    creation.duration = cpuDuration;
+    if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)
+    {
+        creation.lookup = (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) ? Lookup::HIT : Lookup::MISS;
+        creation.duration = feedback.duration / 1e6;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.created++;
+        if (creation.lookup == Lookup::HIT) stats.hits++;
+        if (creation.lookup == Lookup::MISS) stats.misses++;
+        stats.totalDuration += creation.duration;
+        creations.push_back(creation);
+    }
+
+    if (Config::get().print_pipeline_cache_stats())
+    {
+        std::cout << "Pipeline " << name << ": " << std::fixed << std::setprecision(2) << creation.duration << " ms, cache "
+                  << lookupName(creation.lookup) << std::defaultfloat << std::endl;
+    }
+}
+
+SePipelineCache::Stats SePipelineCache::getStats() const
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return stats;
+}
+
+std::vector<SePipelineCache::Creation> SePipelineCache::getCreations() const
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return creations;
+}
+
+void SePipelineCache::printStats() const
+{
+    Stats current = getStats();
+    std::cout << "Pipeline cache: " << current.created << " pipelines, " << current.hits << " hits, " << current.misses << " misses, "
+              << std::fixed << std::setprecision(2) << current.totalDuration << " ms creating, "
+              << (current.bLoaded ? std::to_string(current.loadedBytes / 1024) + " KB loaded" : std::string("started empty"))
+              << std::defaultfloat << std::endl;
+}
+
+}
@@ -0,0 +1,108 @@
+﻿#pragma once
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "SeJobSystem.h"
+
+namespace SE {
+struct VulkanContext;
+
+// Driver pipeline cache that survives restarts.
+//
+// Loaded right after the device is created and written back on destruction, plus every
+// pipeline_cache_save_interval seconds when new pipelines were compiled since the last save.
+// A file is only handed to the driver when its header matches this device's vendor, device and
+// pipelineCacheUUID, a driver update or a different GPU starts from an empty cache instead.
+// Files are written to a temporary name and renamed, a crash mid save never leaves a torn file.
+//
+// Every pipeline should be created through createGraphicsPipeline/createComputePipeline, which
+// also record whether the driver found it in the cache (VK_EXT_pipeline_creation_feedback).
+class SePipelineCache
+{
+public:
+    enum class Lookup
+    {
+        HIT,
+        MISS,
+        UNKNOWN     // no creation feedback support
+    };
+
+    struct Creation
+    {
+        std::string name;
+        Lookup lookup = Lookup::UNKNOWN;
+        double duration = 0.0;  // ms, driver reported when available
+    };
+
+    struct Stats
+    {
+        uint32_t created = 0;
+        uint32_t hits = 0;
+        uint32_t misses = 0;
+        double totalDuration = 0.0;  // ms
+        size_t loadedBytes = 0;      // accepted from disk at startup
+        bool bLoaded = false;
+    };
+
+    SePipelineCache(std::shared_ptr<VulkanContext> inctx);
+    ~SePipelineCache();
+
+    SePipelineCache(const SePipelineCache&) = delete;
+    void operator=(const SePipelineCache&) = delete;
+
+    VkPipelineCache get() const { return pipeline_cache; }
+
+    // vkCreate*Pipelines for a single pipeline through the cache. name is only used for the statistics,
+    // cache overrides the shared cache with one from createThreadCache()
+    VkResult createGraphicsPipeline(const VkGraphicsPipelineCreateInfo& createInfo, VkPipeline* pipeline, const std::string& name,
+                                    VkPipelineCache cache = VK_NULL_HANDLE);
+    VkResult createComputePipeline(const VkComputePipelineCreateInfo& createInfo, VkPipeline* pipeline, const std::string& name,
+                                   VkPipelineCache cache = VK_NULL_HANDLE);
+
+    // Private cache for one thread of a parallel compile, seeded with everything the shared cache
+    // holds so earlier runs still hit. Threads compiling into their own cache never contend on the
+    // driver's cache lock, mergeThreadCaches() folds the results back in and destroys them
+    VkPipelineCache createThreadCache();
+    void mergeThreadCaches(const std::vector<VkPipelineCache>& caches);
+
+    // Writes the cache now, on the calling thread
+    void save();
+    // Once a frame from the main thread. Saves on a job when the interval passed and something changed
+    void saveIfDue();
+
+    Stats getStats() const;
+    std::vector<Creation> getCreations() const;
+    void printStats() const;
+    const std::string& getPath() const { return path; }
+
+public:
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+
+private:
+    // File data the driver may use, empty when missing, corrupt or from another device/driver
+    std::vector<char> loadFile();
+    bool isHeaderCompatible(const char* data, size_t size) const;
+    void recordCreation(const std::string& name, const VkPipelineCreationFeedbackEXT& feedback, double cpuDuration);
+
+    std::shared_ptr<VulkanContext> ctx;
+    std::string path;
+
+    mutable std::mutex statsMutex;
+    Stats stats;
+    std::vector<Creation> creations;
+    uint32_t savedCreations = 0;    // stats.created at the last save
+
+    // vkMergePipelineCaches needs the destination to itself, everything else only reads or is internally synchronized
+    mutable std::shared_mutex cacheMutex;
+    std::mutex saveMutex;
+    SeJobCounter saveJob;
+    std::chrono::steady_clock::time_point lastSave;
+};
+
+}
@@ -0,0 +1,188 @@
+﻿#include "SePipelineLibrary.h"
+
+#include <iostream>
+#include <stdexcept>
+
+#include "SeDevice.h"
+#include "SeHash.h"
+#include "SePipelineCache.h"
+#include "SeProfiler.h"
+#include "vulkancontext.h"
+
+namespace SE {
+
+namespace {
+const SePipeline::StatePart PART_STATES[] = {SePipeline::VERTEX_INPUT, SePipeline::PRE_RASTERIZATION,
+                                             SePipeline::FRAGMENT_SHADER, SePipeline::FRAGMENT_OUTPUT};
+const VkGraphicsPipelineLibraryFlagsEXT PART_FLAGS[] = {
+    VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT, VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+    VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT, VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT};
+const char* PART_NAMES[] = {"vertex input", "pre-rasterization", "fragment shader", "fragment output"};
+}
+
+SePipelineLibrary::SePipelineLibrary(std::shared_ptr<VulkanContext> inctx)
+{
+    ctx = inctx;
+}
+
+SePipelineLibrary::~SePipelineLibrary()
+{
+    // Linked pipelines do not reference their libraries, these can go in any order
+    for (auto& [hash, bucket] : parts)
+    {
+        for (Part& part : bucket)
+        {
+            vkDestroyPipeline(ctx->Se_device->device, part.library, nullptr);
+        }
+    }
+}
+
+VkPipeline SePipelineLibrary::link(const SePipeline::PipelineConfigInfo& config, bool bOptimized, const std::string& name, VkPipelineCache cache)
+{
+    SE_PROFILE_FUNCTION();
+    VkPipeline libraries[PART_COUNT];
+    for (uint32_t i = 0; i < PART_COUNT; i++)
+    {
+        libraries[i] = getPart(i, config, name, cache);
+    }
+
+    VkPipelineLibraryCreateInfoKHR libraryInfo = {};
+    libraryInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+    libraryInfo.libraryCount = PART_COUNT;
+    libraryInfo.pLibraries = libraries;
+
+    VkGraphicsPipelineCreateInfo linkInfo = {};
+    linkInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    linkInfo.pNext = &libraryInfo;
+    linkInfo.flags = bOptimized ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+    linkInfo.layout = config.pipelineLayout;
+    linkInfo.basePipelineIndex = -1;
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult result = ctx->Se_pipeline_cache->createGraphicsPipeline(linkInfo, &pipeline, name + (bOptimized ? " (optimized link)" : " (fast link)"), cache);
+    if (result != VK_SUCCESS)
+    {
+        std::cout << "Failed to link graphics pipeline: " << result << std::endl;
+        throw std::runtime_error("Failed to link graphics pipeline");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (bOptimized) stats.optimizedLinks++;
+    else stats.fastLinks++;
+    return pipeline;
+}
+
+VkPipeline SePipelineLibrary::getPart(uint32_t partIndex, const SePipeline::PipelineConfigInfo& config, const std::string& name, VkPipelineCache cache)
+{
+    std::vector<char> key;
+    SePipeline::writeStateKey(*ctx, config, PART_STATES[partIndex], key);
+    const uint64_t hash = hashBytes(key.data(), key.size());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = parts.find(hash);
+        if (it != parts.end())
+        {
+            for (Part& part : it->second)
+            {
+                if (part.key == key)
+                {
+                    stats.partsReused++;
+                    return part.library;
+                }
+            }
+        }
+    }
+
+    // Two threads may compile the same part at once, the loser's copy is dropped below
+    VkPipeline library = compilePart(partIndex, config, name, cache);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Part>& bucket = parts[hash];
+    for (Part& part : bucket)
+    {
+        if (part.key == key)
+        {
+            vkDestroyPipeline(ctx->Se_device->device, library, nullptr);
+            return part.library;
+        }
+    }
+    bucket.push_back({std::move(key), library});
+    stats.partsCompiled++;
+    return library;
+}
+
+VkPipeline SePipelineLibrary::compilePart(uint32_t partIndex, const SePipeline::PipelineConfigInfo& config, const std::string& name, VkPipelineCache cache)
+{
+    SE_PROFILE_FUNCTION();
+    const VkGraphicsPipelineCreateInfo& full = config.graphicsPipelineInfo;
+
+    VkGraphicsPipelineLibraryCreateInfoEXT partInfo = {};
+    partInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+    partInfo.flags = PART_FLAGS[partIndex];
+
+    // Only the state of this part, the others stay null. Dynamic state is taken where it applies
+    VkGraphicsPipelineCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    info.pNext = &partInfo;
+    info.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+    info.pDynamicState = full.pDynamicState;
+    info.basePipelineIndex = -1;
+    switch (PART_STATES[partIndex])
+    {
+    case SePipeline::VERTEX_INPUT:
+        info.pVertexInputState = full.pVertexInputState;
+        info.pInputAssemblyState = full.pInputAssemblyState;
+        break;
+    case SePipeline::PRE_RASTERIZATION:
+        // Stage 0 is always the vertex shader
+        info.stageCount = 1;
+        info.pStages = full.pStages;
+        info.pViewportState = full.pViewportState;
+        info.pRasterizationState = full.pRasterizationState;
+        info.pTessellationState = full.pTessellationState;
+        info.layout = full.layout;
+        info.renderPass = full.renderPass;
+        info.subpass = full.subpass;
+        break;
+    case SePipeline::FRAGMENT_SHADER:
+        // No stage at all for depth only pipelines
+        info.stageCount = full.stageCount - 1;
+        info.pStages = info.stageCount > 0 ? full.pStages + 1 : nullptr;
+        info.pDepthStencilState = full.pDepthStencilState;
+        info.pMultisampleState = full.pMultisampleState;
+        info.layout = full.layout;
+        info.renderPass = full.renderPass;
+        info.subpass = full.subpass;
+        break;
+    default:
+        info.pColorBlendState = full.pColorBlendState;
+        info.pMultisampleState = full.pMultisampleState;
+        info.renderPass = full.renderPass;
+        info.subpass = full.subpass;
+        break;
+    }
+
+    VkPipeline library = VK_NULL_HANDLE;
+    VkResult result = ctx->Se_pipeline_cache->createGraphicsPipeline(info, &library, name + " [" + PART_NAMES[partIndex] + "]", cache);
+    if (result != VK_SUCCESS)
+    {
+        std::cout << "Failed to create " << PART_NAMES[partIndex] << " pipeline library: " << result << std::endl;
+        throw std::runtime_error("Failed to create pipeline library");
+    }
+    return library;
+}
+
+SePipelineLibrary::Stats SePipelineLibrary::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void SePipelineLibrary::printStats() const
+{
+    Stats current = getStats();
+    std::cout << "Pipeline library: " << current.partsCompiled << " parts compiled, " << current.partsReused << " reused, "
+              << current.fastLinks << " fast links, " << current.optimizedLinks << " optimized links" << std::endl;
+}
+
+}
@@ -0,0 +1,67 @@
+﻿#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "SePipeline.h"
+
+namespace SE {
+struct VulkanContext;
+
+// Graphics pipelines linked from separately compiled parts (VK_EXT_graphics_pipeline_library).
+//
+// A pipeline is split into vertex input, pre-rasterization, fragment shader and fragment output
+// libraries. Each part is cached by the hash of just its own state, so a new permutation usually
+// only compiles the one part that changed and links the rest. A fast link takes well under a
+// millisecond. Parts retain link time optimization info, so an optimized link of the same parts
+// produces a pipeline that is as fast on the GPU as a monolithic one.
+//
+// Only created when the device supports the extension, SePipeline falls back to monolithic
+// creation otherwise. Thread safe, parts are compiled outside the lock.
+class SePipelineLibrary
+{
+public:
+    struct Stats
+    {
+        uint32_t partsCompiled = 0;
+        uint32_t partsReused = 0;
+        uint32_t fastLinks = 0;
+        uint32_t optimizedLinks = 0;
+    };
+
+    SePipelineLibrary(std::shared_ptr<VulkanContext> inctx);
+    ~SePipelineLibrary();
+
+    SePipelineLibrary(const SePipelineLibrary&) = delete;
+    void operator=(const SePipelineLibrary&) = delete;
+
+    // config must have its graphicsPipelineInfo filled, see SePipeline::linkGraphicsPipeline()
+    VkPipeline link(const SePipeline::PipelineConfigInfo& config, bool bOptimized, const std::string& name, VkPipelineCache cache = VK_NULL_HANDLE);
+
+    Stats getStats() const;
+    void printStats() const;
+
+private:
+    static constexpr uint32_t PART_COUNT = 4;
+
+    struct Part
+    {
+        std::vector<char> key;
+        VkPipeline library = VK_NULL_HANDLE;
+    };
+
+    VkPipeline getPart(uint32_t partIndex, const SePipeline::PipelineConfigInfo& config, const std::string& name, VkPipelineCache cache);
+    VkPipeline compilePart(uint32_t partIndex, const SePipeline::PipelineConfigInfo& config, const std::string& name, VkPipelineCache cache);
+
+    std::shared_ptr<VulkanContext> ctx;
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, std::vector<Part>> parts;
+    Stats stats;
+};
+
+}
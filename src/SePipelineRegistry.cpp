@@ -0,0 +1,388 @@
+﻿#include "SePipelineRegistry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+
+#include "Config.h"
+#include "SeDevice.h"
+#include "SeHash.h"
+#include "SeJobSystem.h"
+#include "SePipelineCache.h"
+#include "SePipelineLibrary.h"
+#include "SeProfiler.h"
+#include "SeRenderer.h"
+#include "SeShaderCache.h"
+#include "vulkancontext.h"
+
+namespace SE {
+
+SePipelineRegistry::SePipelineRegistry(std::shared_ptr<VulkanContext> inctx)
+{
+    ctx = inctx;
+}
+
+SePipelineRegistry::~SePipelineRegistry()
+{
+    // Background compiles still write into their entries
+    if (ctx->Se_jobs) ctx->Se_jobs->wait(asyncCompiles);
+    // SePipeline destroys its VkPipeline, the caller guarantees the GPU is done with all of them
+    pipelines.clear();
+}
+
+std::vector<char> SePipelineRegistry::serializeConfig(const SePipeline::PipelineConfigInfo& config)
+{
+    std::vector<char> key;
+    key.reserve(512);
+    SePipeline::writeStateKey(*ctx, config, SePipeline::ALL_STATE, key);
+    return key;
+}
+
+uint64_t SePipelineRegistry::hashConfig(const SePipeline::PipelineConfigInfo& config)
+{
+    std::vector<char> key = serializeConfig(config);
+    return hashBytes(key.data(), key.size());
+}
+
+SePipelineEntry* SePipelineRegistry::registerGraphicsPipeline(const SePipeline::PipelineConfigInfo& config)
+{
+    std::vector<char> key = serializeConfig(config);
+    const uint64_t hash = hashBytes(key.data(), key.size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::unique_ptr<SePipelineEntry>>& bucket = pipelines[hash];
+    for (auto& entry : bucket)
+    {
+        if (entry->key == key)
+        {
+            deduplicated++;
+            return entry.get();
+        }
+    }
+
+    auto entry = std::make_unique<SePipelineEntry>();
+    entry->key = std::move(key);
+    entry->pipeline = std::make_unique<SePipeline>(ctx);
+    entry->pipeline->pipeline_config_info = config;
+    entry->pipeline->state_hash = hash;
+    entry->name = entry->pipeline->getName();
+    bucket.push_back(std::move(entry));
+    pipelineCount++;
+    return bucket.back().get();
+}
+
+SePipeline* SePipelineRegistry::getGraphicsPipeline(const SePipeline::PipelineConfigInfo& config)
+{
+    return getGraphicsPipeline(registerGraphicsPipeline(config));
+}
+
+SePipeline* SePipelineRegistry::getGraphicsPipeline(SePipelineEntry* entry)
+{
+    if (SePipeline* pipeline = entry->get()) return pipeline;
+    compile(*entry);
+    return entry->get();
+}
+
+bool SePipelineRegistry::compile(SePipelineEntry& entry, VkPipelineCache cache)
+{
+    // Concurrent callers wait here for the first one, a throwing compile leaves the entry for the next to retry
+    std::lock_guard<std::mutex> lock(entry.compileMutex);
+    if (entry.get()) return false;
+
+    SE_PROFILE_FUNCTION();
+    if (!ctx->Se_pipeline_library)
+    {
+        entry.pipeline->createGraphicsPipeline(cache);
+        entry.bFailed.store(false, std::memory_order_relaxed);
+        entry.ready.store(entry.pipeline.get(), std::memory_order_release);
+        return true;
+    }
+
+    entry.pipeline->linkGraphicsPipeline(false, cache);
+    entry.bFailed.store(false, std::memory_order_relaxed);
+    entry.ready.store(entry.pipeline.get(), std::memory_order_release);
+    if (Config::get().pipeline_library_optimize())
+    {
+        // The fast link stays alive, frames in flight may still use it after the swap. applyReloads() may
+        // retire it before the job runs, so the job works on a copy of its state taken under the lock
+        SePipelineEntry* optimizeEntry = &entry;
+        auto optimized = std::make_unique<SePipeline>(ctx);
+        optimized->pipeline_config_info = entry.pipeline->pipeline_config_info;
+        optimized->state_hash = entry.pipeline->state_hash;
+        const uint64_t generation = entry.generation;
+        ctx->Se_jobs->run([this, optimizeEntry, pipeline = optimized.release(), generation]() {
+            std::unique_ptr<SePipeline> optimized(pipeline);
+            try
+            {
+                optimized->linkGraphicsPipeline(true);
+                // A shader reload may have replaced the fast link meanwhile, the optimized one is then outdated
+                std::lock_guard<std::mutex> lock(optimizeEntry->compileMutex);
+                if (optimizeEntry->generation != generation) return;
+                optimizeEntry->optimizedPipeline = std::move(optimized);
+                optimizeEntry->ready.store(optimizeEntry->optimizedPipeline.get(), std::memory_order_release);
+            } catch (const std::exception& e)
+            {
+                std::cout << "Optimized link of pipeline " << optimizeEntry->name << " failed, keeping the fast link: " << e.what() << std::endl;
+            }
+        }, &asyncCompiles);
+    }
+    return true;
+}
+
+uint32_t SePipelineRegistry::rebuildForShaders(const std::unordered_set<std::string>& variants)
+{
+    SE_PROFILE_FUNCTION();
+    auto usesVariant = [&](const SePipeline::PipelineConfigInfo& config) {
+        if (variants.count(SeShaderCache::variantName(config.vertShaderFile, config.vertShaderDefines))) return true;
+        return !config.fragShaderFile.empty() && variants.count(SeShaderCache::variantName(config.fragShaderFile, config.fragShaderDefines)) > 0;
+    };
+
+    std::vector<SePipelineEntry*> affected;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& [hash, bucket] : pipelines)
+        {
+            for (auto& entry : bucket)
+            {
+                affected.push_back(entry.get());
+            }
+        }
+    }
+
+    uint32_t rebuilt = 0;
+    for (SePipelineEntry* entry : affected)
+    {
+        SePipeline::PipelineConfigInfo config;
+        bool bCompiled;
+        {
+            std::lock_guard<std::mutex> lock(entry->compileMutex);
+            config = entry->pipeline->pipeline_config_info;
+            bCompiled = entry->get() != nullptr;
+        }
+        if (!usesVariant(config)) continue;
+
+        // The state key holds the module hashes, which changed with the reload
+        std::vector<char> key = serializeConfig(config);
+        std::unique_ptr<SePipeline> pipeline;
+        if (bCompiled)
+        {
+            pipeline = std::make_unique<SePipeline>(ctx);
+            pipeline->pipeline_config_info = config;
+            pipeline->state_hash = hashBytes(key.data(), key.size());
+            try
+            {
+                // Already off the render thread, no point in a fast link first
+                if (ctx->Se_pipeline_library) pipeline->linkGraphicsPipeline(Config::get().pipeline_library_optimize());
+                else pipeline->createGraphicsPipeline();
+            } catch (const std::exception& e)
+            {
+                std::cout << "Rebuild of pipeline " << entry->name << " failed, keeping the previous one: " << e.what() << std::endl;
+                continue;
+            }
+            rebuilt++;
+        }
+
+        std::lock_guard<std::mutex> lock(entry->compileMutex);
+        entry->reloadedPipeline = std::move(pipeline);
+        entry->reloadedKey = std::move(key);
+        entry->bReloadReady.store(true, std::memory_order_release);
+        bReloadsPending.store(true, std::memory_order_release);
+    }
+    return rebuilt;
+}
+
+void SePipelineRegistry::applyReloads()
+{
+    if (!bReloadsPending.exchange(false, std::memory_order_acq_rel)) return;
+    SE_PROFILE_FUNCTION();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // Entries move to the bucket of their new key, pointers to them stay valid
+    std::vector<std::unique_ptr<SePipelineEntry>> rekeyed;
+    for (auto& [hash, bucket] : pipelines)
+    {
+        for (auto it = bucket.begin(); it != bucket.end();)
+        {
+            SePipelineEntry& entry = **it;
+            if (!entry.bReloadReady.exchange(false, std::memory_order_acq_rel))
+            {
+                ++it;
+                continue;
+            }
+
+            std::lock_guard<std::mutex> entryLock(entry.compileMutex);
+            if (entry.reloadedPipeline)
+            {
+                for (std::unique_ptr<SePipeline>* retired : {&entry.pipeline, &entry.optimizedPipeline})
+                {
+                    if (!*retired) continue;
+                    ctx->Se_renderer->deferDestroy([pipeline = retired->release()]() { delete pipeline; });
+                }
+                entry.pipeline = std::move(entry.reloadedPipeline);
+                entry.ready.store(entry.pipeline.get(), std::memory_order_release);
+            } else
+            {
+                entry.pipeline->state_hash = hashBytes(entry.reloadedKey.data(), entry.reloadedKey.size());
+            }
+            entry.generation++;
+            entry.key = std::move(entry.reloadedKey);
+            entry.reloadedKey.clear();
+            rekeyed.push_back(std::move(*it));
+            it = bucket.erase(it);
+        }
+    }
+    for (auto& entry : rekeyed)
+    {
+        const uint64_t hash = hashBytes(entry->key.data(), entry->key.size());
+        pipelines[hash].push_back(std::move(entry));
+    }
+}
+
+SePipeline* SePipelineRegistry::acquireGraphicsPipeline(SePipelineEntry* entry, SePipeline* fallback, uint64_t frame)
+{
+    if (SePipeline* pipeline = entry->get()) return pipeline;
+
+    if (!entry->bQueued.exchange(true, std::memory_order_acq_rel))
+    {
+        ctx->Se_jobs->run([this, entry]() {
+            try
+            {
+                compile(*entry);
+            } catch (const std::exception& e)
+            {
+                // The old draws keep working with the fallback, a broken shader must not end the run
+                std::cout << "Background compile of pipeline " << entry->name << " failed: " << e.what() << std::endl;
+                entry->bFailed.store(true, std::memory_order_relaxed);
+            }
+        }, &asyncCompiles);
+    }
+
+    // Counted once per frame however many draws use the entry
+    if (entry->lastFallbackFrame.exchange(frame, std::memory_order_relaxed) != frame)
+    {
+        entry->fallbackFrames.fetch_add(1, std::memory_order_relaxed);
+    }
+    return fallback;
+}
+
+SePipelineRegistry::WarmupResult SePipelineRegistry::warmUp(const std::vector<SePipeline::PipelineConfigInfo>& manifest)
+{
+    SE_PROFILE_FUNCTION();
+    auto start = std::chrono::high_resolution_clock::now();
+    WarmupResult result;
+    result.requested = static_cast<uint32_t>(manifest.size());
+
+    struct Pending
+    {
+        SePipelineEntry* entry = nullptr;
+        bool bCompiled = false;
+        double duration = 0.0;
+        uint32_t thread = 0;
+        std::exception_ptr error;
+    };
+    // Registered on this thread, which also loads every shader module before the workers start
+    std::vector<Pending> pending;
+    for (const SePipeline::PipelineConfigInfo& config : manifest)
+    {
+        SePipelineEntry* entry = registerGraphicsPipeline(config);
+        if (entry->get()) continue;
+        bool bDuplicate = std::any_of(pending.begin(), pending.end(), [&](const Pending& other) { return other.entry == entry; });
+        if (bDuplicate) continue;
+        Pending item;
+        item.entry = entry;
+        pending.push_back(std::move(item));
+    }
+
+    SeJobSystem& jobs = *ctx->Se_jobs;
+    // One slot per job thread plus one for a caller from outside the job system
+    const uint32_t threadCount = jobs.getThreadCount();
+    std::vector<VkPipelineCache> threadCaches(threadCount + 1, VK_NULL_HANDLE);
+    jobs.parallelFor(static_cast<uint32_t>(pending.size()), 1, [&](uint32_t begin, uint32_t end) {
+        uint32_t thread = std::min(jobs.getThreadIndex(), threadCount);
+        for (uint32_t i = begin; i < end; i++)
+        {
+            Pending& item = pending[i];
+            try
+            {
+                // Created by the first pipeline a thread picks up, threads that never get one cost nothing
+                if (threadCaches[thread] == VK_NULL_HANDLE) threadCaches[thread] = ctx->Se_pipeline_cache->createThreadCache();
+                auto compileStart = std::chrono::high_resolution_clock::now();
+                // False when a background compile got there first, it is finished once this returns
+                item.bCompiled = compile(*item.entry, threadCaches[thread]);
+                item.duration = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - compileStart).count();
+                item.thread = thread;
+            } catch (...)
+            {
+                item.error = std::current_exception();
+            }
+        }
+    });
+
+    std::vector<VkPipelineCache> usedCaches;
+    for (VkPipelineCache cache : threadCaches)
+    {
+        if (cache != VK_NULL_HANDLE) usedCaches.push_back(cache);
+    }
+    ctx->Se_pipeline_cache->mergeThreadCaches(usedCaches);
+    result.threadCount = static_cast<uint32_t>(usedCaches.size());
+
+    for (const Pending& item : pending)
+    {
+        if (item.bCompiled) result.compiles.push_back({item.entry->name, item.duration, item.thread});
+    }
+    // Everything that compiled is usable, the first failure is reported like a direct request would
+    for (const Pending& item : pending)
+    {
+        if (item.error) std::rethrow_exception(item.error);
+    }
+
+    result.wallTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return result;
+}
+
+void SePipelineRegistry::printWarmup(const WarmupResult& result)
+{
+    double compileTime = 0.0;
+    for (const WarmupResult::Compile& compile : result.compiles)
+    {
+        compileTime += compile.duration;
+    }
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Pipeline warm-up: " << result.compiles.size() << " of " << result.requested << " pipelines compiled on "
+              << result.threadCount << " threads in " << result.wallTime << " ms (" << compileTime << " ms compiling)" << std::endl;
+    for (const WarmupResult::Compile& compile : result.compiles)
+    {
+        std::cout << "    " << compile.name << ": " << compile.duration << " ms on thread " << compile.thread << std::endl;
+    }
+    std::cout << std::defaultfloat;
+}
+
+size_t SePipelineRegistry::getPipelineCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pipelineCount;
+}
+
+uint64_t SePipelineRegistry::getDeduplicatedCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return deduplicated;
+}
+
+void SePipelineRegistry::printFallbackStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& [hash, bucket] : pipelines)
+    {
+        for (const auto& entry : bucket)
+        {
+            if (entry->getFallbackFrames() == 0) continue;
+            std::cout << "Pipeline " << entry->name << ": " << entry->getFallbackFrames() << " fallback frames"
+                      << (entry->hasFailed() ? ", compile failed" : "") << std::endl;
+        }
+    }
+}
+
+}
@@ -0,0 +1,141 @@
+﻿#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "SePipeline.h"
+#include "SeJobSystem.h"
+
+namespace SE {
+struct VulkanContext;
+
+// One distinct pipeline state in the SePipelineRegistry. Lives as long as the registry, so materials
+// and components may keep a pointer to it
+class SePipelineEntry
+{
+public:
+    // Compiled pipeline, nullptr while it is still queued or compiling or when it failed
+    SePipeline* get() const { return ready.load(std::memory_order_acquire); }
+    bool hasFailed() const { return bFailed.load(std::memory_order_relaxed); }
+    // Frames that drew with a fallback (or skipped draws) because this pipeline was not ready
+    uint64_t getFallbackFrames() const { return fallbackFrames.load(std::memory_order_relaxed); }
+    const std::string& getName() const { return name; }
+
+private:
+    friend class SePipelineRegistry;
+
+    std::vector<char> key;
+    std::string name;
+    // Holds the config from registration on, the VkPipeline once compiled
+    std::unique_ptr<SePipeline> pipeline;
+    // Replaces a fast linked pipeline once the background optimized link is done
+    std::unique_ptr<SePipeline> optimizedPipeline;
+    std::mutex compileMutex;
+    // Bumped by applyReloads() whenever pipeline is replaced or rekeyed, guarded by compileMutex.
+    // A background optimized link only lands if the generation it started from is still current
+    uint64_t generation = 0;
+    std::atomic<SePipeline*> ready{nullptr};
+    std::atomic<bool> bQueued{false};
+    std::atomic<bool> bFailed{false};
+    std::atomic<uint64_t> fallbackFrames{0};
+    std::atomic<uint64_t> lastFallbackFrame{~0ull};
+    // Rebuilt for changed shaders, swapped in by applyReloads(). The pipeline is null when the
+    // entry was never compiled and only its key changes
+    std::unique_ptr<SePipeline> reloadedPipeline;
+    std::vector<char> reloadedKey;
+    std::atomic<bool> bReloadReady{false};
+};
+
+// Graphics pipelines deduplicated by their full state.
+//
+// Registration hashes everything that ends up in the VkPipeline: shader code (by module
+// content hash, not file name), vertex layout, fixed function state, dynamic states, specialization
+// data, the layout and the render pass attachment formats. Requests with the same state share one
+// SePipeline, materials can ask for their pipeline every time they need it. Equal hashes are
+// confirmed against the stored state, a collision never hands out the wrong pipeline.
+//
+// Pipelines are compiled on demand: blocking through getGraphicsPipeline(), ahead of time through
+// warmUp(), or in the background through acquireGraphicsPipeline() while draws use a fallback.
+// They are owned by the registry and live until it is destroyed, except for pipelines replaced by
+// a shader reload, which are retired through the renderer's deletion queue. Thread safe.
+class SePipelineRegistry
+{
+public:
+    SePipelineRegistry(std::shared_ptr<VulkanContext> inctx);
+    ~SePipelineRegistry();
+
+    SePipelineRegistry(const SePipelineRegistry&) = delete;
+    void operator=(const SePipelineRegistry&) = delete;
+
+    struct WarmupResult
+    {
+        struct Compile
+        {
+            std::string name;
+            double duration = 0.0;  // ms, on the compiling thread
+            uint32_t thread = 0;
+        };
+        std::vector<Compile> compiles;  // manifest entries that were not in the registry yet
+        uint32_t requested = 0;
+        uint32_t threadCount = 0;
+        double wallTime = 0.0;  // ms
+    };
+
+    // Entry for the state, registered without compiling on first request
+    SePipelineEntry* registerGraphicsPipeline(const SePipeline::PipelineConfigInfo& config);
+
+    // Compiled pipeline for the state, compiles on the calling thread (or waits for a compile
+    // already running) when needed
+    SePipeline* getGraphicsPipeline(const SePipeline::PipelineConfigInfo& config);
+    SePipeline* getGraphicsPipeline(SePipelineEntry* entry);
+
+    // Never blocks. Returns the compiled pipeline or, until it is ready, queues its compile on a job
+    // once and returns fallback, which may be nullptr to skip the draw. Every frame that has to
+    // fall back is counted once per entry. Failed compiles keep falling back
+    SePipeline* acquireGraphicsPipeline(SePipelineEntry* entry, SePipeline* fallback, uint64_t frame);
+
+    // Compiles every manifest entry that is not in the registry yet, spread over the job system's
+    // threads. Each thread builds into its own pipeline cache, they are merged into the shared one
+    // at the end. Returns once all are registered, later getGraphicsPipeline calls for them are lookups
+    WarmupResult warmUp(const std::vector<SePipeline::PipelineConfigInfo>& manifest);
+    static void printWarmup(const WarmupResult& result);
+
+    // Builds new pipelines for every entry using one of the variants (SeShaderCache::variantName())
+    // on the calling thread, after SeShaderCache::reload() gave them new modules. Entries whose
+    // rebuild fails keep their pipeline. Nothing changes until applyReloads(), returns the number rebuilt
+    uint32_t rebuildForShaders(const std::unordered_set<std::string>& variants);
+    // Render thread, at a frame boundary. Swaps in rebuilt pipelines and defers destroying the old ones
+    // until the frames in flight are done with them
+    void applyReloads();
+
+    // The pipeline layout enters by handle, so a hash is only meaningful within one run
+    uint64_t hashConfig(const SePipeline::PipelineConfigInfo& config);
+
+    size_t getPipelineCount() const;
+    // Registrations answered with an existing entry
+    uint64_t getDeduplicatedCount() const;
+    // Entries that had to fall back at least once, with their frame counts
+    void printFallbackStats() const;
+
+private:
+    // Canonical byte form of the state, pointers are followed and handles replaced by content where possible
+    std::vector<char> serializeConfig(const SePipeline::PipelineConfigInfo& config);
+    // Runs at most once per entry, concurrent callers wait for it. True when this call compiled it
+    bool compile(SePipelineEntry& entry, VkPipelineCache cache = VK_NULL_HANDLE);
+
+    std::shared_ptr<VulkanContext> ctx;
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, std::vector<std::unique_ptr<SePipelineEntry>>> pipelines;
+    size_t pipelineCount = 0;
+    uint64_t deduplicated = 0;
+    SeJobCounter asyncCompiles;
+    std::atomic<bool> bReloadsPending{false};
+};
+
+}
@@ -0,0 +1,168 @@
+﻿#include "SeProfiler.h"
+
+#include <iostream>
+
+#ifdef SE_ENABLE_PROFILER
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#endif
+
+namespace SE {
+
+#ifdef SE_ENABLE_PROFILER
+
+namespace {
+
+struct ThreadBuffer
+{
+    std::vector<SeProfiler::Event> events = std::vector<SeProfiler::Event>(SeProfiler::EVENTS_PER_THREAD);
+    // Only the owning thread writes, the trace writer reads it once recording is idle
+    std::atomic<uint64_t> count{0};
+    uint32_t threadId = 0;
+    std::string threadName;
+};
+
+struct Registry
+{
+    std::mutex mutex;
+    // Owned here so events survive the thread that recorded them
+    std::vector<std::unique_ptr<ThreadBuffer>> threads;
+    // Reference point to convert ticks to microseconds
+    uint64_t startTicks = SeProfiler::now();
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+};
+
+Registry& registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+// Take the time reference at startup, before the first zone opens
+const bool bRegistryReady = (registry(), true);
+
+thread_local ThreadBuffer* threadBuffer = nullptr;
+
+ThreadBuffer* registerThread()
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.threads.push_back(std::make_unique<ThreadBuffer>());
+    ThreadBuffer* buffer = reg.threads.back().get();
+    buffer->threadId = static_cast<uint32_t>(reg.threads.size());
+    buffer->threadName = "Thread " + std::to_string(buffer->threadId);
+    return buffer;
+}
+
+inline void pushEvent(const SeProfiler::Event& event)
+{
+    ThreadBuffer* buffer = threadBuffer;
+    if (!buffer) buffer = threadBuffer = registerThread();
+    uint64_t index = buffer->count.load(std::memory_order_relaxed);
+    buffer->events[index & (SeProfiler::EVENTS_PER_THREAD - 1)] = event;
+    buffer->count.store(index + 1, std::memory_order_release);
+}
+
+void writeEscaped(std::ofstream& file, const char* text)
+{
+    for (const char* c = text; *c; c++)
+    {
+        if (*c == '"' || *c == '\\') file << '\\';
+        file << *c;
+    }
+}
+
+}
+
+void SeProfiler::recordZone(const char* name, uint64_t begin, uint64_t end)
+{
+    pushEvent({name, begin, end, false});
+}
+
+void SeProfiler::frameMark(uint64_t frameNumber)
+{
+    pushEvent({"Frame", now(), frameNumber, true});
+}
+
+void SeProfiler::setThreadName(const char* name)
+{
+    if (!threadBuffer) threadBuffer = registerThread();
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    threadBuffer->threadName = name;
+}
+
+bool SeProfiler::writeChromeTrace(const std::string& path)
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    // rdtsc has no fixed unit, calibrate it against the steady clock over the whole run
+    const uint64_t endTicks = now();
+    const double elapsedUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - reg.startTime).count();
+    const double usPerTick = endTicks > reg.startTicks && elapsedUs > 0.0 ? elapsedUs / static_cast<double>(endTicks - reg.startTicks) : 0.0;
+    auto toUs = [&](uint64_t ticks) { return ticks > reg.startTicks ? static_cast<double>(ticks - reg.startTicks) * usPerTick : 0.0; };
+
+    std::ofstream file(path);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open CPU trace file: " << path << std::endl;
+        return false;
+    }
+
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool bFirst = true;
+    uint64_t eventCount = 0;
+    for (const auto& thread : reg.threads)
+    {
+        file << (bFirst ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->threadId
+             << ",\"args\":{\"name\":\"";
+        writeEscaped(file, thread->threadName.c_str());
+        file << "\"}}";
+        bFirst = false;
+
+        const uint64_t count = thread->count.load(std::memory_order_acquire);
+        const uint64_t first = count > EVENTS_PER_THREAD ? count - EVENTS_PER_THREAD : 0;
+        for (uint64_t i = first; i < count; i++)
+        {
+            const Event& event = thread->events[i & (EVENTS_PER_THREAD - 1)];
+            file << ",\n{\"name\":\"";
+            writeEscaped(file, event.name);
+            if (event.bFrameMark)
+            {
+                file << "\",\"ph\":\"i\",\"s\":\"g\",\"ts\":" << toUs(event.begin)
+                     << ",\"pid\":1,\"tid\":" << thread->threadId << ",\"args\":{\"frame\":" << event.end << "}}";
+            } else
+            {
+                file << "\",\"ph\":\"X\",\"ts\":" << toUs(event.begin) << ",\"dur\":" << toUs(event.end) - toUs(event.begin)
+                     << ",\"pid\":1,\"tid\":" << thread->threadId << "}";
+            }
+        }
+        eventCount += count - first;
+    }
+    file << "\n]}\n";
+
+    std::cout << "Wrote " << eventCount << " CPU trace events to " << path << std::endl;
+    return true;
+}
+
+#else
+
+void SeProfiler::recordZone(const char*, uint64_t, uint64_t) {}
+void SeProfiler::frameMark(uint64_t) {}
+void SeProfiler::setThreadName(const char*) {}
+
+bool SeProfiler::writeChromeTrace(const std::string& path)
+{
+    std::cout << "CPU profiler compiled out, regenerate with premake5 --profile to write " << path << std::endl;
+    return false;
+}
+
+#endif
+
+}
@@ -0,0 +1,87 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+
+// CPU instrumentation, exported as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+//
+// Everything is compiled out unless SE_ENABLE_PROFILER is defined (premake5 --profile),
+// the macros then expand to nothing and cost nothing.
+#ifdef SE_ENABLE_PROFILER
+#define SE_PROFILE_CONCAT_INNER(a, b) a##b
+#define SE_PROFILE_CONCAT(a, b) SE_PROFILE_CONCAT_INNER(a, b)
+// name must outlive the trace, string literals only
+#define SE_PROFILE_ZONE(name) ::SE::SeProfileZone SE_PROFILE_CONCAT(seProfileZone, __LINE__)(name)
+#define SE_PROFILE_FUNCTION() SE_PROFILE_ZONE(__FUNCTION__)
+#define SE_PROFILE_FRAME(frameNumber) ::SE::SeProfiler::frameMark(frameNumber)
+#define SE_PROFILE_THREAD(name) ::SE::SeProfiler::setThreadName(name)
+#else
+#define SE_PROFILE_ZONE(name) ((void)0)
+#define SE_PROFILE_FUNCTION() ((void)0)
+#define SE_PROFILE_FRAME(frameNumber) ((void)0)
+#define SE_PROFILE_THREAD(name) ((void)0)
+#endif
+
+#ifdef SE_ENABLE_PROFILER
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define SE_PROFILE_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SE_PROFILE_RDTSC 1
+#else
+#include <chrono>
+#endif
+#endif
+
+namespace SE {
+
+class SeProfiler
+{
+public:
+    struct Event
+    {
+        const char* name;
+        uint64_t begin;   // ticks
+        uint64_t end;     // ticks, frame number for frame markers
+        bool bFrameMark;
+    };
+
+    // Events per thread, the oldest are overwritten once a thread records more
+    static constexpr uint32_t EVENTS_PER_THREAD = 1 << 16;
+
+    static uint64_t now()
+    {
+#if defined(SE_PROFILE_RDTSC)
+        return __rdtsc();
+#elif defined(SE_ENABLE_PROFILER)
+        return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#else
+        return 0;
+#endif
+    }
+
+    static void recordZone(const char* name, uint64_t begin, uint64_t end);
+    static void frameMark(uint64_t frameNumber);
+    static void setThreadName(const char* name);
+
+    // Writes what the ring buffers currently hold, call once the recording threads are idle.
+    // Returns false when profiling is compiled out or the file cannot be opened
+    static bool writeChromeTrace(const std::string& path);
+};
+
+// Records one complete event on destruction, nothing but two timestamps and a ring buffer write
+class SeProfileZone
+{
+public:
+    explicit SeProfileZone(const char* inname) : name(inname), begin(SeProfiler::now()) {}
+    ~SeProfileZone() { SeProfiler::recordZone(name, begin, SeProfiler::now()); }
+
+    SeProfileZone(const SeProfileZone&) = delete;
+    SeProfileZone& operator=(const SeProfileZone&) = delete;
+
+private:
+    const char* name;
+    uint64_t begin;
+};
+
+}
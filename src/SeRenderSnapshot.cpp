@@ -0,0 +1,82 @@
+﻿#include "SeRenderSnapshot.h"
+
+#include <thread>
+
+namespace SE {
+
+namespace {
+// Handoffs usually arrive within microseconds, sleeping right away would cost a wake up each frame
+constexpr uint32_t WAIT_SPINS = 256;
+}
+
+SeRenderSnapshots::SeRenderSnapshots()
+{
+    for (uint32_t i = 0; i < SLOT_COUNT; i++)
+    {
+        freeSlots.push(i);
+    }
+}
+
+template <class Pred>
+void SeRenderSnapshots::waitFor(Pred&& pred)
+{
+    for (uint32_t i = 0; i < WAIT_SPINS; i++)
+    {
+        if (pred() || bStopped.load(std::memory_order_acquire)) return;
+        std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    sleepers.fetch_add(1, std::memory_order_seq_cst);
+    sleepCondition.wait(lock, [&]() { return pred() || bStopped.load(std::memory_order_acquire); });
+    sleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void SeRenderSnapshots::notify()
+{
+    // Pairs with the sleepers increment before the predicate is checked under the lock
+    if (sleepers.load(std::memory_order_seq_cst) > 0)
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        sleepCondition.notify_all();
+    }
+}
+
+SeRenderSnapshot* SeRenderSnapshots::beginWrite()
+{
+    waitFor([this]() { return freeSlots.pop(writeSlot); });
+    if (bStopped.load(std::memory_order_acquire)) return nullptr;
+    return &slots[writeSlot];
+}
+
+void SeRenderSnapshots::publish()
+{
+    // As many ring entries as slots, never full
+    readySlots.push(writeSlot);
+    writeSlot = ~0u;
+    notify();
+}
+
+const SeRenderSnapshot* SeRenderSnapshots::acquire()
+{
+    waitFor([this]() { return readySlots.pop(readSlot); });
+    if (bStopped.load(std::memory_order_acquire)) return nullptr;
+    return &slots[readSlot];
+}
+
+void SeRenderSnapshots::release()
+{
+    freeSlots.push(readSlot);
+    readSlot = ~0u;
+    notify();
+}
+
+void SeRenderSnapshots::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        bStopped.store(true, std::memory_order_release);
+    }
+    sleepCondition.notify_all();
+}
+
+}
@@ -0,0 +1,116 @@
+﻿#pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <GLM/glm.hpp>
+
+namespace SE {
+
+class SeModel;
+class SePipelineEntry;
+
+struct SimplePushConstantData
+{
+    glm::mat4 transform{1.f};
+    alignas(16) glm::vec3 color;
+};
+
+// Everything the renderer needs to record one frame. The simulation fills it, after publishing it
+// is read only, so the render thread never touches the world or the scene graph.
+// Models are borrowed, entities must not be destroyed while frames using them are in flight
+struct SeRenderSnapshot
+{
+    uint64_t simulationFrame = 0;
+    glm::mat4 projection{1.f};
+    glm::mat4 view{1.f};
+    // Per drawn object, in the order of the renderer's draw query
+    std::vector<SimplePushConstantData> pushData;
+    std::vector<SeModel*> models;
+    std::vector<SePipelineEntry*> pipelines;
+    // SeShaderFeatures::mask, for objects without their own pipeline
+    std::vector<uint32_t> features;
+    // SeOcclusionCuller bounds for the same objects, empty without the depth prepass
+    std::vector<char> bounds;
+
+    uint32_t getObjectCount() const { return static_cast<uint32_t>(models.size()); }
+};
+
+// Lock free ring for one producer and one consumer thread
+template <class T, uint32_t CAPACITY>
+class SeSpscRing
+{
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+public:
+    bool push(const T& value)
+    {
+        const uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == CAPACITY) return false;
+        items[t & (CAPACITY - 1)] = value;
+        tail.store(t + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    bool pop(T& value)
+    {
+        const uint32_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_seq_cst)) return false;
+        value = items[h & (CAPACITY - 1)];
+        head.store(h + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+private:
+    alignas(64) std::atomic<uint32_t> head{0};
+    alignas(64) std::atomic<uint32_t> tail{0};
+    std::array<T, CAPACITY> items{};
+};
+
+// Double buffered snapshots between the simulation and the render thread.
+//
+// The simulation writes one slot while the render thread records the other. A published snapshot
+// waits for at most the frame currently being recorded, the simulation then blocks in beginWrite()
+// until that frame is done, so it never runs more than one frame ahead. A render thread without work
+// waits in acquire(). Slots are reused, their vectors keep their capacity and a steady frame
+// allocates nothing.
+class SeRenderSnapshots
+{
+public:
+    static constexpr uint32_t SLOT_COUNT = 2;
+
+    SeRenderSnapshots();
+
+    // Simulation thread. nullptr once stopped
+    SeRenderSnapshot* beginWrite();
+    void publish();
+
+    // Render thread. Oldest published snapshot, nullptr once stopped
+    const SeRenderSnapshot* acquire();
+    void release();
+
+    // Wakes both sides, every later call returns nullptr
+    void stop();
+
+private:
+    // Spins briefly, then sleeps until notify()
+    template <class Pred>
+    void waitFor(Pred&& pred);
+    void notify();
+
+    std::array<SeRenderSnapshot, SLOT_COUNT> slots;
+    SeSpscRing<uint32_t, SLOT_COUNT> readySlots;  // simulation -> render
+    SeSpscRing<uint32_t, SLOT_COUNT> freeSlots;   // render -> simulation
+    uint32_t writeSlot = ~0u;
+    uint32_t readSlot = ~0u;
+
+    std::atomic<bool> bStopped{false};
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::atomic<uint32_t> sleepers{0};
+};
+
+}
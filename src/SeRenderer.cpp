@@ -3,97 +3,277 @@
 #include <array>
 #include <chrono>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
+#include <thread>
 
 #include "Config.h"
 #include "SeDevice.h"
-#include "SeObject.h"
+#include "SeGpuProfiler.h"
+#include "SeLayoutCache.h"
+#include "SeComponents.h"
+#include "SeOcclusionCuller.h"
 #include "SePipeline.h"
+#include "SePipelineRegistry.h"
+#include "SeProfiler.h"
+#include "SeShaderCache.h"
 
 namespace SE {
 
-struct SimplePushConstantData
-{
-    glm::mat4 transform{1.f};
-    alignas(16) glm::vec3 color;
-};
-
 SeRenderer::SeRenderer(std::shared_ptr<VulkanContext> inctx)
 {
     ctx = inctx;
+    aspectRatio.store(ctx->Se_swapchain->extentAspectRatio());
+    if (Config::get().depth_prepass()) checkDepthPrepassShaders();
     loadObjects();
     createPipelineLayout();
     createPipeline();
     createCommandBuffers();
+    ctx->Se_gpu_profiler = new SeGpuProfiler(ctx);
+    if (Config::get().depth_prepass())
+    {
+        ctx->Se_occlusion = new SeOcclusionCuller(ctx);
+    }
 }
 
 SeRenderer::~SeRenderer()
 {
-    vkDestroyPipelineLayout(ctx->Se_device->device, pipeline_layout, nullptr);
+    flushDeletionQueue(true);
+    delete ctx->Se_gpu_profiler;
+    ctx->Se_gpu_profiler = nullptr;
+    delete ctx->Se_occlusion;
+    ctx->Se_occlusion = nullptr;
 }
 
-void SeRenderer::createPipelineLayout()
+void SeRenderer::checkDepthPrepassShaders()
 {
-    VkPushConstantRange pushConstantRange = {};
-    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-    pushConstantRange.offset = 0;
-    pushConstantRange.size = sizeof(SimplePushConstantData);
-    
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 0;
-    pipelineLayoutInfo.pSetLayouts = nullptr;
-    pipelineLayoutInfo.pushConstantRangeCount = 1;
-    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
-    
-    if (vkCreatePipelineLayout(ctx->Se_device->device, &pipelineLayoutInfo, VK_NULL_HANDLE, &pipeline_layout) != VK_SUCCESS)
+    // Only simple_shader ships prebuilt SPIR-V. Without shaderc the other shaders have to come from a
+    // ShaderCooker archive or a compileshaders.bat run, fail before any of the setup rather than halfway
+    for (const char* file : {"simple_shader.vert", "depth_prepass.vert", "hiz_downsample.comp", "occlusion_cull.comp"})
     {
-        throw std::runtime_error("failed to create pipeline layout!");
+        try
+        {
+            ctx->Se_shaders->getModule(file);
+        } catch (const std::exception& e)
+        {
+            std::cout << "depth_prepass=true cannot load " << file << ": " << e.what() << std::endl;
+            throw std::runtime_error("depth_prepass needs a build with shaderc (premake5 --shaderc), shaders/shaders.pak from "
+                                     "ShaderCooker or the .spv files of shaders/compileshaders.bat");
+        }
     }
+}
 
-    
+void SeRenderer::createPipelineLayout()
+{
+    // Reflected from the main pass shaders, the depth prepass reads a subset of the same push constants.
+    // Draws push the whole SimplePushConstantData to both stages, a shader reading past it throws here
+    SePipeline::PipelineConfigInfo defaults;
+    SePipeline::defaultPipelineConfigInfo(defaults);
+    const SeShaderModule& vert = ctx->Se_shaders->getModule(defaults.vertShaderFile);
+    const SeShaderModule& frag = ctx->Se_shaders->getModule(defaults.fragShaderFile);
+    pipeline_layout = ctx->Se_layouts->getPipelineLayout({&vert, &frag}, sizeof(SimplePushConstantData));
 }
 
 void SeRenderer::createPipeline()
 {
-    ctx->Se_pipeline = new SePipeline(ctx);
-    ctx->Se_pipeline->defaultPipelineConfigInfo();
-    ctx->Se_pipeline->pipeline_config_info.renderPass = ctx->Se_swapchain->render_pass;
-    ctx->Se_pipeline->pipeline_config_info.pipelineLayout = pipeline_layout;
-    ctx->Se_pipeline->createGraphicsPipeline();
+    SePipeline::defaultPipelineConfigInfo(mainPipelineConfig);
+    mainPipelineConfig.pipelineLayout = pipeline_layout;
+    mainFeatures.apply(*ctx, mainPipelineConfig);
+    if (Config::get().depth_prepass())
+    {
+        // Depth is final after the prepass, only shade the visible surface
+        mainPipelineConfig.depthStencilInfo.depthCompareOp = VK_COMPARE_OP_EQUAL;
+        mainPipelineConfig.depthStencilInfo.depthWriteEnable = VK_FALSE;
+
+        SePipeline::defaultPipelineConfigInfo(depthPrepassPipelineConfig);
+        depthPrepassPipelineConfig.vertShaderFile = "depth_prepass.vert";
+        depthPrepassPipelineConfig.fragShaderFile = "";
+        depthPrepassPipelineConfig.bindingDescriptions = SeModel::Vertex::getPositionBindingDescriptions();
+        depthPrepassPipelineConfig.attributeDescriptions = SeModel::Vertex::getPositionAttributeDescriptions();
+        depthPrepassPipelineConfig.colorBlendInfo.attachmentCount = 0;
+        depthPrepassPipelineConfig.pipelineLayout = pipeline_layout;
+    }
+    updatePipelineRenderPasses();
 
+    // Compiled in parallel before the first frame, the lookups below then only find them
+    SePipelineRegistry::printWarmup(ctx->Se_pipelines->warmUp(collectPipelineManifest()));
+    recreatePipelines();
 }
 
-void SeRenderer::recreateSwapChain(int imageIndex)
+std::vector<SePipeline::PipelineConfigInfo> SeRenderer::collectPipelineManifest() const
 {
-    VkExtent2D extent = {static_cast<uint32_t>(ctx->Se_window->width), static_cast<uint32_t>(ctx->Se_window->height)};
-    while (extent.width == 0 || extent.height == 0)
+    std::vector<SePipeline::PipelineConfigInfo> manifest{mainPipelineConfig};
+    if (Config::get().depth_prepass()) manifest.push_back(depthPrepassPipelineConfig);
+
+    // Material permutations, objects drawing with them later find them compiled. Feature sets the
+    // shaders do not tell apart end up as one state, warmUp() compiles it once
+    std::vector<uint32_t> featureMasks;
+    std::istringstream list(Config::get().material_features());
+    std::string name;
+    while (std::getline(list, name, ','))
     {
-        extent = {static_cast<uint32_t>(ctx->Se_window->width), static_cast<uint32_t>(ctx->Se_window->height)};
-        glfwWaitEvents();
+        SeShaderFeatures features;
+        if (!SeShaderFeatures::fromString(name, features))
+        {
+            std::cout << "material_features: unknown feature set " << name << std::endl;
+            continue;
+        }
+        featureMasks.push_back(features.mask);
+    }
+    if (Config::get().material_features().empty())
+    {
+        for (uint32_t featureMask = 0; featureMask < (1u << SeShaderFeatures::FEATURE_COUNT); featureMask++) featureMasks.push_back(featureMask);
+    }
+    for (const auto& [featureMask, entry] : materialPipelines) featureMasks.push_back(featureMask);
+
+    for (uint32_t featureMask : featureMasks)
+    {
+        if (featureMask == mainFeatures.mask) continue;
+        SeShaderFeatures features;
+        features.mask = featureMask;
+        SePipeline::PipelineConfigInfo config = mainPipelineConfig;
+        features.apply(*ctx, config);
+        manifest.push_back(std::move(config));
+    }
+    return manifest;
+}
+
+SePipelineEntry* SeRenderer::getMaterialPipeline(uint32_t featureMask)
+{
+    auto it = materialPipelines.find(featureMask);
+    if (it != materialPipelines.end()) return it->second;
+
+    SeShaderFeatures features;
+    features.mask = featureMask;
+    SePipeline::PipelineConfigInfo config = mainPipelineConfig;
+    features.apply(*ctx, config);
+    SePipelineEntry* entry = ctx->Se_pipelines->registerGraphicsPipeline(config);
+    materialPipelines.emplace(featureMask, entry);
+    return entry;
+}
+
+void SeRenderer::updatePipelineRenderPasses()
+{
+    mainPipelineConfig.renderPass = ctx->Se_swapchain->render_pass;
+    mainPipelineConfig.colorFormat = ctx->Se_swapchain->getSwapChainImageFormat();
+    mainPipelineConfig.depthFormat = ctx->Se_swapchain->getSwapChainDepthFormat();
+    depthPrepassPipelineConfig.renderPass = ctx->Se_swapchain->depth_prepass_render_pass;
+    depthPrepassPipelineConfig.depthFormat = ctx->Se_swapchain->getSwapChainDepthFormat();
+}
+
+void SeRenderer::recreatePipelines()
+{
+    // Pipelines are looked up by state, render passes with unchanged formats get the ones already built
+    updatePipelineRenderPasses();
+    mainPipelineEntry = ctx->Se_pipelines->registerGraphicsPipeline(mainPipelineConfig);
+    ctx->Se_pipeline = ctx->Se_pipelines->getGraphicsPipeline(mainPipelineEntry);
+    if (Config::get().depth_prepass())
+    {
+        depthPrepassPipelineEntry = ctx->Se_pipelines->registerGraphicsPipeline(depthPrepassPipelineConfig);
+        depth_prepass_pipeline = ctx->Se_pipelines->getGraphicsPipeline(depthPrepassPipelineEntry);
+    }
+
+    // Materials follow the main pipeline into the new render passes, their old entries stay in the
+    // registry for frames in flight. Compiled in the background again on their next draw
+    std::vector<uint32_t> featureMasks;
+    for (const auto& [featureMask, entry] : materialPipelines) featureMasks.push_back(featureMask);
+    materialPipelines.clear();
+    for (uint32_t featureMask : featureMasks) getMaterialPipeline(featureMask);
+}
+
+bool SeRenderer::recreateSwapChain()
+{
+    // Minimized, nothing to render into until the window comes back (headless has no window)
+    if (ctx->Se_window && !ctx->Se_window->waitWhileMinimized()) return false;
+
+    // The old swap chain is handed to vkCreateSwapchainKHR and retired, frames still in flight may
+    // present from it or reference its framebuffers, so it is destroyed once they have completed
+    SeSwapChain* oldSwapChain = ctx->Se_swapchain;
+    if (bPresentSettingsPending.exchange(false))
+    {
+        PresentSettings settings;
+        {
+            std::lock_guard<std::mutex> lock(presentSettingsMutex);
+            settings = pendingPresentSettings;
+        }
+        ctx->Se_swapchain = new SeSwapChain(ctx, oldSwapChain, settings);
+    } else
+    {
+        ctx->Se_swapchain = new SeSwapChain(ctx, oldSwapChain);
+    }
+    deferDestroy([oldSwapChain]() { delete oldSwapChain; });
+    aspectRatio.store(ctx->Se_swapchain->extentAspectRatio());
+    // Frame slots restart at zero when the number of frames in flight changed
+    currentFrameIndex = ctx->Se_swapchain->getCurrentFrame();
+
+    bool swapChainsFormatsIdentical = ctx->Se_swapchain->formatsMatchPrevious();
+    if (!swapChainsFormatsIdentical)
+    {
+        // Render passes were recreated, the pipelines built against them are no longer compatible.
+        // Only happens when the surface format changes (e.g. moving to an HDR monitor). The old
+        // pipelines stay in the registry, frames in flight may still use them
+        recreatePipelines();
+    }
+
+    std::cout << "Swapchain Recreated \n" << "New Swapchain format identical? " << (swapChainsFormatsIdentical ? "true":"false") << std::endl;
+
+    if (ctx->Se_occlusion) ctx->Se_occlusion->recreateHiZ();
+    return true;
+}
+
+void SeRenderer::deferDestroy(std::function<void()>&& destroyFn)
+{
+    deletionQueue.push_back({frameNumber, std::move(destroyFn)});
+}
+
+void SeRenderer::flushDeletionQueue(bool bForce)
+{
+    if (bForce) vkDeviceWaitIdle(ctx->Se_device->device);
+
+    // Entries queued during frame N are safe once frame N + framesInFlight acquires,
+    // by then the fence of every frame that could have used them has been waited on.
+    // Lowering the frame count waits on all old fences, so the current count is always enough
+    const uint64_t framesInFlight = static_cast<uint64_t>(ctx->Se_swapchain->framesInFlight());
+    while (!deletionQueue.empty() && (bForce || deletionQueue.front().frameNumber + framesInFlight <= frameNumber))
+    {
+        deletionQueue.front().destroyFn();
+        deletionQueue.pop_front();
+    }
+}
+
+void SeRenderer::setPresentProfile(PresentProfile profile)
+{
+    setPresentSettings(PresentSettings::fromProfile(profile));
+}
+
+void SeRenderer::setPresentSettings(const PresentSettings& settings)
+{
+    std::lock_guard<std::mutex> lock(presentSettingsMutex);
+    pendingPresentSettings = settings;
+    bPresentSettingsPending.store(true);
+}
+
+void SeRenderer::limitFrameRate()
+{
+    int frameCap = ctx->Se_swapchain->getPresentSettings().frameCap;
+    if (frameCap <= 0) return;
+
+    auto frameDuration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / frameCap));
+    auto now = std::chrono::steady_clock::now();
+    if (now < nextFrameTime)
+    {
+        std::this_thread::sleep_until(nextFrameTime);
+        nextFrameTime += frameDuration;
+    } else
+    {
+        // Fell behind (or first frame), don't try to catch up with a burst of frames
+        nextFrameTime = now + frameDuration;
     }
-    vkDeviceWaitIdle(ctx->Se_device->device);
-
-    ctx->Se_swapchain->clearOldSwapChain();
-    ctx->Se_swapchain = new SeSwapChain(ctx, ctx->Se_swapchain);
-    bool swapChainsFormatsIdentical = ctx->Se_swapchain->compareOldSwapFormats();
-    if (!swapChainsFormatsIdentical) throw std::runtime_error("swapchain formats not identical!");
-
-    std::cout << "Swapchain Recreated \n" << "New Swapchain format identical? " << (swapChainsFormatsIdentical ? "true":"false") << std::endl;    
-
-    /*
-    ctx->Se_swapchain->cleanupSwapChain();
-    ctx->Se_swapchain->createSwapChain();
-    ctx->Se_swapchain->createImageViews();
-    ctx->Se_swapchain->createDepthResources();
-    ctx->Se_swapchain->createFramebuffers();
-    */
-    
-    //createPipeline();
 }
 
 void SeRenderer::createCommandBuffers()
 {
+    // Allocated for the maximum so changing the frames in flight never reallocates
     command_buffers.resize(SeSwapChain::MAX_FRAMES_IN_FLIGHT);
 
     VkCommandBufferAllocateInfo allocInfo = {};
@@ -109,23 +289,189 @@ void SeRenderer::createCommandBuffers()
     
 }
 
-void SeRenderer::renderObjects(VkCommandBuffer commandBuffer, SeCamera &camera)
+Entity SeRenderer::createObject(std::shared_ptr<SeModel> model, glm::vec3 color, const TransformComponent& transform, SeSceneGraph::NodeId parent)
 {
-    ctx->Se_pipeline->bind(commandBuffer);
+    SeSceneGraph::NodeId node = scene_graph.createNode(transform, parent);
+    return world.createEntity(RenderComponent{std::move(model), color}, SceneNodeComponent{node});
+}
 
-    auto projectionView = camera.getProjectionMatrix() * camera.getViewMatrix();
-    
-    for (auto& obj: objects)
+void SeRenderer::clearObjects()
+{
+    world.clear();
+    scene_graph.clear();
+}
+
+void SeRenderer::writeSnapshot(SeRenderSnapshot& snapshot, SeCamera& camera)
+{
+    SE_PROFILE_FUNCTION();
+    scene_graph.update();
+    snapshot.projection = camera.getProjectionMatrix();
+    snapshot.view = camera.getViewMatrix();
+    writePushConstants(snapshot.projection * snapshot.view, world, scene_graph, snapshot.pushData, ctx->Se_jobs);
+
+    // Same query and therefore the same order as the push constants and the culler's bounds
+    snapshot.models.clear();
+    snapshot.pipelines.clear();
+    snapshot.features.clear();
+    world.eachChunk<const RenderComponent, const SceneNodeComponent>(
+        [&](uint32_t count, const Entity*, const RenderComponent* renders, const SceneNodeComponent*) {
+            for (uint32_t k = 0; k < count; k++)
+            {
+                snapshot.models.push_back(renders[k].model.get());
+                snapshot.pipelines.push_back(renders[k].pipeline);
+                snapshot.features.push_back(renders[k].features.mask);
+            }
+        });
+
+    if (ctx->Se_occlusion)
+    {
+        snapshot.bounds.resize(SeOcclusionCuller::boundsSize(snapshot.getObjectCount()));
+        SeOcclusionCuller::writeObjectBounds(world, scene_graph, snapshot.bounds.data(), ctx->Se_jobs);
+    } else
+    {
+        snapshot.bounds.clear();
+    }
+}
+
+void SeRenderer::writePushConstants(const glm::mat4& projectionView, SeWorld& world, const SeSceneGraph& sceneGraph, std::vector<SimplePushConstantData>& pushData, SeJobSystem* jobs)
+{
+    pushData.resize(world.count<RenderComponent, SceneNodeComponent>());
+    auto writeChunk = [&](uint32_t first, uint32_t count, const Entity*, const RenderComponent* renders, const SceneNodeComponent* nodes) {
+        for (uint32_t k = 0; k < count; k++)
+        {
+            pushData[first + k].color = renders[k].color;
+            pushData[first + k].transform = projectionView * sceneGraph.getWorld(nodes[k].node);
+        }
+    };
+    if (jobs)
+    {
+        world.parallelEachChunk<const RenderComponent, const SceneNodeComponent>(*jobs, writeChunk);
+        return;
+    }
+    uint32_t first = 0;
+    world.eachChunk<const RenderComponent, const SceneNodeComponent>(
+        [&](uint32_t count, const Entity* entities, const RenderComponent* renders, const SceneNodeComponent* nodes) {
+            writeChunk(first, count, entities, renders, nodes);
+            first += count;
+        });
+}
+
+void SeRenderer::renderObjects(VkCommandBuffer commandBuffer, const SeRenderSnapshot& snapshot)
+{
+    SE_PROFILE_FUNCTION();
+    // Stands in for pipelines still compiling, same layout, render pass and vertex input
+    SePipeline* fallback = Config::get().skip_pending_pipelines() ? nullptr : ctx->Se_pipeline;
+    SePipeline* bound = nullptr;
+
+    const uint32_t count = snapshot.getObjectCount();
+    uint32_t drawn = 0;
+    // Objects come in runs of the same material, only look up the pipeline when the features change
+    uint32_t materialMask = mainFeatures.mask;
+    SePipelineEntry* materialEntry = nullptr;
+    for (uint32_t i = 0; i < count; i++)
     {
-        
-        SimplePushConstantData push{};
-        push.color = obj.color;
-        push.transform = projectionView * obj.transform.mat4();
-
-        vkCmdPushConstants(commandBuffer, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(SimplePushConstantData), &push);
-        obj.model->bind(commandBuffer);
-        obj.model->draw(commandBuffer);
+        SePipelineEntry* entry = snapshot.pipelines[i];
+        if (!entry && snapshot.features[i] != mainFeatures.mask)
+        {
+            if (snapshot.features[i] != materialMask)
+            {
+                materialMask = snapshot.features[i];
+                materialEntry = getMaterialPipeline(materialMask);
+            }
+            entry = materialEntry;
+        }
+        SePipeline* pipeline = ctx->Se_pipeline;
+        if (entry) pipeline = ctx->Se_pipelines->acquireGraphicsPipeline(entry, fallback, frameNumber);
+        if (!pipeline) continue;
+        if (pipeline != bound)
+        {
+            pipeline->bind(commandBuffer);
+            bound = pipeline;
+        }
+        drawn++;
+
+        SeModel* model = snapshot.models[i];
+        vkCmdPushConstants(commandBuffer, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(SimplePushConstantData), &snapshot.pushData[i]);
+        model->bind(commandBuffer);
+        if (ctx->Se_occlusion)
+        {
+            model->drawIndirect(commandBuffer, ctx->Se_occlusion->getIndirectBuffer(), ctx->Se_occlusion->getIndirectOffset(SeOcclusionCuller::MAIN, i));
+        } else
+        {
+            model->draw(commandBuffer);
+        }
     }
+    drawCount += drawn;
+}
+
+void SeRenderer::renderDepthPrepass(VkCommandBuffer commandBuffer, const SeRenderSnapshot& snapshot)
+{
+    SE_PROFILE_FUNCTION();
+    assert(isFrameInProgress() && "Cannot call renderDepthPrepass() while frame is not in progress!");
+    assert(ctx->Se_occlusion && "Depth prepass is disabled in config");
+
+    ctx->Se_occlusion->updateObjects(currentFrameIndex, snapshot);
+
+    SeGpuProfiler* profiler = ctx->Se_gpu_profiler;
+    // Phase 1: whatever survives last frame's pyramid
+    {
+        SeGpuProfiler::Scope scope(profiler, commandBuffer, "Cull early");
+        ctx->Se_occlusion->cull(commandBuffer, currentFrameIndex, SeOcclusionCuller::EARLY);
+    }
+    {
+        SeGpuProfiler::Scope scope(profiler, commandBuffer, "Depth prepass early");
+        drawDepthPrepass(commandBuffer, snapshot, ctx->Se_swapchain->depth_prepass_render_pass, SeOcclusionCuller::EARLY);
+    }
+
+    // Phase 2: retest the rejected objects against this frame's depth
+    {
+        SeGpuProfiler::Scope scope(profiler, commandBuffer, "Hi-Z build");
+        ctx->Se_occlusion->buildHiZ(commandBuffer, currentImageIndex);
+    }
+    {
+        SeGpuProfiler::Scope scope(profiler, commandBuffer, "Cull late");
+        ctx->Se_occlusion->cull(commandBuffer, currentFrameIndex, SeOcclusionCuller::LATE);
+    }
+    {
+        SeGpuProfiler::Scope scope(profiler, commandBuffer, "Depth prepass late");
+        drawDepthPrepass(commandBuffer, snapshot, ctx->Se_swapchain->depth_prepass_load_render_pass, SeOcclusionCuller::LATE);
+    }
+
+    // Complete pyramid for next frame's first phase
+    SeGpuProfiler::Scope scope(profiler, commandBuffer, "Hi-Z build final");
+    ctx->Se_occlusion->buildHiZ(commandBuffer, currentImageIndex);
+}
+
+void SeRenderer::drawDepthPrepass(VkCommandBuffer commandBuffer, const SeRenderSnapshot& snapshot, VkRenderPass renderPass, uint32_t phase)
+{
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = renderPass;
+    renderPassInfo.framebuffer = ctx->Se_swapchain->getDepthPrepassFrameBuffer(currentImageIndex);
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent = ctx->Se_swapchain->getSwapChainExtent();
+
+    VkClearValue clearValue = {};
+    clearValue.depthStencil = { 1.0f, 0 };
+    renderPassInfo.clearValueCount = 1;
+    renderPassInfo.pClearValues = &clearValue;
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    setViewportAndScissor(commandBuffer);
+
+    depth_prepass_pipeline->bind(commandBuffer);
+    const uint32_t count = snapshot.getObjectCount();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        vkCmdPushConstants(commandBuffer, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(SimplePushConstantData), &snapshot.pushData[i]);
+        snapshot.models[i]->bindPositions(commandBuffer);
+        snapshot.models[i]->drawIndirect(
+            commandBuffer,
+            ctx->Se_occlusion->getIndirectBuffer(),
+            ctx->Se_occlusion->getIndirectOffset(static_cast<SeOcclusionCuller::Phase>(phase), i));
+    }
+    drawCount += count;
+
+    vkCmdEndRenderPass(commandBuffer);
 }
 
 void SeRenderer::freeCommandBuffers()
@@ -142,21 +488,43 @@ void SeRenderer::freeCommandBuffers()
 
 VkCommandBuffer SeRenderer::beginFrame()
 {    
+    SE_PROFILE_FUNCTION();
     assert(!isFrameInProgress() && "Cannot call beginFrame() while frame is already in progress!");
-    updateFPS();
+    if (bPresentSettingsPending.load() && !recreateSwapChain()) return nullptr;
+    limitFrameRate();
     // Grab a swap chain image
     auto result = ctx->Se_swapchain->acquireNextImage(&currentImageIndex);
     if (result == VK_ERROR_OUT_OF_DATE_KHR)
     {
-        recreateSwapChain(currentImageIndex);
-        ctx->Se_pipeline->recreateGraphicsPipeline();
+        recreateSwapChain();
         return nullptr;
     }
-    if (result != VK_SUCCESS)
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
     {
         throw std::runtime_error("failed to acquire swap chain image!");
     }
+    // acquireNextImage waited for this frame slot to retire, older frames are done with retired resources
+    flushDeletionQueue(false);
+    // Pipelines rebuilt for reloaded shaders take over here, the ones they replace join the deletion queue
+    ctx->Se_pipelines->applyReloads();
     bFrameInProgress = true;
+    drawCount = 0;
+    // Fast linked pipelines are swapped for their optimized links once those are done
+    ctx->Se_pipeline = mainPipelineEntry->get();
+    if (depthPrepassPipelineEntry) depth_prepass_pipeline = depthPrepassPipelineEntry->get();
+
+    auto now = std::chrono::steady_clock::now();
+    frame_pacing.frameNumber = frameNumber + 1;
+    frame_pacing.frameInterval = std::chrono::duration<double, std::milli>(now - lastBeginFrame).count();
+    frame_pacing.cpuWaitOnGpu = ctx->Se_swapchain->getGpuWaitTime();
+    frame_pacing.acquireWait = ctx->Se_swapchain->getAcquireWaitTime();
+    frame_pacing.completedFrames = ctx->Se_swapchain->completedFrames();
+    // The very first frame has nothing to measure its interval against
+    if (lastBeginFrame.time_since_epoch().count() != 0)
+    {
+        frame_stats.addFrame(frame_pacing.frameNumber, frame_pacing.frameInterval, frame_pacing.cpuWaitOnGpu + frame_pacing.acquireWait);
+    }
+    lastBeginFrame = now;
 
     auto commandBuffer = getCurrentCommandBuffer();
     VkCommandBufferBeginInfo beginInfo = {};
@@ -167,30 +535,46 @@ VkCommandBuffer SeRenderer::beginFrame()
         throw std::runtime_error("failed to begin command buffer recording!");
     }
 
+    // The slot's previous frame retired in acquireNextImage, its GPU timings are ready
+    ctx->Se_gpu_profiler->beginFrame(commandBuffer, currentFrameIndex, frameNumber + 1);
+    if (ctx->Se_gpu_profiler->getResultFrame() > frame_pacing.gpuFrameNumber)
+    {
+        frame_pacing.gpuFrameNumber = ctx->Se_gpu_profiler->getResultFrame();
+        frame_pacing.gpuFrameTime = ctx->Se_gpu_profiler->getFrameTime();
+        frame_pacing.gpuCompletionTime = ctx->Se_gpu_profiler->getFrameEndTime();
+        frame_stats.addGpuTime(frame_pacing.gpuFrameNumber, frame_pacing.gpuFrameTime);
+    }
+    ctx->Se_gpu_profiler->beginScope(commandBuffer, "Frame", false);
+    updateFrameStats();
+
     return commandBuffer;
 }
 
 void SeRenderer::endFrame()
 {
+    SE_PROFILE_FUNCTION();
     assert(isFrameInProgress() && "No frames are in progress to end.");
     auto commandBuffer = getCurrentCommandBuffer();
+    ctx->Se_gpu_profiler->endScope(commandBuffer);
     if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) { throw std::runtime_error("failed to end command buffer recording!"); }
     bFrameInProgress = false;
+    lastDrawCount = drawCount;
     auto result = ctx->Se_swapchain->submitCommandBuffers(&commandBuffer, &currentImageIndex);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || ctx->Se_window->framebufferResized)
+    // The frame was submitted either way, advance before a possible recreate so the swap chain
+    // and the renderer agree on which frame slot comes next
+    frameNumber++;
+    currentFrameIndex = (currentFrameIndex + 1) % ctx->Se_swapchain->framesInFlight();
+    bool bResized = ctx->Se_window && ctx->Se_window->framebufferResized;
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || bResized)
     {
-        ctx->Se_window->framebufferResized = false;
-        recreateSwapChain(currentImageIndex);
-        ctx->Se_pipeline->recreateGraphicsPipeline();
-        
+        if (ctx->Se_window) ctx->Se_window->framebufferResized = false;
+        recreateSwapChain();
         return;
     }
     if (result != VK_SUCCESS)
     {
         throw std::runtime_error("failed to submit swap chain command buffers!");
     }
-    currentFrameIndex = (currentFrameIndex + 1) % SeSwapChain::MAX_FRAMES_IN_FLIGHT; 
-    
 }
 
 void SeRenderer::beginSwapChainRenderPass(VkCommandBuffer commandBuffer)
@@ -198,6 +582,9 @@ void SeRenderer::beginSwapChainRenderPass(VkCommandBuffer commandBuffer)
     assert(isFrameInProgress() && "Cannot call beginSwapChainRenderPass() while frame is already in progress!");
     assert(commandBuffer == getCurrentCommandBuffer() && "Cannot begin renderpass on command buffer from a different frame");
 
+    // Closed in endSwapChainRenderPass, outside the render pass so statistics queries stay legal
+    ctx->Se_gpu_profiler->beginScope(commandBuffer, "Main pass");
+
     // RenderPass
     VkRenderPassBeginInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -213,7 +600,11 @@ void SeRenderer::beginSwapChainRenderPass(VkCommandBuffer commandBuffer)
     renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
     renderPassInfo.pClearValues = clearValues.data();
     vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    setViewportAndScissor(commandBuffer);
+}
 
+void SeRenderer::setViewportAndScissor(VkCommandBuffer commandBuffer)
+{
     // Dynamic Viewport
     VkViewport viewport{};
     viewport.x = 0.0f;
@@ -233,6 +624,7 @@ void SeRenderer::endSwapChainRenderPass(VkCommandBuffer commandBuffer)
     assert(isFrameInProgress() && "Cannot call endSwapChainRenderPass() while frame is already in progress!");
     assert(commandBuffer == getCurrentCommandBuffer() && "Cannot end renderpass on command buffer from a different frame");
     vkCmdEndRenderPass(commandBuffer);
+    ctx->Se_gpu_profiler->endScope(commandBuffer);
     
 }
 
@@ -242,35 +634,32 @@ void SeRenderer::loadModel()
 
 void SeRenderer::loadObjects()
 {
+    SE_PROFILE_FUNCTION();
     loadCubeModel({0.f, 0.f, 0.f});
-    SeObject cube = SeObject::createObject();
-    cube.model = ctx->Se_model;
-    cube.transform.translation = { 0.f, 0.f, 2.5f };
-    cube.transform.scale = { 0.5f, 0.5f, 0.5f };
-    objects.push_back(std::move(cube));
-
-    SeObject cube2 = SeObject::createObject();
-    cube2.model = ctx->Se_model;
-    cube2.transform.translation = { 3.f, 0.f, 5.5f };
-    cube2.transform.scale = { 0.5f, 0.5f, 0.5f };
-    objects.push_back(std::move(cube2));
+    TransformComponent cube;
+    cube.translation = { 0.f, 0.f, 2.5f };
+    cube.scale = { 0.5f, 0.5f, 0.5f };
+    createObject(ctx->Se_model, {}, cube);
+
+    TransformComponent cube2;
+    cube2.translation = { 3.f, 0.f, 5.5f };
+    cube2.scale = { 0.5f, 0.5f, 0.5f };
+    createObject(ctx->Se_model, {}, cube2);
 }
 
-void SeRenderer::updateFPS()
+void SeRenderer::updateFrameStats()
 {
-    frameCount++;
-    double currentTime = glfwGetTime();
-    double elapsedTime = currentTime - lastFPSTime;
-
-    // Update FPS every second
-    if (elapsedTime >= 1.0) {
-        avgFPS = frameCount / (float)elapsedTime;
-        std::cout << "Average FPS: " << avgFPS << std::endl;
-        
-        // Reset counters
-        frameCount = 0;
-        lastFPSTime = currentTime;
-    }
+    // steady_clock rather than glfwGetTime, GLFW is not initialized when running headless
+    auto now = std::chrono::steady_clock::now();
+    if (lastStatsWindow.time_since_epoch().count() == 0) lastStatsWindow = now;
+    double elapsedTime = std::chrono::duration<double>(now - lastStatsWindow).count();
+    if (!frame_stats.isWindowElapsed(elapsedTime)) return;
+
+    SeFrameStats::Summary summary = frame_stats.endWindow(elapsedTime);
+    lastStatsWindow = now;
+    SeFrameStats::printSummary(summary);
+    std::cout << (frame_pacing.isGpuBound() ? "\tGPU bound" : "\tCPU bound") << std::endl;
+    if (Config::get().print_gpu_profile()) ctx->Se_gpu_profiler->printResults();
 }
 
 // temporary helper function, creates a 1x1x1 cube centered at offset
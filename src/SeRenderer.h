@@ -1,18 +1,44 @@
 ﻿#pragma once
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #include "SeCamera.h"
+#include "SeFrameStats.h"
 #include "SePipeline.h"
-
-namespace SE {
-class SeObject;
-}
+#include "SeRenderSnapshot.h"
+#include "SeSceneGraph.h"
+#include "SeShaderFeatures.h"
+#include "SeSwapChain.h"
+#include "SeWorld.h"
 
 namespace SE {
 struct VulkanContext;
+class SePipelineEntry;
 }
 
 namespace SE {
+
+// Where the last frame spent its time, all durations in milliseconds
+struct FramePacing
+{
+    uint64_t frameNumber = 0;        // frame these CPU numbers belong to
+    double frameInterval = 0.0;      // beginFrame to beginFrame
+    double cpuWaitOnGpu = 0.0;       // blocked until the frame slot was retired by the GPU
+    double acquireWait = 0.0;        // blocked inside vkAcquireNextImageKHR
+    uint64_t gpuFrameNumber = 0;     // newest frame with GPU timestamps, lags framesInFlight behind
+    double gpuFrameTime = 0.0;       // first to last command of that frame on the GPU
+    double gpuCompletionTime = 0.0;  // GPU clock when that frame finished, relative to the first frame
+    uint64_t completedFrames = 0;    // value of the frame timeline
+
+    // The CPU sat idle waiting for the GPU or the display for a noticeable part of the frame
+    bool isGpuBound() const { return cpuWaitOnGpu + acquireWait > frameInterval * 0.1; }
+};
+
 class SeRenderer
 {
 public:
@@ -23,10 +49,23 @@ public:
     void createPipelineLayout();
     void createPipeline();
     void createCommandBuffers();
-    void recreateSwapChain(int imageIndex);
-    void renderObjects(VkCommandBuffer commandBuffer, SeCamera &camera);
+    // False when the window closed while minimized, the swap chain is then left as it is
+    bool recreateSwapChain();
+    // Simulation side of a frame: resolves the scene graph and copies out what the draws need
+    void writeSnapshot(SeRenderSnapshot& snapshot, SeCamera& camera);
+    void renderObjects(VkCommandBuffer commandBuffer, const SeRenderSnapshot& snapshot);
+    // Depth only pass with two phase Hi-Z occlusion culling, recorded before the swap chain render pass
+    void renderDepthPrepass(VkCommandBuffer commandBuffer, const SeRenderSnapshot& snapshot);
     void freeCommandBuffers();
     void loadCubeModel(glm::vec3 offset);
+    // Drawn entity with its transform in a new scene graph node
+    Entity createObject(std::shared_ptr<SeModel> model, glm::vec3 color, const TransformComponent& transform, SeSceneGraph::NodeId parent = SeSceneGraph::INVALID_NODE);
+    // Destroys every entity and scene node, callers wait for the GPU first
+    void clearObjects();
+    uint32_t getObjectCount() const { return static_cast<uint32_t>(world.count<RenderComponent, SceneNodeComponent>()); }
+    // Per object MVP and color as pushed by both passes, from the world matrices cached in the scene graph.
+    // Chunks are spread over jobs when given. Exposed for the microbenchmarks
+    static void writePushConstants(const glm::mat4& projectionView, SeWorld& world, const SeSceneGraph& sceneGraph, std::vector<SimplePushConstantData>& pushData, SeJobSystem* jobs = nullptr);
 
     VkCommandBuffer beginFrame();
     void endFrame();
@@ -48,31 +87,99 @@ public:
     }
 
     int getDeltaTime() { return deltaTime; }
+    const FramePacing& getFramePacing() const { return frame_pacing; }
+    const SeFrameStats& getFrameStats() const { return frame_stats; }
+    // Start measuring from scratch, e.g. after warm up frames
+    void resetFrameStats() { frame_stats.reset(); }
+    // Draw calls recorded in the last submitted frame
+    uint32_t getDrawCount() const { return lastDrawCount; }
+    // Image the last submitted frame rendered into
+    uint32_t getLastImageIndex() const { return currentImageIndex; }
+    uint64_t getFrameNumber() const { return frameNumber; }
+    // State of the main pipeline, the starting point for material pipelines registered with SePipelineRegistry
+    const SePipeline::PipelineConfigInfo& getMainPipelineConfig() const { return mainPipelineConfig; }
+    // Of the current swap chain, safe to read from the simulation while the render thread recreates it
+    float getAspectRatio() const { return aspectRatio.load(std::memory_order_relaxed); }
+
+    // Destroy a resource once every frame that could still reference it has finished on the GPU
+    void deferDestroy(std::function<void()>&& destroyFn);
+
+    // Applied at the start of the next frame by recreating the swap chain, callable from any thread
+    void setPresentProfile(PresentProfile profile);
+    void setPresentSettings(const PresentSettings& settings);
     
 public:
     
     std::vector<VkCommandBuffer> command_buffers;
+    // Owned by SeLayoutCache
     VkPipelineLayout pipeline_layout;
+    // Owned by SePipelineRegistry
+    SePipeline* depth_prepass_pipeline = nullptr;
     std::shared_ptr<VulkanContext> ctx;
-    std::vector<SeObject> objects;
+    // Every entity with a RenderComponent and a SceneNodeComponent is drawn. Simulation thread only,
+    // writeSnapshot copies them out in query order, so an entity's index is the same in push
+    // constants, bounds and indirect commands
+    SeWorld world;
+    SeSceneGraph scene_graph;
 
 private:
     void loadModel();
     void loadObjects();
+    // Throws with instructions when a shader of the depth prepass or the occlusion culler cannot be loaded
+    void checkDepthPrepassShaders();
+    // Every pipeline state the renderer draws with for the current render passes, with the material
+    // permutations of Config::material_features() and those drawn so far
+    std::vector<SePipeline::PipelineConfigInfo> collectPipelineManifest() const;
+    void updatePipelineRenderPasses();
+    void recreatePipelines();
+    // Render thread. Main pipeline specialized for RenderComponent::features, registered on first use
+    SePipelineEntry* getMaterialPipeline(uint32_t featureMask);
+    void flushDeletionQueue(bool bForce);
+    void limitFrameRate();
+    void setViewportAndScissor(VkCommandBuffer commandBuffer);
+    void drawDepthPrepass(VkCommandBuffer commandBuffer, const SeRenderSnapshot& snapshot, VkRenderPass renderPass, uint32_t phase);
     
-    void updateFPS();
+    void updateFrameStats();
     
 private:
 
-    // FPS tracking
-    int frameCount = 0;         // Number of frames since last update
-    double lastFPSTime = 0.0;   // Time of last FPS update
-    float avgFPS = 0.0f;        // Calculated average FPS
+    // Requested from SePipelineRegistry again when the render passes change
+    SePipeline::PipelineConfigInfo mainPipelineConfig{};
+    SePipeline::PipelineConfigInfo depthPrepassPipelineConfig{};
+    SePipelineEntry* mainPipelineEntry = nullptr;
+    SePipelineEntry* depthPrepassPipelineEntry = nullptr;
+    // Features the main pipeline is specialized for, objects with other features use a material pipeline
+    SeShaderFeatures mainFeatures{};
+    // By SeShaderFeatures::mask, render thread only
+    std::unordered_map<uint32_t, SePipelineEntry*> materialPipelines;
 
     bool bFrameInProgress = false;
-    uint32_t currentImageIndex;
+    uint32_t currentImageIndex = 0;
     int currentFrameIndex = 0;
     int deltaTime = 0;
+    // Frames submitted so far, used to fence deferred deletions
+    uint64_t frameNumber = 0;
+    uint32_t drawCount = 0;
+    uint32_t lastDrawCount = 0;
+
+    struct PendingDeletion
+    {
+        uint64_t frameNumber;
+        std::function<void()> destroyFn;
+    };
+    std::deque<PendingDeletion> deletionQueue;
+
+    std::mutex presentSettingsMutex;
+    PresentSettings pendingPresentSettings{};
+    std::atomic<bool> bPresentSettingsPending{false};
+    std::atomic<float> aspectRatio{1.f};
+    std::chrono::steady_clock::time_point nextFrameTime{};
+
+    std::chrono::steady_clock::time_point lastBeginFrame{};
+    FramePacing frame_pacing{};
+
+    SeFrameStats frame_stats;
+    std::chrono::steady_clock::time_point lastStatsWindow{};
     
 };
 
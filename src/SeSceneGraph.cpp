@@ -0,0 +1,201 @@
+﻿#include "SeSceneGraph.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+namespace SE {
+
+SeSceneGraph::NodeId SeSceneGraph::createNode(const TransformComponent& local, NodeId parent)
+{
+    if (parent != INVALID_NODE && parent >= indices.size())
+    {
+        throw std::runtime_error("failed to create scene node, parent does not exist!");
+    }
+
+    // Appending keeps the order valid, the parent already exists and therefore sits earlier
+    NodeId node = static_cast<NodeId>(indices.size());
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    indices.push_back(index);
+    nodes.push_back(node);
+    parents.push_back(parent == INVALID_NODE ? INVALID_NODE : indices[parent]);
+    locals.push_back(local);
+    localMatrices.emplace_back(1.f);
+    worlds.emplace_back(1.f);
+    dirty.push_back(0);
+    updatedIn.push_back(0);
+    markDirty(index);
+    return node;
+}
+
+SeSceneGraph::NodeId SeSceneGraph::getParent(NodeId node) const
+{
+    uint32_t parent = parents[indices[node]];
+    return parent == INVALID_NODE ? INVALID_NODE : nodes[parent];
+}
+
+void SeSceneGraph::setParent(NodeId node, NodeId parent)
+{
+    for (NodeId ancestor = parent; ancestor != INVALID_NODE; ancestor = getParent(ancestor))
+    {
+        if (ancestor == node)
+        {
+            throw std::runtime_error("failed to reparent scene node, new parent is one of its descendants!");
+        }
+    }
+
+    uint32_t index = indices[node];
+    parents[index] = parent == INVALID_NODE ? INVALID_NODE : indices[parent];
+    markDirty(index);
+    // Descendants always follow the node, so a parent that is already earlier keeps the order valid
+    if (parent != INVALID_NODE && indices[parent] > index) sortTopologically();
+}
+
+void SeSceneGraph::setLocal(NodeId node, const TransformComponent& local)
+{
+    uint32_t index = indices[node];
+    locals[index] = local;
+    markDirty(index);
+}
+
+void SeSceneGraph::clear()
+{
+    parents.clear();
+    locals.clear();
+    localMatrices.clear();
+    worlds.clear();
+    dirty.clear();
+    updatedIn.clear();
+    nodes.clear();
+    indices.clear();
+    dirtyList.clear();
+    lastUpdateCount = 0;
+}
+
+void SeSceneGraph::markDirty(uint32_t index)
+{
+    if (dirty[index]) return;
+    dirty[index] = 1;
+    dirtyList.push_back(index);
+}
+
+uint32_t SeSceneGraph::update()
+{
+    lastUpdateCount = 0;
+    if (dirtyList.empty()) return 0;
+
+    // Generation 0 marks nodes that were never recomputed
+    if (++generation == 0)
+    {
+        std::fill(updatedIn.begin(), updatedIn.end(), 0);
+        generation = 1;
+    }
+
+    localBatch.resize(dirtyList.size());
+    for (size_t i = 0; i < dirtyList.size(); i++)
+    {
+        localBatch.set(i, locals[dirtyList[i]]);
+    }
+    batchMatrices.resize(dirtyList.size());
+    localBatch.computeMatrices(glm::mat4{1.f}, batchMatrices.data(), sizeof(glm::mat4));
+
+    uint32_t first = static_cast<uint32_t>(nodes.size());
+    for (size_t i = 0; i < dirtyList.size(); i++)
+    {
+        localMatrices[dirtyList[i]] = batchMatrices[i];
+        first = std::min(first, dirtyList[i]);
+    }
+    dirtyList.clear();
+
+    // Nothing before the first dirty node can change. Parents come first, so by the time a node
+    // is visited its parent's world matrix is final for this update
+    const uint32_t count = static_cast<uint32_t>(nodes.size());
+    for (uint32_t i = first; i < count; i++)
+    {
+        uint32_t parent = parents[i];
+        bool bParentChanged = parent != INVALID_NODE && updatedIn[parent] == generation;
+        if (!dirty[i] && !bParentChanged) continue;
+
+        worlds[i] = parent == INVALID_NODE ? localMatrices[i] : worlds[parent] * localMatrices[i];
+        dirty[i] = 0;
+        updatedIn[i] = generation;
+        lastUpdateCount++;
+    }
+    return lastUpdateCount;
+}
+
+void SeSceneGraph::sortTopologically()
+{
+    const uint32_t count = static_cast<uint32_t>(nodes.size());
+
+    // Children in their current relative order, then depth first from every root
+    std::vector<uint32_t> childStart(count + 1, 0);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (parents[i] != INVALID_NODE) childStart[parents[i] + 1]++;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        childStart[i + 1] += childStart[i];
+    }
+    std::vector<uint32_t> children(childStart[count]);
+    std::vector<uint32_t> fill(childStart.begin(), childStart.end() - 1);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (parents[i] != INVALID_NODE) children[fill[parents[i]]++] = i;
+    }
+
+    std::vector<uint32_t> order;
+    order.reserve(count);
+    std::vector<uint32_t> stack;
+    for (uint32_t root = 0; root < count; root++)
+    {
+        if (parents[root] != INVALID_NODE) continue;
+        stack.push_back(root);
+        while (!stack.empty())
+        {
+            uint32_t i = stack.back();
+            stack.pop_back();
+            order.push_back(i);
+            for (uint32_t c = childStart[i + 1]; c > childStart[i]; c--)
+            {
+                stack.push_back(children[c - 1]);
+            }
+        }
+    }
+
+    std::vector<uint32_t> newIndex(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        newIndex[order[i]] = i;
+    }
+
+    auto permute = [&order](auto& values) {
+        std::remove_reference_t<decltype(values)> sorted;
+        sorted.reserve(values.size());
+        for (uint32_t old : order)
+        {
+            sorted.push_back(values[old]);
+        }
+        values.swap(sorted);
+    };
+    permute(parents);
+    permute(locals);
+    permute(localMatrices);
+    permute(worlds);
+    permute(dirty);
+    permute(updatedIn);
+    permute(nodes);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (parents[i] != INVALID_NODE) parents[i] = newIndex[parents[i]];
+        indices[nodes[i]] = i;
+    }
+    for (auto& index : dirtyList)
+    {
+        index = newIndex[index];
+    }
+}
+
+}
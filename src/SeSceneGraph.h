@@ -0,0 +1,64 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "SeComponents.h"
+#include "SeTransformBatch.h"
+
+namespace SE {
+
+// Parent/child transform hierarchy with cached world matrices.
+//
+// Nodes are kept in topological order, every parent sits before its children, so update()
+// resolves the whole hierarchy in one linear pass. Only nodes whose local transform changed,
+// and their descendants, are recomputed. A frame where nothing moved costs nothing.
+//
+// Nodes are addressed by stable ids, their position in the arrays changes when setParent()
+// has to reorder. Nodes live until clear().
+class SeSceneGraph
+{
+public:
+    using NodeId = uint32_t;
+    static constexpr NodeId INVALID_NODE = ~0u;
+
+    NodeId createNode(const TransformComponent& local, NodeId parent = INVALID_NODE);
+    // local stays the same and is now relative to the new parent
+    void setParent(NodeId node, NodeId parent);
+    void setLocal(NodeId node, const TransformComponent& local);
+    void clear();
+
+    // Recomputes the world matrices of dirty nodes and their descendants, returns how many
+    uint32_t update();
+
+    const TransformComponent& getLocal(NodeId node) const { return locals[indices[node]]; }
+    NodeId getParent(NodeId node) const;
+    // Valid after the update() following the last change
+    const glm::mat4& getWorld(NodeId node) const { return worlds[indices[node]]; }
+    size_t size() const { return nodes.size(); }
+    uint32_t getLastUpdateCount() const { return lastUpdateCount; }
+
+private:
+    void markDirty(uint32_t index);
+    // Restores parent before child order after a reparent
+    void sortTopologically();
+
+    // Indexed by position in topological order
+    std::vector<uint32_t> parents;          // position of the parent, INVALID_NODE for roots
+    std::vector<TransformComponent> locals;
+    std::vector<glm::mat4> localMatrices;
+    std::vector<glm::mat4> worlds;
+    std::vector<uint8_t> dirty;             // local changed since the last update
+    std::vector<uint32_t> updatedIn;        // update generation that last recomputed the world matrix
+    std::vector<NodeId> nodes;              // position -> id
+
+    std::vector<uint32_t> indices;          // id -> position
+    std::vector<uint32_t> dirtyList;
+    uint32_t generation = 0;
+    uint32_t lastUpdateCount = 0;
+
+    // Local matrices of the dirty nodes are built with the SIMD kernel
+    SeTransformBatch localBatch;
+    std::vector<glm::mat4> batchMatrices;
+};
+
+}
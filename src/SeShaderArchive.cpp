@@ -0,0 +1,216 @@
+﻿#include "SeShaderArchive.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "SeHash.h"
+
+namespace SE {
+
+namespace {
+constexpr uint32_t ARCHIVE_MAGIC = 0x41534553;     // "SESA"
+// Bump when the layout below changes
+constexpr uint32_t ARCHIVE_VERSION = 1;
+// SPIR-V is read as 32 bit words straight from the mapping
+constexpr uint64_t BLOB_ALIGNMENT = 8;
+
+struct ArchiveHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t slotCount;     // power of two, the slots follow the header
+};
+
+struct ArchiveSlot
+{
+    uint64_t key;           // 0 = empty
+    uint64_t offset;        // from the start of the file
+    uint32_t size;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(ArchiveHeader) == 16 && sizeof(ArchiveSlot) == 24, "archive structs are written as is");
+
+uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+}
+
+SeShaderArchive::~SeShaderArchive()
+{
+    close();
+}
+
+bool SeShaderArchive::open(const std::string& path)
+{
+    close();
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(ArchiveHeader)))
+    {
+        CloseHandle(file);
+        return false;
+    }
+    // The view keeps the mapping and the file open
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) return false;
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) return false;
+    data = static_cast<const char*>(view);
+    size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(ArchiveHeader)))
+    {
+        ::close(fd);
+        return false;
+    }
+    // The mapping keeps the file open
+    void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) return false;
+    data = static_cast<const char*>(view);
+    size = static_cast<size_t>(info.st_size);
+#endif
+
+    // Checked once here so find() can trust every slot
+    const ArchiveHeader* header = reinterpret_cast<const ArchiveHeader*>(data);
+    bool bValid = header->magic == ARCHIVE_MAGIC && header->version == ARCHIVE_VERSION && header->slotCount != 0 &&
+                  (header->slotCount & (header->slotCount - 1)) == 0 &&
+                  sizeof(ArchiveHeader) + static_cast<uint64_t>(header->slotCount) * sizeof(ArchiveSlot) <= size;
+    const ArchiveSlot* slots = reinterpret_cast<const ArchiveSlot*>(data + sizeof(ArchiveHeader));
+    for (uint32_t i = 0; bValid && i < header->slotCount; i++)
+    {
+        if (slots[i].key == 0) continue;
+        bValid = slots[i].offset % sizeof(uint32_t) == 0 && slots[i].offset + slots[i].size <= size;
+    }
+    if (!bValid)
+    {
+        std::cout << "Shader archive " << path << " is damaged or from another version, ignoring it" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SeShaderArchive::close()
+{
+    if (!data) return;
+#if defined(_WIN32)
+    UnmapViewOfFile(data);
+#else
+    munmap(const_cast<char*>(data), size);
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+bool SeShaderArchive::find(uint64_t key, const void*& code, size_t& codeSize) const
+{
+    if (!data) return false;
+    const ArchiveHeader* header = reinterpret_cast<const ArchiveHeader*>(data);
+    const ArchiveSlot* slots = reinterpret_cast<const ArchiveSlot*>(data + sizeof(ArchiveHeader));
+    const uint32_t mask = header->slotCount - 1;
+    uint32_t slot = static_cast<uint32_t>(key) & mask;
+    for (uint32_t probe = 0; probe < header->slotCount; probe++, slot = (slot + 1) & mask)
+    {
+        if (slots[slot].key == 0) return false;
+        if (slots[slot].key != key) continue;
+        code = data + slots[slot].offset;
+        codeSize = slots[slot].size;
+        return true;
+    }
+    return false;
+}
+
+uint32_t SeShaderArchive::getEntryCount() const
+{
+    return data ? reinterpret_cast<const ArchiveHeader*>(data)->entryCount : 0;
+}
+
+uint64_t SeShaderArchive::variantKey(const std::string& file, const SeShaderDefines& defines)
+{
+    uint64_t key = hashString(std::filesystem::path(file).lexically_normal().generic_string());
+    SeShaderDefines sortedDefines = defines;
+    std::sort(sortedDefines.begin(), sortedDefines.end());
+    for (const auto& [name, value] : sortedDefines)
+    {
+        key = hashString(name, key);
+        key = hashString(value.empty() ? "1" : value, key);
+    }
+    // 0 marks an empty slot
+    return key != 0 ? key : 1;
+}
+
+void SeShaderArchive::write(const std::string& path, const std::vector<Entry>& entries)
+{
+    // At most half full, a miss ends at the first empty slot
+    uint32_t slotCount = 2;
+    while (slotCount < entries.size() * 2) slotCount *= 2;
+
+    std::vector<ArchiveSlot> slots(slotCount, ArchiveSlot{0, 0, 0, 0});
+    std::vector<uint64_t> offsets;
+    uint64_t offset = alignUp(sizeof(ArchiveHeader) + slotCount * sizeof(ArchiveSlot), BLOB_ALIGNMENT);
+    for (const Entry& entry : entries)
+    {
+        uint32_t slot = static_cast<uint32_t>(entry.key) & (slotCount - 1);
+        while (slots[slot].key != 0)
+        {
+            if (slots[slot].key == entry.key) throw std::runtime_error("Shader archive: " + entry.name + " is in the archive twice");
+            slot = (slot + 1) & (slotCount - 1);
+        }
+        slots[slot] = ArchiveSlot{entry.key, offset, static_cast<uint32_t>(entry.code.size()), 0};
+        offsets.push_back(offset);
+        offset = alignUp(offset + entry.code.size(), BLOB_ALIGNMENT);
+    }
+
+    std::vector<char> bytes(offset, 0);
+    const ArchiveHeader header{ARCHIVE_MAGIC, ARCHIVE_VERSION, static_cast<uint32_t>(entries.size()), slotCount};
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    std::memcpy(bytes.data() + sizeof(header), slots.data(), slots.size() * sizeof(ArchiveSlot));
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        std::memcpy(bytes.data() + offsets[i], entries[i].code.data(), entries[i].code.size());
+    }
+
+    // Renamed into place, the engine never maps a half written archive
+    const std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), bytes.size());
+        file.close();
+        if (!file) throw std::runtime_error("Shader archive: failed to write " + tempPath);
+    }
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    if (error)
+    {
+        std::filesystem::remove(tempPath, error);
+        throw std::runtime_error("Shader archive: failed to replace " + path);
+    }
+}
+
+}
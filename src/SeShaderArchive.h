@@ -0,0 +1,53 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SeShaderCompiler.h"
+
+namespace SE {
+
+// Every shader variant of a build in one file, written offline by ShaderCooker.
+//
+// The file is a header, an open addressing hash table of {variantKey, offset, size} slots and
+// the SPIR-V blobs, word aligned. It is memory mapped read only, a lookup is a probe in the table
+// and the code is used in place, nothing is read or copied per shader. Variants are keyed by file
+// and defines alone (the sources are not shipped), so an archive is only valid for the build it
+// was cooked for. Lookups are thread safe, open() and close() are not.
+class SeShaderArchive
+{
+public:
+    struct Entry
+    {
+        uint64_t key = 0;           // variantKey()
+        std::string name;           // for error messages only
+        std::vector<char> code;
+    };
+
+    SeShaderArchive() = default;
+    ~SeShaderArchive();
+
+    SeShaderArchive(const SeShaderArchive&) = delete;
+    void operator=(const SeShaderArchive&) = delete;
+
+    // False when the file does not exist or is not an archive of this version
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+
+    // Points into the mapping, valid until close()
+    bool find(uint64_t key, const void*& code, size_t& codeSize) const;
+    uint32_t getEntryCount() const;
+
+    // file as passed to SeShaderCache::getModule(), define order does not matter
+    static uint64_t variantKey(const std::string& file, const SeShaderDefines& defines);
+    // Throws on duplicate keys or when the file cannot be written
+    static void write(const std::string& path, const std::vector<Entry>& entries);
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+};
+
+}
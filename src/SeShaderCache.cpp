@@ -0,0 +1,166 @@
+﻿#include "SeShaderCache.h"
+
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+#include "Config.h"
+#include "SeDevice.h"
+#include "SeHash.h"
+#include "SePipeline.h"
+#include "SeProfiler.h"
+#include "vulkancontext.h"
+
+namespace SE {
+
+SeShaderCache::SeShaderCache(std::shared_ptr<VulkanContext> inctx)
+{
+    ctx = inctx;
+    // Hot reload works on the sources, a cooked archive would hide every edit
+    const std::string& archivePath = Config::get().shader_archive_path();
+    if (!archivePath.empty() && !Config::get().shader_hot_reload() && archive.open(archivePath))
+    {
+        std::cout << "Shader archive: " << archive.getEntryCount() << " shaders in " << archivePath << std::endl;
+    }
+}
+
+SeShaderCache::~SeShaderCache()
+{
+    for (auto& [hash, shader] : modules)
+    {
+        vkDestroyShaderModule(ctx->Se_device->device, shader->module, nullptr);
+    }
+}
+
+std::string SeShaderCache::variantName(const std::string& file, const SeShaderDefines& defines)
+{
+    std::string name = file;
+    for (const auto& [define, value] : defines)
+    {
+        name += " " + define + "=" + value;
+    }
+    return name;
+}
+
+SeShaderBinary SeShaderCache::load(const std::string& file, const SeShaderDefines& defines)
+{
+    if (SeShaderCompiler::isSource(file)) return compiler.compile(file, defines);
+
+    SeShaderBinary binary;
+    const std::string path = Config::get().shader_path() + file;
+    binary.code = SePipeline::readFile(path);
+    binary.dependencies.push_back(std::filesystem::path(path).lexically_normal().generic_string());
+    return binary;
+}
+
+const SeShaderModule& SeShaderCache::getModule(const std::string& file, const SeShaderDefines& defines)
+{
+    const std::string name = variantName(file, defines);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = files.find(name);
+        if (it != files.end()) return *it->second.module;
+    }
+
+    const void* archived = nullptr;
+    size_t archivedSize = 0;
+    if (archive.find(SeShaderArchive::variantKey(file, defines), archived, archivedSize))
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = files.find(name);
+        if (it != files.end()) return *it->second.module;
+        const SeShaderModule& shader = getModuleLocked(archived, archivedSize);
+        // No dependencies, reload() never matches cooked variants
+        files.emplace(name, Variant{file, defines, {}, &shader});
+        return shader;
+    }
+
+    // Compiled outside the lock, parallel pipeline warm up compiles different shaders side by side.
+    // Two threads asking for the same variant both compile it, the module is still created once
+    SeShaderBinary binary = load(file, defines);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = files.find(name);
+    if (it != files.end()) return *it->second.module;
+    const SeShaderModule& shader = getModuleLocked(binary.code.data(), binary.code.size());
+    files.emplace(name, Variant{file, defines, std::move(binary.dependencies), &shader});
+    return shader;
+}
+
+std::unordered_set<std::string> SeShaderCache::reload(const std::unordered_set<std::string>& changedPaths)
+{
+    SE_PROFILE_FUNCTION();
+    std::vector<std::pair<std::string, Variant>> affected;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& [name, variant] : files)
+        {
+            for (const std::string& dependency : variant.dependencies)
+            {
+                if (!changedPaths.count(dependency)) continue;
+                affected.emplace_back(name, variant);
+                break;
+            }
+        }
+    }
+
+    std::unordered_set<std::string> reloaded;
+    for (auto& [name, variant] : affected)
+    {
+        try
+        {
+            SeShaderBinary binary = load(variant.file, variant.defines);
+            std::lock_guard<std::mutex> lock(mutex);
+            Variant& current = files[name];
+            // Includes may have been added or removed
+            current.dependencies = std::move(binary.dependencies);
+            const SeShaderModule& shader = getModuleLocked(binary.code.data(), binary.code.size());
+            if (&shader == current.module) continue;
+            current.module = &shader;
+            reloaded.insert(name);
+        } catch (const std::exception& e)
+        {
+            // Pipelines keep the last good code until the file is fixed
+            std::cout << "Shader reload of " << name << " failed, keeping the previous version: " << e.what() << std::endl;
+        }
+    }
+    return reloaded;
+}
+
+const SeShaderModule& SeShaderCache::getModule(const std::vector<char>& code)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return getModuleLocked(code.data(), code.size());
+}
+
+const SeShaderModule& SeShaderCache::getModuleLocked(const void* code, size_t size)
+{
+    const uint64_t hash = hashBytes(code, size);
+    auto it = modules.find(hash);
+    if (it != modules.end()) return *it->second;
+
+    SE_PROFILE_FUNCTION();
+    VkShaderModuleCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    createInfo.codeSize = size;
+    createInfo.pCode = static_cast<const uint32_t*>(code);
+
+    auto shader = std::make_unique<SeShaderModule>();
+    shader->hash = hash;
+    shader->codeSize = size;
+    shader->reflection = SeShaderReflection::reflect(code, size);
+    if (vkCreateShaderModule(ctx->Se_device->device, &createInfo, nullptr, &shader->module) != VK_SUCCESS)
+    {
+        std::cout << "Failed to create shader module" << std::endl;
+        throw std::runtime_error("Failed to create shader module");
+    }
+    return *modules.emplace(hash, std::move(shader)).first->second;
+}
+
+size_t SeShaderCache::getModuleCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return modules.size();
+}
+
+}
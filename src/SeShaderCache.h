@@ -0,0 +1,82 @@
+﻿#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "SeShaderArchive.h"
+#include "SeShaderCompiler.h"
+#include "SeShaderReflection.h"
+
+namespace SE {
+struct VulkanContext;
+
+struct SeShaderModule
+{
+    VkShaderModule module = VK_NULL_HANDLE;
+    uint64_t hash = 0;      // of the SPIR-V, identical code in two files is one module
+    size_t codeSize = 0;
+    SeShaderReflection reflection;
+};
+
+// Shader modules for the whole engine, keyed by the content hash of their SPIR-V.
+//
+// A file is read from Config::shader_path() the first time it is asked for, later requests and
+// pipeline recreations never touch the disk again. GLSL sources (.vert/.frag/.comp) go through
+// SeShaderCompiler, once per set of defines, anything else is loaded as SPIR-V. When
+// Config::shader_archive_path() holds an archive cooked by ShaderCooker, variants found in it are
+// created straight from the mapped file and never touch shader_path.
+// reload() points variants at new modules when their files change. Modules live until the cache
+// is destroyed, after every pipeline built from them, so a replaced one stays valid. Thread safe.
+class SeShaderCache
+{
+public:
+    SeShaderCache(std::shared_ptr<VulkanContext> inctx);
+    ~SeShaderCache();
+
+    SeShaderCache(const SeShaderCache&) = delete;
+    void operator=(const SeShaderCache&) = delete;
+
+    // file is relative to Config::shader_path(), throws when it cannot be read, compiled or reflected
+    const SeShaderModule& getModule(const std::string& file, const SeShaderDefines& defines = {});
+    const SeShaderModule& getModule(const std::vector<char>& code);
+
+    // Recompiles every variant built from one of the changed files (paths as in
+    // SeShaderBinary::dependencies). Returns the variantName() of those whose code changed, a variant
+    // that fails to compile keeps its module
+    std::unordered_set<std::string> reload(const std::unordered_set<std::string>& changedPaths);
+    // Identifies one file and define set, as returned by reload()
+    static std::string variantName(const std::string& file, const SeShaderDefines& defines);
+
+    size_t getModuleCount() const;
+    bool isArchiveOpen() const { return archive.isOpen(); }
+    SeShaderCompiler& getCompiler() { return compiler; }
+
+private:
+    struct Variant
+    {
+        std::string file;
+        SeShaderDefines defines;
+        std::vector<std::string> dependencies;
+        const SeShaderModule* module = nullptr;
+    };
+
+    // Source or SPIR-V of a variant with the files it was built from
+    SeShaderBinary load(const std::string& file, const SeShaderDefines& defines);
+    const SeShaderModule& getModuleLocked(const void* code, size_t size);
+
+    std::shared_ptr<VulkanContext> ctx;
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, std::unique_ptr<SeShaderModule>> modules;
+    std::unordered_map<std::string, Variant> files;     // by variantName()
+
+    SeShaderCompiler compiler;
+    SeShaderArchive archive;
+};
+
+}
@@ -0,0 +1,377 @@
+﻿#include "SeShaderCompiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef SE_ENABLE_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
+
+#include "Config.h"
+#include "SeHash.h"
+#include "SeProfiler.h"
+
+namespace SE {
+
+struct SeShaderCompiler::Backend
+{
+#ifdef SE_ENABLE_SHADERC
+    // Compiling only reads it, concurrent compiles need no lock
+    shaderc::Compiler compiler;
+#endif
+};
+
+namespace {
+// Bump when anything below changes what a key compiles to
+constexpr uint32_t CACHE_VERSION = 1;
+constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+
+#ifdef SE_ENABLE_SHADERC
+// Includes without guards that include each other would otherwise nest until the stack runs out
+constexpr size_t MAX_INCLUDE_DEPTH = 32;
+#ifdef NDEBUG
+constexpr bool DEBUG_INFO = false;
+constexpr shaderc_optimization_level OPTIMIZATION = shaderc_optimization_level_performance;
+#else
+constexpr bool DEBUG_INFO = true;
+constexpr shaderc_optimization_level OPTIMIZATION = shaderc_optimization_level_zero;
+#endif
+
+// Serves includes from the files the key was built from, the compiled code always matches its key
+class SeIncluder : public shaderc::CompileOptions::IncluderInterface
+{
+public:
+    explicit SeIncluder(const std::map<std::string, std::string>& inIncludes) : includes(inIncludes) {}
+
+    shaderc_include_result* GetInclude(const char* requested_source, shaderc_include_type type,
+                                       const char* requesting_source, size_t include_depth) override
+    {
+        auto* include = new Include();
+        std::string resolved;
+        auto it = includes.end();
+        if (include_depth > MAX_INCLUDE_DEPTH)
+        {
+            include->error = "includes nested deeper than " + std::to_string(MAX_INCLUDE_DEPTH) + " levels at " + requested_source;
+        } else if (SeShaderCompiler::resolveIncludePath(requested_source, requesting_source, type == shaderc_include_type_relative, resolved))
+        {
+            it = includes.find(resolved);
+        }
+        if (it != includes.end())
+        {
+            include->result.source_name = it->first.c_str();
+            include->result.source_name_length = it->first.size();
+            include->result.content = it->second.c_str();
+            include->result.content_length = it->second.size();
+        }
+        else
+        {
+            // An empty name is how shaderc reports a failed include, content is the message
+            if (include->error.empty()) include->error = std::string("cannot find include ") + requested_source;
+            include->result.content = include->error.c_str();
+            include->result.content_length = include->error.size();
+        }
+        include->result.user_data = include;
+        return &include->result;
+    }
+
+    void ReleaseInclude(shaderc_include_result* data) override
+    {
+        delete static_cast<Include*>(data->user_data);
+    }
+
+private:
+    struct Include
+    {
+        shaderc_include_result result{};
+        std::string error;
+    };
+
+    const std::map<std::string, std::string>& includes;
+};
+
+shaderc_shader_kind getShaderKind(const std::string& file)
+{
+    const std::string extension = std::filesystem::path(file).extension().string();
+    if (extension == ".vert") return shaderc_glsl_vertex_shader;
+    if (extension == ".frag") return shaderc_glsl_fragment_shader;
+    return shaderc_glsl_compute_shader;
+}
+#endif
+
+std::string keyToHex(uint64_t key)
+{
+    std::ostringstream hex;
+    hex << std::hex << std::setfill('0') << std::setw(16) << key;
+    return hex.str();
+}
+}
+
+SeShaderCompiler::SeShaderCompiler()
+    : backend(std::make_unique<Backend>())
+{
+#ifdef SE_ENABLE_SHADERC
+    if (!backend->compiler.IsValid())
+    {
+        std::cout << "Failed to initialize shaderc" << std::endl;
+        throw std::runtime_error("Failed to initialize shaderc");
+    }
+#endif
+}
+
+SeShaderCompiler::~SeShaderCompiler() = default;
+
+bool SeShaderCompiler::isSource(const std::string& file)
+{
+    const std::string extension = std::filesystem::path(file).extension().string();
+    return extension == ".vert" || extension == ".frag" || extension == ".comp";
+}
+
+SeShaderBinary SeShaderCompiler::compile(const std::string& file, const SeShaderDefines& defines)
+{
+    SE_PROFILE_FUNCTION();
+    SeShaderBinary binary;
+    const std::string path = (std::filesystem::path(Config::get().shader_path()) / file).lexically_normal().generic_string();
+    binary.dependencies.push_back(path);
+
+#ifdef SE_ENABLE_SHADERC
+    const std::string text = readText(path);
+    IncludeMap includes;
+    collectIncludes(path, text, includes);
+    for (const auto& [includePath, includeText] : includes)
+    {
+        binary.dependencies.push_back(includePath);
+    }
+
+    binary.key = makeKey(path, text, includes, defines);
+    if (loadCached(binary.key, binary.code))
+    {
+        binary.bFromCache = true;
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.cached++;
+        return binary;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    binary.code = compileSource(path, text, includes, defines);
+    double duration = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    storeCached(binary.key, binary.code);
+
+    std::cout << "Shader compiled: " << file << " (" << std::fixed << std::setprecision(1) << duration << " ms)" << std::defaultfloat << std::endl;
+    std::lock_guard<std::mutex> lock(statsMutex);
+    stats.compiled++;
+    stats.compileTime += duration;
+#else
+    if (!defines.empty())
+    {
+        throw std::runtime_error("Shader variants of " + file + " need a build with shaderc (premake5 --shaderc)");
+    }
+    // compileshaders.bat writes name.stage as name_stage.spv
+    std::filesystem::path prebuilt(path);
+    const std::string stage = prebuilt.extension().string().substr(1);
+    prebuilt.replace_filename(prebuilt.stem().string() + "_" + stage + ".spv");
+    binary.dependencies = {prebuilt.generic_string()};
+    std::ifstream spv(prebuilt, std::ios::ate | std::ios::binary);
+    if (!spv.is_open())
+    {
+        throw std::runtime_error("failed to open file: " + prebuilt.generic_string());
+    }
+    binary.code.resize(static_cast<size_t>(spv.tellg()));
+    spv.seekg(0);
+    spv.read(binary.code.data(), binary.code.size());
+    binary.key = hashBytes(binary.code.data(), binary.code.size());
+    binary.bFromCache = true;
+#endif
+    return binary;
+}
+
+SeShaderCompiler::Stats SeShaderCompiler::getStats() const
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return stats;
+}
+
+std::string SeShaderCompiler::readText(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("failed to open file: " + path);
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+bool SeShaderCompiler::resolveIncludePath(const std::string& requested, const std::string& includer, bool bRelative, std::string& resolved)
+{
+    std::error_code error;
+    if (bRelative)
+    {
+        std::filesystem::path candidate = (std::filesystem::path(includer).parent_path() / requested).lexically_normal();
+        if (std::filesystem::is_regular_file(candidate, error))
+        {
+            resolved = candidate.generic_string();
+            return true;
+        }
+    }
+    std::filesystem::path candidate = (std::filesystem::path(Config::get().shader_path()) / requested).lexically_normal();
+    if (std::filesystem::is_regular_file(candidate, error))
+    {
+        resolved = candidate.generic_string();
+        return true;
+    }
+    return false;
+}
+
+void SeShaderCompiler::collectIncludes(const std::string& path, const std::string& text, IncludeMap& includes)
+{
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        size_t pos = line.find_first_not_of(" \t");
+        if (pos == std::string::npos || line[pos] != '#') continue;
+        pos = line.find_first_not_of(" \t", pos + 1);
+        if (pos == std::string::npos || line.compare(pos, 7, "include") != 0) continue;
+        pos = line.find_first_of("\"<", pos + 7);
+        if (pos == std::string::npos) continue;
+        const bool bRelative = line[pos] == '"';
+        const size_t end = line.find(bRelative ? '"' : '>', pos + 1);
+        if (end == std::string::npos) continue;
+
+        // Unresolvable includes may sit in an inactive #if branch, the compiler reports the ones that matter
+        std::string resolved;
+        if (!resolveIncludePath(line.substr(pos + 1, end - pos - 1), path, bRelative, resolved)) continue;
+        if (includes.count(resolved)) continue;
+        auto it = includes.emplace(resolved, readText(resolved)).first;
+        collectIncludes(it->first, it->second, includes);
+    }
+}
+
+uint64_t SeShaderCompiler::makeKey(const std::string& path, const std::string& text, const IncludeMap& includes, const SeShaderDefines& defines) const
+{
+    std::vector<char> key;
+    SeKeyWriter writer{key};
+    writer.write(CACHE_VERSION);
+#ifdef SE_ENABLE_SHADERC
+    unsigned int spirvVersion = 0, spirvRevision = 0;
+    shaderc_get_spv_version(&spirvVersion, &spirvRevision);
+    writer.write(spirvVersion);
+    writer.write(spirvRevision);
+    writer.write(DEBUG_INFO);
+    writer.write(OPTIMIZATION);
+    writer.write(static_cast<uint32_t>(getShaderKind(path)));
+#endif
+
+    uint64_t hash = hashBytes(key.data(), key.size());
+    hash = hashString(path, hash);
+    hash = hashString(text, hash);
+    for (const auto& [includePath, includeText] : includes)
+    {
+        hash = hashString(includePath, hash);
+        hash = hashString(includeText, hash);
+    }
+
+    // Order does not change the result, sorted so equal variants share an entry
+    SeShaderDefines sortedDefines = defines;
+    std::sort(sortedDefines.begin(), sortedDefines.end());
+    for (const auto& [name, value] : sortedDefines)
+    {
+        hash = hashString(name, hash);
+        hash = hashString(value.empty() ? "1" : value, hash);
+    }
+    return hash;
+}
+
+bool SeShaderCompiler::loadCached(uint64_t key, std::vector<char>& code) const
+{
+    const std::filesystem::path path = std::filesystem::path(Config::get().shader_cache_path()) / (keyToHex(key) + ".spv");
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) return false;
+
+    const size_t size = static_cast<size_t>(file.tellg());
+    if (size < sizeof(uint32_t) || size % sizeof(uint32_t) != 0) return false;
+    code.resize(size);
+    file.seekg(0);
+    file.read(code.data(), size);
+    uint32_t magic = 0;
+    std::memcpy(&magic, code.data(), sizeof(magic));
+    if (!file || magic != SPIRV_MAGIC)
+    {
+        code.clear();
+        return false;
+    }
+    return true;
+}
+
+void SeShaderCompiler::storeCached(uint64_t key, const std::vector<char>& code) const
+{
+    // Written next to the target and renamed over it, two threads compiling the same variant may race harmlessly
+    std::error_code error;
+    const std::filesystem::path directory(Config::get().shader_cache_path());
+    std::filesystem::create_directories(directory, error);
+    const std::filesystem::path target = directory / (keyToHex(key) + ".spv");
+    std::ostringstream tempName;
+    tempName << keyToHex(key) << "." << std::this_thread::get_id() << ".tmp";
+    const std::filesystem::path tempPath = directory / tempName.str();
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(code.data(), code.size());
+        file.close();
+        if (!file)
+        {
+            std::cout << "Shader cache: failed to write " << tempPath.generic_string() << std::endl;
+            std::filesystem::remove(tempPath, error);
+            return;
+        }
+    }
+    std::filesystem::rename(tempPath, target, error);
+    if (error)
+    {
+        std::cout << "Shader cache: failed to replace " << target.generic_string() << ": " << error.message() << std::endl;
+        std::filesystem::remove(tempPath, error);
+    }
+}
+
+std::vector<char> SeShaderCompiler::compileSource(const std::string& path, const std::string& text, const IncludeMap& includes, const SeShaderDefines& defines)
+{
+    SE_PROFILE_FUNCTION();
+#ifdef SE_ENABLE_SHADERC
+    shaderc::CompileOptions options;
+    options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+    options.SetOptimizationLevel(OPTIMIZATION);
+    if (DEBUG_INFO) options.SetGenerateDebugInfo();
+    options.SetIncluder(std::make_unique<SeIncluder>(includes));
+    for (const auto& [name, value] : defines)
+    {
+        if (value.empty()) options.AddMacroDefinition(name);
+        else options.AddMacroDefinition(name, value);
+    }
+
+    shaderc::SpvCompilationResult result = backend->compiler.CompileGlslToSpv(text, getShaderKind(path), path.c_str(), options);
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+    {
+        std::cout << "Failed to compile shader " << path << ":\n" << result.GetErrorMessage() << std::endl;
+        throw std::runtime_error("Failed to compile shader " + path + ": " + result.GetErrorMessage());
+    }
+    if (result.GetNumWarnings() > 0) std::cout << result.GetErrorMessage();
+
+    const char* bytes = reinterpret_cast<const char*>(result.cbegin());
+    return std::vector<char>(bytes, bytes + (result.cend() - result.cbegin()) * sizeof(uint32_t));
+#else
+    (void)text;
+    (void)includes;
+    (void)defines;
+    throw std::runtime_error("Cannot compile " + path + " without shaderc");
+#endif
+}
+
+}
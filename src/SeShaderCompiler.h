@@ -0,0 +1,78 @@
+﻿#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace SE {
+
+// Preprocessor definitions of one shader variant, {NAME, VALUE}, an empty value defines NAME as 1
+using SeShaderDefines = std::vector<std::pair<std::string, std::string>>;
+
+struct SeShaderBinary
+{
+    std::vector<char> code;                 // SPIR-V
+    uint64_t key = 0;                       // content address in the disk cache
+    std::vector<std::string> dependencies;  // the source and every file it includes, resolved paths
+    bool bFromCache = false;
+};
+
+// GLSL to SPIR-V at runtime through shaderc.
+//
+// Sources are .vert/.frag/.comp files relative to Config::shader_path(). #include "file" resolves
+// next to the including file first, then in shader_path, #include <file> only in shader_path.
+// Every result is written to Config::shader_cache_path() under a hash of the source, everything it
+// includes, the defines and the compiler options, so a warm run only reads text and one .spv.
+// Includes are found by scanning for #include lines, conditional ones are always part of the key.
+//
+// Builds without SE_ENABLE_SHADERC (premake5 --shaderc) load the prebuilt name_stage.spv of
+// compileshaders.bat instead and cannot compile variants. Thread safe.
+class SeShaderCompiler
+{
+public:
+    struct Stats
+    {
+        uint32_t compiled = 0;
+        uint32_t cached = 0;
+        double compileTime = 0.0;  // ms, cache misses only
+    };
+
+    SeShaderCompiler();
+    ~SeShaderCompiler();
+
+    SeShaderCompiler(const SeShaderCompiler&) = delete;
+    void operator=(const SeShaderCompiler&) = delete;
+
+    // True for file names compile() accepts, everything else is loaded as SPIR-V
+    static bool isSource(const std::string& file);
+
+    // file is relative to Config::shader_path(), throws with the compiler log on errors
+    SeShaderBinary compile(const std::string& file, const SeShaderDefines& defines = {});
+
+    // Path of an #include as written in includer, false when no such file exists
+    static bool resolveIncludePath(const std::string& requested, const std::string& includer, bool bRelative, std::string& resolved);
+
+    Stats getStats() const;
+
+private:
+    // Resolved path -> text of every file the source may include, read once per compile
+    using IncludeMap = std::map<std::string, std::string>;
+
+    static std::string readText(const std::string& path);
+    static void collectIncludes(const std::string& path, const std::string& text, IncludeMap& includes);
+    uint64_t makeKey(const std::string& path, const std::string& text, const IncludeMap& includes, const SeShaderDefines& defines) const;
+
+    bool loadCached(uint64_t key, std::vector<char>& code) const;
+    void storeCached(uint64_t key, const std::vector<char>& code) const;
+    std::vector<char> compileSource(const std::string& path, const std::string& text, const IncludeMap& includes, const SeShaderDefines& defines);
+
+    mutable std::mutex statsMutex;
+    Stats stats;
+    struct Backend;
+    std::unique_ptr<Backend> backend;
+};
+
+}
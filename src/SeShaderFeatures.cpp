@@ -0,0 +1,80 @@
+﻿#include "SeShaderFeatures.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+#include "SeShaderCache.h"
+#include "vulkancontext.h"
+
+namespace SE {
+
+namespace {
+const char* FEATURE_NAMES[SeShaderFeatures::FEATURE_COUNT] = {"VERTEX_COLOR", "FOG"};
+}
+
+SeShaderFeatures& SeShaderFeatures::enable(Feature feature, bool bEnabled)
+{
+    if (bEnabled) mask |= 1u << feature;
+    else mask &= ~(1u << feature);
+    return *this;
+}
+
+std::string SeShaderFeatures::toString() const
+{
+    std::string result;
+    for (uint32_t feature = 0; feature < FEATURE_COUNT; feature++)
+    {
+        if (!isEnabled(static_cast<Feature>(feature))) continue;
+        if (!result.empty()) result += "|";
+        result += FEATURE_NAMES[feature];
+    }
+    return result.empty() ? "NONE" : result;
+}
+
+bool SeShaderFeatures::fromString(const std::string& text, SeShaderFeatures& features)
+{
+    features.mask = 0;
+    if (text == "NONE") return true;
+    std::istringstream names(text);
+    std::string name;
+    while (std::getline(names, name, '|'))
+    {
+        auto it = std::find(std::begin(FEATURE_NAMES), std::end(FEATURE_NAMES), name);
+        if (it == std::end(FEATURE_NAMES)) return false;
+        features.enable(static_cast<Feature>(it - std::begin(FEATURE_NAMES)));
+    }
+    return true;
+}
+
+void SeShaderFeatures::apply(VulkanContext& ctx, SePipeline::PipelineConfigInfo& config) const
+{
+    const SeShaderModule& vert = ctx.Se_shaders->getModule(config.vertShaderFile, config.vertShaderDefines);
+    const SeShaderModule* frag = config.fragShaderFile.empty() ? nullptr : &ctx.Se_shaders->getModule(config.fragShaderFile, config.fragShaderDefines);
+
+    // Constants that are not features keep their values, repacked in front of the features
+    std::vector<VkSpecializationMapEntry> entries;
+    std::vector<char> data;
+    for (const VkSpecializationMapEntry& entry : config.specializationEntries)
+    {
+        if (entry.constantID < FEATURE_COUNT) continue;
+        entries.push_back({entry.constantID, static_cast<uint32_t>(data.size()), entry.size});
+        data.insert(data.end(), config.specializationData.begin() + entry.offset, config.specializationData.begin() + entry.offset + entry.size);
+    }
+
+    for (uint32_t feature = 0; feature < FEATURE_COUNT; feature++)
+    {
+        if (!vert.reflection.findSpecConstant(feature) && !(frag && frag->reflection.findSpecConstant(feature))) continue;
+        const VkBool32 value = isEnabled(static_cast<Feature>(feature)) ? VK_TRUE : VK_FALSE;
+        entries.push_back({feature, static_cast<uint32_t>(data.size()), sizeof(VkBool32)});
+        data.resize(data.size() + sizeof(VkBool32));
+        std::memcpy(data.data() + data.size() - sizeof(VkBool32), &value, sizeof(VkBool32));
+    }
+
+    config.specializationEntries = std::move(entries);
+    config.specializationData = std::move(data);
+}
+
+}
@@ -0,0 +1,41 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+
+#include "SePipeline.h"
+
+namespace SE {
+struct VulkanContext;
+
+// Feature toggles of a material, one boolean specialization constant each.
+//
+// Shaders declare a feature as layout(constant_id = <Feature>) const bool NAME, so a single SPIR-V
+// module serves every combination. Each combination is its own pipeline, specialized before the
+// driver compiles it, which removes disabled features as dead code. Constant ids below
+// FEATURE_COUNT are reserved for features, other specialization constants start after them.
+struct SeShaderFeatures
+{
+    enum Feature : uint32_t
+    {
+        VERTEX_COLOR = 0,   // per vertex color, otherwise RenderComponent::color
+        FOG = 1,            // distance fog towards the clear color
+        FEATURE_COUNT
+    };
+
+    uint32_t mask = 1u << VERTEX_COLOR;
+
+    SeShaderFeatures& enable(Feature feature, bool bEnabled = true);
+    bool isEnabled(Feature feature) const { return (mask >> feature) & 1u; }
+    // "VERTEX_COLOR|FOG", "NONE" without features
+    std::string toString() const;
+    // Inverse of toString(), false on unknown names
+    static bool fromString(const std::string& text, SeShaderFeatures& features);
+
+    // Sets a VkBool32 constant for every feature the config's shaders declare, other specialization
+    // constants of the config are kept. Features neither stage declares do not apply to those shaders
+    // (e.g. the depth prepass). The constants are part of the pipeline state, equal feature sets share
+    // a pipeline in SePipelineRegistry
+    void apply(VulkanContext& ctx, SePipeline::PipelineConfigInfo& config) const;
+};
+
+}
@@ -0,0 +1,472 @@
+﻿#include "SeShaderReflection.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <spirv_cross/spirv.hpp>
+
+#include "SeProfiler.h"
+
+namespace SE {
+
+namespace {
+
+struct TypeInfo
+{
+    spv::Op op = spv::OpNop;
+    uint32_t width = 0;         // int, float
+    bool bSigned = false;       // int
+    uint32_t element = 0;       // component, column, array element or pointee type
+    uint32_t count = 0;         // vector components, matrix columns, array length constant id
+    uint32_t storage = 0;       // pointer
+    uint32_t imageDim = 0;
+    uint32_t imageSampled = 0;  // 1 = sampled, 2 = storage
+    std::vector<uint32_t> members;
+};
+
+struct DecorationInfo
+{
+    bool bBuiltIn = false;
+    bool bBufferBlock = false;
+    bool bLocation = false;
+    bool bBinding = false;
+    bool bSpecId = false;
+    uint32_t location = 0;
+    uint32_t binding = 0;
+    uint32_t set = 0;
+    uint32_t specId = 0;
+    uint32_t arrayStride = 0;
+    // Per struct member
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> matrixStrides;
+    bool bMemberBuiltIn = false;
+};
+
+struct VariableInfo
+{
+    uint32_t id = 0;
+    uint32_t type = 0;
+    uint32_t storage = 0;
+};
+
+class SpirvReader
+{
+public:
+    SpirvReader(const void* code, size_t size)
+    {
+        if (size < 5 * sizeof(uint32_t) || size % sizeof(uint32_t) != 0)
+        {
+            throw std::runtime_error("shader reflection: not a SPIR-V module");
+        }
+        words.resize(size / sizeof(uint32_t));
+        std::memcpy(words.data(), code, size);
+        if (words[0] != spv::MagicNumber) throw std::runtime_error("shader reflection: not a SPIR-V module");
+    }
+
+    void parse(SeShaderReflection& reflection)
+    {
+        size_t offset = 5;
+        while (offset < words.size())
+        {
+            const uint32_t wordCount = words[offset] >> 16;
+            const spv::Op op = static_cast<spv::Op>(words[offset] & 0xffff);
+            if (wordCount == 0 || offset + wordCount > words.size()) throw std::runtime_error("shader reflection: truncated instruction");
+            const uint32_t* operands = &words[offset + 1];
+            parseInstruction(op, operands, wordCount - 1, reflection);
+            offset += wordCount;
+        }
+    }
+
+    uint32_t typeSize(uint32_t id, uint32_t matrixStride = 0) const
+    {
+        const TypeInfo& type = getType(id);
+        switch (type.op)
+        {
+        case spv::OpTypeBool: return 4;
+        case spv::OpTypeInt:
+        case spv::OpTypeFloat: return type.width / 8;
+        case spv::OpTypeVector: return type.count * typeSize(type.element);
+        case spv::OpTypeMatrix: return type.count * (matrixStride ? matrixStride : typeSize(type.element));
+        case spv::OpTypeArray:
+        {
+            const uint32_t stride = decorationsOf(id).arrayStride;
+            return getConstant(type.count) * (stride ? stride : typeSize(type.element));
+        }
+        case spv::OpTypeStruct:
+        {
+            const DecorationInfo& decorations = decorationsOf(id);
+            uint32_t size = 0;
+            for (size_t i = 0; i < type.members.size(); i++)
+            {
+                const uint32_t memberOffset = i < decorations.offsets.size() ? decorations.offsets[i] : 0;
+                const uint32_t memberStride = i < decorations.matrixStrides.size() ? decorations.matrixStrides[i] : 0;
+                size = std::max(size, memberOffset + typeSize(type.members[i], memberStride));
+            }
+            return size;
+        }
+        default: return 0;
+        }
+    }
+
+    void collectResources(SeShaderReflection& reflection) const
+    {
+        for (const VariableInfo& variable : variables)
+        {
+            const uint32_t pointee = getType(variable.type).element;
+            const DecorationInfo& decorations = decorationsOf(variable.id);
+            switch (variable.storage)
+            {
+            case spv::StorageClassPushConstant:
+                reflection.pushConstantSize = std::max(reflection.pushConstantSize, typeSize(pointee));
+                break;
+            case spv::StorageClassUniformConstant:
+            case spv::StorageClassUniform:
+            case spv::StorageClassStorageBuffer:
+                reflection.bindings.push_back(getBinding(variable, pointee, decorations));
+                break;
+            case spv::StorageClassInput:
+                if (reflection.stage == VK_SHADER_STAGE_VERTEX_BIT) addInputs(pointee, decorations, reflection);
+                break;
+            default:
+                break;
+            }
+        }
+
+        for (const auto& [id, type] : specConstants)
+        {
+            const DecorationInfo& decorations = decorationsOf(id);
+            if (!decorations.bSpecId) continue;
+            reflection.specConstants.push_back({decorations.specId, typeSize(type)});
+        }
+    }
+
+private:
+    void parseInstruction(spv::Op op, const uint32_t* operands, uint32_t count, SeShaderReflection& reflection)
+    {
+        auto operand = [&](uint32_t i) {
+            if (i >= count) throw std::runtime_error("shader reflection: missing operand");
+            return operands[i];
+        };
+
+        switch (op)
+        {
+        case spv::OpEntryPoint:
+            reflection.stage = getStage(operand(0));
+            break;
+        case spv::OpDecorate:
+            decorate(decorations[operand(0)], static_cast<spv::Decoration>(operand(1)), count > 2 ? operands[2] : 0);
+            break;
+        case spv::OpMemberDecorate:
+        {
+            DecorationInfo& info = decorations[operand(0)];
+            const uint32_t member = operand(1);
+            const spv::Decoration decoration = static_cast<spv::Decoration>(operand(2));
+            if (decoration == spv::DecorationOffset)
+            {
+                if (info.offsets.size() <= member) info.offsets.resize(member + 1, 0);
+                info.offsets[member] = operand(3);
+            } else if (decoration == spv::DecorationMatrixStride)
+            {
+                if (info.matrixStrides.size() <= member) info.matrixStrides.resize(member + 1, 0);
+                info.matrixStrides[member] = operand(3);
+            } else if (decoration == spv::DecorationBuiltIn)
+            {
+                info.bMemberBuiltIn = true;
+            }
+            break;
+        }
+        case spv::OpTypeBool:
+            types[operand(0)].op = op;
+            break;
+        case spv::OpTypeInt:
+        {
+            TypeInfo& type = types[operand(0)];
+            type.op = op;
+            type.width = operand(1);
+            type.bSigned = operand(2) != 0;
+            break;
+        }
+        case spv::OpTypeFloat:
+        {
+            TypeInfo& type = types[operand(0)];
+            type.op = op;
+            type.width = operand(1);
+            break;
+        }
+        case spv::OpTypeVector:
+        case spv::OpTypeMatrix:
+        case spv::OpTypeArray:
+        {
+            TypeInfo& type = types[operand(0)];
+            type.op = op;
+            type.element = operand(1);
+            type.count = operand(2);
+            break;
+        }
+        case spv::OpTypeRuntimeArray:
+        case spv::OpTypeSampledImage:
+        {
+            TypeInfo& type = types[operand(0)];
+            type.op = op;
+            type.element = operand(1);
+            break;
+        }
+        case spv::OpTypeImage:
+        {
+            TypeInfo& type = types[operand(0)];
+            type.op = op;
+            type.imageDim = operand(2);
+            type.imageSampled = operand(6);
+            break;
+        }
+        case spv::OpTypeSampler:
+        case spv::OpTypeAccelerationStructureKHR:
+            types[operand(0)].op = op;
+            break;
+        case spv::OpTypeStruct:
+        {
+            TypeInfo& type = types[operand(0)];
+            type.op = op;
+            type.members.assign(operands + 1, operands + count);
+            break;
+        }
+        case spv::OpTypePointer:
+        {
+            TypeInfo& type = types[operand(0)];
+            type.op = op;
+            type.storage = operand(1);
+            type.element = operand(2);
+            break;
+        }
+        case spv::OpConstant:
+            constants[operand(1)] = operand(2);
+            break;
+        case spv::OpSpecConstantTrue:
+        case spv::OpSpecConstantFalse:
+        case spv::OpSpecConstant:
+            specConstants.emplace_back(operand(1), operand(0));
+            break;
+        case spv::OpVariable:
+            // Function local variables come after the first function, the interface is declared before
+            if (operand(2) != spv::StorageClassFunction) variables.push_back({operand(1), operand(0), operand(2)});
+            break;
+        default:
+            break;
+        }
+    }
+
+    static void decorate(DecorationInfo& info, spv::Decoration decoration, uint32_t value)
+    {
+        switch (decoration)
+        {
+        case spv::DecorationBuiltIn: info.bBuiltIn = true; break;
+        case spv::DecorationBufferBlock: info.bBufferBlock = true; break;
+        case spv::DecorationLocation: info.bLocation = true; info.location = value; break;
+        case spv::DecorationBinding: info.bBinding = true; info.binding = value; break;
+        case spv::DecorationDescriptorSet: info.set = value; break;
+        case spv::DecorationSpecId: info.bSpecId = true; info.specId = value; break;
+        case spv::DecorationArrayStride: info.arrayStride = value; break;
+        default: break;
+        }
+    }
+
+    static VkShaderStageFlagBits getStage(uint32_t executionModel)
+    {
+        switch (executionModel)
+        {
+        case spv::ExecutionModelVertex: return VK_SHADER_STAGE_VERTEX_BIT;
+        case spv::ExecutionModelTessellationControl: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+        case spv::ExecutionModelTessellationEvaluation: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+        case spv::ExecutionModelGeometry: return VK_SHADER_STAGE_GEOMETRY_BIT;
+        case spv::ExecutionModelFragment: return VK_SHADER_STAGE_FRAGMENT_BIT;
+        case spv::ExecutionModelGLCompute: return VK_SHADER_STAGE_COMPUTE_BIT;
+        default: throw std::runtime_error("shader reflection: unsupported execution model " + std::to_string(executionModel));
+        }
+    }
+
+    SeShaderReflection::Binding getBinding(const VariableInfo& variable, uint32_t typeId, const DecorationInfo& decorations) const
+    {
+        if (!decorations.bBinding) throw std::runtime_error("shader reflection: resource without a binding decoration");
+        SeShaderReflection::Binding binding;
+        binding.set = decorations.set;
+        binding.binding = decorations.binding;
+
+        const TypeInfo* type = &getType(typeId);
+        uint32_t resourceId = typeId;
+        if (type->op == spv::OpTypeArray || type->op == spv::OpTypeRuntimeArray)
+        {
+            binding.count = type->op == spv::OpTypeArray ? getConstant(type->count) : 0;
+            resourceId = type->element;
+            type = &getType(resourceId);
+        }
+
+        if (variable.storage == spv::StorageClassStorageBuffer)
+        {
+            binding.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        } else if (variable.storage == spv::StorageClassUniform)
+        {
+            // Before SPIR-V 1.3 storage buffers are Uniform blocks decorated BufferBlock
+            binding.type = decorationsOf(resourceId).bBufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        } else if (type->op == spv::OpTypeSampledImage)
+        {
+            const TypeInfo& image = getType(type->element);
+            binding.type = image.imageDim == spv::DimBuffer ? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        } else if (type->op == spv::OpTypeImage)
+        {
+            const bool bStorage = type->imageSampled == 2;
+            if (type->imageDim == spv::DimSubpassData) binding.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+            else if (type->imageDim == spv::DimBuffer) binding.type = bStorage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+            else binding.type = bStorage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        } else if (type->op == spv::OpTypeSampler)
+        {
+            binding.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+        } else if (type->op == spv::OpTypeAccelerationStructureKHR)
+        {
+            binding.type = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+        } else
+        {
+            throw std::runtime_error("shader reflection: unsupported resource at set " + std::to_string(binding.set) + " binding " + std::to_string(binding.binding));
+        }
+        return binding;
+    }
+
+    void addInputs(uint32_t typeId, const DecorationInfo& decorations, SeShaderReflection& reflection) const
+    {
+        if (decorations.bBuiltIn || decorationsOf(typeId).bMemberBuiltIn) return;
+        if (!decorations.bLocation) throw std::runtime_error("shader reflection: vertex input without a location");
+
+        // Matrices and arrays take one location per column or element
+        const TypeInfo* type = &getType(typeId);
+        uint32_t locations = 1;
+        if (type->op == spv::OpTypeArray)
+        {
+            locations = getConstant(type->count);
+            type = &getType(type->element);
+        }
+        if (type->op == spv::OpTypeMatrix)
+        {
+            locations *= type->count;
+            type = &getType(type->element);
+        }
+
+        uint32_t components = 1;
+        const TypeInfo* scalar = type;
+        if (type->op == spv::OpTypeVector)
+        {
+            components = type->count;
+            scalar = &getType(type->element);
+        }
+        const VkFormat format = getInputFormat(*scalar, components);
+        for (uint32_t i = 0; i < locations; i++)
+        {
+            reflection.inputs.push_back({decorations.location + i, format});
+        }
+    }
+
+    static VkFormat getInputFormat(const TypeInfo& scalar, uint32_t components)
+    {
+        static const VkFormat floats[4] = {VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT};
+        static const VkFormat sints[4] = {VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT};
+        static const VkFormat uints[4] = {VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT};
+        if (components < 1 || components > 4 || scalar.width != 32) throw std::runtime_error("shader reflection: unsupported vertex input type");
+        if (scalar.op == spv::OpTypeFloat) return floats[components - 1];
+        if (scalar.op == spv::OpTypeInt) return scalar.bSigned ? sints[components - 1] : uints[components - 1];
+        throw std::runtime_error("shader reflection: unsupported vertex input type");
+    }
+
+    const TypeInfo& getType(uint32_t id) const
+    {
+        auto it = types.find(id);
+        if (it == types.end()) throw std::runtime_error("shader reflection: unknown type " + std::to_string(id));
+        return it->second;
+    }
+
+    const DecorationInfo& decorationsOf(uint32_t id) const
+    {
+        static const DecorationInfo none;
+        auto it = decorations.find(id);
+        return it != decorations.end() ? it->second : none;
+    }
+
+    uint32_t getConstant(uint32_t id) const
+    {
+        auto it = constants.find(id);
+        // Spec constant sized arrays, the default size is not known here
+        if (it == constants.end()) throw std::runtime_error("shader reflection: array size is not a constant");
+        return it->second;
+    }
+
+    std::vector<uint32_t> words;
+    std::unordered_map<uint32_t, TypeInfo> types;
+    std::unordered_map<uint32_t, DecorationInfo> decorations;
+    std::unordered_map<uint32_t, uint32_t> constants;
+    std::vector<std::pair<uint32_t, uint32_t>> specConstants;   // id, type
+    std::vector<VariableInfo> variables;
+};
+
+enum class NumericType
+{
+    FLOAT,
+    SINT,
+    UINT
+};
+
+NumericType getNumericType(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_R8_UINT: case VK_FORMAT_R8G8_UINT: case VK_FORMAT_R8G8B8_UINT: case VK_FORMAT_R8G8B8A8_UINT:
+    case VK_FORMAT_R16_UINT: case VK_FORMAT_R16G16_UINT: case VK_FORMAT_R16G16B16_UINT: case VK_FORMAT_R16G16B16A16_UINT:
+    case VK_FORMAT_R32_UINT: case VK_FORMAT_R32G32_UINT: case VK_FORMAT_R32G32B32_UINT: case VK_FORMAT_R32G32B32A32_UINT:
+    case VK_FORMAT_A2B10G10R10_UINT_PACK32:
+        return NumericType::UINT;
+    case VK_FORMAT_R8_SINT: case VK_FORMAT_R8G8_SINT: case VK_FORMAT_R8G8B8_SINT: case VK_FORMAT_R8G8B8A8_SINT:
+    case VK_FORMAT_R16_SINT: case VK_FORMAT_R16G16_SINT: case VK_FORMAT_R16G16B16_SINT: case VK_FORMAT_R16G16B16A16_SINT:
+    case VK_FORMAT_R32_SINT: case VK_FORMAT_R32G32_SINT: case VK_FORMAT_R32G32B32_SINT: case VK_FORMAT_R32G32B32A32_SINT:
+    case VK_FORMAT_A2B10G10R10_SINT_PACK32:
+        return NumericType::SINT;
+    default:
+        // SFLOAT, UNORM, SNORM and the scaled formats all arrive as floats
+        return NumericType::FLOAT;
+    }
+}
+
+}
+
+SeShaderReflection SeShaderReflection::reflect(const std::vector<char>& code)
+{
+    return reflect(code.data(), code.size());
+}
+
+SeShaderReflection SeShaderReflection::reflect(const void* code, size_t size)
+{
+    SE_PROFILE_FUNCTION();
+    SeShaderReflection reflection;
+    SpirvReader reader(code, size);
+    reader.parse(reflection);
+    reader.collectResources(reflection);
+
+    std::sort(reflection.bindings.begin(), reflection.bindings.end(), [](const Binding& a, const Binding& b) {
+        return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+    });
+    std::sort(reflection.inputs.begin(), reflection.inputs.end(), [](const Input& a, const Input& b) { return a.location < b.location; });
+    return reflection;
+}
+
+const SeShaderReflection::SpecConstant* SeShaderReflection::findSpecConstant(uint32_t id) const
+{
+    for (const SpecConstant& constant : specConstants)
+    {
+        if (constant.id == id) return &constant;
+    }
+    return nullptr;
+}
+
+bool SeShaderReflection::isInputCompatible(VkFormat shaderFormat, VkFormat attributeFormat)
+{
+    return getNumericType(shaderFormat) == getNumericType(attributeFormat);
+}
+
+}
@@ -0,0 +1,54 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace SE {
+
+// Interface of one SPIR-V module: what a pipeline layout, the vertex input state and the
+// specialization data have to provide for it.
+//
+// Read straight from the instruction stream, no debug names are needed (stripped modules work).
+// Only single entry point modules are supported, which is all the engine builds.
+struct SeShaderReflection
+{
+    struct Binding
+    {
+        uint32_t set = 0;
+        uint32_t binding = 0;
+        VkDescriptorType type = VK_DESCRIPTOR_TYPE_MAX_ENUM;
+        uint32_t count = 1;     // 0 for runtime sized arrays
+    };
+
+    struct Input
+    {
+        uint32_t location = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;   // 32 bit per component, what the shader reads
+    };
+
+    struct SpecConstant
+    {
+        uint32_t id = 0;
+        uint32_t size = 0;      // bytes in VkSpecializationInfo data, booleans are VkBool32
+    };
+
+    VkShaderStageFlagBits stage = VK_SHADER_STAGE_ALL;
+    // Bytes of the push constant block from offset 0, 0 without one
+    uint32_t pushConstantSize = 0;
+    std::vector<Binding> bindings;          // sorted by set, then binding
+    std::vector<Input> inputs;              // vertex shaders only, sorted by location, no built-ins
+    std::vector<SpecConstant> specConstants;
+
+    // Throws on malformed code or resources it cannot map to Vulkan
+    static SeShaderReflection reflect(const std::vector<char>& code);
+    static SeShaderReflection reflect(const void* code, size_t size);
+
+    const SpecConstant* findSpecConstant(uint32_t id) const;
+
+    // Whether a vertex attribute in attributeFormat can feed an input the shader reads as
+    // shaderFormat. Component counts may differ, Vulkan fills or drops components, numeric types may not
+    static bool isInputCompatible(VkFormat shaderFormat, VkFormat attributeFormat);
+};
+
+}
@@ -0,0 +1,154 @@
+﻿#include "SeShaderWatcher.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "Config.h"
+#include "SePipelineRegistry.h"
+#include "SeProfiler.h"
+#include "SeShaderCache.h"
+#include "vulkancontext.h"
+
+namespace SE {
+
+namespace {
+#ifndef __linux__
+// File times are only compared this often, a full scan every frame would cost more than the frame
+constexpr double POLL_INTERVAL = 0.25;
+#endif
+}
+
+SeShaderWatcher::SeShaderWatcher(std::shared_ptr<VulkanContext> inctx)
+{
+    ctx = inctx;
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0)
+    {
+        std::cout << "Shader hot reload: inotify_init1 failed, errno " << errno << std::endl;
+        return;
+    }
+#endif
+    std::error_code error;
+    const std::filesystem::path root(Config::get().shader_path());
+    addWatch(root);
+    for (auto it = std::filesystem::recursive_directory_iterator(root, error); !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+    {
+        if (it->is_directory(error)) addWatch(it->path());
+    }
+    std::cout << "Shader hot reload: watching " << root.generic_string() << std::endl;
+}
+
+SeShaderWatcher::~SeShaderWatcher()
+{
+    // The reload job uses the shader cache and the registry, both outlive this
+    ctx->Se_jobs->wait(reloadJob);
+#ifdef __linux__
+    if (inotifyFd >= 0) close(inotifyFd);
+#endif
+}
+
+void SeShaderWatcher::addWatch(const std::filesystem::path& directory)
+{
+#ifdef __linux__
+    if (inotifyFd < 0) return;
+    // Editors either write in place or write a temporary file and rename it over the original
+    const int wd = inotify_add_watch(inotifyFd, directory.string().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0)
+    {
+        std::cout << "Shader hot reload: cannot watch " << directory.generic_string() << ", errno " << errno << std::endl;
+        return;
+    }
+    watchedDirectories[wd] = directory.lexically_normal().generic_string();
+#else
+    std::error_code error;
+    for (auto it = std::filesystem::directory_iterator(directory, error); !error && it != std::filesystem::directory_iterator(); it.increment(error))
+    {
+        if (!it->is_regular_file(error)) continue;
+        fileTimes[it->path().lexically_normal().generic_string()] = it->last_write_time(error);
+    }
+#endif
+}
+
+void SeShaderWatcher::collectChanges()
+{
+#ifdef __linux__
+    if (inotifyFd < 0) return;
+    alignas(inotify_event) char buffer[4096];
+    while (true)
+    {
+        const ssize_t size = read(inotifyFd, buffer, sizeof(buffer));
+        // EAGAIN once the queue is empty
+        if (size <= 0) return;
+        for (ssize_t offset = 0; offset < size;)
+        {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            auto it = watchedDirectories.find(event->wd);
+            if (it == watchedDirectories.end() || event->len == 0) continue;
+            const std::filesystem::path path = std::filesystem::path(it->second) / event->name;
+            if (event->mask & IN_ISDIR)
+            {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) addWatch(path);
+                continue;
+            }
+            // A new file is reported again by IN_CLOSE_WRITE once it is complete
+            if (event->mask & IN_CREATE) continue;
+            changedPaths.insert(path.lexically_normal().generic_string());
+        }
+    }
+#else
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - lastPoll).count() < POLL_INTERVAL) return;
+    lastPoll = now;
+
+    std::error_code error;
+    const std::filesystem::path root(Config::get().shader_path());
+    for (auto it = std::filesystem::recursive_directory_iterator(root, error); !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+    {
+        if (!it->is_regular_file(error)) continue;
+        const std::string path = it->path().lexically_normal().generic_string();
+        const std::filesystem::file_time_type time = it->last_write_time(error);
+        auto [known, bInserted] = fileTimes.emplace(path, time);
+        if (!bInserted && known->second == time) continue;
+        known->second = time;
+        changedPaths.insert(path);
+    }
+#endif
+}
+
+void SeShaderWatcher::update()
+{
+    SE_PROFILE_FUNCTION();
+    collectChanges();
+    if (changedPaths.empty() || !reloadJob.isDone()) return;
+
+    reloadPaths = std::move(changedPaths);
+    changedPaths.clear();
+    reloadCount++;
+    ctx->Se_jobs->run([this]() { reload(); }, &reloadJob);
+}
+
+void SeShaderWatcher::reload()
+{
+    SE_PROFILE_FUNCTION();
+    auto start = std::chrono::high_resolution_clock::now();
+    // Files no shader was built from (e.g. the .spv outputs of compileshaders.bat next to the sources) match nothing
+    std::unordered_set<std::string> variants = ctx->Se_shaders->reload(reloadPaths);
+    if (variants.empty()) return;
+
+    const uint32_t rebuilt = ctx->Se_pipelines->rebuildForShaders(variants);
+    double duration = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << std::fixed << std::setprecision(1) << "Shader hot reload: " << variants.size() << " shaders and " << rebuilt
+              << " pipelines rebuilt in " << duration << " ms" << std::defaultfloat << std::endl;
+}
+
+}
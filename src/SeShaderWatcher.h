@@ -0,0 +1,59 @@
+﻿#pragma once
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "SeJobSystem.h"
+
+namespace SE {
+struct VulkanContext;
+
+// Shader hot reload.
+//
+// Watches Config::shader_path() and its subdirectories, with inotify on Linux and by polling file
+// times elsewhere. Changed files are recompiled on a job through SeShaderCache::reload(), only the
+// pipelines using them are rebuilt through the SePipelineRegistry and the renderer swaps them in at
+// the next frame boundary. The old pipelines keep drawing until then, and for good when a shader
+// fails to compile. Changes arriving while a reload runs are picked up by the next one.
+class SeShaderWatcher
+{
+public:
+    SeShaderWatcher(std::shared_ptr<VulkanContext> inctx);
+    ~SeShaderWatcher();
+
+    SeShaderWatcher(const SeShaderWatcher&) = delete;
+    void operator=(const SeShaderWatcher&) = delete;
+
+    // Once a frame from the main thread, never blocks
+    void update();
+
+    uint32_t getReloadCount() const { return reloadCount; }
+
+private:
+    // Adds the paths changed since the last call to changedPaths
+    void collectChanges();
+    void addWatch(const std::filesystem::path& directory);
+    void reload();
+
+    std::shared_ptr<VulkanContext> ctx;
+
+    // Normalized like SeShaderBinary::dependencies
+    std::unordered_set<std::string> changedPaths;
+    // Owned by the reload job while it runs
+    std::unordered_set<std::string> reloadPaths;
+    SeJobCounter reloadJob;
+    uint32_t reloadCount = 0;
+
+#ifdef __linux__
+    int inotifyFd = -1;
+    std::unordered_map<int, std::string> watchedDirectories;
+#else
+    std::unordered_map<std::string, std::filesystem::file_time_type> fileTimes;
+    std::chrono::steady_clock::time_point lastPoll;
+#endif
+};
+
+}
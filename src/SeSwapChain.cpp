@@ -1,7 +1,10 @@
 #include "SeSwapChain.h"
 
 // std
+#include <algorithm>
 #include <array>
+#include <cassert>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
@@ -9,13 +12,75 @@
 #include <set>
 #include <stdexcept>
 
+#include <vulkan/vk_enum_string_helper.h>
+
+#include "Config.h"
 #include "SeDevice.h"
+#include "SeProfiler.h"
 #include "vulkancontext.h"
 
 namespace SE {
 
+PresentSettings PresentSettings::fromProfile(PresentProfile profile)
+{
+  PresentSettings settings{};
+  settings.profile = profile;
+  switch (profile) {
+    case PresentProfile::LowLatency:
+      settings.presentMode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+      settings.framesInFlight = 1;
+      break;
+    case PresentProfile::Throughput:
+      settings.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+      settings.framesInFlight = 3;
+      break;
+    case PresentProfile::PowerSaving:
+      settings.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+      settings.framesInFlight = 2;
+      settings.frameCap = Config::get().frame_cap() > 0 ? Config::get().frame_cap() : 30;
+      break;
+    case PresentProfile::Custom:
+      settings = fromConfig();
+      settings.profile = PresentProfile::Custom;
+      break;
+  }
+  return settings;
+}
+
+PresentSettings PresentSettings::fromConfig()
+{
+  PresentProfile profile = profileFromString(Config::get().present_profile());
+  if (profile != PresentProfile::Custom) return fromProfile(profile);
+
+  PresentSettings settings{};
+  settings.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+  settings.framesInFlight = std::clamp(Config::get().max_frames_in_flight(), 1, SeSwapChain::MAX_FRAMES_IN_FLIGHT);
+  settings.frameCap = Config::get().frame_cap();
+  return settings;
+}
+
+PresentProfile PresentSettings::profileFromString(const std::string& name)
+{
+  if (name == "low-latency") return PresentProfile::LowLatency;
+  if (name == "throughput") return PresentProfile::Throughput;
+  if (name == "power-saving") return PresentProfile::PowerSaving;
+  if (!name.empty() && name != "custom") std::cout << "Unknown present profile '" << name << "', using custom" << std::endl;
+  return PresentProfile::Custom;
+}
+
+const char* PresentSettings::profileName(PresentProfile profile)
+{
+  switch (profile) {
+    case PresentProfile::LowLatency: return "low-latency";
+    case PresentProfile::Throughput: return "throughput";
+    case PresentProfile::PowerSaving: return "power-saving";
+    default: return "custom";
+  }
+}
+
 SeSwapChain::SeSwapChain(std::shared_ptr<VulkanContext> inctx) {
   ctx = inctx;
+  present_settings = PresentSettings::fromConfig();
   init();
 }
 
@@ -23,6 +88,16 @@ SeSwapChain::SeSwapChain(std::shared_ptr<VulkanContext> inctx, SeSwapChain* prev
 {
   ctx = inctx;
   oldSwapChain = previous;
+  present_settings = previous->present_settings;
+  init();
+}
+
+SeSwapChain::SeSwapChain(std::shared_ptr<VulkanContext> inctx, SeSwapChain* previous, const PresentSettings& settings)
+{
+  ctx = inctx;
+  oldSwapChain = previous;
+  present_settings = settings;
+  present_settings.framesInFlight = std::clamp(present_settings.framesInFlight, 1, MAX_FRAMES_IN_FLIGHT);
   init();
 }
 
@@ -38,6 +113,12 @@ SeSwapChain::~SeSwapChain() {
     swap_chain  = nullptr;
   }
 
+  // headless only, presentable images belong to the swap chain
+  for (size_t i = 0; i < offscreenImageMemorys.size(); i++) {
+    vkDestroyImage(ctx->Se_device->device, swapChainImages[i], nullptr);
+    vkFreeMemory(ctx->Se_device->device, offscreenImageMemorys[i], nullptr);
+  }
+
   for (int i = 0; i < depthImages.size(); i++) {
     vkDestroyImageView(ctx->Se_device->device, depthImageViews[i], nullptr);
     vkDestroyImage(ctx->Se_device->device, depthImages[i], nullptr);
@@ -49,24 +130,41 @@ SeSwapChain::~SeSwapChain() {
     vkDestroyFramebuffer(ctx->Se_device->device, framebuffer, nullptr);
   }
 
-  vkDestroyRenderPass(ctx->Se_device->device, renderPass, nullptr);
+  for (auto framebuffer : depthPrepassFramebuffers) {
+    vkDestroyFramebuffer(ctx->Se_device->device, framebuffer, nullptr);
+  }
+
+  // null when they were handed over to the next swap chain
+  vkDestroyRenderPass(ctx->Se_device->device, render_pass, nullptr);
+  vkDestroyRenderPass(ctx->Se_device->device, depth_prepass_render_pass, nullptr);
+  vkDestroyRenderPass(ctx->Se_device->device, depth_prepass_load_render_pass, nullptr);
 
-  // cleanup synchronization objects
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+  // cleanup synchronization objects, empty when they were handed over to the next swap chain
+  for (size_t i = 0; i < imageAvailableSemaphores.size(); i++) {
     vkDestroySemaphore(ctx->Se_device->device, renderFinishedSemaphores[i], nullptr);
     vkDestroySemaphore(ctx->Se_device->device, imageAvailableSemaphores[i], nullptr);
-    vkDestroyFence(ctx->Se_device->device, inFlightFences[i], nullptr);
+  }
+  if (frame_timeline != VK_NULL_HANDLE) {
+    waitForTimeline(submittedFrames);
+    vkDestroySemaphore(ctx->Se_device->device, frame_timeline, nullptr);
   }
   
 }
 
 VkResult SeSwapChain::acquireNextImage(uint32_t *imageIndex) {
-  vkWaitForFences(
-      ctx->Se_device->device,
-      1,
-      &inFlightFences[currentFrame],
-      VK_TRUE,
-      std::numeric_limits<uint64_t>::max());
+  SE_PROFILE_FUNCTION();
+  // Frame N may start once frame N - framesInFlight has retired, its command buffer and per frame data are free again
+  auto waitStart = std::chrono::steady_clock::now();
+  uint64_t retireValue = submittedFrames >= static_cast<uint64_t>(framesInFlight()) ? submittedFrames + 1 - framesInFlight() : 0;
+  waitForTimeline(retireValue);
+  auto acquireStart = std::chrono::steady_clock::now();
+
+  if (isHeadless()) {
+    *imageIndex = static_cast<uint32_t>(currentFrame);
+    gpuWaitTime = std::chrono::duration<double, std::milli>(acquireStart - waitStart).count();
+    acquireWaitTime = 0.0;
+    return VK_SUCCESS;
+  }
 
   VkResult result = vkAcquireNextImageKHR(
       ctx->Se_device->device,
@@ -76,38 +174,58 @@ VkResult SeSwapChain::acquireNextImage(uint32_t *imageIndex) {
       VK_NULL_HANDLE,
       imageIndex);
 
+  auto acquireEnd = std::chrono::steady_clock::now();
+  gpuWaitTime = std::chrono::duration<double, std::milli>(acquireStart - waitStart).count();
+  acquireWaitTime = std::chrono::duration<double, std::milli>(acquireEnd - acquireStart).count();
+
   return result;
 }
 
 VkResult SeSwapChain::submitCommandBuffers(
     const VkCommandBuffer *buffers, uint32_t *imageIndex) {
-  if (imagesInFlight[*imageIndex] != VK_NULL_HANDLE) {
-    vkWaitForFences(ctx->Se_device->device, 1, &imagesInFlight[*imageIndex], VK_TRUE, UINT64_MAX);
-  }
-  imagesInFlight[*imageIndex] = inFlightFences[currentFrame];
+  SE_PROFILE_FUNCTION();
+  // The image's depth attachment and framebuffer may still be used by the last frame that rendered to it
+  waitForTimeline(imageTimelineValues[*imageIndex]);
+  const uint64_t signalValue = submittedFrames + 1;
+  imageTimelineValues[*imageIndex] = signalValue;
 
   VkSubmitInfo submitInfo = {};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
   VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
   VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submitInfo.waitSemaphoreCount = 1;
+  submitInfo.waitSemaphoreCount = isHeadless() ? 0 : 1;
   submitInfo.pWaitSemaphores = waitSemaphores;
   submitInfo.pWaitDstStageMask = waitStages;
 
   submitInfo.commandBufferCount = 1;
   submitInfo.pCommandBuffers = buffers;
 
-  VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-  submitInfo.signalSemaphoreCount = 1;
-  submitInfo.pSignalSemaphores = signalSemaphores;
-
-  vkResetFences(ctx->Se_device->device, 1, &inFlightFences[currentFrame]);
-  VkResult result = vkQueueSubmit(ctx->Se_device->graphics_queue, 1, &submitInfo, inFlightFences[currentFrame]);
+  // Presentation only understands binary semaphores, the timeline is signaled alongside
+  VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame], frame_timeline};
+  uint64_t signalValues[] = {0, signalValue};
+  // Headless frames are never presented, only the timeline is signaled
+  const uint32_t firstSignal = isHeadless() ? 1 : 0;
+  submitInfo.signalSemaphoreCount = 2 - firstSignal;
+  submitInfo.pSignalSemaphores = signalSemaphores + firstSignal;
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.signalSemaphoreValueCount = 2 - firstSignal;
+  timelineInfo.pSignalSemaphoreValues = signalValues + firstSignal;
+  submitInfo.pNext = &timelineInfo;
+
+  VkResult result = vkQueueSubmit(ctx->Se_device->graphics_queue, 1, &submitInfo, VK_NULL_HANDLE);
   if (result !=
       VK_SUCCESS) {
     throw std::runtime_error("failed to submit draw command buffer!");
   }
+  submittedFrames = signalValue;
+
+  if (isHeadless()) {
+    currentFrame = (currentFrame + 1) % imageAvailableSemaphores.size();
+    return VK_SUCCESS;
+  }
 
   VkPresentInfoKHR presentInfo = {};
   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -123,34 +241,125 @@ VkResult SeSwapChain::submitCommandBuffers(
 
   result = vkQueuePresentKHR(ctx->Se_device->present_queue, &presentInfo);
 
-  currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+  currentFrame = (currentFrame + 1) % imageAvailableSemaphores.size();
 
   return result;
 }
 
-void SeSwapChain::clearOldSwapChain()
-{
-  delete oldSwapChain;
+uint64_t SeSwapChain::completedFrames() const {
+  uint64_t value = 0;
+  vkGetSemaphoreCounterValue(ctx->Se_device->device, frame_timeline, &value);
+  return value;
+}
+
+void SeSwapChain::waitForTimeline(uint64_t value) {
+  if (value == 0) return;
+  SE_PROFILE_FUNCTION();
+
+  VkSemaphoreWaitInfo waitInfo = {};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &frame_timeline;
+  waitInfo.pValues = &value;
+  vkWaitSemaphores(ctx->Se_device->device, &waitInfo, UINT64_MAX);
 }
 
 void SeSwapChain::init()
 {
   createSwapChain();
   createImageViews();
-  createRenderPass();
+  swapChainDepthFormat = findDepthFormat();
+
+  bFormatsMatchPrevious = oldSwapChain != nullptr && compareOldSwapFormats();
+  if (bFormatsMatchPrevious) {
+    adoptRenderPasses(oldSwapChain);
+  } else {
+    createRenderPass();
+    if (Config::get().depth_prepass()) createDepthPrepassRenderPasses();
+  }
+
   createDepthResources();
   createFramebuffers();
-  createSyncObjects();
+  if (Config::get().depth_prepass()) createDepthPrepassFramebuffers();
+
+  if (oldSwapChain != nullptr) {
+    adoptSyncObjects(oldSwapChain);
+  } else {
+    createTimeline();
+    createSyncObjects();
+  }
+  oldSwapChain = nullptr;
+}
+
+void SeSwapChain::adoptRenderPasses(SeSwapChain* previous)
+{
+  // render passes only depend on the attachment formats, so they survive a resize untouched
+  render_pass = previous->render_pass;
+  depth_prepass_render_pass = previous->depth_prepass_render_pass;
+  depth_prepass_load_render_pass = previous->depth_prepass_load_render_pass;
+  previous->render_pass = VK_NULL_HANDLE;
+  previous->depth_prepass_render_pass = VK_NULL_HANDLE;
+  previous->depth_prepass_load_render_pass = VK_NULL_HANDLE;
+}
+
+void SeSwapChain::adoptSyncObjects(SeSwapChain* previous)
+{
+  // The frame timeline keeps counting across swap chains, frames recorded against the previous
+  // one are still waited on through it without any device wide stall
+  frame_timeline = previous->frame_timeline;
+  submittedFrames = previous->submittedFrames;
+  previous->frame_timeline = VK_NULL_HANDLE;
+  // The new images, depth attachments and framebuffers were never used by the GPU, nothing to wait
+  // for before the first frame renders into them. Frame slot reuse is covered by the frame timeline
+  imageTimelineValues.assign(imageCount(), 0);
+
+  if (previous->imageAvailableSemaphores.size() != static_cast<size_t>(framesInFlight())) {
+    // Frame count changed (profile switch), frame slots are renumbered so every previous frame must
+    // have finished with its command buffer. The old binary semaphores go away with the old swap chain
+    waitForTimeline(submittedFrames);
+    createSyncObjects();
+    return;
+  }
+
+  imageAvailableSemaphores = std::move(previous->imageAvailableSemaphores);
+  renderFinishedSemaphores = std::move(previous->renderFinishedSemaphores);
+  previous->imageAvailableSemaphores.clear();
+  previous->renderFinishedSemaphores.clear();
+  currentFrame = previous->currentFrame;
+}
+
+void SeSwapChain::createTimeline()
+{
+  VkSemaphoreTypeCreateInfo typeInfo = {};
+  typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeInfo.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphoreInfo = {};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &typeInfo;
+
+  if (vkCreateSemaphore(ctx->Se_device->device, &semaphoreInfo, nullptr, &frame_timeline) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create frame timeline semaphore!");
+  }
+  submittedFrames = 0;
+  imageTimelineValues.assign(imageCount(), 0);
 }
 
 void SeSwapChain::createSwapChain() {
+  if (Config::get().headless()) {
+    createOffscreenImages();
+    return;
+  }
+
   SwapChainSupportDetails swapChainSupport = ctx->Se_device->getSwapChainSupport();
 
   VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
-  VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+  presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
   VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
 
-  uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+  // One image on screen plus one per frame the CPU may queue up, more images only add latency
+  uint32_t imageCount = std::max(swapChainSupport.capabilities.minImageCount, static_cast<uint32_t>(framesInFlight()) + 1);
   if (swapChainSupport.capabilities.maxImageCount > 0 &&
       imageCount > swapChainSupport.capabilities.maxImageCount) {
     imageCount = swapChainSupport.capabilities.maxImageCount;
@@ -207,6 +416,76 @@ void SeSwapChain::createSwapChain() {
   swapChainExtent = extent;
 }
 
+void SeSwapChain::createOffscreenImages() {
+  // One color target per frame in flight, the frame slot doubles as the image index
+  swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+  swapChainExtent = {Config::get().window().width, Config::get().window().height};
+  presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+  std::cout << "Headless: " << swapChainExtent.width << "x" << swapChainExtent.height
+            << ", " << framesInFlight() << " frames in flight" << std::endl;
+
+  swapChainImages.resize(framesInFlight());
+  offscreenImageMemorys.resize(framesInFlight());
+  for (size_t i = 0; i < swapChainImages.size(); i++) {
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = swapChainExtent.width;
+    imageInfo.extent.height = swapChainExtent.height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = swapChainImageFormat;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.flags = 0;
+
+    ctx->Se_device->createImageWithInfo(
+        imageInfo,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        swapChainImages[i],
+        offscreenImageMemorys[i]);
+  }
+}
+
+void SeSwapChain::readbackImage(uint32_t imageIndex, std::vector<uint8_t>& pixels) {
+  assert(isHeadless() && "Readback is only available for offscreen images");
+
+  // Debug/CI path, stalling here is fine
+  waitForTimeline(imageTimelineValues[imageIndex]);
+
+  VkDeviceSize size = static_cast<VkDeviceSize>(swapChainExtent.width) * swapChainExtent.height * 4;
+  VkBuffer stagingBuffer;
+  VkDeviceMemory stagingBufferMemory;
+  ctx->Se_device->createBuffer(
+      size,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      stagingBuffer,
+      stagingBufferMemory);
+
+  // The render pass leaves offscreen images in TRANSFER_SRC_OPTIMAL
+  VkCommandBuffer commandBuffer = ctx->Se_device->beginSingleTimeCommands();
+  VkBufferImageCopy region{};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = {swapChainExtent.width, swapChainExtent.height, 1};
+  vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, stagingBuffer, 1, &region);
+  ctx->Se_device->endSingleTimeCommands(commandBuffer);
+
+  pixels.resize(static_cast<size_t>(size));
+  void* data;
+  vkMapMemory(ctx->Se_device->device, stagingBufferMemory, 0, size, 0, &data);
+  memcpy(pixels.data(), data, static_cast<size_t>(size));
+  vkUnmapMemory(ctx->Se_device->device, stagingBufferMemory);
+
+  vkDestroyBuffer(ctx->Se_device->device, stagingBuffer, nullptr);
+  vkFreeMemory(ctx->Se_device->device, stagingBufferMemory, nullptr);
+}
+
 void SeSwapChain::createImageViews() {
   swapChainImageViews.resize(swapChainImages.size());
   for (size_t i = 0; i < swapChainImages.size(); i++) {
@@ -232,7 +511,7 @@ void SeSwapChain::createImageViews() {
 
 void SeSwapChain::createRenderPass() {
   VkAttachmentDescription depthAttachment{};
-  depthAttachment.format = findDepthFormat();
+  depthAttachment.format = swapChainDepthFormat;
   depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
   depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
   depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
@@ -245,6 +524,15 @@ void SeSwapChain::createRenderPass() {
   depthAttachmentRef.attachment = 1;
   depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
+  if (Config::get().depth_prepass()) {
+    // depth is already laid down by the prepass, the main pass only tests against it.
+    // DONT_CARE still counts as a depth write, the next prepass waits for it (dependencies[0] there)
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  }
+
   VkAttachmentDescription colorAttachment = {};
   colorAttachment.format = getSwapChainImageFormat();
   colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -253,7 +541,7 @@ void SeSwapChain::createRenderPass() {
   colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
   colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
   colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  colorAttachment.finalLayout = isHeadless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
   VkAttachmentReference colorAttachmentRef = {};
   colorAttachmentRef.attachment = 0;
@@ -288,6 +576,85 @@ void SeSwapChain::createRenderPass() {
   }
 }
 
+void SeSwapChain::createDepthPrepassRenderPasses() {
+  VkAttachmentDescription depthAttachment{};
+  depthAttachment.format = swapChainDepthFormat;
+  depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  // left read only so the Hi-Z build can sample it and the main pass can test against it
+  depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+  VkAttachmentReference depthAttachmentRef{};
+  depthAttachmentRef.attachment = 0;
+  depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 0;
+  subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+  std::array<VkSubpassDependency, 2> dependencies = {};
+  // previous users of this depth image (main pass, Hi-Z build) before we write it again. The main
+  // pass only tests, but its DONT_CARE store op is a write at the end of the pass
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  // depth writes visible to the Hi-Z build and the main pass
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+  VkRenderPassCreateInfo renderPassInfo = {};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassInfo.attachmentCount = 1;
+  renderPassInfo.pAttachments = &depthAttachment;
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+  renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+  renderPassInfo.pDependencies = dependencies.data();
+
+  if (vkCreateRenderPass(ctx->Se_device->device, &renderPassInfo, nullptr, &depth_prepass_render_pass) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create depth prepass render pass!");
+  }
+
+  // second phase keeps the first phase's depth
+  depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+  if (vkCreateRenderPass(ctx->Se_device->device, &renderPassInfo, nullptr, &depth_prepass_load_render_pass) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create depth prepass render pass!");
+  }
+}
+
+void SeSwapChain::createDepthPrepassFramebuffers() {
+  // load and clear variants are compatible, so one set of framebuffers serves both
+  depthPrepassFramebuffers.resize(swapChainImages.size());
+  for (size_t i = 0; i < swapChainImages.size(); i++) {
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = depth_prepass_render_pass;
+    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.pAttachments = &depthImageViews[i];
+    framebufferInfo.width = swapChainExtent.width;
+    framebufferInfo.height = swapChainExtent.height;
+    framebufferInfo.layers = 1;
+
+    if (vkCreateFramebuffer(ctx->Se_device->device, &framebufferInfo, nullptr, &depthPrepassFramebuffers[i]) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create depth prepass framebuffer!");
+    }
+  }
+}
+
 void SeSwapChain::createFramebuffers() {
   
   swapChainFramebuffers.resize(swapChainImages.size());
@@ -317,8 +684,7 @@ void SeSwapChain::createFramebuffers() {
 }
 
 void SeSwapChain::createDepthResources() {
-  VkFormat depthFormat = findDepthFormat();
-  swapChainDepthFormat = depthFormat;
+  VkFormat depthFormat = swapChainDepthFormat;
   depthImages.resize(imageCount());
   depthImageMemorys.resize(imageCount());
   depthImageViews.resize(imageCount());
@@ -336,6 +702,7 @@ void SeSwapChain::createDepthResources() {
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    if (Config::get().depth_prepass()) imageInfo.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageInfo.flags = 0;
@@ -364,24 +731,20 @@ void SeSwapChain::createDepthResources() {
 }
 
 void SeSwapChain::createSyncObjects() {
-  imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-  imagesInFlight.resize(imageCount(), VK_NULL_HANDLE);
+  // Binary semaphores are still needed for acquire and present, frame completion lives on the timeline
+  const int frameCount = framesInFlight();
+  imageAvailableSemaphores.resize(frameCount);
+  renderFinishedSemaphores.resize(frameCount);
+  currentFrame = 0;
 
   VkSemaphoreCreateInfo semaphoreInfo = {};
   semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-  VkFenceCreateInfo fenceInfo = {};
-  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+  for (int i = 0; i < frameCount; i++) {
     if (vkCreateSemaphore(ctx->Se_device->device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) !=
             VK_SUCCESS ||
         vkCreateSemaphore(ctx->Se_device->device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) !=
-            VK_SUCCESS ||
-        vkCreateFence(ctx->Se_device->device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
+            VK_SUCCESS) {
       throw std::runtime_error("failed to create synchronization objects for a frame!");
     }
   }
@@ -422,20 +785,16 @@ VkSurfaceFormatKHR SeSwapChain::chooseSwapSurfaceFormat(
 VkPresentModeKHR SeSwapChain::chooseSwapPresentMode(
     const std::vector<VkPresentModeKHR> &availablePresentModes) {
   for (const auto &availablePresentMode : availablePresentModes) {
-    if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-      //std::cout << "Present mode: Mailbox" << std::endl;
+    if (availablePresentMode == present_settings.presentMode) {
+      std::cout << "Present mode: " << string_VkPresentModeKHR(availablePresentMode)
+                << " (" << PresentSettings::profileName(present_settings.profile) << ", "
+                << framesInFlight() << " frames in flight)" << std::endl;
       return availablePresentMode;
     }
   }
 
-  // for (const auto &availablePresentMode : availablePresentModes) {
-  //   if (availablePresentMode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
-  //     std::cout << "Present mode: Immediate" << std::endl;
-  //     return availablePresentMode;
-  //   }
-  // }
-
-  std::cout << "Present mode: V-Sync" << std::endl;
+  // FIFO is the only mode every driver has to support
+  std::cout << "Present mode: V-Sync (" << string_VkPresentModeKHR(present_settings.presentMode) << " unsupported)" << std::endl;
   return VK_PRESENT_MODE_FIFO_KHR;
 }
 
@@ -443,9 +802,8 @@ VkExtent2D SeSwapChain::chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabil
   if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
     return capabilities.currentExtent;
   } else {
-    int ewidth = 0, eheight = 0;
-    glfwGetFramebufferSize(ctx->Se_window->window, &ewidth, &eheight);
-    VkExtent2D actualExtent; { ewidth, eheight; }
+    // Cached by the window's callbacks, GLFW may only be queried on the main thread
+    VkExtent2D actualExtent = {static_cast<uint32_t>(ctx->Se_window->width.load()), static_cast<uint32_t>(ctx->Se_window->height.load())};
     
     actualExtent.width = std::max(
         capabilities.minImageExtent.width,
@@ -459,10 +817,13 @@ VkExtent2D SeSwapChain::chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabil
 }
 
 VkFormat SeSwapChain::findDepthFormat() {
+  VkFormatFeatureFlags features = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  // the Hi-Z build samples the depth buffer
+  if (Config::get().depth_prepass()) features |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
   return ctx->Se_device->findSupportedFormat(
       {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
       VK_IMAGE_TILING_OPTIMAL,
-      VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+      features);
 }
 
 }
@@ -3,13 +3,37 @@
 #include <vulkan/vulkan.h>
 #include "vulkancontext.h"
 // std lib headers
+#include <string>
 #include <vector>
 
 namespace SE {
 
+// Latency/throughput trade-off of the swap chain, selectable in config.ini or at runtime
+enum class PresentProfile
+{
+    Custom,       // present mode preference and frames in flight as configured
+    LowLatency,   // FIFO_RELAXED, one frame in flight
+    Throughput,   // MAILBOX, three frames in flight
+    PowerSaving   // FIFO with a CPU side frame cap
+};
+
+struct PresentSettings
+{
+    PresentProfile profile = PresentProfile::Custom;
+    VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+    int framesInFlight = 2;
+    int frameCap = 0;   // 0 = uncapped
+
+    static PresentSettings fromProfile(PresentProfile profile);
+    static PresentSettings fromConfig();
+    static PresentProfile profileFromString(const std::string& name);
+    static const char* profileName(PresentProfile profile);
+};
+
 class SeSwapChain {
 public:
-    static constexpr int MAX_FRAMES_IN_FLIGHT = 2;
+    // Upper bound for anything sized per frame in flight, the active count is framesInFlight()
+    static constexpr int MAX_FRAMES_IN_FLIGHT = 4;
 
     SeSwapChain(std::shared_ptr<VulkanContext> inctx);
     
@@ -18,24 +42,31 @@ public:
     SeSwapChain& operator=(const SeSwapChain&) = delete;
 
     SeSwapChain(std::shared_ptr<VulkanContext> inctx, SeSwapChain* previous);
+    SeSwapChain(std::shared_ptr<VulkanContext> inctx, SeSwapChain* previous, const PresentSettings& settings);
     ~SeSwapChain();
     void createSwapChain();
     void createFramebuffers();
     void createImageViews();
     void createDepthResources();
     void createRenderPass();
+    void createDepthPrepassRenderPasses();
+    void createDepthPrepassFramebuffers();
     void createSyncObjects();
+    void createOffscreenImages();
     void cleanupSwapChain();
 
     
     // Getters
     VkFramebuffer getFrameBuffer(int index) { return swapChainFramebuffers[index]; }
+    VkFramebuffer getDepthPrepassFrameBuffer(int index) { return depthPrepassFramebuffers[index]; }
+    VkImageView getDepthImageView(int index) { return depthImageViews[index]; }
     std::vector<VkFramebuffer> getFrameBuffers() { return swapChainFramebuffers; }
-    VkRenderPass getRenderPass() { return renderPass; }
+    VkRenderPass getRenderPass() { return render_pass; }
     VkImageView getImageView(int index) { return swapChainImageViews[index]; }
     std::vector<VkImageView> getImageViews() { return swapChainImageViews; }
     size_t imageCount() { return swapChainImages.size(); }
     VkFormat getSwapChainImageFormat() { return swapChainImageFormat; }
+    VkFormat getSwapChainDepthFormat() { return swapChainDepthFormat; }
     VkExtent2D getSwapChainExtent() { return swapChainExtent; }
     uint32_t width() { return swapChainExtent.width; }
     uint32_t height() { return swapChainExtent.height; }
@@ -47,22 +78,45 @@ public:
     {
         return oldSwapChain->swapChainImageFormat == swapChainImageFormat && oldSwapChain->swapChainDepthFormat == swapChainDepthFormat;
     }
+    // Render passes were carried over from the previous swap chain, pipelines built against them stay valid
+    bool formatsMatchPrevious() const { return bFormatsMatchPrevious; }
+    int framesInFlight() const { return present_settings.framesInFlight; }
+    int getCurrentFrame() const { return static_cast<int>(currentFrame); }
+    const PresentSettings& getPresentSettings() const { return present_settings; }
+    VkPresentModeKHR getPresentMode() const { return presentMode; }
+    // Offscreen color targets instead of a VkSwapchainKHR, see Config::headless()
+    bool isHeadless() const { return swap_chain == VK_NULL_HANDLE; }
+    // Copies a finished offscreen image into tightly packed RGBA8, blocks until it is done
+    void readbackImage(uint32_t imageIndex, std::vector<uint8_t>& pixels);
     VkFormat findDepthFormat();
     VkResult acquireNextImage(uint32_t *imageIndex);
     VkResult submitCommandBuffers(const VkCommandBuffer *buffers, uint32_t *imageIndex);
 
-    void clearOldSwapChain();
+    // Frame pacing, frame N signals value N on the frame timeline when its GPU work completes
+    uint64_t submittedFrameCount() const { return submittedFrames; }
+    uint64_t completedFrames() const;
+    void waitForTimeline(uint64_t value);
+    // Time the last acquireNextImage spent blocked on the GPU retiring an old frame, and inside vkAcquireNextImageKHR
+    double getGpuWaitTime() const { return gpuWaitTime; }
+    double getAcquireWaitTime() const { return acquireWaitTime; }
 
 public:
     VkSwapchainKHR swap_chain{};
     VkRenderPass render_pass{};
+    // Depth prepass: clears depth for the first phase, loads it for the second
+    VkRenderPass depth_prepass_render_pass{};
+    VkRenderPass depth_prepass_load_render_pass{};
     std::vector<VkImageView> swapChainImageViews;
     std::vector<VkImageView> depthImageViews;
     std::vector<VkFramebuffer> swapChainFramebuffers;
+    std::vector<VkFramebuffer> depthPrepassFramebuffers;
 private:
     
     
     void init();
+    void adoptRenderPasses(SeSwapChain* previous);
+    void adoptSyncObjects(SeSwapChain* previous);
+    void createTimeline();
     
     // Helper functions
     VkSurfaceFormatKHR chooseSwapSurfaceFormat(
@@ -76,19 +130,28 @@ private:
     VkFormat swapChainImageFormat{};
     VkFormat swapChainDepthFormat{};
     VkExtent2D swapChainExtent{};
+    // Only valid during construction, the previous swap chain is retired by the renderer afterwards
     SeSwapChain* oldSwapChain = nullptr;
-    VkRenderPass renderPass{};
+    bool bFormatsMatchPrevious = false;
+    PresentSettings present_settings{};
+    VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
     std::vector<VkImage> depthImages;
     std::vector<VkDeviceMemory> depthImageMemorys;
     std::vector<VkImage> swapChainImages;
+    std::vector<VkDeviceMemory> offscreenImageMemorys;
     
     
 
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> renderFinishedSemaphores;
-    std::vector<VkFence> inFlightFences;
-    std::vector<VkFence> imagesInFlight;
+    // Single timeline shared by all frames, handed over to the next swap chain on recreation
+    VkSemaphore frame_timeline = VK_NULL_HANDLE;
+    uint64_t submittedFrames = 0;
+    // Timeline value of the last frame that rendered to each swap chain image
+    std::vector<uint64_t> imageTimelineValues;
     size_t currentFrame = 0;
+    double gpuWaitTime = 0.0;       // ms
+    double acquireWaitTime = 0.0;   // ms
     std::shared_ptr<VulkanContext> ctx;
 };
 
@@ -0,0 +1,418 @@
+﻿#include "SeTransformBatch.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "SeComponents.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SE_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC emits AVX2 intrinsics without /arch, the kernel only runs after the CPUID check
+#define SE_TARGET_AVX2
+#else
+#define SE_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define SE_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace SE {
+
+namespace {
+// Cephes single precision sin/cos: Cody-Waite reduction by pi/2, minimax polynomials on [-pi/4, pi/4].
+// Accurate to a few ulp for |x| up to ~8000, far beyond any rotation angle
+constexpr float TWO_OVER_PI = 0.636619772367581343f;
+constexpr float PIO2_1 = 1.5703125f;
+constexpr float PIO2_2 = 4.837512969970703125e-4f;
+constexpr float PIO2_3 = 7.54978995489188216e-8f;
+constexpr float SIN_1 = -1.9515295891e-4f;
+constexpr float SIN_2 = 8.3321608736e-3f;
+constexpr float SIN_3 = -1.6666654611e-1f;
+constexpr float COS_1 = 2.443315711809948e-5f;
+constexpr float COS_2 = -1.388731625493765e-3f;
+constexpr float COS_3 = 4.166664568298827e-2f;
+
+size_t paddedSize(size_t count)
+{
+    return (count + SeTransformBatch::LANES - 1) / SeTransformBatch::LANES * SeTransformBatch::LANES;
+}
+
+glm::mat4& matrixAt(glm::mat4* base, size_t stride, size_t index)
+{
+    return *reinterpret_cast<glm::mat4*>(reinterpret_cast<char*>(base) + index * stride);
+}
+
+// Lane major results of one SIMD batch, written out per object afterwards
+struct alignas(32) BatchLanes
+{
+    float mvp[16][SeTransformBatch::LANES];
+    float world[16][SeTransformBatch::LANES];
+};
+
+void scatterLanes(const BatchLanes& lanes, size_t base, size_t valid, glm::mat4* mvp, size_t mvpStride, glm::mat4* world, size_t worldStride)
+{
+    for (size_t lane = 0; lane < valid; lane++)
+    {
+        float* dst = &matrixAt(mvp, mvpStride, base + lane)[0][0];
+        for (int e = 0; e < 16; e++)
+        {
+            dst[e] = lanes.mvp[e][lane];
+        }
+        if (!world) continue;
+        float* worldDst = &matrixAt(world, worldStride, base + lane)[0][0];
+        for (int e = 0; e < 16; e++)
+        {
+            worldDst[e] = lanes.world[e][lane];
+        }
+    }
+}
+}
+
+void SeTransformBatch::resize(size_t incount)
+{
+    count = incount;
+    const size_t padded = paddedSize(count);
+    for (auto* stream : {&translationX, &translationY, &translationZ, &rotationX, &rotationY, &rotationZ})
+    {
+        stream->resize(padded, 0.f);
+    }
+    for (auto* stream : {&scaleX, &scaleY, &scaleZ})
+    {
+        stream->resize(padded, 1.f);
+    }
+}
+
+void SeTransformBatch::set(size_t index, const TransformComponent& transform)
+{
+    translationX[index] = transform.translation.x;
+    translationY[index] = transform.translation.y;
+    translationZ[index] = transform.translation.z;
+    rotationX[index] = transform.rotation.x;
+    rotationY[index] = transform.rotation.y;
+    rotationZ[index] = transform.rotation.z;
+    scaleX[index] = transform.scale.x;
+    scaleY[index] = transform.scale.y;
+    scaleZ[index] = transform.scale.z;
+}
+
+TransformComponent SeTransformBatch::get(size_t index) const
+{
+    TransformComponent transform;
+    transform.translation = {translationX[index], translationY[index], translationZ[index]};
+    transform.rotation = {rotationX[index], rotationY[index], rotationZ[index]};
+    transform.scale = {scaleX[index], scaleY[index], scaleZ[index]};
+    return transform;
+}
+
+void SeTransformBatch::gather(const std::vector<TransformComponent>& transforms)
+{
+    resize(transforms.size());
+    for (size_t i = 0; i < transforms.size(); i++)
+    {
+        set(i, transforms[i]);
+    }
+}
+
+SeTransformBatch::Kernel SeTransformBatch::detectKernel()
+{
+    static const Kernel detected = []()
+    {
+#if defined(SE_SIMD_X86)
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return Kernel::SCALAR;
+        __cpuid(info, 1);
+        const bool bFma = (info[2] & (1 << 12)) != 0;
+        const bool bOsxsave = (info[2] & (1 << 27)) != 0;
+        const bool bAvx = (info[2] & (1 << 28)) != 0;
+        if (!bFma || !bOsxsave || !bAvx) return Kernel::SCALAR;
+        // The OS has to save the upper halves of the ymm registers
+        if ((_xgetbv(0) & 0x6) != 0x6) return Kernel::SCALAR;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) ? Kernel::AVX2 : Kernel::SCALAR;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? Kernel::AVX2 : Kernel::SCALAR;
+#endif
+#elif defined(SE_SIMD_NEON)
+        return Kernel::NEON;
+#else
+        return Kernel::SCALAR;
+#endif
+    }();
+    return detected;
+}
+
+const char* SeTransformBatch::kernelName(Kernel kernel)
+{
+    switch (kernel)
+    {
+    case Kernel::AVX2: return "avx2";
+    case Kernel::NEON: return "neon";
+    default: return "scalar";
+    }
+}
+
+void SeTransformBatch::setKernel(Kernel inkernel)
+{
+    kernel = inkernel == Kernel::SCALAR || inkernel == detectKernel() ? inkernel : Kernel::SCALAR;
+}
+
+void SeTransformBatch::computeMatrices(const glm::mat4& projectionView, glm::mat4* mvp, size_t mvpStride, glm::mat4* world, size_t worldStride) const
+{
+    switch (kernel)
+    {
+    case Kernel::AVX2:
+        computeAvx2(projectionView, mvp, mvpStride, world, worldStride);
+        break;
+    case Kernel::NEON:
+        computeNeon(projectionView, mvp, mvpStride, world, worldStride);
+        break;
+    default:
+        computeMatricesScalar(projectionView, mvp, mvpStride, world, worldStride);
+        break;
+    }
+}
+
+void SeTransformBatch::computeMatricesScalar(const glm::mat4& projectionView, glm::mat4* mvp, size_t mvpStride, glm::mat4* world, size_t worldStride) const
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::mat4 model = get(i).mat4();
+        matrixAt(mvp, mvpStride, i) = projectionView * model;
+        if (world) matrixAt(world, worldStride, i) = model;
+    }
+}
+
+float SeTransformBatch::validate(const glm::mat4& projectionView) const
+{
+    std::vector<glm::mat4> reference(count), reference_world(count), result(count), result_world(count);
+    computeMatricesScalar(projectionView, reference.data(), sizeof(glm::mat4), reference_world.data());
+    computeMatrices(projectionView, result.data(), sizeof(glm::mat4), result_world.data());
+
+    float maxError = 0.f;
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            for (int r = 0; r < 4; r++)
+            {
+                maxError = std::max(maxError, std::abs(reference[i][c][r] - result[i][c][r]));
+                maxError = std::max(maxError, std::abs(reference_world[i][c][r] - result_world[i][c][r]));
+            }
+        }
+    }
+    return maxError;
+}
+
+#if defined(SE_SIMD_X86)
+
+namespace {
+SE_TARGET_AVX2 inline void sincos8(__m256 x, __m256& s, __m256& c)
+{
+    __m256 j = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(j, _mm256_set1_ps(PIO2_1), x);
+    r = _mm256_fnmadd_ps(j, _mm256_set1_ps(PIO2_2), r);
+    r = _mm256_fnmadd_ps(j, _mm256_set1_ps(PIO2_3), r);
+    __m256i quadrant = _mm256_cvtps_epi32(j);
+    __m256 r2 = _mm256_mul_ps(r, r);
+
+    __m256 ps = _mm256_fmadd_ps(_mm256_set1_ps(SIN_1), r2, _mm256_set1_ps(SIN_2));
+    ps = _mm256_fmadd_ps(ps, r2, _mm256_set1_ps(SIN_3));
+    ps = _mm256_fmadd_ps(_mm256_mul_ps(ps, r2), r, r);
+
+    __m256 pc = _mm256_fmadd_ps(_mm256_set1_ps(COS_1), r2, _mm256_set1_ps(COS_2));
+    pc = _mm256_fmadd_ps(pc, r2, _mm256_set1_ps(COS_3));
+    pc = _mm256_fmadd_ps(_mm256_mul_ps(pc, r2), r2, _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), r2, _mm256_set1_ps(1.f)));
+
+    // Odd quadrants swap sin and cos, quadrants 2/3 negate sin, 1/2 negate cos
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i two = _mm256_set1_epi32(2);
+    __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, one), one));
+    __m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(quadrant, two), 30));
+    __m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(quadrant, one), two), 30));
+    s = _mm256_xor_ps(_mm256_blendv_ps(ps, pc, swap), sinSign);
+    c = _mm256_xor_ps(_mm256_blendv_ps(pc, ps, swap), cosSign);
+}
+}
+
+SE_TARGET_AVX2 void SeTransformBatch::computeAvx2(const glm::mat4& projectionView, glm::mat4* mvp, size_t mvpStride, glm::mat4* world, size_t worldStride) const
+{
+    __m256 pv[16];
+    for (int e = 0; e < 16; e++)
+    {
+        pv[e] = _mm256_set1_ps(projectionView[e / 4][e % 4]);
+    }
+
+    BatchLanes lanes;
+    for (size_t base = 0; base < count; base += LANES)
+    {
+        __m256 s1, c1, s2, c2, s3, c3;
+        sincos8(_mm256_loadu_ps(&rotationY[base]), s1, c1);
+        sincos8(_mm256_loadu_ps(&rotationX[base]), s2, c2);
+        sincos8(_mm256_loadu_ps(&rotationZ[base]), s3, c3);
+        const __m256 sx = _mm256_loadu_ps(&scaleX[base]);
+        const __m256 sy = _mm256_loadu_ps(&scaleY[base]);
+        const __m256 sz = _mm256_loadu_ps(&scaleZ[base]);
+
+        // Rotation columns exactly as TransformComponent::mat4 builds them
+        const __m256 s2s3 = _mm256_mul_ps(s2, s3);
+        const __m256 c3s2 = _mm256_mul_ps(c3, s2);
+        __m256 m[4][3];
+        m[0][0] = _mm256_mul_ps(sx, _mm256_fmadd_ps(c1, c3, _mm256_mul_ps(s1, s2s3)));
+        m[0][1] = _mm256_mul_ps(sx, _mm256_mul_ps(c2, s3));
+        m[0][2] = _mm256_mul_ps(sx, _mm256_fmsub_ps(c1, s2s3, _mm256_mul_ps(c3, s1)));
+        m[1][0] = _mm256_mul_ps(sy, _mm256_fmsub_ps(c3s2, s1, _mm256_mul_ps(c1, s3)));
+        m[1][1] = _mm256_mul_ps(sy, _mm256_mul_ps(c2, c3));
+        m[1][2] = _mm256_mul_ps(sy, _mm256_fmadd_ps(c1, c3s2, _mm256_mul_ps(s1, s3)));
+        m[2][0] = _mm256_mul_ps(sz, _mm256_mul_ps(c2, s1));
+        m[2][1] = _mm256_mul_ps(sz, _mm256_sub_ps(_mm256_setzero_ps(), s2));
+        m[2][2] = _mm256_mul_ps(sz, _mm256_mul_ps(c1, c2));
+        m[3][0] = _mm256_loadu_ps(&translationX[base]);
+        m[3][1] = _mm256_loadu_ps(&translationY[base]);
+        m[3][2] = _mm256_loadu_ps(&translationZ[base]);
+
+        for (int col = 0; col < 4; col++)
+        {
+            for (int row = 0; row < 4; row++)
+            {
+                __m256 sum = col == 3 ? pv[12 + row] : _mm256_setzero_ps();
+                sum = _mm256_fmadd_ps(pv[row], m[col][0], sum);
+                sum = _mm256_fmadd_ps(pv[4 + row], m[col][1], sum);
+                sum = _mm256_fmadd_ps(pv[8 + row], m[col][2], sum);
+                _mm256_store_ps(lanes.mvp[col * 4 + row], sum);
+            }
+            if (world)
+            {
+                _mm256_store_ps(lanes.world[col * 4 + 0], m[col][0]);
+                _mm256_store_ps(lanes.world[col * 4 + 1], m[col][1]);
+                _mm256_store_ps(lanes.world[col * 4 + 2], m[col][2]);
+                _mm256_store_ps(lanes.world[col * 4 + 3], _mm256_set1_ps(col == 3 ? 1.f : 0.f));
+            }
+        }
+        scatterLanes(lanes, base, std::min(LANES, count - base), mvp, mvpStride, world, worldStride);
+    }
+}
+
+void SeTransformBatch::computeNeon(const glm::mat4& projectionView, glm::mat4* mvp, size_t mvpStride, glm::mat4* world, size_t worldStride) const
+{
+    computeMatricesScalar(projectionView, mvp, mvpStride, world, worldStride);
+}
+
+#elif defined(SE_SIMD_NEON)
+
+namespace {
+inline void sincos4(float32x4_t x, float32x4_t& s, float32x4_t& c)
+{
+    float32x4_t j = vrndnq_f32(vmulq_n_f32(x, TWO_OVER_PI));
+    float32x4_t r = vfmsq_f32(x, j, vdupq_n_f32(PIO2_1));
+    r = vfmsq_f32(r, j, vdupq_n_f32(PIO2_2));
+    r = vfmsq_f32(r, j, vdupq_n_f32(PIO2_3));
+    int32x4_t quadrant = vcvtq_s32_f32(j);
+    float32x4_t r2 = vmulq_f32(r, r);
+
+    float32x4_t ps = vfmaq_f32(vdupq_n_f32(SIN_2), vdupq_n_f32(SIN_1), r2);
+    ps = vfmaq_f32(vdupq_n_f32(SIN_3), ps, r2);
+    ps = vfmaq_f32(r, vmulq_f32(ps, r2), r);
+
+    float32x4_t pc = vfmaq_f32(vdupq_n_f32(COS_2), vdupq_n_f32(COS_1), r2);
+    pc = vfmaq_f32(vdupq_n_f32(COS_3), pc, r2);
+    pc = vfmaq_f32(vfmsq_f32(vdupq_n_f32(1.f), vdupq_n_f32(0.5f), r2), vmulq_f32(pc, r2), r2);
+
+    const int32x4_t one = vdupq_n_s32(1);
+    const int32x4_t two = vdupq_n_s32(2);
+    uint32x4_t swap = vtstq_s32(quadrant, one);
+    uint32x4_t sinSign = vshlq_n_u32(vreinterpretq_u32_s32(vandq_s32(quadrant, two)), 30);
+    uint32x4_t cosSign = vshlq_n_u32(vreinterpretq_u32_s32(vandq_s32(vaddq_s32(quadrant, one), two)), 30);
+    s = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(vbslq_f32(swap, pc, ps)), sinSign));
+    c = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(vbslq_f32(swap, ps, pc)), cosSign));
+}
+}
+
+void SeTransformBatch::computeNeon(const glm::mat4& projectionView, glm::mat4* mvp, size_t mvpStride, glm::mat4* world, size_t worldStride) const
+{
+    float32x4_t pv[16];
+    for (int e = 0; e < 16; e++)
+    {
+        pv[e] = vdupq_n_f32(projectionView[e / 4][e % 4]);
+    }
+
+    // Two NEON halves fill one eight lane batch
+    BatchLanes lanes;
+    for (size_t base = 0; base < count; base += LANES)
+    {
+        for (size_t half = 0; half < LANES; half += 4)
+        {
+            const size_t i = base + half;
+            float32x4_t s1, c1, s2, c2, s3, c3;
+            sincos4(vld1q_f32(&rotationY[i]), s1, c1);
+            sincos4(vld1q_f32(&rotationX[i]), s2, c2);
+            sincos4(vld1q_f32(&rotationZ[i]), s3, c3);
+            const float32x4_t sx = vld1q_f32(&scaleX[i]);
+            const float32x4_t sy = vld1q_f32(&scaleY[i]);
+            const float32x4_t sz = vld1q_f32(&scaleZ[i]);
+
+            const float32x4_t s2s3 = vmulq_f32(s2, s3);
+            const float32x4_t c3s2 = vmulq_f32(c3, s2);
+            float32x4_t m[4][3];
+            m[0][0] = vmulq_f32(sx, vfmaq_f32(vmulq_f32(s1, s2s3), c1, c3));
+            m[0][1] = vmulq_f32(sx, vmulq_f32(c2, s3));
+            m[0][2] = vmulq_f32(sx, vfmsq_f32(vmulq_f32(c1, s2s3), c3, s1));
+            m[1][0] = vmulq_f32(sy, vfmsq_f32(vmulq_f32(c3s2, s1), c1, s3));
+            m[1][1] = vmulq_f32(sy, vmulq_f32(c2, c3));
+            m[1][2] = vmulq_f32(sy, vfmaq_f32(vmulq_f32(s1, s3), c1, c3s2));
+            m[2][0] = vmulq_f32(sz, vmulq_f32(c2, s1));
+            m[2][1] = vmulq_f32(sz, vnegq_f32(s2));
+            m[2][2] = vmulq_f32(sz, vmulq_f32(c1, c2));
+            m[3][0] = vld1q_f32(&translationX[i]);
+            m[3][1] = vld1q_f32(&translationY[i]);
+            m[3][2] = vld1q_f32(&translationZ[i]);
+
+            for (int col = 0; col < 4; col++)
+            {
+                for (int row = 0; row < 4; row++)
+                {
+                    float32x4_t sum = col == 3 ? pv[12 + row] : vdupq_n_f32(0.f);
+                    sum = vfmaq_f32(sum, pv[row], m[col][0]);
+                    sum = vfmaq_f32(sum, pv[4 + row], m[col][1]);
+                    sum = vfmaq_f32(sum, pv[8 + row], m[col][2]);
+                    vst1q_f32(&lanes.mvp[col * 4 + row][half], sum);
+                }
+                if (world)
+                {
+                    vst1q_f32(&lanes.world[col * 4 + 0][half], m[col][0]);
+                    vst1q_f32(&lanes.world[col * 4 + 1][half], m[col][1]);
+                    vst1q_f32(&lanes.world[col * 4 + 2][half], m[col][2]);
+                    vst1q_f32(&lanes.world[col * 4 + 3][half], vdupq_n_f32(col == 3 ? 1.f : 0.f));
+                }
+            }
+        }
+        scatterLanes(lanes, base, std::min(LANES, count - base), mvp, mvpStride, world, worldStride);
+    }
+}
+
+void SeTransformBatch::computeAvx2(const glm::mat4& projectionView, glm::mat4* mvp, size_t mvpStride, glm::mat4* world, size_t worldStride) const
+{
+    computeMatricesScalar(projectionView, mvp, mvpStride, world, worldStride);
+}
+
+#else
+
+void SeTransformBatch::computeAvx2(const glm::mat4& projectionView, glm::mat4* mvp, size_t mvpStride, glm::mat4* world, size_t worldStride) const
+{
+    computeMatricesScalar(projectionView, mvp, mvpStride, world, worldStride);
+}
+
+void SeTransformBatch::computeNeon(const glm::mat4& projectionView, glm::mat4* mvp, size_t mvpStride, glm::mat4* world, size_t worldStride) const
+{
+    computeMatricesScalar(projectionView, mvp, mvpStride, world, worldStride);
+}
+
+#endif
+
+}
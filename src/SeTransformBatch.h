@@ -0,0 +1,65 @@
+﻿#pragma once
+#include <cstddef>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <GLM/glm.hpp>
+
+namespace SE {
+struct TransformComponent;
+
+// Transforms stored as structure of arrays, one stream per component.
+//
+// computeMatrices() builds the same matrix as TransformComponent::mat4() for every transform,
+// eight (AVX2) or four (NEON) at a time with vectorized sin/cos, and multiplies by the
+// projection view on the way. Streams are padded to a multiple of the SIMD width so the
+// kernel never needs a scalar tail.
+class SeTransformBatch
+{
+public:
+    enum class Kernel
+    {
+        SCALAR,
+        AVX2,
+        NEON
+    };
+
+    static constexpr size_t LANES = 8;
+
+    void resize(size_t count);
+    size_t size() const { return count; }
+
+    void set(size_t index, const TransformComponent& transform);
+    TransformComponent get(size_t index) const;
+    // Copies every transform into the streams
+    void gather(const std::vector<TransformComponent>& transforms);
+
+    // Writes projectionView * model to mvp and, if world is not null, model to world.
+    // Strides are in bytes so the results can land directly in per object structs
+    void computeMatrices(const glm::mat4& projectionView, glm::mat4* mvp, size_t mvpStride, glm::mat4* world = nullptr, size_t worldStride = sizeof(glm::mat4)) const;
+    // Same through TransformComponent::mat4, the reference the SIMD kernels are checked against
+    void computeMatricesScalar(const glm::mat4& projectionView, glm::mat4* mvp, size_t mvpStride, glm::mat4* world = nullptr, size_t worldStride = sizeof(glm::mat4)) const;
+    // Largest absolute difference between the active kernel and the scalar reference
+    float validate(const glm::mat4& projectionView) const;
+
+    // Best kernel the CPU supports, picked once
+    static Kernel detectKernel();
+    static const char* kernelName(Kernel kernel);
+    // Override for benchmarks, falls back to SCALAR if the CPU can't run it
+    void setKernel(Kernel inkernel);
+    Kernel getKernel() const { return kernel; }
+
+    std::vector<float> translationX, translationY, translationZ;
+    std::vector<float> rotationX, rotationY, rotationZ;
+    std::vector<float> scaleX, scaleY, scaleZ;
+
+private:
+    void computeAvx2(const glm::mat4& projectionView, glm::mat4* mvp, size_t mvpStride, glm::mat4* world, size_t worldStride) const;
+    void computeNeon(const glm::mat4& projectionView, glm::mat4* mvp, size_t mvpStride, glm::mat4* world, size_t worldStride) const;
+
+    size_t count = 0;
+    Kernel kernel = detectKernel();
+};
+
+}
@@ -1,4 +1,7 @@
 ﻿#include "SeWindow.h"
+
+#include <chrono>
+
 #include "Config.h"
 #include "vulkancontext.h"
 
@@ -7,9 +10,13 @@ namespace SE {
 SeWindow::SeWindow(std::shared_ptr<VulkanContext> inctx)
 {
     ctx = inctx;
+    mainThread = std::this_thread::get_id();
     initWindow();
     
-    glfwGetWindowSize(window, &width, &height);
+    int framebufferWidth = 0, framebufferHeight = 0;
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    width = framebufferWidth;
+    height = framebufferHeight;
 }
 
 SeWindow::~SeWindow()
@@ -43,6 +50,25 @@ bool SeWindow::shouldClose()
     return glfwWindowShouldClose(window);
 }
 
+bool SeWindow::waitWhileMinimized()
+{
+    const bool bMainThread = std::this_thread::get_id() == mainThread;
+    while (width == 0 || height == 0)
+    {
+        if (bStopRequested) return false;
+        // Closing a minimized window is an event too, glfwWaitEvents() returns for it
+        if (bMainThread)
+        {
+            if (shouldClose()) return false;
+            glfwWaitEvents();
+        } else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    return true;
+}
+
 void SeWindow::createWindowSurface()
 {
     VkResult result = glfwCreateWindowSurface(ctx->Se_engine->instance, window, nullptr, &surface);
@@ -1,7 +1,9 @@
 ﻿#pragma once
 
 #define GLFW_INCLUDE_VULKAN
+#include <atomic>
 #include <memory>
+#include <thread>
 #include <GLFW/glfw3.h>
 
 
@@ -16,20 +18,29 @@ public:
     ~SeWindow();
     bool shouldClose();
     void createWindowSurface();
+    // Blocks while the framebuffer is zero sized. Pumps events on the main thread, any other
+    // thread (the render thread) waits for the main thread to see the window come back.
+    // False when it gave up because the window should close or requestStop() was called
+    bool waitWhileMinimized();
+    // Ends waitWhileMinimized() on every thread, called before the render thread is joined
+    void requestStop() { bStopRequested = true; }
 
 public:
     GLFWwindow* window;
     VkSurfaceKHR surface;
 
-    int width;
-    int height;
-    bool framebufferResized = false;
+    // Framebuffer size in pixels, written by GLFW callbacks on the main thread
+    std::atomic<int> width{0};
+    std::atomic<int> height{0};
+    std::atomic<bool> framebufferResized{false};
     
 private:
     static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
     
     void initWindow();
     std::shared_ptr<VulkanContext> ctx;
+    std::thread::id mainThread;
+    std::atomic<bool> bStopRequested{false};
     
 };
 
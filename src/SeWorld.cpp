@@ -0,0 +1,358 @@
+﻿#include "SeWorld.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace SE {
+
+namespace {
+struct ComponentRegistry
+{
+    std::mutex mutex;
+    std::array<ComponentInfo, MAX_COMPONENTS> infos{};
+    uint32_t count = 0;
+};
+
+ComponentRegistry& componentRegistry()
+{
+    static ComponentRegistry registry;
+    return registry;
+}
+
+size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+}
+
+ComponentId registerComponent(const ComponentInfo& info)
+{
+    ComponentRegistry& registry = componentRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    if (registry.count == MAX_COMPONENTS)
+    {
+        throw std::runtime_error("failed to register component, too many component types!");
+    }
+    if (info.alignment > 64)
+    {
+        throw std::runtime_error("failed to register component, alignment above 64 bytes is not supported!");
+    }
+    registry.infos[registry.count] = info;
+    return registry.count++;
+}
+
+const ComponentInfo& getComponentInfo(ComponentId id)
+{
+    // Entries are written once before their id is handed out and never change
+    return componentRegistry().infos[id];
+}
+
+SeEntityAllocator::SeEntityAllocator()
+{
+    pages = std::make_unique<std::atomic<std::atomic<uint32_t>*>[]>(MAX_PAGES);
+    for (uint32_t i = 0; i < MAX_PAGES; i++)
+    {
+        pages[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+SeEntityAllocator::~SeEntityAllocator()
+{
+    for (uint32_t i = 0; i < MAX_PAGES; i++)
+    {
+        delete[] pages[i].load(std::memory_order_relaxed);
+    }
+}
+
+std::atomic<uint32_t>* SeEntityAllocator::generationSlot(uint32_t index) const
+{
+    std::atomic<uint32_t>* page = pages[index / PAGE_SIZE].load(std::memory_order_acquire);
+    return page ? &page[index % PAGE_SIZE] : nullptr;
+}
+
+Entity SeEntityAllocator::allocate()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Entity entity;
+    if (!freeIndices.empty())
+    {
+        entity.index = freeIndices.back();
+        freeIndices.pop_back();
+        entity.generation = generationSlot(entity.index)->load(std::memory_order_relaxed);
+        return entity;
+    }
+
+    uint32_t index = indexCount.load(std::memory_order_relaxed);
+    if (index == PAGE_SIZE * MAX_PAGES)
+    {
+        throw std::runtime_error("failed to allocate entity, out of entity ids!");
+    }
+    if (index % PAGE_SIZE == 0 && !pages[index / PAGE_SIZE].load(std::memory_order_relaxed))
+    {
+        auto* page = new std::atomic<uint32_t>[PAGE_SIZE];
+        for (uint32_t i = 0; i < PAGE_SIZE; i++)
+        {
+            page[i].store(0, std::memory_order_relaxed);
+        }
+        pages[index / PAGE_SIZE].store(page, std::memory_order_release);
+    }
+    indexCount.store(index + 1, std::memory_order_release);
+    entity.index = index;
+    entity.generation = 0;
+    return entity;
+}
+
+void SeEntityAllocator::release(Entity entity)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::atomic<uint32_t>* slot = generationSlot(entity.index);
+    uint32_t expected = entity.generation;
+    // A second release of the same handle finds the generation already bumped
+    if (slot && slot->compare_exchange_strong(expected, entity.generation + 1, std::memory_order_release))
+    {
+        freeIndices.push_back(entity.index);
+    }
+}
+
+bool SeEntityAllocator::isAlive(Entity entity) const
+{
+    if (entity.index >= getIndexCount()) return false;
+    std::atomic<uint32_t>* slot = generationSlot(entity.index);
+    return slot && slot->load(std::memory_order_acquire) == entity.generation;
+}
+
+void SeEntityAllocator::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    // Bump instead of reset, handles from before the clear must not come back to life
+    const uint32_t count = indexCount.load(std::memory_order_relaxed);
+    freeIndices.clear();
+    for (uint32_t i = count; i > 0; i--)
+    {
+        std::atomic<uint32_t>* slot = generationSlot(i - 1);
+        slot->store(slot->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        freeIndices.push_back(i - 1);
+    }
+}
+
+SeWorld::~SeWorld()
+{
+    clear();
+    for (SeChunk* chunk : freeChunks)
+    {
+        delete chunk;
+    }
+}
+
+int SeWorld::popCount(Signature signature)
+{
+    int count = 0;
+    for (; signature; signature &= signature - 1)
+    {
+        count++;
+    }
+    return count;
+}
+
+SeArchetype* SeWorld::getArchetype(Signature signature)
+{
+    auto found = archetypeBySignature.find(signature);
+    if (found != archetypeBySignature.end()) return found->second;
+
+    auto archetype = std::make_unique<SeArchetype>();
+    archetype->signature = signature;
+    archetype->columnOf.fill(SeArchetype::NO_COLUMN);
+    size_t rowSize = sizeof(Entity);
+    for (ComponentId id = 0; id < MAX_COMPONENTS; id++)
+    {
+        if (!(signature & bit(id))) continue;
+        archetype->columnOf[id] = static_cast<uint8_t>(archetype->components.size());
+        archetype->components.push_back(id);
+        archetype->infos.push_back(&getComponentInfo(id));
+        rowSize += archetype->infos.back()->size;
+    }
+
+    // Largest capacity whose aligned columns still fit
+    uint32_t capacity = static_cast<uint32_t>(SeChunk::DATA_SIZE / rowSize);
+    for (; capacity > 0; capacity--)
+    {
+        archetype->offsets.clear();
+        size_t offset = sizeof(Entity) * capacity;
+        for (const ComponentInfo* info : archetype->infos)
+        {
+            offset = alignUp(offset, info->alignment);
+            archetype->offsets.push_back(static_cast<uint32_t>(offset));
+            offset += info->size * capacity;
+        }
+        if (offset <= SeChunk::DATA_SIZE) break;
+    }
+    if (capacity == 0)
+    {
+        throw std::runtime_error("failed to create archetype, one entity does not fit in a chunk!");
+    }
+    archetype->chunkCapacity = capacity;
+
+    SeArchetype* result = archetype.get();
+    archetypes.push_back(std::move(archetype));
+    archetypeBySignature[signature] = result;
+    return result;
+}
+
+SeArchetype* SeWorld::addTarget(SeArchetype* source, ComponentId id)
+{
+    if (!source->addEdges[id]) source->addEdges[id] = getArchetype(source->signature | bit(id));
+    return source->addEdges[id];
+}
+
+SeArchetype* SeWorld::removeTarget(SeArchetype* source, ComponentId id)
+{
+    if (!source->removeEdges[id]) source->removeEdges[id] = getArchetype(source->signature & ~bit(id));
+    return source->removeEdges[id];
+}
+
+SeChunk* SeWorld::allocateChunk(SeArchetype* archetype)
+{
+    SeChunk* chunk = nullptr;
+    if (!freeChunks.empty())
+    {
+        chunk = freeChunks.back();
+        freeChunks.pop_back();
+    } else
+    {
+        chunk = new SeChunk;
+    }
+    chunk->archetype = archetype;
+    chunk->count = 0;
+    archetype->chunks.push_back(chunk);
+    return chunk;
+}
+
+std::pair<SeChunk*, uint32_t> SeWorld::allocateRow(SeArchetype* archetype, Entity entity)
+{
+    SeChunk* chunk = archetype->chunks.empty() ? nullptr : archetype->chunks.back();
+    if (!chunk || chunk->count == archetype->chunkCapacity) chunk = allocateChunk(archetype);
+
+    uint32_t row = chunk->count++;
+    chunk->entities()[row] = entity;
+    archetype->entityCount++;
+    if (entity.index >= records.size()) records.resize(std::max<size_t>(allocator.getIndexCount(), entity.index + 1));
+    records[entity.index] = {chunk, row};
+    return {chunk, row};
+}
+
+std::pair<SeChunk*, uint32_t> SeWorld::moveEntity(Entity entity, EntityRecord from, SeArchetype* target)
+{
+    SeArchetype* source = from.chunk->archetype;
+    auto location = allocateRow(target, entity);
+    for (uint32_t column = 0; column < target->components.size(); column++)
+    {
+        uint8_t sourceColumn = source->columnOf[target->components[column]];
+        if (sourceColumn == SeArchetype::NO_COLUMN) continue;
+
+        const ComponentInfo* info = target->infos[column];
+        void* destination = target->component(location.first, column, location.second);
+        void* component = source->component(from.chunk, sourceColumn, from.row);
+        if (info->bTrivial) memcpy(destination, component, info->size);
+        else info->moveConstruct(destination, component);
+    }
+    return location;
+}
+
+void SeWorld::removeRow(SeChunk* chunk, uint32_t row)
+{
+    SeArchetype* archetype = chunk->archetype;
+    SeChunk* last = archetype->chunks.back();
+    uint32_t lastRow = last->count - 1;
+    const bool bFillHole = chunk != last || row != lastRow;
+
+    for (uint32_t column = 0; column < archetype->components.size(); column++)
+    {
+        const ComponentInfo* info = archetype->infos[column];
+        void* hole = archetype->component(chunk, column, row);
+        if (info->bTrivial)
+        {
+            if (bFillHole) memcpy(hole, archetype->component(last, column, lastRow), info->size);
+            continue;
+        }
+        info->destroy(hole);
+        if (bFillHole)
+        {
+            void* moved = archetype->component(last, column, lastRow);
+            info->moveConstruct(hole, moved);
+            info->destroy(moved);
+        }
+    }
+    if (bFillHole)
+    {
+        Entity moved = last->entities()[lastRow];
+        chunk->entities()[row] = moved;
+        records[moved.index] = {chunk, row};
+    }
+
+    last->count--;
+    archetype->entityCount--;
+    if (last->count == 0)
+    {
+        archetype->chunks.pop_back();
+        freeChunks.push_back(last);
+    }
+}
+
+void SeWorld::destroyEntity(Entity entity)
+{
+    if (!isAlive(entity)) return;
+    EntityRecord record = recordOf(entity);
+    if (record.chunk)
+    {
+        removeRow(record.chunk, record.row);
+        records[entity.index] = {};
+    }
+    allocator.release(entity);
+}
+
+size_t SeWorld::getEntityCount() const
+{
+    size_t total = 0;
+    for (auto& archetype : archetypes)
+    {
+        total += archetype->entityCount;
+    }
+    return total;
+}
+
+size_t SeWorld::getChunkCount() const
+{
+    size_t total = 0;
+    for (auto& archetype : archetypes)
+    {
+        total += archetype->chunks.size();
+    }
+    return total;
+}
+
+void SeWorld::clear()
+{
+    for (auto& archetype : archetypes)
+    {
+        for (SeChunk* chunk : archetype->chunks)
+        {
+            for (uint32_t column = 0; column < archetype->components.size(); column++)
+            {
+                const ComponentInfo* info = archetype->infos[column];
+                if (info->bTrivial) continue;
+                for (uint32_t row = 0; row < chunk->count; row++)
+                {
+                    info->destroy(archetype->component(chunk, column, row));
+                }
+            }
+            freeChunks.push_back(chunk);
+        }
+        archetype->chunks.clear();
+        archetype->entityCount = 0;
+    }
+    records.clear();
+    allocator.clear();
+}
+
+}
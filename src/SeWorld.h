@@ -0,0 +1,376 @@
+﻿#pragma once
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "SeJobSystem.h"
+
+namespace SE {
+
+// Versioned entity handle. A destroyed entity's index is reused with the next generation,
+// so a stale handle is detected instead of silently aliasing the new entity
+struct Entity
+{
+    uint32_t index = ~0u;
+    uint32_t generation = 0;
+
+    bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+using ComponentId = uint32_t;
+using Signature = uint64_t;
+constexpr ComponentId MAX_COMPONENTS = 64;
+constexpr size_t CHUNK_SIZE = 16 * 1024;
+
+// Type erased operations on one component type
+struct ComponentInfo
+{
+    size_t size;
+    size_t alignment;
+    bool bTrivial;  // relocated with memcpy, never destroyed
+    void (*moveConstruct)(void* destination, void* source);
+    void (*destroy)(void* component);
+};
+
+ComponentId registerComponent(const ComponentInfo& info);
+const ComponentInfo& getComponentInfo(ComponentId id);
+
+namespace detail {
+template <class T>
+ComponentId componentId()
+{
+    static const ComponentId id = registerComponent({
+        sizeof(T),
+        alignof(T),
+        std::is_trivially_copyable<T>::value,
+        [](void* destination, void* source) { new (destination) T(std::move(*static_cast<T*>(source))); },
+        [](void* component) { static_cast<T*>(component)->~T(); }});
+    return id;
+}
+}
+
+// Ids are handed out on first use, T and const T share one
+template <class T>
+ComponentId componentId()
+{
+    return detail::componentId<std::remove_cv_t<std::remove_reference_t<T>>>();
+}
+
+// Thread safe entity id allocation. Generations live in fixed pages that never move,
+// so isAlive() needs no lock while other threads allocate
+class SeEntityAllocator
+{
+public:
+    SeEntityAllocator();
+    ~SeEntityAllocator();
+
+    SeEntityAllocator(const SeEntityAllocator&) = delete;
+    SeEntityAllocator& operator=(const SeEntityAllocator&) = delete;
+
+    Entity allocate();
+    void release(Entity entity);
+    bool isAlive(Entity entity) const;
+    // Every index handed out so far is below this
+    uint32_t getIndexCount() const { return indexCount.load(std::memory_order_acquire); }
+    // Not thread safe, every outstanding handle becomes stale
+    void clear();
+
+private:
+    static constexpr uint32_t PAGE_SIZE = 4096;
+    static constexpr uint32_t MAX_PAGES = 4096;
+
+    std::atomic<uint32_t>* generationSlot(uint32_t index) const;
+
+    std::mutex mutex;
+    std::unique_ptr<std::atomic<std::atomic<uint32_t>*>[]> pages;
+    std::vector<uint32_t> freeIndices;
+    std::atomic<uint32_t> indexCount{0};
+};
+
+struct SeArchetype;
+
+// Fixed size block of entities that share an archetype. Every component is a tightly packed
+// array inside data, so a query walks plain contiguous arrays
+struct alignas(64) SeChunk
+{
+    static constexpr size_t DATA_SIZE = CHUNK_SIZE - 64;
+
+    SeArchetype* archetype = nullptr;
+    uint32_t count = 0;
+    alignas(64) unsigned char data[DATA_SIZE];
+
+    Entity* entities() { return reinterpret_cast<Entity*>(data); }
+};
+static_assert(sizeof(SeChunk) == CHUNK_SIZE, "SeChunk header grew past one cache line");
+
+// All entities with exactly the same set of components
+struct SeArchetype
+{
+    static constexpr uint8_t NO_COLUMN = 0xff;
+
+    Signature signature = 0;
+    std::vector<ComponentId> components;          // ascending, one column each
+    std::vector<const ComponentInfo*> infos;
+    std::vector<uint32_t> offsets;                // column start in SeChunk::data
+    std::array<uint8_t, MAX_COMPONENTS> columnOf; // NO_COLUMN when the component is absent
+    uint32_t chunkCapacity = 0;
+    std::vector<SeChunk*> chunks;                 // all full except the last
+    size_t entityCount = 0;
+    // Archetype one component away, filled on first use
+    std::array<SeArchetype*, MAX_COMPONENTS> addEdges{};
+    std::array<SeArchetype*, MAX_COMPONENTS> removeEdges{};
+
+    void* component(SeChunk* chunk, uint32_t column, uint32_t row) const
+    {
+        return chunk->data + offsets[column] + row * infos[column]->size;
+    }
+};
+
+// Archetype based entity component system.
+//
+// Entities with the same component set share an archetype and live in its 16KB chunks, one
+// packed array per component. Adding or removing a component moves the entity to the
+// neighbouring archetype, destroying one fills the hole with the archetype's last entity, both
+// O(1). Queries visit every archetype that has the requested components, chunk by chunk.
+//
+// Structural changes (create, destroy, add, remove) must not overlap with each other or a
+// query. reserveEntity() is safe from any thread, the entity is filled in later with create()
+class SeWorld
+{
+public:
+    SeWorld() = default;
+    ~SeWorld();
+
+    SeWorld(const SeWorld&) = delete;
+    SeWorld& operator=(const SeWorld&) = delete;
+
+    Entity reserveEntity() { return allocator.allocate(); }
+    bool isAlive(Entity entity) const { return allocator.isAlive(entity); }
+
+    template <class... Cs>
+    Entity createEntity(Cs&&... components)
+    {
+        Entity entity = reserveEntity();
+        create(entity, std::forward<Cs>(components)...);
+        return entity;
+    }
+
+    // Gives a reserved entity its components
+    template <class... Cs>
+    void create(Entity entity, Cs&&... components)
+    {
+        static_assert(sizeof...(Cs) > 0, "an entity needs at least one component");
+        assert(isAlive(entity) && "Entity was destroyed");
+        const Signature signature = signatureOf<Cs...>();
+        assert(static_cast<size_t>(popCount(signature)) == sizeof...(Cs) && "Component types must be distinct");
+
+        auto location = allocateRow(getArchetype(signature), entity);
+        (constructComponent(location.first, location.second, std::forward<Cs>(components)), ...);
+    }
+
+    void destroyEntity(Entity entity);
+
+    // Replaces the component if the entity already has one
+    template <class T>
+    void add(Entity entity, T&& component)
+    {
+        using Component = std::decay_t<T>;
+        assert(isAlive(entity) && "Entity was destroyed");
+        EntityRecord record = recordOf(entity);
+        if (!record.chunk)
+        {
+            create(entity, std::forward<T>(component));
+            return;
+        }
+
+        const ComponentId id = componentId<Component>();
+        SeArchetype* source = record.chunk->archetype;
+        if (source->signature & bit(id))
+        {
+            *static_cast<Component*>(source->component(record.chunk, source->columnOf[id], record.row)) = std::forward<T>(component);
+            return;
+        }
+        auto location = moveEntity(entity, record, addTarget(source, id));
+        constructComponent(location.first, location.second, std::forward<T>(component));
+        removeRow(record.chunk, record.row);
+    }
+
+    template <class T>
+    void remove(Entity entity)
+    {
+        assert(isAlive(entity) && "Entity was destroyed");
+        EntityRecord record = recordOf(entity);
+        const ComponentId id = componentId<T>();
+        if (!record.chunk || !(record.chunk->archetype->signature & bit(id))) return;
+
+        moveEntity(entity, record, removeTarget(record.chunk->archetype, id));
+        removeRow(record.chunk, record.row);
+    }
+
+    template <class T>
+    bool has(Entity entity) const
+    {
+        EntityRecord record = recordOf(entity);
+        return record.chunk && (record.chunk->archetype->signature & bit(componentId<T>()));
+    }
+
+    template <class T>
+    T& get(Entity entity)
+    {
+        assert(isAlive(entity) && has<T>(entity) && "Entity does not have the component");
+        EntityRecord record = recordOf(entity);
+        SeArchetype* archetype = record.chunk->archetype;
+        return *static_cast<T*>(archetype->component(record.chunk, archetype->columnOf[componentId<T>()], record.row));
+    }
+
+    // fn(uint32_t count, const Entity* entities, Cs*... components) once per chunk that has all of Cs.
+    // Ask for const components where nothing is written
+    template <class... Cs, class Fn>
+    void eachChunk(Fn&& fn)
+    {
+        const Signature required = signatureOf<Cs...>();
+        for (auto& archetype : archetypes)
+        {
+            if ((archetype->signature & required) != required || archetype->entityCount == 0) continue;
+            const Columns<sizeof...(Cs)> columns{archetype->columnOf[componentId<Cs>()]...};
+            for (SeChunk* chunk : archetype->chunks)
+            {
+                invokeChunk<Cs...>(chunk, columns, fn, std::index_sequence_for<Cs...>{});
+            }
+        }
+    }
+
+    // fn(Cs&... components) for every entity that has all of Cs
+    template <class... Cs, class Fn>
+    void each(Fn&& fn)
+    {
+        eachChunk<Cs...>([&fn](uint32_t count, const Entity*, Cs*... components) {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                fn(components[i]...);
+            }
+        });
+    }
+
+    // eachChunk with the chunks spread over the job system, returns once all are done.
+    // fn(uint32_t first, uint32_t count, const Entity* entities, Cs*... components) gets in first
+    // how many entities the chunks before it hold, the position eachChunk would have reached.
+    // fn runs concurrently and must only touch its own chunk
+    template <class... Cs, class Fn>
+    void parallelEachChunk(SeJobSystem& jobs, Fn&& fn)
+    {
+        const Signature required = signatureOf<Cs...>();
+        parallelChunks.clear();
+        uint32_t first = 0;
+        for (auto& archetype : archetypes)
+        {
+            if ((archetype->signature & required) != required || archetype->entityCount == 0) continue;
+            for (SeChunk* chunk : archetype->chunks)
+            {
+                parallelChunks.push_back({chunk, first});
+                first += chunk->count;
+            }
+        }
+        jobs.parallelFor(static_cast<uint32_t>(parallelChunks.size()), 1, [this, &fn](uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; i++)
+            {
+                SeChunk* chunk = parallelChunks[i].chunk;
+                SeArchetype* archetype = chunk->archetype;
+                fn(parallelChunks[i].first, chunk->count, static_cast<const Entity*>(chunk->entities()),
+                   static_cast<Cs*>(archetype->component(chunk, archetype->columnOf[componentId<Cs>()], 0))...);
+            }
+        });
+    }
+
+    // Entities that have all of Cs
+    template <class... Cs>
+    size_t count() const
+    {
+        const Signature required = signatureOf<Cs...>();
+        size_t total = 0;
+        for (auto& archetype : archetypes)
+        {
+            if ((archetype->signature & required) == required) total += archetype->entityCount;
+        }
+        return total;
+    }
+
+    size_t getEntityCount() const;
+    size_t getArchetypeCount() const { return archetypes.size(); }
+    size_t getChunkCount() const;
+    // Destroys every entity, archetypes and chunks are kept for reuse
+    void clear();
+
+private:
+    struct EntityRecord
+    {
+        SeChunk* chunk = nullptr;
+        uint32_t row = 0;
+    };
+
+    template <size_t N>
+    using Columns = std::array<uint8_t, N>;
+
+    static Signature bit(ComponentId id) { return Signature(1) << id; }
+    static int popCount(Signature signature);
+
+    template <class... Cs>
+    static Signature signatureOf()
+    {
+        return (Signature(0) | ... | bit(componentId<Cs>()));
+    }
+
+    template <class... Cs, class Fn, size_t... I>
+    static void invokeChunk(SeChunk* chunk, const Columns<sizeof...(Cs)>& columns, Fn& fn, std::index_sequence<I...>)
+    {
+        SeArchetype* archetype = chunk->archetype;
+        fn(chunk->count, static_cast<const Entity*>(chunk->entities()), static_cast<Cs*>(archetype->component(chunk, columns[I], 0))...);
+    }
+
+    template <class T>
+    void constructComponent(SeChunk* chunk, uint32_t row, T&& component)
+    {
+        using Component = std::decay_t<T>;
+        SeArchetype* archetype = chunk->archetype;
+        new (archetype->component(chunk, archetype->columnOf[componentId<Component>()], row)) Component(std::forward<T>(component));
+    }
+
+    EntityRecord recordOf(Entity entity) const { return entity.index < records.size() ? records[entity.index] : EntityRecord{}; }
+    SeArchetype* getArchetype(Signature signature);
+    SeArchetype* addTarget(SeArchetype* source, ComponentId id);
+    SeArchetype* removeTarget(SeArchetype* source, ComponentId id);
+    // Appends an uninitialized row for entity and points its record there
+    std::pair<SeChunk*, uint32_t> allocateRow(SeArchetype* archetype, Entity entity);
+    // Move constructs every component target shares with the entity's current row into a new row.
+    // The old row is left for removeRow()
+    std::pair<SeChunk*, uint32_t> moveEntity(Entity entity, EntityRecord from, SeArchetype* target);
+    // Destroys the row and fills the hole with the archetype's last row
+    void removeRow(SeChunk* chunk, uint32_t row);
+    SeChunk* allocateChunk(SeArchetype* archetype);
+
+    SeEntityAllocator allocator;
+    std::vector<EntityRecord> records;
+    std::vector<std::unique_ptr<SeArchetype>> archetypes;
+    std::unordered_map<Signature, SeArchetype*> archetypeBySignature;
+    std::vector<SeChunk*> freeChunks;
+
+    struct ParallelChunk
+    {
+        SeChunk* chunk;
+        uint32_t first;
+    };
+    // Kept between parallelEachChunk() calls so a frame's queries do not allocate
+    std::vector<ParallelChunk> parallelChunks;
+};
+
+}
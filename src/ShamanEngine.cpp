@@ -1,17 +1,30 @@
 ﻿#include "ShamanEngine.h"
 
+#include <atomic>
 #include <chrono>
+#include <exception>
+#include <fstream>
 #include <iostream>
 #include <ostream>
+#include <thread>
 #include <unordered_set>
 
 
 #include "Config.h"
 #include "SeController.h"
 #include "SeDevice.h"
-#include "SeObject.h"
+#include "SeComponents.h"
+#include "SeJobSystem.h"
+#include "SeLayoutCache.h"
 #include "SePipeline.h"
+#include "SePipelineCache.h"
+#include "SePipelineLibrary.h"
+#include "SePipelineRegistry.h"
+#include "SeProfiler.h"
+#include "SeRenderSnapshot.h"
 #include "SeRenderer.h"
+#include "SeShaderCache.h"
+#include "SeShaderWatcher.h"
 #include "SeWindow.h"
 #include "vulkancontext.h"
 
@@ -51,17 +64,29 @@ ShamanEngine::ShamanEngine()
 
 ShamanEngine::~ShamanEngine()
 {
+    delete ctx->Se_shader_watcher;
+    delete ctx->Se_pipelines;
+    delete ctx->Se_pipeline_library;
+    delete ctx->Se_layouts;
+    delete ctx->Se_shaders;
+    // Waits for a periodic save still running on a job and writes the final state
+    delete ctx->Se_pipeline_cache;
+    delete ctx->Se_jobs;
     if (Config::get().enableValidationLayers) {
         DestroyDebugUtilsMessengerEXT(instance, debug_messenger, nullptr);
     }
 }
 
 std::vector<const char *> ShamanEngine::getRequiredExtensions() {
-    uint32_t glfwExtensionCount = 0;
-    const char **glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-    std::vector<const char *> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    std::vector<const char *> extensions;
+    // Headless runs never create a surface, so no WSI extensions are needed
+    if (!Config::get().headless())
+    {
+        uint32_t glfwExtensionCount = 0;
+        const char **glfwExtensions;
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
 
     if (Config::get().enableValidationLayers) {
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -82,16 +107,35 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 
 void ShamanEngine::init()
 {
+    SE_PROFILE_THREAD("Main");
+    SE_PROFILE_FUNCTION();
     ctx = std::make_shared<VulkanContext>();
     ctx->Se_engine = this;
-    ctx->Se_window = new SeWindow(ctx);
-    createInstance();
-    ctx->Se_window->createWindowSurface();
+    // Created on the main thread, which becomes job thread 0 and the only one running main thread jobs
+    const int jobThreads = Config::get().job_threads();
+    ctx->Se_jobs = new SeJobSystem(jobThreads < 0 ? SeJobSystem::AUTO_WORKERS : static_cast<uint32_t>(jobThreads), Config::get().pin_job_threads());
+    if (Config::get().headless())
+    {
+        deviceExtensions.clear();
+        createInstance();
+    } else
+    {
+        ctx->Se_window = new SeWindow(ctx);
+        createInstance();
+        ctx->Se_window->createWindowSurface();
+    }
     setupDebugMessenger();
     ctx->Se_device = new SeDevice(ctx);
+    // Before anything creates a pipeline
+    ctx->Se_pipeline_cache = new SePipelineCache(ctx);
+    ctx->Se_shaders = new SeShaderCache(ctx);
+    ctx->Se_layouts = new SeLayoutCache(ctx);
+    if (ctx->Se_device->bGraphicsPipelineLibrarySupported) ctx->Se_pipeline_library = new SePipelineLibrary(ctx);
+    ctx->Se_pipelines = new SePipelineRegistry(ctx);
     ctx->Se_swapchain = new SeSwapChain(ctx);
     ctx->Se_renderer = new SeRenderer(ctx);
     ctx->Se_camera = new SeCamera(ctx);
+    if (Config::get().shader_hot_reload()) ctx->Se_shader_watcher = new SeShaderWatcher(ctx);
   
 }
 
@@ -107,7 +151,7 @@ void ShamanEngine::createInstance()
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    appInfo.apiVersion = VK_API_VERSION_1_2;
 
     VkInstanceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -213,38 +257,167 @@ void ShamanEngine::setupDebugMessenger() {
 }
 
 
+bool ShamanEngine::shouldStop(uint64_t frame, double elapsedTime)
+{
+    if (ctx->Se_window && ctx->Se_window->shouldClose()) return true;
+    if (Config::get().frame_limit() > 0 && frame >= static_cast<uint64_t>(Config::get().frame_limit())) return true;
+    if (Config::get().time_limit() > 0.f && elapsedTime >= Config::get().time_limit()) return true;
+    // Headless without a limit would never end
+    return !ctx->Se_window && Config::get().frame_limit() <= 0 && Config::get().time_limit() <= 0.f;
+}
+
+void ShamanEngine::writeReadback(const std::string& path)
+{
+    if (!ctx->Se_swapchain->isHeadless())
+    {
+        std::cout << "Readback is only supported in headless mode, skipping " << path << std::endl;
+        return;
+    }
+
+    std::vector<uint8_t> pixels;
+    ctx->Se_swapchain->readbackImage(ctx->Se_renderer->getLastImageIndex(), pixels);
+
+    // Binary PPM, RGBA8 -> RGB8
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("failed to open readback file: " + path);
+    }
+    const uint32_t width = ctx->Se_swapchain->width();
+    const uint32_t height = ctx->Se_swapchain->height();
+    file << "P6\n" << width << " " << height << "\n255\n";
+    for (size_t i = 0; i < static_cast<size_t>(width) * height; i++)
+    {
+        file.write(reinterpret_cast<const char*>(&pixels[i * 4]), 3);
+    }
+    std::cout << "Wrote final frame to " << path << std::endl;
+}
+
+bool ShamanEngine::renderFrame()
+{
+    if (!serialSnapshot) serialSnapshot = std::make_unique<SeRenderSnapshot>();
+    writeSnapshot(*serialSnapshot);
+    return renderSnapshot(*serialSnapshot);
+}
+
+void ShamanEngine::writeSnapshot(SeRenderSnapshot& snapshot)
+{
+    SE_PROFILE_FUNCTION();
+    // Aspect of the newest swap chain, one frame late while the render thread recreates it
+    ctx->Se_camera->setPerspectiveProjection(glm::radians(50.f), ctx->Se_renderer->getAspectRatio(), 0.1f, 1000.f);
+    snapshot.simulationFrame = ++simulationFrame;
+    ctx->Se_renderer->writeSnapshot(snapshot, *ctx->Se_camera);
+}
+
+bool ShamanEngine::renderSnapshot(const SeRenderSnapshot& snapshot)
+{
+    SE_PROFILE_FUNCTION();
+    auto commandBuffer = ctx->Se_renderer->beginFrame();
+    if (!commandBuffer) return false;
+
+    if (Config::get().depth_prepass()) ctx->Se_renderer->renderDepthPrepass(commandBuffer, snapshot);
+    ctx->Se_renderer->beginSwapChainRenderPass(commandBuffer);
+    ctx->Se_renderer->renderObjects(commandBuffer, snapshot);
+    ctx->Se_renderer->endSwapChainRenderPass(commandBuffer);
+    ctx->Se_renderer->endFrame();
+    return true;
+}
+
 void ShamanEngine::run()
 {
-    auto cameraObject = SeObject::createObject();
-    SeController* cameraController = new SeController(ctx);
+    TransformComponent cameraTransform{};
+    // Input needs a window, headless runs keep the camera where it starts
+    SeController* cameraController = ctx->Se_window ? new SeController(ctx) : nullptr;
     
     ctx->Se_camera->setViewDirection(glm::vec3(0.f), glm::vec3(1.5f, 0.f, 0.f));
     ctx->Se_camera->setViewTarget(glm::vec3(0.f, 0.f, -0.0000000001f), glm::vec3(0.0f, 0.0f, 0.f));
     auto currentTime = std::chrono::high_resolution_clock::now();
+    auto startTime = currentTime;
+    uint64_t frame = 0;
+
+    // The render thread records and submits frame N while this thread simulates frame N + 1.
+    // GLFW stays on this thread, the render thread only sees the published snapshots
+    std::unique_ptr<SeRenderSnapshots> snapshots;
+    std::atomic<uint64_t> renderedFrames{0};
+    std::exception_ptr renderError;
+    std::thread renderThread;
+    if (Config::get().render_thread())
+    {
+        snapshots = std::make_unique<SeRenderSnapshots>();
+        renderThread = std::thread([this, &snapshots, &renderedFrames, &renderError]() {
+            SE_PROFILE_THREAD("Render");
+            try
+            {
+                while (const SeRenderSnapshot* snapshot = snapshots->acquire())
+                {
+                    if (renderSnapshot(*snapshot)) renderedFrames++;
+                    snapshots->release();
+                }
+            } catch (...)
+            {
+                // Rethrown on the main thread once it notices the stop
+                renderError = std::current_exception();
+                snapshots->stop();
+            }
+        });
+    }
     
-    while (!ctx->Se_window->shouldClose())
+    while (!shouldStop(frame, std::chrono::duration<double>(currentTime - startTime).count()))
     {
-        glfwPollEvents();
+        SE_PROFILE_ZONE("Frame loop");
+        SE_PROFILE_FRAME(frame);
+        if (ctx->Se_window) glfwPollEvents();
+        ctx->Se_jobs->pumpMainThread();
+        ctx->Se_pipeline_cache->saveIfDue();
+        if (ctx->Se_shader_watcher) ctx->Se_shader_watcher->update();
 
         auto newTime = std::chrono::high_resolution_clock::now();
         float frameTime = std::chrono::duration<float>(newTime - currentTime).count();
         frameTime = glm::min(frameTime, Config::get().max_frame_time());
         currentTime = newTime;
 
-        cameraController->moveInPlaneXZ(ctx->Se_window->window, frameTime, cameraObject);
-        ctx->Se_camera->setViewYXZ(cameraObject.transform.translation, cameraObject.transform.rotation);
+        if (cameraController)
+        {
+            cameraController->moveInPlaneXZ(ctx->Se_window->window, frameTime, cameraTransform);
+            cameraController->switchPresentProfile(ctx->Se_window->window);
+        }
+        ctx->Se_camera->setViewYXZ(cameraTransform.translation, cameraTransform.rotation);
         
-        float aspect = ctx->Se_swapchain->extentAspectRatio();
-        ctx->Se_camera->setPerspectiveProjection(glm::radians(50.f), aspect, 0.1f, 1000.f);
-        if (auto commandBuffer = ctx->Se_renderer->beginFrame())
+        if (!snapshots)
         {
-            ctx->Se_renderer->beginSwapChainRenderPass(commandBuffer);
-            ctx->Se_renderer->renderObjects(commandBuffer, *ctx->Se_camera);
-            ctx->Se_renderer->endSwapChainRenderPass(commandBuffer);
-            ctx->Se_renderer->endFrame();
+            if (renderFrame()) frame++;
+            continue;
         }
+        // Keeps pumping events while minimized instead of blocking below on a render thread that waits
+        // for the window to come back. Closing the window ends the wait and shouldStop() ends the loop
+        if (ctx->Se_window && !ctx->Se_window->waitWhileMinimized()) continue;
+        // Waits while the render thread is a full frame behind, nullptr when it stopped on an error
+        SeRenderSnapshot* snapshot = snapshots->beginWrite();
+        if (!snapshot) break;
+        writeSnapshot(*snapshot);
+        snapshots->publish();
+        frame = renderedFrames.load();
+    }
+    if (snapshots)
+    {
+        // A snapshot still queued is dropped, the frame count may overshoot a frame_limit by the one in flight.
+        // A render thread waiting for a minimized window gives up and finds the snapshots stopped
+        if (ctx->Se_window) ctx->Se_window->requestStop();
+        snapshots->stop();
+        renderThread.join();
+        if (renderError) std::rethrow_exception(renderError);
+        frame = renderedFrames.load();
     }
     vkDeviceWaitIdle(ctx->Se_device->device);
+
+    if (!Config::get().readback_path().empty() && frame > 0) writeReadback(Config::get().readback_path());
+    if (!Config::get().cpu_trace_path().empty()) SeProfiler::writeChromeTrace(Config::get().cpu_trace_path());
+    SeFrameStats::printSummary(ctx->Se_renderer->getFrameStats().getTotalSummary());
+    ctx->Se_pipeline_cache->printStats();
+    ctx->Se_pipelines->printFallbackStats();
+    if (ctx->Se_pipeline_library) ctx->Se_pipeline_library->printStats();
+    std::cout << "Rendered " << frame << " frames in "
+              << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count() << " s" << std::endl;
 }
 
 
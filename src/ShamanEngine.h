@@ -1,5 +1,6 @@
 ﻿#pragma once
 #include <memory>
+#include <string>
 #include <vector>
 #include <vulkan_core.h>
 
@@ -8,6 +9,7 @@
 namespace SE {
 
 struct VulkanContext;
+struct SeRenderSnapshot;
 
 class ShamanEngine
 {
@@ -16,6 +18,12 @@ public:
     ~ShamanEngine();
     void run();
     void init();
+    // Records and submits one frame from the current camera view, false when the frame was skipped
+    bool renderFrame();
+    // The two halves of renderFrame(). writeSnapshot runs on the simulation (main) thread,
+    // renderSnapshot on whichever thread owns the renderer
+    void writeSnapshot(SeRenderSnapshot& snapshot);
+    bool renderSnapshot(const SeRenderSnapshot& snapshot);
 
 public:
     VkInstance instance;
@@ -31,8 +39,14 @@ private:
     void hasGflwRequiredInstanceExtensions();
     void setupDebugMessenger();
     std::vector<const char *> getRequiredExtensions();
+    // Frame or time limit from config reached, or the window was closed
+    bool shouldStop(uint64_t frame, double elapsedTime);
+    void writeReadback(const std::string& path);
 
 private:
+    // Used when frames are rendered on the calling thread
+    std::unique_ptr<SeRenderSnapshot> serialSnapshot;
+    uint64_t simulationFrame = 0;
     
     
     
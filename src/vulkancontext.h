@@ -15,6 +15,15 @@ class SeRenderer;
 class SeWindow;
 class SeDevice;
 class SePipeline;
+class SeOcclusionCuller;
+class SeGpuProfiler;
+class SeJobSystem;
+class SePipelineCache;
+class SePipelineRegistry;
+class SePipelineLibrary;
+class SeShaderCache;
+class SeShaderWatcher;
+class SeLayoutCache;
 
 
 
@@ -28,6 +37,15 @@ struct VulkanContext
     SeSwapChain* Se_swapchain = nullptr;
     SeRenderer* Se_renderer = nullptr;
     SeCamera* Se_camera = nullptr;
+    SeOcclusionCuller* Se_occlusion = nullptr;
+    SeGpuProfiler* Se_gpu_profiler = nullptr;
+    SeJobSystem* Se_jobs = nullptr;
+    SePipelineCache* Se_pipeline_cache = nullptr;
+    SePipelineRegistry* Se_pipelines = nullptr;
+    SePipelineLibrary* Se_pipeline_library = nullptr;  // nullptr without VK_EXT_graphics_pipeline_library
+    SeShaderCache* Se_shaders = nullptr;
+    SeShaderWatcher* Se_shader_watcher = nullptr;  // nullptr unless shader_hot_reload
+    SeLayoutCache* Se_layouts = nullptr;
     std::shared_ptr<SeModel> Se_model = nullptr;
 
     